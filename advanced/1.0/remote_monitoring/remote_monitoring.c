@@ -1,20 +1,22 @@
 ﻿// Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
-#define _XOPEN_SOURCE
 #define _GNU_SOURCE
-#include "iothubtransportmqtt.h"
+#include "iothubtransportamqp.h"
 #include "schemalib.h"
 #include "iothub_client.h"
 #include "serializer_devicetwin.h"
 #include "schemaserializer.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/tickcounter.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,9 +26,30 @@
 #include <wiringPiSPI.h>
 #include "bme280.h"
 #include "locking.h"
-
-static char* deviceId;
-static char* connectionString;
+#include "remote_sensor.h"
+#include "connection.h"
+#include "send_lanes.h"
+#include "transport_select.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+#include "sensor_trace.h"
+#include "config_store.h"
+#include "adaptive_interval.h"
+#include "edge_aggregate.h"
+#include "anomaly_detector.h"
+#include "reading_shm.h"
+#include "payload_compress.h"
+#include "sample_block.h"
+#include "sample_clock.h"
+#include "message_format.h"
+#include "mem_pool.h"
+#include "alloc_debug.h"
+#include "realtime.h"
+
+/* device identity, firmware update anchors and tuning, see LoadConfig */
+static CONFIG_STORE g_config;
+static const char* configPath;
 
 static const char* deviceInfo = "{ \"ObjectType\": \"DeviceInfo\","
 "\"IsSimulatedDevice\": 0,"
@@ -37,22 +60,146 @@ static const char* deviceInfo = "{ \"ObjectType\": \"DeviceInfo\","
 "{\"Name\": \"Temperature\", \"DisplayName\" : \"Temperature\", \"Type\" : \"double\"},"
 "{ \"Name\": \"Humidity\", \"DisplayName\" : \"Humidity\", \"Type\" : \"double\" }] }";
 
-static const char* telemetryData = "{"
+/* the means keep the fields dashboards chart, the stats describe the window */
+static const char* summaryData = "{"
 "\"DeviceID\": \"%s\","
 "\"Temperature\" : %f,"
-"\"Humidity\" : %f } ";
-
-static char* lastUpdateBegin;
-static char* lastRebootBegin;
+"\"Humidity\" : %f,"
+"\"WindowStart\" : \"%s\","
+"\"WindowEnd\" : \"%s\","
+"\"FirstSequence\" : %u,"
+"\"LastSequence\" : %u,"
+"\"Epoch\" : %u,"
+"\"WindowSeconds\" : %.1f,"
+"\"Samples\" : %zu,"
+"\"TemperatureStats\" : { \"Min\" : %f, \"Max\" : %f, \"StdDev\" : %f, \"P50\" : %f, \"P95\" : %f },"
+"\"HumidityStats\" : { \"Min\" : %f, \"Max\" : %f, \"StdDev\" : %f, \"P50\" : %f, \"P95\" : %f } }";
+
+static const char* alertData = "{"
+"\"DeviceID\": \"%s\","
+"\"Alert\" : \"%s\","
+"\"Sensor\" : \"%s\","
+"\"Value\" : %f,"
+"\"Mean\" : %f,"
+"\"ZScore\" : %f,"
+"\"RatePerMinute\" : %f,"
+"\"SampleTime\" : \"%s\","
+"\"Series\" : \"%s\","
+"\"Sequence\" : %u,"
+"\"Epoch\" : %u } ";
+
+/* the series an alert's sequence number belongs to, the reads that are sent or those only the detector sees */
+#define TELEMETRY_SERIES "Telemetry"
+#define WATCH_SERIES "Watch"
+
+/* alerts carry this application property so a hub route can pick them out */
+#define ALERT_MESSAGE_TYPE "Alert"
+/* so do sample blocks, their body is binary, see sample_block.h */
+#define SAMPLE_BLOCK_MESSAGE_TYPE "SampleBlock"
 
 static IOTHUB_CLIENT_HANDLE g_iotHubClientHandle = NULL;
+/* the single device's transport, without a twin the thermostat is a plain model instance */
+static const TRANSPORT* g_transport = NULL;
+
+/* -1 until set on the command line */
+static int metricsPort = -1;
+static int sasTokenLifetimeS = -1;
+static int retryTimeoutS = -1;
+/* NULL until set on the command line */
+static const char* transportName = NULL;
+static int compressThresholdBytes = -1;
+static int sampleBlockSamples = -1;
+/* blocks of raw BME280 frames, compensated by the backend */
+static int sampleBlockRaw = -1;
+/* reports every allocation after startup, with ENABLE_ALLOC_DEBUG */
+static int allocCheck = 0;
+/* core, SCHED_FIFO priority and locked memory for the thread that samples */
+static REALTIME_OPTIONS g_realtime;
+/* numbers the reads of the device's own sensor that telemetry carries */
+static SAMPLE_CLOCK g_sampleClock;
+/* numbers the reads between two sends, which only the anomaly detector sees, so they leave no gaps in the telemetry */
+static SAMPLE_CLOCK g_watchClock;
+/* readings waiting for the next sample block message, no buffer while the block is empty */
+static SAMPLE_BLOCK_ENCODER g_sampleBlock;
+static CONNECTION g_connection;
+/* the latest readings for other processes on the Pi, NULL when the segment could not be created */
+static READING_SHM* g_readingShm = NULL;
+static LOGGER_FORMAT_MODE logMode = LOGGER_FORMAT_EAGER;
+static SENSOR_REPLAY_PACE sensorReplayPace = SENSOR_REPLAY_REALTIME;
+
+/* How often the metrics summary is published as a reported property */
+#define METRICS_REPORT_INTERVAL_US (300 * 1000000ULL)
+#define DEFAULT_TELEMETRY_INTERVAL_S 3
+/* an adapted interval is reported when it moved by this factor, at most once per period */
+#define ADAPTED_INTERVAL_REPORT_FACTOR 2
+#define ADAPTED_INTERVAL_REPORT_PERIOD_US (60 * 1000000ULL)
+#define DEFAULT_ANOMALY_Z_THRESHOLD 4.0
+#define DEFAULT_ANOMALY_RATE_PER_MINUTE 1.0
+#define DEFAULT_ANOMALY_SAMPLE_MS 1000
+/* a compressed body larger than this is not worth it, the message goes out as it is */
+#define SEND_COMPRESS_BUFFER_SIZE 1024
+/* twin report contexts */
+#define POOL_SMALL_BLOCK_SIZE 64
+#define POOL_SMALL_BLOCKS 32
+/* a JSON message with its send context, and the text of a reported property update */
+#define POOL_MESSAGE_BLOCK_SIZE 1024
+/* reported property updates and the firmware url, beyond the messages the lanes hold */
+#define POOL_SPARE_MESSAGE_BLOCKS 16
+/* 10 minutes at 1 Hz, an unsent block still fits a line of the unsent file */
+#define SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES 600
+#define UNSENT_LINE_SIZE (2 * SAMPLE_BLOCK_SIZE(SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES) + 64)
+/* in-flight messages get this long on shutdown, below the 3 s firmwarereboot.sh waits before starting the new firmware */
+#define SHUTDOWN_FLUSH_DEADLINE_MS 2000
+/* how quickly a sleeping loop notices a shutdown request */
+#define SHUTDOWN_POLL_MS 200
+/* how often the dispatcher looks for expired messages when nothing happens, and its pause after a failed hand over */
+#define SEND_DISPATCH_POLL_MS 100
+/* set in the environment of a re-executed process */
+#define RESTART_ENV "REMOTE_MONITORING_RESTARTED"
 
 static const int Spi_channel = 0;
 static const int Spi_clock = 1000000L;
 
 static const int Grn_led_pin = 7;
 
-static int Lock_fd;
+static int Lock_fd = -1;
+
+/* SIGTERM and SIGINT stop, SIGHUP restarts the process in place */
+typedef enum SHUTDOWN_REQUEST_TAG
+{
+	SHUTDOWN_NONE,
+	SHUTDOWN_STOP,
+	SHUTDOWN_RESTART
+} SHUTDOWN_REQUEST;
+
+static volatile sig_atomic_t shutdownRequest = SHUTDOWN_NONE;
+
+/*
+ * A message from its send lane to the hub's confirmation, with its plain body
+ * for the unsent file. While handed to the SDK it is also in the In_flight list.
+ */
+typedef struct SEND_CONTEXT_TAG
+{
+	/* first, the lanes hand back a pointer to it */
+	SEND_LANE_ITEM item;
+	IOTHUB_CLIENT_HANDLE clientHandle;
+	uint64_t sentAtUs;
+	struct SEND_CONTEXT_TAG* previous;
+	struct SEND_CONTEXT_TAG* next;
+	const char* messageType;
+	size_t size;
+	unsigned char body[];
+} SEND_CONTEXT;
+
+static pthread_mutex_t In_flight_lock = PTHREAD_MUTEX_INITIALIZER;
+static SEND_CONTEXT* In_flight;
+
+/* every message goes through the lanes, the dispatcher thread hands them to the SDK */
+static SEND_LANE_CONFIG g_laneConfigs[SEND_LANE_COUNT];
+static SEND_LANES g_sendLanes;
+static pthread_t Dispatcher_thread;
+static int Dispatcher_started;
+static volatile int Dispatcher_stop;
 
 /*json of supported methods*/
 static char* supportedMethod = "{ \"LightBlink\": \"light blink\", \"ChangeLightStatus--LightStatusValue-int\""
@@ -68,7 +215,15 @@ ascii_char_ptr, FirmwareVersion
 );
 
 DECLARE_MODEL(ConfigProperties,
-WITH_REPORTED_PROPERTY(uint8_t, TelemetryInterval)
+WITH_REPORTED_PROPERTY(uint8_t, TelemetryInterval),
+WITH_REPORTED_PROPERTY(int, TelemetryIntervalMs),
+WITH_REPORTED_PROPERTY(int, TelemetryIntervalMinMs),
+WITH_REPORTED_PROPERTY(int, TelemetryIntervalMaxMs),
+WITH_REPORTED_PROPERTY(int, AggregationWindowS),
+WITH_REPORTED_PROPERTY(int, AggregationHopS),
+WITH_REPORTED_PROPERTY(double, AnomalyZThreshold),
+WITH_REPORTED_PROPERTY(double, AnomalyRatePerMinute),
+WITH_REPORTED_PROPERTY(int, AnomalySampleMs)
 );
 
 DECLARE_DEVICETWIN_MODEL(Thermostat,
@@ -77,6 +232,17 @@ WITH_REPORTED_PROPERTY(ConfigProperties, Config),
 WITH_REPORTED_PROPERTY(SystemProperties, System),
 
 WITH_DESIRED_PROPERTY(uint8_t, TelemetryInterval, onDesiredTelemetryInterval),
+/* milliseconds, win over TelemetryInterval; min < max selects the adaptive interval */
+WITH_DESIRED_PROPERTY(int, TelemetryIntervalMs, onDesiredTelemetryInterval),
+WITH_DESIRED_PROPERTY(int, TelemetryIntervalMinMs, onDesiredTelemetryInterval),
+WITH_DESIRED_PROPERTY(int, TelemetryIntervalMaxMs, onDesiredTelemetryInterval),
+/* seconds, a window replaces the readings by one summary per window; a hop below the window slides it */
+WITH_DESIRED_PROPERTY(int, AggregationWindowS, onDesiredAggregation),
+WITH_DESIRED_PROPERTY(int, AggregationHopS, onDesiredAggregation),
+/* 0 keeps the default, a negative threshold disables that check; the sensor is watched every AnomalySampleMs */
+WITH_DESIRED_PROPERTY(double, AnomalyZThreshold, onDesiredAnomaly),
+WITH_DESIRED_PROPERTY(double, AnomalyRatePerMinute, onDesiredAnomaly),
+WITH_DESIRED_PROPERTY(int, AnomalySampleMs, onDesiredAnomaly),
 
 /* Direct methods implemented by the device */
 WITH_METHOD(LightBlink),
@@ -89,125 +255,312 @@ WITH_REPORTED_PROPERTY(ascii_char_ptr_no_quotes, SupportedMethods)
 
 END_NAMESPACE(Contoso);
 
-/* Callback after sending reported properties */
+/* the twin whose desired properties are cached in g_config */
+static Thermostat* g_persistedThermostat;
+
+/* Callback after sending reported properties, the context is the time the update was handed over */
 void deviceTwinCallback(int status_code, void* userContextCallback)
 {
-	(void)(userContextCallback);
-	printf("IoTHub: reported properties delivered with status_code = %u\n", status_code);
+	uint64_t* sentAtUs = userContextCallback;
+
+	LOGGER_INFO("IoTHub: reported properties delivered with status_code = %d\n", status_code);
+	if (status_code < 200 || status_code >= 300)
+	{
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+	}
+	else if (sentAtUs != NULL)
+	{
+		metrics_histogram_observe(METRIC_TWIN_ROUNDTRIP_LATENCY, metrics_now_us() - *sentAtUs);
+	}
+	mem_pool_free(sentAtUs);
 }
 
-/*Callback for desired property changed*/
-void onDesiredTelemetryInterval(void* argument)
+static uint64_t* NewTwinReportContext(void)
 {
-	/* By convention 'argument' is of the type of the MODEL */
-	Thermostat* thermostat = argument;
-	printf("Received a new desired_TelemetryInterval = %d\r\n", thermostat->TelemetryInterval);
-	thermostat->Config.TelemetryInterval = thermostat->TelemetryInterval;
-	if (IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
+	uint64_t* sentAtUs = mem_pool_alloc(sizeof(uint64_t));
+
+	if (sentAtUs != NULL)
 	{
-		printf("Report Config.TelemetryInterval property failed");
+		*sentAtUs = metrics_now_us();
 	}
-	else
+	metrics_counter_add(METRIC_TWIN_REPORTS, 1);
+
+	return sentAtUs;
+}
+
+static IOTHUB_CLIENT_RESULT SendReportedState(Thermostat* thermostat)
+{
+	IOTHUB_CLIENT_RESULT result;
+	uint64_t* sentAtUs = NewTwinReportContext();
+
+	if ((result = IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, sentAtUs)) != IOTHUB_CLIENT_OK)
 	{
-		printf("Report new value of Config.TelemetryInterval property: %d\r\n", thermostat->Config.TelemetryInterval);
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+		mem_pool_free(sentAtUs);
 	}
+
+	return result;
 }
 
-/*change light status on Raspberry Pi to received value*/
-METHODRETURN_HANDLE ChangeLightStatus(Thermostat* thermostat, int lightstatus)
+/* Sets the desired interval properties to the ones cached in the config store */
+static void LoadDesiredInterval(Thermostat* thermostat)
 {
-	printf("Raspberry Pi light status change\n");
-	pinMode(Grn_led_pin, OUTPUT);
-	printf("LED value\n %d", lightstatus);
-	digitalWrite(Grn_led_pin, lightstatus);
-	return MethodReturn_Create(201, "\"light status changed\"");
+	uint32_t seconds = (g_config.telemetryIntervalS != 0) ? g_config.telemetryIntervalS : DEFAULT_TELEMETRY_INTERVAL_S;
+
+	thermostat->TelemetryInterval = (uint8_t)((seconds > UINT8_MAX) ? UINT8_MAX : seconds);
+	thermostat->TelemetryIntervalMs = (int)g_config.telemetryIntervalMs;
+	thermostat->TelemetryIntervalMinMs = (int)g_config.telemetryIntervalMinMs;
+	thermostat->TelemetryIntervalMaxMs = (int)g_config.telemetryIntervalMaxMs;
+	thermostat->AggregationWindowS = (int)g_config.aggregationWindowS;
+	thermostat->AggregationHopS = (int)g_config.aggregationHopS;
+	thermostat->AnomalyZThreshold = g_config.anomalyZThreshold;
+	thermostat->AnomalyRatePerMinute = g_config.anomalyRatePerMinute;
+	thermostat->AnomalySampleMs = (int)g_config.anomalySampleMs;
 }
 
+static void SetIntervalReport(Thermostat* thermostat, int intervalMs)
+{
+	int seconds = (intervalMs + 500) / 1000;
 
+	thermostat->Config.TelemetryIntervalMs = intervalMs;
+	/* the whole seconds property stays for dashboards that only know it */
+	thermostat->Config.TelemetryInterval = (uint8_t)((seconds < 1) ? 1 : (seconds > UINT8_MAX) ? UINT8_MAX : seconds);
+}
 
-time_t ReadFormatedTime(const char *time_details)
+/* Derives the interval range in Config from the desired properties, returns 0 when it did not change */
+static int ApplyDesiredInterval(Thermostat* thermostat)
 {
-	struct tm tm;
-	strptime(time_details, "%Y-%m-%d %H:%M:%S", &tm);
-	time_t t = mktime(&tm);
-	printf("time: %s\r\n", time_details);
-	return t;
+	int fixedMs = (thermostat->TelemetryIntervalMs > 0) ? thermostat->TelemetryIntervalMs :
+		(thermostat->TelemetryInterval > 0) ? thermostat->TelemetryInterval * 1000 : DEFAULT_TELEMETRY_INTERVAL_S * 1000;
+	int minMs = thermostat->TelemetryIntervalMinMs;
+	int maxMs = thermostat->TelemetryIntervalMaxMs;
+	int result;
+
+	if (minMs <= 0 || maxMs <= minMs)
+	{
+		minMs = maxMs = fixedMs;
+	}
+	if (minMs < ADAPTIVE_INTERVAL_FLOOR_MS)
+	{
+		minMs = ADAPTIVE_INTERVAL_FLOOR_MS;
+	}
+	if (maxMs < minMs)
+	{
+		maxMs = minMs;
+	}
+
+	if (minMs == thermostat->Config.TelemetryIntervalMinMs && maxMs == thermostat->Config.TelemetryIntervalMaxMs)
+	{
+		result = 0;
+	}
+	else
+	{
+		thermostat->Config.TelemetryIntervalMinMs = minMs;
+		thermostat->Config.TelemetryIntervalMaxMs = maxMs;
+		/* an adaptive interval starts at the slow end */
+		SetIntervalReport(thermostat, maxMs);
+		result = 1;
+	}
+
+	return result;
 }
 
-void WriteConfig()
+/*Callback for desired property changed*/
+void onDesiredTelemetryInterval(void* argument)
 {
-	FILE* fp;
+	/* By convention 'argument' is of the type of the MODEL */
+	Thermostat* thermostat = argument;
+
+	/* every reconnect delivers the whole twin again, an interval that is already applied needs no work */
+	if (!ApplyDesiredInterval(thermostat))
+	{
+		LOGGER_DEBUG("Desired telemetry interval %d-%d ms is unchanged\r\n",
+			thermostat->Config.TelemetryIntervalMinMs, thermostat->Config.TelemetryIntervalMaxMs);
+		return;
+	}
+
+	LOGGER_INFO("Received a new desired telemetry interval = %d-%d ms\r\n",
+		thermostat->Config.TelemetryIntervalMinMs, thermostat->Config.TelemetryIntervalMaxMs);
+
+	/* cached so the next start sends at this rate from the first message */
+	if (thermostat == g_persistedThermostat)
+	{
+		g_config.telemetryIntervalS = thermostat->TelemetryInterval;
+		g_config.telemetryIntervalMs = (thermostat->TelemetryIntervalMs > 0) ? (uint32_t)thermostat->TelemetryIntervalMs : 0;
+		g_config.telemetryIntervalMinMs = (thermostat->TelemetryIntervalMinMs > 0) ? (uint32_t)thermostat->TelemetryIntervalMinMs : 0;
+		g_config.telemetryIntervalMaxMs = (thermostat->TelemetryIntervalMaxMs > 0) ? (uint32_t)thermostat->TelemetryIntervalMaxMs : 0;
+		if (config_store_save(configPath, &g_config) != CONFIG_STORE_OK)
+		{
+			LOGGER_WARN("Failed to cache the telemetry interval\r\n");
+		}
+	}
 
-	if (NULL == (fp = fopen("//home//pi//iot-remote-monitoring-c-raspberrypi-getstartedkit//advanced//config//lastupdate", "w")))
+	if (SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
 	{
-		printf("Failed to open lastupdate file to write\r\n");
+		LOGGER_WARN("Report Config.TelemetryInterval property failed");
 	}
 	else
 	{
-		printf("last update begin value: %s\r\n", lastUpdateBegin);
-		printf("last reboot begin value: %s\r\n", lastRebootBegin);
-		fprintf(fp, "%s\r\n%s", lastUpdateBegin, lastRebootBegin);
-		fclose(fp);
+		LOGGER_INFO("Report new value of Config.TelemetryInterval property: %d ms\r\n", thermostat->Config.TelemetryIntervalMs);
 	}
 }
 
-void LoadConfig()
+/* Copies the desired aggregation window to Config, returns 0 when it did not change */
+static int ApplyDesiredAggregation(Thermostat* thermostat)
 {
-	FILE* fp;
+	int windowS = (thermostat->AggregationWindowS > 0) ? thermostat->AggregationWindowS : 0;
+	int hopS = (windowS > 0 && thermostat->AggregationHopS > 0 && thermostat->AggregationHopS < windowS) ? thermostat->AggregationHopS : windowS;
+	int result;
 
-	if (NULL == (fp = fopen("//home//pi//iot-remote-monitoring-c-raspberrypi-getstartedkit//advanced//config//deviceinfo", "r")))
+	if (windowS == thermostat->Config.AggregationWindowS && hopS == thermostat->Config.AggregationHopS)
 	{
-		printf("Failed to open deviceInfo file to read\r\n");
+		result = 0;
 	}
 	else
 	{
-		char line[256] = { 0 };
+		thermostat->Config.AggregationWindowS = windowS;
+		thermostat->Config.AggregationHopS = hopS;
+		result = 1;
+	}
+
+	return result;
+}
+
+/*Callback for desired property changed*/
+void onDesiredAggregation(void* argument)
+{
+	Thermostat* thermostat = argument;
+
+	if (!ApplyDesiredAggregation(thermostat))
+	{
+		LOGGER_DEBUG("Desired aggregation window %d s is unchanged\r\n", thermostat->Config.AggregationWindowS);
+		return;
+	}
 
-		for (int i = 0; i < 2; i++)
+	LOGGER_INFO("Received a new desired aggregation window = %d s, hop %d s\r\n",
+		thermostat->Config.AggregationWindowS, thermostat->Config.AggregationHopS);
+
+	if (thermostat == g_persistedThermostat)
+	{
+		g_config.aggregationWindowS = (uint32_t)thermostat->Config.AggregationWindowS;
+		g_config.aggregationHopS = (uint32_t)thermostat->Config.AggregationHopS;
+		if (config_store_save(configPath, &g_config) != CONFIG_STORE_OK)
 		{
-			if (fgets(line, sizeof(line), fp)) {
-				if (i == 0)
-				{
-					deviceId = strdup(line);
-					deviceId = strtok(deviceId, "\n");
-					printf("read device id: %s\r\n", deviceId);
-				}
-				else
-				{
-					connectionString = strdup(line);
-					connectionString = strtok(connectionString, "\n");
-					printf("read connection string: %s\r\n", connectionString);
-				}
-			}
+			LOGGER_WARN("Failed to cache the aggregation window\r\n");
 		}
+	}
 
-		fclose(fp);
+	if (SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
+	{
+		LOGGER_WARN("Report Config.AggregationWindowS property failed");
+	}
+}
+
+/* Derives the effective anomaly thresholds in Config, 0 there disables a check; returns 0 when nothing changed */
+static int ApplyDesiredAnomaly(Thermostat* thermostat)
+{
+	double zThreshold = (thermostat->AnomalyZThreshold < 0) ? 0 :
+		(thermostat->AnomalyZThreshold > 0) ? thermostat->AnomalyZThreshold : DEFAULT_ANOMALY_Z_THRESHOLD;
+	double rateThreshold = (thermostat->AnomalyRatePerMinute < 0) ? 0 :
+		(thermostat->AnomalyRatePerMinute > 0) ? thermostat->AnomalyRatePerMinute : DEFAULT_ANOMALY_RATE_PER_MINUTE;
+	int sampleMs = (thermostat->AnomalySampleMs > 0) ? thermostat->AnomalySampleMs : DEFAULT_ANOMALY_SAMPLE_MS;
+	int result;
+
+	if (sampleMs < ADAPTIVE_INTERVAL_FLOOR_MS)
+	{
+		sampleMs = ADAPTIVE_INTERVAL_FLOOR_MS;
 	}
 
-	if (NULL == (fp = fopen("//home//pi//iot-remote-monitoring-c-raspberrypi-getstartedkit//advanced//config//lastupdate", "r")))
+	if (zThreshold == thermostat->Config.AnomalyZThreshold && rateThreshold == thermostat->Config.AnomalyRatePerMinute &&
+		sampleMs == thermostat->Config.AnomalySampleMs)
 	{
-		printf("Failed to open lastupdate file to read\r\n");
+		result = 0;
 	}
 	else
 	{
-		char buffer[256] = { 0 };
-		for (int i = 0; i < 2; i++)
+		thermostat->Config.AnomalyZThreshold = zThreshold;
+		thermostat->Config.AnomalyRatePerMinute = rateThreshold;
+		thermostat->Config.AnomalySampleMs = sampleMs;
+		result = 1;
+	}
+
+	return result;
+}
+
+/*Callback for desired property changed*/
+void onDesiredAnomaly(void* argument)
+{
+	Thermostat* thermostat = argument;
+
+	if (!ApplyDesiredAnomaly(thermostat))
+	{
+		LOGGER_DEBUG("Desired anomaly thresholds are unchanged\r\n");
+		return;
+	}
+
+	LOGGER_INFO("Received new anomaly thresholds: z-score %.2f, %.2f C/min, sampled every %d ms\r\n",
+		thermostat->Config.AnomalyZThreshold, thermostat->Config.AnomalyRatePerMinute, thermostat->Config.AnomalySampleMs);
+
+	if (thermostat == g_persistedThermostat)
+	{
+		g_config.anomalyZThreshold = (float)thermostat->AnomalyZThreshold;
+		g_config.anomalyRatePerMinute = (float)thermostat->AnomalyRatePerMinute;
+		g_config.anomalySampleMs = (thermostat->AnomalySampleMs > 0) ? (uint32_t)thermostat->AnomalySampleMs : 0;
+		if (config_store_save(configPath, &g_config) != CONFIG_STORE_OK)
 		{
-			if (fgets(buffer, sizeof(buffer), fp)) {
-				if (i == 0)
-				{
-					lastUpdateBegin = strdup(buffer);
-					printf("firmware update begin %s\r\n", lastUpdateBegin);
-				}
-				else
-				{
-					lastRebootBegin = strdup(buffer);
-					printf("firmware update reboot %s\r\n", lastRebootBegin);
-				}
-			}
+			LOGGER_WARN("Failed to cache the anomaly thresholds\r\n");
 		}
-		fclose(fp);
 	}
+
+	if (SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
+	{
+		LOGGER_WARN("Report Config.AnomalyZThreshold property failed");
+	}
+}
+
+/*change light status on Raspberry Pi to received value*/
+METHODRETURN_HANDLE ChangeLightStatus(Thermostat* thermostat, int lightstatus)
+{
+	printf("Raspberry Pi light status change\n");
+	pinMode(Grn_led_pin, OUTPUT);
+	printf("LED value\n %d", lightstatus);
+	digitalWrite(Grn_led_pin, lightstatus);
+	return MethodReturn_Create(201, "\"light status changed\"");
+}
+
+
+
+/* Reads the config store, seeding it from the legacy text files on first start */
+int LoadConfig(void)
+{
+	int result;
+	CONFIG_STORE_RESULT loaded;
+
+	config_store_defaults(&g_config);
+	configPath = config_store_path(configPath);
+
+	loaded = config_store_load(configPath, &g_config);
+	if (loaded == CONFIG_STORE_MISSING || loaded == CONFIG_STORE_CORRUPT)
+	{
+		config_store_defaults(&g_config);
+		if (config_store_import_legacy(configPath, &g_config) == CONFIG_STORE_OK)
+		{
+			printf("Imported deviceinfo and lastupdate into %s\r\n", configPath);
+			loaded = config_store_save(configPath, &g_config);
+		}
+	}
+
+	if (loaded == CONFIG_STORE_ERROR)
+	{
+		result = __LINE__;
+	}
+	else
+	{
+		printf("read device id: %s\r\n", g_config.deviceId);
+		result = 0;
+	}
+
+	return result;
 }
 
 char* FormatTime(time_t* time)
@@ -230,14 +583,6 @@ bool DownloadFile(ascii_char_ptr url)
 	return system(str) == 0;
 }
 
-void AllocAndVPrintf(unsigned char** buffer, size_t* size, const char* format, va_list argptr)
-{
-	*size = vsnprintf(NULL, 0, format, argptr);
-
-	*buffer = malloc(*size + 1);
-	vsprintf((char*)*buffer, format, argptr);
-}
-
 void UpdateReportedProperties(const char* format, ...)
 {
 	unsigned char* report;
@@ -245,19 +590,30 @@ void UpdateReportedProperties(const char* format, ...)
 
 	va_list args;
 	va_start(args, format);
-	AllocAndVPrintf(&report, &len, format, args);
+	report = message_format_valloc(&len, format, args);
 	va_end(args);
 
-	if (IoTHubClient_SendReportedState(g_iotHubClientHandle, report, len, NULL, NULL) != IOTHUB_CLIENT_OK)
+	if (report == NULL)
 	{
-		(void)printf("Failed to update reported properties: %.*s\r\n", len, report);
+		LOGGER_ERROR("unable to allocate the reported properties\r\n");
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
 	}
 	else
 	{
-		(void)printf("Succeeded in updating reported properties: %.*s\r\n", len, report);
-	}
+		uint64_t* sentAtUs = NewTwinReportContext();
+		if (IoTHubClient_SendReportedState(g_iotHubClientHandle, report, len, deviceTwinCallback, sentAtUs) != IOTHUB_CLIENT_OK)
+		{
+			LOGGER_WARN("Failed to update reported properties: %.*s\r\n", (int)len, (const char*)report);
+			metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+			mem_pool_free(sentAtUs);
+		}
+		else
+		{
+			LOGGER_INFO("Succeeded in updating reported properties: %.*s\r\n", (int)len, (const char*)report);
+		}
 
-	free(report);
+		mem_pool_free(report);
+	}
 }
 
 //this method is an example for apply firmware
@@ -282,8 +638,7 @@ void* FirmwareUpdateThread(void* arg)
 	UpdateReportedProperties("{ 'Method' : { 'UpdateFirmware': null } }");
 	time(&begin);
 	char * beginUpdate = FormatTime(&begin);
-	lastUpdateBegin = malloc(strlen(beginUpdate) + 1);
-	strcpy(lastUpdateBegin, beginUpdate);
+	g_config.updateBegin = (int64_t)begin;
 	UpdateReportedProperties(
 		"{ 'Method' : { 'UpdateFirmware': { 'Duration-s': 0, 'LastUpdate': '%s', 'Status': 'Running' } } }",
 		beginUpdate);
@@ -295,7 +650,10 @@ void* FirmwareUpdateThread(void* arg)
 
 	time(&stepEnd);
 	//downloadfile
-	if (!DownloadFile(url))
+	TRACE_BEGIN(downloadSpan, "firmware_download");
+	bool downloaded = DownloadFile(url);
+	TRACE_END(downloadSpan);
+	if (!downloaded)
 	{
 		UpdateReportedProperties(
 			"{ 'Method' : { 'UpdateFirmware': { 'Download' : { 'Duration-s': %u, 'LastUpdate': '%s', 'Status': 'Failed' } } } }",
@@ -307,6 +665,7 @@ void* FirmwareUpdateThread(void* arg)
 			"{ 'Method' : { 'UpdateFirmware': { 'Duration-s': %u, 'LastUpdate': '%s', 'Status': 'Failed' } } }",
 			end - begin,
 			FormatTime(&end));
+		mem_pool_free(arg);
 		return NULL;
 	}
 
@@ -324,8 +683,11 @@ void* FirmwareUpdateThread(void* arg)
 
 	printf("unlock file before apply new firmware\r\n");
 	close_lockfile(Lock_fd);
+	Lock_fd = -1;
 
+	TRACE_BEGIN(applySpan, "firmware_apply");
 	ApplyFirmware();
+	TRACE_END(applySpan);
 
 	time(&stepEnd);
 	UpdateReportedProperties(
@@ -339,42 +701,46 @@ void* FirmwareUpdateThread(void* arg)
 		"{ 'Method' : { 'UpdateFirmware': { 'Reboot' : { 'Duration-s': 0, 'LastUpdate': '%s', 'Status': 'Running' } } } }",
 		rebootBegin);
 
-	lastRebootBegin = malloc(strlen(rebootBegin) + 1);
-	strcpy(lastRebootBegin, rebootBegin);
-	WriteConfig();
-	free(arg);
-	exit(0);
+	/* must be on disk before the reboot, the new firmware reports the update complete from it */
+	g_config.rebootBegin = (int64_t)stepBegin;
+	if (config_store_save(configPath, &g_config) != CONFIG_STORE_OK)
+	{
+		printf("Failed to save the firmware update state\r\n");
+	}
+	mem_pool_free(arg);
+	/* keep the update's spans, the new firmware starts with empty buffers */
+	trace_dump();
+	/* the main loop flushes and tears down, exiting here would lose the messages in flight */
+	shutdownRequest = SHUTDOWN_STOP;
+	return NULL;
 }
 
 void UpdateFirmwareComplete()
 {
-	if (lastRebootBegin == NULL || lastUpdateBegin == NULL)
+	if (g_config.rebootBegin == 0 || g_config.updateBegin == 0)
 		return;
 	printf("start send firmware update complete");
 	time_t begin, end, stepBegin, stepEnd;
-	stepBegin = ReadFormatedTime(lastRebootBegin);
+	stepBegin = (time_t)g_config.rebootBegin;
 	time(&stepEnd);
 	UpdateReportedProperties(
 		"{ 'Method' : { 'UpdateFirmware': { 'Reboot' : { 'Duration-s': %u, 'LastUpdate': '%s', 'Status': 'Complete' } } } }",
 		stepEnd - stepBegin,
 		FormatTime(&stepEnd));
 
-	begin = ReadFormatedTime(lastUpdateBegin);
+	begin = (time_t)g_config.updateBegin;
 	time(&end);
 	UpdateReportedProperties(
 		"{ 'Method' : { 'UpdateFirmware': { 'Duration-s': %u, 'LastUpdate': '%s', 'Status': 'Complete' } } }",
 		end - begin,
 		FormatTime(&end));
 	printf("finsh send firmware update complete");
-	//clean up lastupdate log
-	FILE* fp;
-	if (NULL == (fp = fopen("//home//pi//iot-remote-monitoring-c-raspberrypi-getstartedkit//advanced//config//lastupdate", "w")))
-	{
-		printf("Failed to open lastupdate file to write\r\n");
-	}
-	else
+	//clean up the update anchors
+	g_config.updateBegin = 0;
+	g_config.rebootBegin = 0;
+	if (config_store_save(configPath, &g_config) != CONFIG_STORE_OK)
 	{
-		fclose(fp);
+		printf("Failed to clear the firmware update state\r\n");
 	}
 }
 
@@ -386,10 +752,26 @@ METHODRETURN_HANDLE InitiateFirmwareUpdate(Thermostat* thermostat, ascii_char_pt
 	METHODRETURN_HANDLE result = MethodReturn_Create(201, "\"Initiating Firmware Update\"");
 	printf("Recieved firmware update request. Use package at: %s\r\n", FwPackageURI);
 	pthread_t tid;
-	ascii_char_ptr url = malloc(strlen(FwPackageURI) + 1);
-	strcpy(url, FwPackageURI);
-	printf("receive and strcpy url: %s\r\n", url);
-	pthread_create(&tid, NULL, &FirmwareUpdateThread, url);
+	ascii_char_ptr url = mem_pool_alloc(strlen(FwPackageURI) + 1);
+	if (url == NULL)
+	{
+		printf("Failed to allocate the firmware url\r\n");
+	}
+	else
+	{
+		strcpy(url, FwPackageURI);
+		printf("receive and strcpy url: %s\r\n", url);
+		/* nobody joins the thread, detached its stack is released when it ends */
+		if (pthread_create(&tid, NULL, &FirmwareUpdateThread, url) != 0)
+		{
+			printf("Failed to start the firmware update\r\n");
+			mem_pool_free(url);
+		}
+		else
+		{
+			(void)pthread_detach(tid);
+		}
+	}
 	return result;
 }
 
@@ -411,203 +793,1871 @@ METHODRETURN_HANDLE LightBlink(Thermostat* thermostat)
 	return MethodReturn_Create(201, "\"light blink success\"");
 }
 
-/* Send data to IoT Hub */
-static void sendMessage(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const unsigned char* buffer, size_t size)
+/* The backend needs the calibration of the module to compensate raw frames */
+static void SendCalibrationReport(void)
 {
-	IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(buffer, size);
-	if (messageHandle == NULL)
+	const bme280_calib_data_t* c = bme280_calibration();
+
+	UpdateReportedProperties("{ \"Bme280Calibration\" : { "
+		"\"dig_T1\": %u, \"dig_T2\": %d, \"dig_T3\": %d, "
+		"\"dig_P1\": %u, \"dig_P2\": %d, \"dig_P3\": %d, \"dig_P4\": %d, \"dig_P5\": %d, \"dig_P6\": %d, \"dig_P7\": %d, \"dig_P8\": %d, \"dig_P9\": %d, "
+		"\"dig_H1\": %u, \"dig_H2\": %d, \"dig_H3\": %u, \"dig_H4\": %d, \"dig_H5\": %d, \"dig_H6\": %d } }",
+		(unsigned int)c->dig_T1, (int)c->dig_T2, (int)c->dig_T3,
+		(unsigned int)c->dig_P1, (int)c->dig_P2, (int)c->dig_P3, (int)c->dig_P4, (int)c->dig_P5, (int)c->dig_P6, (int)c->dig_P7, (int)c->dig_P8, (int)c->dig_P9,
+		(unsigned int)c->dig_H1, (int)c->dig_H2, (unsigned int)c->dig_H3, (int)c->dig_H4, (int)c->dig_H5, (int)c->dig_H6);
+}
+
+/* Publishes the compact metrics summary next to the model's reported properties */
+static void SendMetricsReport(void)
+{
+	char report[512];
+
+	if (metrics_format_reported(report, sizeof(report)) == 0)
+	{
+		LOGGER_WARN("Metrics report does not fit the buffer\r\n");
+	}
+	else
+	{
+		UpdateReportedProperties("%s", report);
+	}
+}
+
+/* Reports the latest step of the realtime clock once, the backend can line up the samples around it */
+static void ReportClockStep(void)
+{
+	static uint64_t reportedSteps;
+	SAMPLE_CLOCK_STEP step;
+	uint64_t steps = sample_clock_last_step(&step);
+
+	if (steps != reportedSteps)
+	{
+		char at[SAMPLE_CLOCK_TEXT_SIZE];
+
+		(void)sample_clock_format(step.unixUs, at, sizeof(at));
+		UpdateReportedProperties("{ \"ClockStep\" : { \"Count\" : %llu, \"At\" : \"%s\", \"StepMs\" : %lld } }",
+			(unsigned long long)steps, at, (long long)(step.stepUs / 1000));
+		reportedSteps = steps;
+	}
+}
+
+static void InFlightRemove(SEND_CONTEXT* context)
+{
+	(void)pthread_mutex_lock(&In_flight_lock);
+	if (context->previous != NULL)
 	{
-		printf("unable to create a new IoTHubMessage\r\n");
+		context->previous->next = context->next;
 	}
 	else
 	{
-		if (IoTHubClient_SendEventAsync(iotHubClientHandle, messageHandle, NULL, NULL) != IOTHUB_CLIENT_OK)
+		In_flight = context->next;
+	}
+	if (context->next != NULL)
+	{
+		context->next->previous = context->previous;
+	}
+	(void)pthread_mutex_unlock(&In_flight_lock);
+}
+
+/* Gives a message that was not delivered back to its lane, or drops it when the lane is best effort or its attempts are used up */
+static void SendFailed(SEND_CONTEXT* context)
+{
+	SEND_LANE_ITEM* dropped;
+
+	switch (send_lanes_complete(&g_sendLanes, &context->item, 0, metrics_now_us(), &dropped))
+	{
+	case SEND_LANE_REQUEUED:
+		metrics_counter_add(METRIC_MESSAGES_RETRIED, 1);
+		if (dropped != NULL)
 		{
-			printf("failed to hand over the message to IoTHubClient");
+			LOGGER_WARN("The %s lane is full, dropping its newest message for a retry\r\n", send_lanes_name(context->item.lane));
+			metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+			mem_pool_free(dropped);
 		}
 		else
 		{
-			printf("IoTHubClient accepted the message for delivery\r\n");
+			metrics_gauge_add(METRIC_SEND_LANE_BACKLOG, 1);
 		}
+		break;
+	case SEND_LANE_ABANDONED:
+		LOGGER_WARN("Giving up a %s message after %u attempts\r\n", send_lanes_name(context->item.lane), context->item.attempts);
+		metrics_counter_add(METRIC_MESSAGES_ABANDONED, 1);
+		mem_pool_free(context);
+		break;
+	default:
+		metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+		mem_pool_free(context);
+		break;
+	}
+}
 
-		IoTHubMessage_Destroy(messageHandle);
+static void SendConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+	SEND_CONTEXT* context = userContextCallback;
+
+	InFlightRemove(context);
+	metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, -1);
+	if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+	{
+		metrics_counter_add(METRIC_MESSAGES_CONFIRMED, 1);
+		metrics_histogram_observe(METRIC_SEND_CONFIRM_LATENCY, metrics_now_us() - context->sentAtUs);
+		SEND_LANE_ITEM* dropped;
+
+		(void)send_lanes_complete(&g_sendLanes, &context->item, 1, metrics_now_us(), &dropped);
+		mem_pool_free(context);
+	}
+	else
+	{
+		SendFailed(context);
 	}
-	free((void*)buffer);
 }
 
-void SendDeviceInfo(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+/* Waits until every message is confirmed or the time is up, returns the number still queued or in flight */
+static size_t WaitForConfirmations(unsigned int timeoutMs)
 {
-	char* buffer = malloc(sizeof(char) * 512);
-	sprintf(buffer, deviceInfo, deviceId);
-	printf("send device info: %s %d\r\n", buffer, strlen(buffer));
-	sendMessage(iotHubClientHandle, buffer, strlen(buffer));
+	unsigned int waitedMs = 0;
+	size_t outstanding;
+
+	for (;;)
+	{
+		outstanding = send_lanes_pending(&g_sendLanes);
+		if (outstanding == 0 || waitedMs >= timeoutMs)
+		{
+			break;
+		}
+		ThreadAPI_Sleep(10);
+		waitedMs += 10;
+	}
+
+	return outstanding;
 }
 
-void SendTelemetryData(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+/* The file unconfirmed messages are kept in across a restart, next to the config store; returns 0 when path holds all of it */
+static int UnsentPath(char* path, size_t size)
 {
-	float tempC = -300.0;
-	float pressurePa = -300;
-	float humidityPct = -300;
+	const char* slash = strrchr(configPath, '/');
+	int directoryLength = (slash != NULL) ? (int)(slash - configPath + 1) : 0;
+	int length = snprintf(path, size, "%.*sunsent", directoryLength, configPath);
 
-	int sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
+	return (length > 0 && (size_t)length < size) ? 0 : __LINE__;
+}
 
-	if (sensorResult == 1)
+/* One line of the unsent file, nothing for a best-effort lane */
+static size_t WriteUnsent(FILE* fp, const SEND_CONTEXT* context)
+{
+	size_t result = 0;
+
+	if (send_lanes_config(&g_sendLanes, context->item.lane)->delivery != SEND_DELIVERY_AT_LEAST_ONCE)
 	{
-		printf("Read Sensor Data: Humidity = %.1f%% Temperature = %.1f*C \n",
-			humidityPct, tempC);
+		metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+	}
+	else if (context->messageType != NULL && strcmp(context->messageType, SAMPLE_BLOCK_MESSAGE_TYPE) == 0)
+	{
+		fprintf(fp, "%s\t", context->messageType);
+		for (size_t i = 0; i < context->size; i++)
+		{
+			fprintf(fp, "%02x", context->body[i]);
+		}
+		fputc('\n', fp);
+		result = 1;
 	}
 	else
 	{
-		printf("Read Sensor Data Failed, send simulated data Humidity = %.1f%% Temperature = %.1f*C \n", humidityPct, tempC);
+		fprintf(fp, "%s\t%.*s\n", (context->messageType != NULL) ? context->messageType : "-", (int)context->size, (const char*)context->body);
+		result = 1;
 	}
 
-	char* buffer = malloc(sizeof(char) * 256);
-	sprintf(buffer, telemetryData, deviceId, tempC, humidityPct);
-	printf("Sending sensor value: %s %d\r\n", buffer, strlen(buffer));
-	sendMessage(iotHubClientHandle, buffer, strlen(buffer));
+	return result;
 }
 
-void remote_monitoring_run(void)
+/*
+ * Writes the messages still in flight and then those waiting in the lanes to
+ * the unsent file, one per line as <message type or -> TAB <body>, a sample
+ * block in hex. The hub may have received some of those in flight without
+ * confirming yet, they are sent twice. Call it after StopSendDispatcher.
+ */
+static void PersistUnsent(void)
 {
-	if (platform_init() != 0)
+	char path[PATH_MAX];
+	char temporaryPath[PATH_MAX];
+	size_t persisted = 0;
+	SEND_LANE_ITEM* queued = send_lanes_take_queued(&g_sendLanes);
+	FILE* fp;
+	int length;
+
+	(void)pthread_mutex_lock(&In_flight_lock);
+	if (UnsentPath(path, sizeof(path)) != 0 ||
+		(length = snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path)) < 0 || (size_t)length >= sizeof(temporaryPath))
 	{
-		printf("Failed to initialize the platform.\n");
+		printf("The unsent file path next to %s is too long, unsent messages are lost\r\n", configPath);
+	}
+	else if (In_flight == NULL && queued == NULL)
+	{
+		(void)unlink(path);
+	}
+	else if ((fp = fopen(temporaryPath, "w")) == NULL)
+	{
+		printf("Failed to open %s, unsent messages are lost\r\n", temporaryPath);
 	}
 	else
 	{
-		if (SERIALIZER_REGISTER_NAMESPACE(Contoso) == NULL)
+		/* the list is newest first, the file keeps the send order */
+		SEND_CONTEXT* context = In_flight;
+		while (context != NULL && context->next != NULL)
 		{
-			printf("Unable to SERIALIZER_REGISTER_NAMESPACE\n");
+			context = context->next;
+		}
+		for (; context != NULL; context = context->previous)
+		{
+			persisted += WriteUnsent(fp, context);
+		}
+		for (; queued != NULL; queued = queued->next)
+		{
+			persisted += WriteUnsent(fp, (const SEND_CONTEXT*)queued);
+		}
+		if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fclose(fp) != 0 || rename(temporaryPath, path) != 0)
+		{
+			printf("Failed to write %s, unsent messages are lost\r\n", path);
 		}
 		else
 		{
-			IOTHUB_CLIENT_HANDLE iotHubClientHandle = IoTHubClient_CreateFromConnectionString(connectionString, MQTT_Protocol);
-			g_iotHubClientHandle = iotHubClientHandle;
-			if (iotHubClientHandle == NULL)
+			printf("Kept %zu unsent messages in %s\r\n", persisted, path);
+		}
+	}
+	(void)pthread_mutex_unlock(&In_flight_lock);
+}
+
+/*
+ * Hands a message from its lane to the SDK, with the lane's timeout as the
+ * SDK's message timeout. A message type is set as the MessageType application
+ * property. A body from the compression threshold on is deflated and flagged
+ * with its content encoding; the context keeps the plain body, so a retry and
+ * the unsent file start from it. Returns 0 once the SDK has the message.
+ */
+static int HandOver(SEND_CONTEXT* context)
+{
+	/* the dispatcher is the only caller, the last timeout set is only changed when a lane needs another */
+	static IOTHUB_CLIENT_HANDLE timeoutClientHandle;
+	static tickcounter_ms_t timeoutMs;
+	unsigned char compressed[SEND_COMPRESS_BUFFER_SIZE];
+	size_t compressedSize = 0;
+	const char* messageType = context->messageType;
+	tickcounter_ms_t laneTimeoutMs = send_lanes_config(&g_sendLanes, context->item.lane)->timeoutMs;
+	int result = __LINE__;
+
+	/* a sample block is packed already */
+	if (compressThresholdBytes > 0 && context->size >= (size_t)compressThresholdBytes && (messageType == NULL || strcmp(messageType, SAMPLE_BLOCK_MESSAGE_TYPE) != 0))
+	{
+		TRACE_BEGIN(compressSpan, "payload_compress");
+		compressedSize = payload_compress(context->body, context->size, compressed, sizeof(compressed));
+		TRACE_END(compressSpan);
+	}
+	TRACE_BEGIN(createSpan, "IoTHubMessage_CreateFromByteArray");
+	IOTHUB_MESSAGE_HANDLE messageHandle = (compressedSize != 0) ?
+		IoTHubMessage_CreateFromByteArray(compressed, compressedSize) : IoTHubMessage_CreateFromByteArray(context->body, context->size);
+	TRACE_END(createSpan);
+	if (messageHandle == NULL)
+	{
+		LOGGER_ERROR("unable to create a new IoTHubMessage\r\n");
+	}
+	else if (compressedSize != 0 && IoTHubMessage_SetContentEncodingSystemProperty(messageHandle, PAYLOAD_COMPRESS_ENCODING) != IOTHUB_MESSAGE_OK)
+	{
+		LOGGER_ERROR("unable to set the content encoding\r\n");
+		IoTHubMessage_Destroy(messageHandle);
+	}
+	else if (messageType != NULL && Map_AddOrUpdate(IoTHubMessage_Properties(messageHandle), "MessageType", messageType) != MAP_OK)
+	{
+		LOGGER_ERROR("unable to set the message type\r\n");
+		IoTHubMessage_Destroy(messageHandle);
+	}
+	else
+	{
+		/* the SDK takes the timeout when a message is queued, so it can differ from message to message */
+		if ((timeoutClientHandle != context->clientHandle || timeoutMs != laneTimeoutMs) &&
+			IoTHubClient_SetOption(context->clientHandle, "messageTimeout", &laneTimeoutMs) == IOTHUB_CLIENT_OK)
+		{
+			timeoutClientHandle = context->clientHandle;
+			timeoutMs = laneTimeoutMs;
+		}
+
+		context->sentAtUs = metrics_now_us();
+		/* listed and counted before the hand over, the confirmation can arrive before SendEventAsync returns */
+		(void)pthread_mutex_lock(&In_flight_lock);
+		context->previous = NULL;
+		context->next = In_flight;
+		if (In_flight != NULL)
+		{
+			In_flight->previous = context;
+		}
+		In_flight = context;
+		(void)pthread_mutex_unlock(&In_flight_lock);
+		metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, 1);
+		TRACE_BEGIN(queueSpan, "IoTHubClient_SendEventAsync");
+		IOTHUB_CLIENT_RESULT sendResult = IoTHubClient_SendEventAsync(context->clientHandle, messageHandle, SendConfirmationCallback, context);
+		TRACE_END(queueSpan);
+		if (sendResult != IOTHUB_CLIENT_OK)
+		{
+			LOGGER_ERROR("failed to hand over the message to IoTHubClient");
+			InFlightRemove(context);
+			metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, -1);
+		}
+		else
+		{
+			LOGGER_DEBUG("IoTHubClient accepted the %s message for delivery\r\n", send_lanes_name(context->item.lane));
+			metrics_counter_add(METRIC_MESSAGES_SENT, 1);
+			if (compressedSize != 0)
+			{
+				metrics_counter_add(METRIC_MESSAGES_COMPRESSED, 1);
+				metrics_counter_add(METRIC_COMPRESSION_SAVED_BYTES, context->size - compressedSize);
+			}
+			result = 0;
+		}
+
+		IoTHubMessage_Destroy(messageHandle);
+	}
+
+	return result;
+}
+
+/* Takes messages from the lanes and hands them over, until StopSendDispatcher */
+static void* SendDispatcher(void* argument)
+{
+	(void)argument;
+
+	while (!Dispatcher_stop)
+	{
+		SEND_LANE_ITEM* expired;
+		SEND_LANE_ITEM* item = send_lanes_pop(&g_sendLanes, metrics_now_us(), &expired);
+
+		while (expired != NULL)
+		{
+			SEND_LANE_ITEM* next = expired->next;
+
+			metrics_gauge_add(METRIC_SEND_LANE_BACKLOG, -1);
+			metrics_counter_add(METRIC_MESSAGES_EXPIRED, 1);
+			mem_pool_free(expired);
+			expired = next;
+		}
+
+		if (item == NULL)
+		{
+			send_lanes_wait(&g_sendLanes, SEND_DISPATCH_POLL_MS);
+		}
+		else
+		{
+			metrics_gauge_add(METRIC_SEND_LANE_BACKLOG, -1);
+			if (item->lane == SEND_LANE_ALERT && item->attempts == 1)
+			{
+				metrics_histogram_observe(METRIC_ALERT_LANE_WAIT, metrics_now_us() - item->queuedUs);
+			}
+			if (HandOver((SEND_CONTEXT*)item) != 0)
+			{
+				SendFailed((SEND_CONTEXT*)item);
+				/* the client is not taking messages, do not spin on a retried one */
+				send_lanes_wait(&g_sendLanes, SEND_DISPATCH_POLL_MS);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int StartSendDispatcher(void)
+{
+	int result = 0;
+
+	if (send_lanes_init(&g_sendLanes, g_laneConfigs) != 0)
+	{
+		printf("Failed to set up the send lanes\r\n");
+		result = __LINE__;
+	}
+	else if (pthread_create(&Dispatcher_thread, NULL, SendDispatcher, NULL) != 0)
+	{
+		printf("Failed to start the send dispatcher\r\n");
+		send_lanes_deinit(&g_sendLanes);
+		result = __LINE__;
+	}
+	else
+	{
+		Dispatcher_started = 1;
+	}
+
+	return result;
+}
+
+/*
+ * Safe to call more than once. What is still queued stays in the lanes for
+ * PersistUnsent, and the lanes stay set up: destroying a client confirms its
+ * messages in flight through them.
+ */
+static void StopSendDispatcher(void)
+{
+	if (Dispatcher_started)
+	{
+		Dispatcher_stop = 1;
+		send_lanes_wake(&g_sendLanes);
+		(void)pthread_join(Dispatcher_thread, NULL);
+		Dispatcher_started = 0;
+	}
+}
+
+/*
+ * Sizes the memory pools for the most the application holds at once: a send
+ * context for every message the lanes can queue and have in flight, and for
+ * the one being queued while a full lane still holds its oldest. Sample
+ * blocks get a class of their own, which also holds the block being filled.
+ * Once the lanes are full nothing is allocated from the heap any more.
+ */
+static void StartMemoryPools(void)
+{
+	MEM_POOL_CLASS classes[3];
+	size_t count = 0;
+	size_t messages = POOL_SPARE_MESSAGE_BLOCKS;
+
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		messages += g_laneConfigs[lane].maxQueued + g_laneConfigs[lane].maxInFlight + 1;
+	}
+	classes[count].blockSize = POOL_SMALL_BLOCK_SIZE;
+	classes[count++].blocks = POOL_SMALL_BLOCKS;
+	classes[count].blockSize = POOL_MESSAGE_BLOCK_SIZE;
+	classes[count++].blocks = messages;
+	if (sampleBlockSamples > 0)
+	{
+		const SEND_LANE_CONFIG* bulk = &g_laneConfigs[SEND_LANE_BULK];
+		size_t blockSize = sizeof(SEND_CONTEXT) + SAMPLE_BLOCK_SIZE((size_t)sampleBlockSamples);
+		size_t blocks = bulk->maxQueued + bulk->maxInFlight + 2;
+
+		/* small blocks fit the message class, the classes stay in ascending size */
+		if (blockSize <= POOL_MESSAGE_BLOCK_SIZE)
+		{
+			classes[count - 1].blocks += blocks;
+		}
+		else
+		{
+			classes[count].blockSize = blockSize;
+			classes[count++].blocks = blocks;
+		}
+	}
+
+	if (mem_pool_init(classes, count) != 0)
+	{
+		printf("Continuing without memory pools, messages are allocated from the heap\n");
+	}
+}
+
+/* Queues a copy of data for IoT Hub on a lane, the caller keeps the buffer */
+static void sendMessage(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const unsigned char* buffer, size_t size, const char* messageType, SEND_LANE lane)
+{
+	SEND_CONTEXT* context = mem_pool_alloc(sizeof(SEND_CONTEXT) + size);
+
+	if (context == NULL)
+	{
+		LOGGER_ERROR("unable to allocate the send context\r\n");
+		metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+	}
+	else
+	{
+		SEND_LANE_ITEM* dropped;
+
+		context->clientHandle = iotHubClientHandle;
+		context->messageType = messageType;
+		context->size = size;
+		memcpy(context->body, buffer, size);
+		metrics_gauge_add(METRIC_SEND_LANE_BACKLOG, 1);
+		if ((dropped = send_lanes_push(&g_sendLanes, &context->item, lane, metrics_now_us())) != NULL)
+		{
+			LOGGER_WARN("The %s lane is full, dropping its oldest message\r\n", send_lanes_name(lane));
+			metrics_gauge_add(METRIC_SEND_LANE_BACKLOG, -1);
+			metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+			mem_pool_free(dropped);
+		}
+	}
+}
+
+void SendDeviceInfo(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* id)
+{
+	char buffer[512];
+	sprintf(buffer, deviceInfo, id);
+	LOGGER_INFO("send device info: %s %zu\r\n", buffer, strlen(buffer));
+	sendMessage(iotHubClientHandle, buffer, strlen(buffer), NULL, SEND_LANE_DIAGNOSTICS);
+}
+
+void SendSensorValues(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* id, const SAMPLE_STAMP* stamp, float tempC, float humidityPct)
+{
+	uint64_t serializeStartUs = metrics_now_us();
+	TRACE_BEGIN(serializeSpan, "sprintf_telemetry");
+	char buffer[MESSAGE_FORMAT_TELEMETRY_SIZE];
+	size_t length = message_format_telemetry(buffer, sizeof(buffer), id, stamp, tempC, humidityPct);
+	TRACE_END(serializeSpan);
+	metrics_histogram_observe(METRIC_SERIALIZE_LATENCY, metrics_now_us() - serializeStartUs);
+	if (length == 0)
+	{
+		LOGGER_ERROR("Failed to format the sensor values\r\n");
+	}
+	else
+	{
+		LOGGER_INFO("Sending sensor value: %s %zu\r\n", buffer, length);
+		sendMessage(iotHubClientHandle, buffer, length, NULL, SEND_LANE_TELEMETRY);
+	}
+}
+
+void SendSummaryValues(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* id, const EDGE_SUMMARY* summary)
+{
+	const EDGE_CHANNEL_SUMMARY* temperature = &summary->channels[EDGE_CHANNEL_TEMPERATURE];
+	const EDGE_CHANNEL_SUMMARY* humidity = &summary->channels[EDGE_CHANNEL_HUMIDITY];
+	char windowStart[SAMPLE_CLOCK_TEXT_SIZE];
+	char windowEnd[SAMPLE_CLOCK_TEXT_SIZE];
+	uint64_t serializeStartUs = metrics_now_us();
+	TRACE_BEGIN(serializeSpan, "sprintf_summary");
+	char buffer[768];
+	(void)sample_clock_format(summary->first.unixUs, windowStart, sizeof(windowStart));
+	(void)sample_clock_format(summary->last.unixUs, windowEnd, sizeof(windowEnd));
+	/* the length of the window is measured on the monotonic clock, a clock step does not change it */
+	sprintf(buffer, summaryData, id, temperature->mean, humidity->mean, windowStart, windowEnd,
+		(unsigned int)summary->first.sequence, (unsigned int)summary->last.sequence, (unsigned int)summary->first.epoch,
+		(summary->last.monotonicUs - summary->first.monotonicUs) / 1e6, summary->count,
+		temperature->min, temperature->max, temperature->stddev, temperature->p50, temperature->p95,
+		humidity->min, humidity->max, humidity->stddev, humidity->p50, humidity->p95);
+	TRACE_END(serializeSpan);
+	metrics_histogram_observe(METRIC_SERIALIZE_LATENCY, metrics_now_us() - serializeStartUs);
+	LOGGER_INFO("Sending window summary: %s %zu\r\n", buffer, strlen(buffer));
+	sendMessage(iotHubClientHandle, buffer, strlen(buffer), NULL, SEND_LANE_TELEMETRY);
+}
+
+void SendAlert(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const char* id, const char* series, const SAMPLE_STAMP* stamp, const ANOMALY_EVENT* event)
+{
+	char sampleTime[SAMPLE_CLOCK_TEXT_SIZE];
+	char buffer[512];
+	(void)sample_clock_format(stamp->unixUs, sampleTime, sizeof(sampleTime));
+	sprintf(buffer, alertData, id, (event->kind == ANOMALY_RATE) ? "RateOfChange" : "ZScore",
+		(event->channel == EDGE_CHANNEL_TEMPERATURE) ? "Temperature" : "Humidity",
+		event->value, event->mean, event->zscore, event->rate, sampleTime,
+		series, (unsigned int)stamp->sequence, (unsigned int)stamp->epoch);
+	LOGGER_WARN("Sending anomaly alert: %s %zu\r\n", buffer, strlen(buffer));
+	sendMessage(iotHubClientHandle, buffer, strlen(buffer), ALERT_MESSAGE_TYPE, SEND_LANE_ALERT);
+}
+
+/* Feeds a reading to the detector, an anomaly is sent at once, ahead of the interval and any aggregation */
+static void CheckForAnomaly(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat, const char* series, const SAMPLE_STAMP* stamp, float tempC, float humidityPct)
+{
+	static ANOMALY_DETECTOR detector;
+	static int initialized;
+	double values[EDGE_CHANNEL_COUNT];
+	ANOMALY_EVENT event;
+
+	if (!initialized)
+	{
+		anomaly_detector_init(&detector, thermostat->Config.AnomalyZThreshold, thermostat->Config.AnomalyRatePerMinute);
+		initialized = 1;
+	}
+	/* new thresholds apply to the next sample, the learned baseline stays */
+	detector.zThreshold = thermostat->Config.AnomalyZThreshold;
+	detector.rateThreshold = thermostat->Config.AnomalyRatePerMinute;
+
+	values[EDGE_CHANNEL_TEMPERATURE] = tempC;
+	values[EDGE_CHANNEL_HUMIDITY] = humidityPct;
+	if (anomaly_detector_add(&detector, stamp->monotonicUs, values, &event))
+	{
+		SendAlert(iotHubClientHandle, g_config.deviceId, series, stamp, &event);
+		metrics_counter_add(METRIC_ANOMALY_ALERTS, 1);
+		metrics_histogram_observe(METRIC_ALERT_LATENCY, metrics_now_us() - stamp->monotonicUs);
+	}
+}
+
+/* Reads the sensor between two sends, only for the detector */
+static void WatchSensor(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat)
+{
+	float tempC;
+	float pressurePa;
+	float humidityPct;
+	SAMPLE_STAMP stamp;
+	int sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
+
+	sample_clock_stamp(&g_watchClock, &stamp);
+	if (sensorResult == 1)
+	{
+		tempC += g_config.temperatureOffsetC;
+		humidityPct += g_config.humidityOffsetPct;
+		reading_shm_publish(g_readingShm, &stamp, tempC, pressurePa + g_config.pressureOffsetPa, humidityPct);
+		CheckForAnomaly(iotHubClientHandle, thermostat, WATCH_SERIES, &stamp, tempC, humidityPct);
+	}
+}
+
+static int AnomalyDetectionEnabled(const Thermostat* thermostat)
+{
+	return thermostat->Config.AnomalyZThreshold > 0 || thermostat->Config.AnomalyRatePerMinute > 0;
+}
+
+/* Queues the messages a previous run could not get confirmed, as history on the bulk lane */
+static void ResendUnsent(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+{
+	static char line[UNSENT_LINE_SIZE];
+	char path[PATH_MAX];
+	size_t resent = 0;
+	FILE* fp;
+
+	if (UnsentPath(path, sizeof(path)) != 0)
+	{
+		LOGGER_WARN("The unsent file path next to %s is too long\r\n", configPath);
+	}
+	else if ((fp = fopen(path, "r")) != NULL)
+	{
+		while (fgets(line, sizeof(line), fp) != NULL)
+		{
+			char* body = strchr(line, '\t');
+
+			if (body != NULL)
+			{
+				*body++ = '\0';
+				body[strcspn(body, "\r\n")] = '\0';
+				if (strcmp(line, SAMPLE_BLOCK_MESSAGE_TYPE) == 0)
+				{
+					size_t size = strlen(body) / 2;
+					unsigned char* block = (unsigned char*)body;
+
+					/* decoded in place, each byte lands before the hex digits still to read */
+					for (size_t i = 0; i < size; i++)
+					{
+						unsigned int byte = 0;
+						(void)sscanf(&body[2 * i], "%2x", &byte);
+						block[i] = (unsigned char)byte;
+					}
+					sendMessage(iotHubClientHandle, block, size, SAMPLE_BLOCK_MESSAGE_TYPE, SEND_LANE_BULK);
+					resent++;
+				}
+				else
+				{
+					/* the context keeps the type pointer, only the known types survive the round trip; an old alert is still an alert */
+					int alert = (strcmp(line, ALERT_MESSAGE_TYPE) == 0);
+					sendMessage(iotHubClientHandle, (const unsigned char*)body, strlen(body),
+						alert ? ALERT_MESSAGE_TYPE : NULL, alert ? SEND_LANE_ALERT : SEND_LANE_BULK);
+					resent++;
+				}
+			}
+		}
+		fclose(fp);
+		(void)unlink(path);
+		LOGGER_INFO("Resent %zu messages left unsent by the previous run\r\n", resent);
+	}
+}
+
+/* Adds a reading to the window the twin asks for, sending a summary when it completes */
+static void AggregateSensorValues(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat, const SAMPLE_STAMP* stamp, float tempC, float humidityPct)
+{
+	static EDGE_AGGREGATE aggregate;
+	static int windowS;
+	static int hopS;
+	double values[EDGE_CHANNEL_COUNT];
+	EDGE_SUMMARY summary;
+
+	if (windowS != thermostat->Config.AggregationWindowS || hopS != thermostat->Config.AggregationHopS)
+	{
+		windowS = thermostat->Config.AggregationWindowS;
+		hopS = thermostat->Config.AggregationHopS;
+		edge_aggregate_init(&aggregate, (unsigned int)windowS * 1000, (unsigned int)hopS * 1000);
+	}
+
+	values[EDGE_CHANNEL_TEMPERATURE] = tempC;
+	values[EDGE_CHANNEL_HUMIDITY] = humidityPct;
+	if (edge_aggregate_add(&aggregate, stamp, values, &summary))
+	{
+		SendSummaryValues(iotHubClientHandle, g_config.deviceId, &summary);
+	}
+}
+
+/* Sends the readings collected so far as one sample block message */
+static void SendSampleBlock(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+{
+	size_t size = sample_block_finish(&g_sampleBlock);
+
+	if (size != 0)
+	{
+		LOGGER_INFO("Sending a block of %u samples in %zu bytes\r\n", (unsigned int)g_sampleBlock.count, size);
+		sendMessage(iotHubClientHandle, g_sampleBlock.buffer, size, SAMPLE_BLOCK_MESSAGE_TYPE, SEND_LANE_BULK);
+	}
+	mem_pool_free(g_sampleBlock.buffer);
+	g_sampleBlock.buffer = NULL;
+}
+
+/*
+ * Adds a reading to the sample block, or the raw frame when raw is not NULL,
+ * sending the block once it holds sampleBlockSamples readings
+ */
+static void BlockSensorValues(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const SAMPLE_STAMP* stamp, float tempC, float humidityPct, const bme280_raw_t* raw)
+{
+	uint64_t unixMs = stamp->unixUs / 1000ULL;
+	int added = 0;
+
+	/* a second attempt in a new block when the clock was stepped back */
+	for (int attempt = 0; attempt < 2 && !added; attempt++)
+	{
+		if (g_sampleBlock.buffer == NULL)
+		{
+			size_t capacity = SAMPLE_BLOCK_SIZE((size_t)sampleBlockSamples);
+			unsigned char* buffer = mem_pool_alloc(capacity);
+
+			if (buffer == NULL)
+			{
+				LOGGER_ERROR("unable to allocate a sample block\r\n");
+				metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+				break;
+			}
+			if (raw != NULL)
+			{
+				sample_block_begin_raw(&g_sampleBlock, buffer, capacity, SAMPLE_BLOCK_DEFAULT_TICK_MS);
+			}
+			else
+			{
+				sample_block_begin(&g_sampleBlock, buffer, capacity, SAMPLE_BLOCK_DEFAULT_TICK_MS);
+			}
+		}
+		if ((raw != NULL) ? sample_block_add_raw(&g_sampleBlock, unixMs, stamp->epoch, stamp->sequence, raw->adc_T, raw->adc_P, raw->adc_H) == 0 :
+			sample_block_add(&g_sampleBlock, unixMs, stamp->epoch, stamp->sequence, tempC, humidityPct) == 0)
+		{
+			added = 1;
+		}
+		else
+		{
+			SendSampleBlock(iotHubClientHandle);
+		}
+	}
+
+	if (g_sampleBlock.buffer != NULL && g_sampleBlock.count >= (unsigned int)sampleBlockSamples)
+	{
+		SendSampleBlock(iotHubClientHandle);
+	}
+}
+
+/* Adapts the interval to the last reading when the twin allows a range, returns it in milliseconds */
+static unsigned int NextTelemetryInterval(Thermostat* thermostat, ADAPTIVE_INTERVAL* adaptive, int sensorResult, float tempC, float humidityPct)
+{
+	static uint64_t lastReportUs;
+	static int reportedMs;
+	int minMs = thermostat->Config.TelemetryIntervalMinMs;
+	int maxMs = thermostat->Config.TelemetryIntervalMaxMs;
+	int intervalMs;
+
+	if (minMs >= maxMs)
+	{
+		intervalMs = minMs;
+	}
+	else if (sensorResult != 1)
+	{
+		/* a failed read says nothing about the trend, keep the pace */
+		intervalMs = (int)adaptive->intervalMs;
+	}
+	else
+	{
+		intervalMs = (int)adaptive_interval_next(adaptive, metrics_now_us(), tempC, humidityPct, (unsigned int)minMs, (unsigned int)maxMs);
+
+		/* Config reflects the adapted rate without a twin update per sample */
+		if (reportedMs == 0 ||
+			((intervalMs >= reportedMs * ADAPTED_INTERVAL_REPORT_FACTOR || intervalMs * ADAPTED_INTERVAL_REPORT_FACTOR <= reportedMs) &&
+				metrics_now_us() - lastReportUs >= ADAPTED_INTERVAL_REPORT_PERIOD_US))
+		{
+			SetIntervalReport(thermostat, intervalMs);
+			if (SendReportedState(thermostat) == IOTHUB_CLIENT_OK)
+			{
+				LOGGER_INFO("Telemetry interval adapted to %d ms\r\n", intervalMs);
+				reportedMs = intervalMs;
+				lastReportUs = metrics_now_us();
+			}
+		}
+	}
+
+	return (intervalMs > 0) ? (unsigned int)intervalMs : DEFAULT_TELEMETRY_INTERVAL_S * 1000;
+}
+
+/*
+ * The raw counterpart of SendTelemetryData: the ADC values go into the block
+ * as they are, the device only compensates them for the anomaly detector.
+ * Without readings the adaptive interval keeps its pace and the shared memory
+ * segment is not updated.
+ */
+static unsigned int SendRawTelemetryData(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat, ADAPTIVE_INTERVAL* adaptive)
+{
+	bme280_raw_t raw;
+	SAMPLE_STAMP stamp;
+
+	TRACE_BEGIN(cycleSpan, "telemetry_cycle");
+	int sensorResult = bme280_read_raw(&raw);
+	sample_clock_stamp(&g_sampleClock, &stamp);
+
+	if (sensorResult == 1)
+	{
+		LOGGER_DEBUG("Read Sensor Data: adc_T = %d adc_P = %d adc_H = %d\n", (int)raw.adc_T, (int)raw.adc_P, (int)raw.adc_H);
+		if (AnomalyDetectionEnabled(thermostat))
+		{
+			const bme280_calib_data_t* calibration = bme280_calibration();
+			int32_t tFine;
+			float tempC = bme280_compensate_T_int32(calibration, raw.adc_T, &tFine) / 100.0f + g_config.temperatureOffsetC;
+			float humidityPct = bme280_compensate_H_int32(calibration, raw.adc_H, tFine) / 1024.0f + g_config.humidityOffsetPct;
+
+			CheckForAnomaly(iotHubClientHandle, thermostat, TELEMETRY_SERIES, &stamp, tempC, humidityPct);
+		}
+		BlockSensorValues(iotHubClientHandle, &stamp, 0.0f, 0.0f, &raw);
+	}
+	else
+	{
+		LOGGER_WARN("Read Sensor Data Failed, the sample is left out of the block\n");
+	}
+	TRACE_END(cycleSpan);
+
+	return NextTelemetryInterval(thermostat, adaptive, 0, 0.0f, 0.0f);
+}
+
+/* Reads and sends one sample, returns the milliseconds until the next one */
+unsigned int SendTelemetryData(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat, ADAPTIVE_INTERVAL* adaptive)
+{
+	float tempC = -300.0;
+	float pressurePa = -300;
+	float humidityPct = -300;
+	SAMPLE_STAMP stamp;
+
+	TRACE_BEGIN(cycleSpan, "telemetry_cycle");
+	int sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
+	sample_clock_stamp(&g_sampleClock, &stamp);
+
+	if (sensorResult == 1)
+	{
+		tempC += g_config.temperatureOffsetC;
+		pressurePa += g_config.pressureOffsetPa;
+		humidityPct += g_config.humidityOffsetPct;
+		reading_shm_publish(g_readingShm, &stamp, tempC, pressurePa, humidityPct);
+		LOGGER_DEBUG("Read Sensor Data: Humidity = %.1f%% Temperature = %.1f*C \n",
+			humidityPct, tempC);
+		if (AnomalyDetectionEnabled(thermostat))
+		{
+			CheckForAnomaly(iotHubClientHandle, thermostat, TELEMETRY_SERIES, &stamp, tempC, humidityPct);
+		}
+	}
+	else
+	{
+		LOGGER_WARN("Read Sensor Data Failed, send simulated data Humidity = %.1f%% Temperature = %.1f*C \n", humidityPct, tempC);
+	}
+
+	if (thermostat->Config.AggregationWindowS > 0)
+	{
+		/* a failed read is left out of the window rather than sent as simulated data */
+		if (sensorResult == 1)
+		{
+			AggregateSensorValues(iotHubClientHandle, thermostat, &stamp, tempC, humidityPct);
+		}
+	}
+	else if (sampleBlockSamples > 0)
+	{
+		/* and out of the block */
+		if (sensorResult == 1)
+		{
+			BlockSensorValues(iotHubClientHandle, &stamp, tempC, humidityPct, NULL);
+		}
+	}
+	else
+	{
+		SendSensorValues(iotHubClientHandle, g_config.deviceId, &stamp, tempC, humidityPct);
+	}
+	TRACE_END(cycleSpan);
+
+	return NextTelemetryInterval(thermostat, adaptive, sensorResult, tempC, humidityPct);
+}
+
+static void OnShutdownSignal(int signalNumber)
+{
+	shutdownRequest = (signalNumber == SIGHUP) ? SHUTDOWN_RESTART : SHUTDOWN_STOP;
+}
+
+static int InstallShutdownHandlers(void)
+{
+	struct sigaction action;
+	int result = 0;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnShutdownSignal;
+	/* the SDK threads can take the signal too, their system calls should not fail with EINTR */
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGTERM, &action, NULL) != 0 || sigaction(SIGINT, &action, NULL) != 0 || sigaction(SIGHUP, &action, NULL) != 0)
+	{
+		perror("Installing the shutdown handlers failed");
+		result = __LINE__;
+	}
+
+	return result;
+}
+
+/*
+ * Sleeps until the metrics_now_us deadline, in slices that notice a shutdown
+ * request. Each slice ends at an absolute time, so the oversleep of one does
+ * not add up with the next.
+ */
+static void SleepUntilUnlessStopping(uint64_t deadlineUs)
+{
+	uint64_t nowUs;
+
+	while (shutdownRequest == SHUTDOWN_NONE && (nowUs = metrics_now_us()) < deadlineUs)
+	{
+		uint64_t sliceEndUs = (deadlineUs - nowUs > SHUTDOWN_POLL_MS * 1000ULL) ? nowUs + SHUTDOWN_POLL_MS * 1000ULL : deadlineUs;
+		struct timespec until;
+
+		until.tv_sec = (time_t)(sliceEndUs / 1000000ULL);
+		until.tv_nsec = (long)(sliceEndUs % 1000000ULL) * 1000L;
+		(void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+	}
+}
+
+/* Once the other threads run, which keep the normal scheduler and all cores */
+static void StartRealtimeSampling(void)
+{
+	if (realtime_apply(&g_realtime) != 0)
+	{
+		printf("Continuing without some of the sampler's scheduling options\n");
+	}
+}
+
+/* The command line wins over the store */
+static void ResolveConnectionOptions(CONNECTION_OPTIONS* options)
+{
+	options->sasTokenLifetimeS = (sasTokenLifetimeS > 0) ? (unsigned int)sasTokenLifetimeS :
+		(g_config.sasTokenLifetimeS != 0) ? g_config.sasTokenLifetimeS : CONNECTION_DEFAULT_SAS_TOKEN_LIFETIME_S;
+	options->retryTimeoutS = (retryTimeoutS >= 0) ? (unsigned int)retryTimeoutS :
+		(g_config.retryTimeoutS != 0) ? g_config.retryTimeoutS : CONNECTION_DEFAULT_RETRY_TIMEOUT_S;
+}
+
+/* The command line wins over the store, NULL when the name is not built in */
+static const TRANSPORT* ResolveTransport(void)
+{
+	const char* name = (transportName != NULL) ? transportName : g_config.transport;
+
+	return (name[0] != '\0') ? transport_find(name) : transport_default();
+}
+
+void remote_monitoring_run(void)
+{
+	/* created by the thread remote_monitoring_init started, the platform setup and connect overlapped the sensor setup */
+	IOTHUB_CLIENT_HANDLE iotHubClientHandle = connection_wait(&g_connection);
+	g_iotHubClientHandle = iotHubClientHandle;
+
+	if (iotHubClientHandle == NULL)
+	{
+		printf("No IoT Hub client to run with.\n");
+	}
+	else
+	{
+		if (SERIALIZER_REGISTER_NAMESPACE(Contoso) == NULL)
+		{
+			printf("Unable to SERIALIZER_REGISTER_NAMESPACE\n");
+		}
+		else
+		{
+#ifdef MBED_BUILD_TIMESTAMP
+			// For mbed add the certificate information
+			if (IoTHubClient_SetOption(iotHubClientHandle, "TrustedCerts", certificates) != IOTHUB_CLIENT_OK)
+			{
+				printf("Failed to set option \"TrustedCerts\"\n");
+			}
+#endif // MBED_BUILD_TIMESTAMP
+			if (transport_configure(iotHubClientHandle, g_transport) != 0)
+			{
+				printf("Failed to set the %s transport options\n", g_transport->name);
+			}
+			/* HTTP has neither the twin nor direct methods, the settings come from the store alone */
+			Thermostat* thermostat = g_transport->hasTwin ? IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle) :
+				CREATE_MODEL_INSTANCE(Contoso, Thermostat);
+			if (thermostat == NULL)
+			{
+				printf("Failure creating the thermostat over %s\n", g_transport->name);
+			}
+			else
+			{
+				/* the cached interval applies before the twin arrives, its callback only sees changes */
+				LoadDesiredInterval(thermostat);
+				(void)ApplyDesiredInterval(thermostat);
+				(void)ApplyDesiredAggregation(thermostat);
+				(void)ApplyDesiredAnomaly(thermostat);
+				g_persistedThermostat = thermostat;
+
+				/* Set values for reported properties */
+				thermostat->System.FirmwareVersion = "1.0";
+				/* Specify the signatures of the supported direct methods */
+				thermostat->SupportedMethods = supportedMethod;
+
+				/* Send reported properties to IoT Hub */
+				if (g_transport->hasTwin && SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
+				{
+					printf("Failed sending serialized reported state\n");
+				}
+				else
+				{
+					UpdateFirmwareComplete();
+					if (sampleBlockRaw > 0 && sampleBlockSamples > 0)
+					{
+						SendCalibrationReport();
+					}
+
+					/* a restarted process is the same device, the solution already has its DeviceInfo */
+					if (getenv(RESTART_ENV) == NULL)
+					{
+						printf("Send DeviceInfo object to IoT Hub at startup\n");
+						SendDeviceInfo(iotHubClientHandle, g_config.deviceId);
+					}
+					unsetenv(RESTART_ENV);
+					ResendUnsent(iotHubClientHandle);
+
+					StartRealtimeSampling();
+					/* from here on the pools serve the application, what still allocates is the SDK's */
+					alloc_debug_seal();
+					uint64_t lastMetricsReportUs = metrics_now_us();
+					uint64_t nextSendUs = 0;
+					ADAPTIVE_INTERVAL adaptive;
+					adaptive_interval_init(&adaptive, (unsigned int)thermostat->Config.TelemetryIntervalMs);
+
+					while (!sensor_trace_replay_finished() && shutdownRequest == SHUTDOWN_NONE)
+					{
+						uint64_t nowUs = metrics_now_us();
+
+						if (nowUs >= nextSendUs)
+						{
+							/* an aggregation window needs readings, it takes precedence over raw blocks too */
+							unsigned int intervalMs = (sampleBlockRaw > 0 && sampleBlockSamples > 0 && thermostat->Config.AggregationWindowS <= 0) ?
+								SendRawTelemetryData(iotHubClientHandle, thermostat, &adaptive) :
+								SendTelemetryData(iotHubClientHandle, thermostat, &adaptive);
+
+							/* a replay is paced by the capture itself, every record is a send */
+							nextSendUs = sensor_trace_replaying() ? 0 : metrics_now_us() + intervalMs * 1000ULL;
+							ReportClockStep();
+							if (metrics_now_us() - lastMetricsReportUs >= METRICS_REPORT_INTERVAL_US)
+							{
+								SendMetricsReport();
+								lastMetricsReportUs = metrics_now_us();
+							}
+						}
+						else if (AnomalyDetectionEnabled(thermostat))
+						{
+							/* a spike cannot wait for the next send, the detector samples in between */
+							WatchSensor(iotHubClientHandle, thermostat);
+						}
+
+						nowUs = metrics_now_us();
+						if (nextSendUs > nowUs)
+						{
+							uint64_t wakeUs = nextSendUs;
+							uint64_t anomalySampleUs = (uint64_t)thermostat->Config.AnomalySampleMs * 1000ULL;
+
+							if (AnomalyDetectionEnabled(thermostat) && wakeUs - nowUs > anomalySampleUs)
+							{
+								wakeUs = nowUs + anomalySampleUs;
+							}
+							SleepUntilUnlessStopping(wakeUs);
+							/* how late the next read starts, what other work on the Pi costs the sampler */
+							if (shutdownRequest == SHUTDOWN_NONE)
+							{
+								metrics_histogram_observe(METRIC_SAMPLE_WAKE_LATENCY, metrics_now_us() - wakeUs);
+							}
+						}
+					}
+
+					/* a partial block goes out with the rest */
+					if (g_sampleBlock.buffer != NULL)
+					{
+						SendSampleBlock(iotHubClientHandle);
+					}
+					/* what the hub has not confirmed by the deadline is kept for the next start */
+					size_t unconfirmed = WaitForConfirmations(SHUTDOWN_FLUSH_DEADLINE_MS);
+					StopSendDispatcher();
+					if (unconfirmed > 0)
+					{
+						PersistUnsent();
+					}
+				}
+				if (g_transport->hasTwin)
+				{
+					IoTHubDeviceTwin_DestroyThermostat(thermostat);
+				}
+				else
+				{
+					DESTROY_MODEL_INSTANCE(thermostat);
+				}
+			}
+			serializer_deinit();
+		}
+	}
+	connection_stop(&g_connection);
+}
+
+int remote_monitoring_init(void)
+{
+	int result;
+
+	Lock_fd = open_lockfile(LOCKFILE);
+
+	if (setuid(getuid()) < 0)
+	{
+		perror("Dropping privileges failed. (did you use sudo?)n");
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		CONNECTION_OPTIONS options;
+
+		/* the lock is held, no other instance can connect as this device */
+		ResolveConnectionOptions(&options);
+		if ((g_transport = ResolveTransport()) == NULL)
+		{
+			printf("Transport %s is not built in\n", (transportName != NULL) ? transportName : g_config.transport);
+			result = EXIT_FAILURE;
+		}
+		else if (connection_start(&g_connection, g_config.connectionString, g_transport->protocol, &options) != 0)
+		{
+			result = EXIT_FAILURE;
+		}
+		else
+		{
+			/* a replay serves every sensor read from the capture, the SPI bus is not touched */
+			result = sensor_trace_replaying() ? 0 : wiringPiSetup();
+			if (result != 0)
+			{
+				perror("Wiring Pi setup failed.");
+			}
+			else
+			{
+				result = sensor_trace_replaying() ? 0 : wiringPiSPISetup(Spi_channel, Spi_clock);
+				if (result < 0)
+				{
+					printf("Can't setup SPI, error %i calling wiringPiSPISetup(%i, %i)  %sn",
+						result, Spi_channel, Spi_clock, strerror(result));
+				}
+				else
+				{
+					int sensorResult = bme280_init(Spi_channel);
+					if (sensorResult != 1)
+					{
+						printf("It appears that no BMP280 module on Chip Enable %i is attached. Aborting.\n", Spi_channel);
+						result = 1;
+					}
+					else
+					{
+						// Read the Temp & Pressure module.
+						float tempC = -300.0;
+						float pressurePa = -300;
+						float humidityPct = -300;
+						sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
+						if (sensorResult == 1)
+						{
+							printf("Temperature = %.1f *C  Pressure = %.1f Pa  Humidity = %1f %%\n",
+								tempC, pressurePa, humidityPct);
+							result = 0;
+						}
+						else
+						{
+							printf("Unable to read BME280 on pin %i. Aborting.\n", Spi_channel);
+							result = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+	return result;
+}
+
+/*
+ * Gateway mode: one process publishes several sensors as distinct device
+ * identities. All identities share a single AMQP transport (the MQTT
+ * transport cannot carry more than one device per connection), so there is
+ * one TLS session and one worker thread for the whole gateway.
+ */
+#define GATEWAY_MAX_IDENTITIES 32
+#define GATEWAY_POLL_MS 100
+/* remote readings older than this many telemetry intervals are not sent */
+#define GATEWAY_STALE_INTERVALS 3
+
+typedef struct GATEWAY_IDENTITY_TAG
+{
+	char deviceId[129];
+	char deviceKey[128];
+	/* SPI chip enable of a local BME280, -1 for a remote sensor */
+	int chipEnable;
+	char remoteName[REMOTE_SENSOR_NAME_MAX];
+	bme280_device_t sensor;
+	IOTHUB_CLIENT_HANDLE clientHandle;
+	CONNECTION connection;
+	Thermostat* thermostat;
+	float tempC;
+	float humidityPct;
+	/* numbers the identity's readings, the stamp is the latest one's */
+	SAMPLE_CLOCK clock;
+	SAMPLE_STAMP stamp;
+	time_t lastReading;
+	time_t nextSend;
+	/* READING_SHM_DEFAULT_NAME-<device id> */
+	char readingName[sizeof(READING_SHM_DEFAULT_NAME) + 130];
+	READING_SHM* reading;
+} GATEWAY_IDENTITY;
+
+typedef struct GATEWAY_TAG
+{
+	char hubName[128];
+	char hubSuffix[128];
+	char udpAddress[64];
+	unsigned short udpPort;
+	int udpFd;
+	TRANSPORT_HANDLE transport;
+	CONNECTION_OPTIONS connectionOptions;
+	GATEWAY_IDENTITY identities[GATEWAY_MAX_IDENTITIES];
+	size_t identityCount;
+} GATEWAY;
+
+static GATEWAY g_gateway;
+
+/*
+ * HostName=<hub>.<suffix>
+ * udp <address> <port>
+ * device <device id> <device key> spi:<chip enable>|udp:<sensor name>
+ */
+int LoadGatewayConfig(const char* path, GATEWAY* gateway)
+{
+	int result = 0;
+	FILE* fp;
+
+	memset(gateway, 0, sizeof(*gateway));
+	gateway->udpFd = -1;
+
+	if (NULL == (fp = fopen(path, "r")))
+	{
+		printf("Failed to open gateway config %s\r\n", path);
+		result = __LINE__;
+	}
+	else
+	{
+		char line[512];
+		int lineNumber = 0;
+
+		while (result == 0 && fgets(line, sizeof(line), fp) != NULL)
+		{
+			char hostName[256];
+			char source[64];
+			unsigned int port;
+			GATEWAY_IDENTITY* identity = &gateway->identities[gateway->identityCount];
+
+			lineNumber++;
+			if (line[0] == '#' || line[0] == '\r' || line[0] == '\n')
+			{
+				continue;
+			}
+
+			if (sscanf(line, "HostName=%255s", hostName) == 1)
+			{
+				char* dot = strchr(hostName, '.');
+				if (dot == NULL || (size_t)(dot - hostName) >= sizeof(gateway->hubName) || strlen(dot + 1) >= sizeof(gateway->hubSuffix))
+				{
+					result = __LINE__;
+				}
+				else
+				{
+					*dot = '\0';
+					strcpy(gateway->hubName, hostName);
+					strcpy(gateway->hubSuffix, dot + 1);
+				}
+			}
+			else if (sscanf(line, "udp %63s %u", gateway->udpAddress, &port) == 2 && port > 0 && port <= 65535)
+			{
+				gateway->udpPort = (unsigned short)port;
+			}
+			else if (gateway->identityCount < GATEWAY_MAX_IDENTITIES &&
+				sscanf(line, "device %128s %127s %63s", identity->deviceId, identity->deviceKey, source) == 3)
+			{
+				identity->chipEnable = -1;
+				if (sscanf(source, "spi:%d", &identity->chipEnable) == 1 ||
+					sscanf(source, "udp:%31s", identity->remoteName) == 1)
+				{
+					gateway->identityCount++;
+				}
+				else
+				{
+					result = __LINE__;
+				}
+			}
+			else
+			{
+				result = __LINE__;
+			}
+
+			if (result != 0)
+			{
+				printf("Invalid gateway config line %d: %s\r\n", lineNumber, line);
+			}
+		}
+
+		fclose(fp);
+
+		if (result == 0 && (gateway->hubName[0] == '\0' || gateway->identityCount == 0))
+		{
+			printf("Gateway config needs a HostName and at least one device\r\n");
+			result = __LINE__;
+		}
+	}
+
+	return result;
+}
+
+int remote_monitoring_gateway_init(GATEWAY* gateway)
+{
+	int result;
+
+	Lock_fd = open_lockfile(LOCKFILE);
+
+	if (setuid(getuid()) < 0)
+	{
+		perror("Dropping privileges failed. (did you use sudo?)n");
+		result = EXIT_FAILURE;
+	}
+	else if (!sensor_trace_replaying() && (result = wiringPiSetup()) != 0)
+	{
+		perror("Wiring Pi setup failed.");
+	}
+	else
+	{
+		int spiReady[2] = { 0, 0 };
+
+		for (size_t i = 0; i < gateway->identityCount && result == 0; i++)
+		{
+			GATEWAY_IDENTITY* identity = &gateway->identities[i];
+
+			if (identity->chipEnable < 0)
+			{
+				if (gateway->udpFd < 0 && gateway->udpPort == 0)
+				{
+					printf("Device %s uses a remote sensor but no udp endpoint is configured\r\n", identity->deviceId);
+					result = 1;
+				}
+				else if (gateway->udpFd < 0 && (gateway->udpFd = remote_sensor_open(gateway->udpAddress, gateway->udpPort)) < 0)
+				{
+					result = 1;
+				}
+			}
+			else if (identity->chipEnable > 1)
+			{
+				printf("Device %s: chip enable %i does not exist\r\n", identity->deviceId, identity->chipEnable);
+				result = 1;
+			}
+			else if (!spiReady[identity->chipEnable] && !sensor_trace_replaying() && wiringPiSPISetup(identity->chipEnable, Spi_clock) < 0)
 			{
-				printf("Failure in IoTHubClient_CreateFromConnectionString\n");
+				printf("Can't setup SPI on chip enable %i\r\n", identity->chipEnable);
+				result = 1;
 			}
 			else
 			{
-#ifdef MBED_BUILD_TIMESTAMP
-				// For mbed add the certificate information
-				if (IoTHubClient_SetOption(iotHubClientHandle, "TrustedCerts", certificates) != IOTHUB_CLIENT_OK)
+				spiReady[identity->chipEnable] = 1;
+				if (bme280_init_device(&identity->sensor, identity->chipEnable) != 1)
 				{
-					printf("Failed to set option \"TrustedCerts\"\n");
+					printf("It appears that no BMP280 module on Chip Enable %i is attached. Aborting.\n", identity->chipEnable);
+					result = 1;
 				}
-#endif // MBED_BUILD_TIMESTAMP
-				Thermostat* thermostat = IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle);
-				if (thermostat == NULL)
+			}
+		}
+	}
+
+	return result;
+}
+
+static void OnRemoteReading(const char* sensorName, float tempC, float pressurePa, float humidityPct, void* context)
+{
+	GATEWAY* gateway = context;
+
+	for (size_t i = 0; i < gateway->identityCount; i++)
+	{
+		GATEWAY_IDENTITY* identity = &gateway->identities[i];
+		if (identity->chipEnable < 0 && strcmp(identity->remoteName, sensorName) == 0)
+		{
+			/* the remote sensor sends no time, the reading is stamped on arrival */
+			sample_clock_stamp(&identity->clock, &identity->stamp);
+			identity->tempC = tempC;
+			identity->humidityPct = humidityPct;
+			time(&identity->lastReading);
+			reading_shm_publish(identity->reading, &identity->stamp, tempC, pressurePa, humidityPct);
+		}
+	}
+}
+
+static int ConnectGatewayIdentity(GATEWAY* gateway, GATEWAY_IDENTITY* identity)
+{
+	int result;
+	IOTHUB_CLIENT_CONFIG clientConfig;
+
+	memset(&clientConfig, 0, sizeof(clientConfig));
+	clientConfig.protocol = AMQP_Protocol;
+	clientConfig.deviceId = identity->deviceId;
+	clientConfig.deviceKey = identity->deviceKey;
+	clientConfig.iotHubName = gateway->hubName;
+	clientConfig.iotHubSuffix = gateway->hubSuffix;
+
+	if ((identity->clientHandle = IoTHubClient_CreateWithTransport(gateway->transport, &clientConfig)) == NULL)
+	{
+		printf("Failure in IoTHubClient_CreateWithTransport for %s\n", identity->deviceId);
+		result = __LINE__;
+	}
+	else if (connection_configure(&identity->connection, identity->clientHandle, &gateway->connectionOptions) != 0)
+	{
+		printf("Failure in connection_configure for %s\n", identity->deviceId);
+		result = __LINE__;
+	}
+	else if ((identity->thermostat = IoTHubDeviceTwin_CreateThermostat(identity->clientHandle)) == NULL)
+	{
+		printf("Failure in IoTHubDeviceTwin_CreateThermostat for %s\n", identity->deviceId);
+		result = __LINE__;
+	}
+	else
+	{
+		/* the cached interval belongs to the gateway's own device, the first identity */
+		LoadDesiredInterval(identity->thermostat);
+		(void)ApplyDesiredInterval(identity->thermostat);
+		if (identity == &gateway->identities[0])
+		{
+			g_persistedThermostat = identity->thermostat;
+		}
+
+		/* Set values for reported properties */
+		identity->thermostat->System.FirmwareVersion = "1.0";
+		/* Specify the signatures of the supported direct methods */
+		identity->thermostat->SupportedMethods = supportedMethod;
+
+		if (SendReportedState(identity->thermostat) != IOTHUB_CLIENT_OK)
+		{
+			printf("Failed sending serialized reported state for %s\n", identity->deviceId);
+		}
+		SendDeviceInfo(identity->clientHandle, identity->deviceId);
+		result = 0;
+	}
+
+	return result;
+}
+
+static void SendGatewayTelemetry(GATEWAY_IDENTITY* identity, time_t now)
+{
+	/* the gateway schedules in whole seconds and does not adapt, it follows the slow end of a range */
+	unsigned int interval = (unsigned int)(identity->thermostat->Config.TelemetryIntervalMaxMs + 999) / 1000;
+	TRACE_BEGIN(cycleSpan, "gateway_telemetry_cycle");
+
+	if (identity->chipEnable >= 0)
+	{
+		float tempC;
+		float pressurePa;
+		float humidityPct;
+		SAMPLE_STAMP stamp;
+		int sensorResult = bme280_read_device(&identity->sensor, &tempC, &pressurePa, &humidityPct);
+
+		/* a failed read keeps the previous reading and its stamp */
+		sample_clock_stamp(&identity->clock, &stamp);
+		if (sensorResult == 1)
+		{
+			identity->tempC = tempC;
+			identity->humidityPct = humidityPct;
+			identity->stamp = stamp;
+			identity->lastReading = now;
+			reading_shm_publish(identity->reading, &stamp, tempC, pressurePa, humidityPct);
+		}
+	}
+
+	if (identity->lastReading == 0 || now - identity->lastReading > (time_t)(GATEWAY_STALE_INTERVALS * interval))
+	{
+		LOGGER_WARN("No recent reading for %s, skipping telemetry\r\n", identity->deviceId);
+	}
+	else
+	{
+		SendSensorValues(identity->clientHandle, identity->deviceId, &identity->stamp, identity->tempC, identity->humidityPct);
+	}
+
+	identity->nextSend = now + interval;
+	TRACE_END(cycleSpan);
+}
+
+void remote_monitoring_gateway_run(GATEWAY* gateway)
+{
+	if (platform_init() != 0)
+	{
+		printf("Failed to initialize the platform.\n");
+	}
+	else
+	{
+		if (SERIALIZER_REGISTER_NAMESPACE(Contoso) == NULL)
+		{
+			printf("Unable to SERIALIZER_REGISTER_NAMESPACE\n");
+		}
+		else if ((gateway->transport = IoTHubTransport_Create(AMQP_Protocol, gateway->hubName, gateway->hubSuffix)) == NULL)
+		{
+			printf("Failure in IoTHubTransport_Create\n");
+		}
+		else
+		{
+			size_t connected = 0;
+
+			ResolveConnectionOptions(&gateway->connectionOptions);
+			for (size_t i = 0; i < gateway->identityCount; i++)
+			{
+				if (ConnectGatewayIdentity(gateway, &gateway->identities[i]) == 0)
 				{
-					printf("Failure in IoTHubDeviceTwin_CreateThermostat\n");
+					connected++;
 				}
-				else
+			}
+
+			if (connected != gateway->identityCount)
+			{
+				printf("Only %zu of %zu gateway identities connected, stopping\r\n", connected, gateway->identityCount);
+			}
+			else
+			{
+				for (size_t i = 0; i < gateway->identityCount; i++)
+				{
+					GATEWAY_IDENTITY* identity = &gateway->identities[i];
+					(void)snprintf(identity->readingName, sizeof(identity->readingName), READING_SHM_DEFAULT_NAME "-%s", identity->deviceId);
+					identity->reading = reading_shm_create(identity->readingName);
+				}
+
+				/* firmware update reports go through the first identity, the gateway itself */
+				g_iotHubClientHandle = gateway->identities[0].clientHandle;
+				UpdateFirmwareComplete();
+
+				StartRealtimeSampling();
+				alloc_debug_seal();
+				uint64_t lastMetricsReportUs = metrics_now_us();
+
+				while (!sensor_trace_replay_finished() && shutdownRequest == SHUTDOWN_NONE)
 				{
-					/* Set values for reported properties */
-					thermostat->Config.TelemetryInterval = 3;
-					thermostat->System.FirmwareVersion = "1.0";
-					/* Specify the signatures of the supported direct methods */
-					thermostat->SupportedMethods = supportedMethod;
-
-					/* Send reported properties to IoT Hub */
-					if (IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
+					time_t now;
+					time(&now);
+
+					/* the metrics cover the whole gateway and are reported by its own identity */
+					if (metrics_now_us() - lastMetricsReportUs >= METRICS_REPORT_INTERVAL_US)
 					{
-						printf("Failed sending serialized reported state\n");
+						SendMetricsReport();
+						lastMetricsReportUs = metrics_now_us();
 					}
-					else
-					{
-						UpdateFirmwareComplete();
-						printf("Send DeviceInfo object to IoT Hub at startup\n");
+					ReportClockStep();
 
-						SendDeviceInfo(iotHubClientHandle);
-						
-						/* set default telemetry interval */
-						thermostat->TelemetryInterval = 3;
-
-						while (1)
+					for (size_t i = 0; i < gateway->identityCount; i++)
+					{
+						if (now >= gateway->identities[i].nextSend)
 						{
-							SendTelemetryData(iotHubClientHandle);
-
-							ThreadAPI_Sleep(thermostat->TelemetryInterval * 1000);
+							SendGatewayTelemetry(&gateway->identities[i], now);
 						}
+					}
 
-						IoTHubDeviceTwin_DestroyThermostat(thermostat);
+					if (gateway->udpFd >= 0)
+					{
+						remote_sensor_poll(gateway->udpFd, GATEWAY_POLL_MS, OnRemoteReading, gateway);
+					}
+					else
+					{
+						ThreadAPI_Sleep(GATEWAY_POLL_MS);
 					}
 				}
-				IoTHubClient_Destroy(iotHubClientHandle);
+
+				/* the identities share no unsent file, what misses the deadline is dropped */
+				size_t unconfirmed = WaitForConfirmations(SHUTDOWN_FLUSH_DEADLINE_MS);
+				StopSendDispatcher();
+				if (unconfirmed > 0)
+				{
+					printf("Dropping %zu unconfirmed gateway messages\r\n", unconfirmed);
+				}
 			}
-			serializer_deinit();
+
+			for (size_t i = 0; i < gateway->identityCount; i++)
+			{
+				reading_shm_destroy(gateway->identities[i].reading, gateway->identities[i].readingName);
+				gateway->identities[i].reading = NULL;
+				if (gateway->identities[i].thermostat != NULL)
+				{
+					IoTHubDeviceTwin_DestroyThermostat(gateway->identities[i].thermostat);
+				}
+				if (gateway->identities[i].clientHandle != NULL)
+				{
+					IoTHubClient_Destroy(gateway->identities[i].clientHandle);
+				}
+			}
+			IoTHubTransport_Destroy(gateway->transport);
 		}
+		serializer_deinit();
 	}
 	platform_deinit();
+	remote_sensor_close(gateway->udpFd);
 }
 
-int remote_monitoring_init(void)
+int main(int argc, char** argv)
 {
-	int result;
+	int result = 0;
+	const char* gatewayConfig = NULL;
+	const char* sensorCapturePath = NULL;
+	const char* sensorReplayPath = NULL;
+
+	send_lanes_defaults(g_laneConfigs);
+	realtime_defaults(&g_realtime);
+	for (int i = 1; i < argc && result == 0; i += 2)
+	{
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
 
-	Lock_fd = open_lockfile(LOCKFILE);
+		if (value == NULL)
+		{
+			result = __LINE__;
+		}
+		else if (strcmp(argv[i], "--gateway") == 0)
+		{
+			gatewayConfig = value;
+		}
+		else if (strcmp(argv[i], "--metrics-port") == 0)
+		{
+			metricsPort = (int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--sas-token-lifetime") == 0)
+		{
+			sasTokenLifetimeS = (int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--retry-timeout") == 0)
+		{
+			retryTimeoutS = (int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--transport") == 0)
+		{
+			transportName = value;
+		}
+		else if (strcmp(argv[i], "--compress-threshold") == 0)
+		{
+			compressThresholdBytes = (int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--sample-block") == 0)
+		{
+			sampleBlockSamples = (int)strtoul(value, NULL, 10);
+			if (sampleBlockSamples > SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--lane") == 0)
+		{
+			if (send_lanes_parse(value, g_laneConfigs) != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--sample-block-format") == 0)
+		{
+			if (strcmp(value, "raw") == 0)
+			{
+				sampleBlockRaw = 1;
+			}
+			else if (strcmp(value, "readings") == 0)
+			{
+				sampleBlockRaw = 0;
+			}
+			else
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--sampler-cpu") == 0)
+		{
+			g_realtime.cpu = (int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--sampler-priority") == 0)
+		{
+			g_realtime.priority = (int)strtoul(value, NULL, 10);
+			if (g_realtime.priority > REALTIME_MAX_PRIORITY)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--lock-memory") == 0)
+		{
+			if (strcmp(value, "on") == 0)
+			{
+				g_realtime.lockMemory = 1;
+			}
+			else if (strcmp(value, "off") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--alloc-check") == 0)
+		{
+			if (strcmp(value, "on") == 0)
+			{
+				allocCheck = 1;
+			}
+			else if (strcmp(value, "off") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--log-level") == 0)
+		{
+			if ((logger_level = logger_parse_level(value)) < 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--log-mode") == 0)
+		{
+			if (strcmp(value, "deferred") == 0)
+			{
+				logMode = LOGGER_FORMAT_DEFERRED;
+			}
+			else if (strcmp(value, "eager") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--config") == 0)
+		{
+			configPath = value;
+		}
+		else if (strcmp(argv[i], "--capture-sensor") == 0)
+		{
+			sensorCapturePath = value;
+		}
+		else if (strcmp(argv[i], "--replay-sensor") == 0)
+		{
+			sensorReplayPath = value;
+		}
+		else if (strcmp(argv[i], "--replay-pace") == 0)
+		{
+			if (strcmp(value, "max") == 0)
+			{
+				sensorReplayPace = SENSOR_REPLAY_MAX_SPEED;
+			}
+			else if (strcmp(value, "realtime") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
 
-	if (setuid(getuid()) < 0)
+	if (result == 0 && sensorCapturePath != NULL && sensorReplayPath != NULL)
 	{
-		perror("Dropping privileges failed. (did you use sudo?)n");
+		printf("--capture-sensor and --replay-sensor cannot be combined\n");
+		result = __LINE__;
+	}
+
+	if (result != 0)
+	{
+		printf("usage: %s [--config <store, default $" CONFIG_STORE_ENV " or " CONFIG_STORE_DEFAULT_PATH ">]\n"
+			"       [--gateway <gateway config>] [--metrics-port <port, 0 disables, default %u>]\n"
+			"       [--sas-token-lifetime <s, default %u>] [--retry-timeout <s, 0 retries forever>]\n"
+			"       [--transport mqtt|mqtt-ws|amqp|amqp-ws|http|http-batch, default mqtt, http sends telemetry only]\n"
+			"       [--compress-threshold <bytes, 0 disables, suggested %u>] [--sample-block <readings, up to %u, 0 sends JSON>]\n"
+			"       [--sample-block-format readings|raw]\n"
+			"       [--lane alert|telemetry|bulk|diagnostics,<weight>,<in flight>,<queued>,<timeout ms>,at-least-once|best-effort[,<attempts>]]...\n"
+			"       [--sampler-cpu <core>] [--sampler-priority <1-%u, 0 keeps the normal scheduler>] [--lock-memory on|off]\n"
+			"       [--log-level error|warn|info|debug] [--log-mode eager|deferred] [--alloc-check on|off]\n"
+			"       [--capture-sensor <file>] [--replay-sensor <file>] [--replay-pace realtime|max]\n",
+			argv[0], METRICS_DEFAULT_PORT, CONNECTION_DEFAULT_SAS_TOKEN_LIFETIME_S, PAYLOAD_COMPRESS_SUGGESTED_THRESHOLD,
+			SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES, REALTIME_MAX_PRIORITY);
 		result = EXIT_FAILURE;
 	}
 	else
 	{
-		result = wiringPiSetup();
-		if (result != 0)
+		(void)logger_start(logMode, LOGGER_DEFAULT_RATE_LIMIT);
+		(void)trace_init(TRACE_DEFAULT_PATH_PREFIX);
+
+		if (alloc_debug_init(allocCheck) != 0 || InstallShutdownHandlers() != 0 || LoadConfig() != 0 || StartSendDispatcher() != 0)
+		{
+			result = EXIT_FAILURE;
+		}
+		else if ((sensorReplayPath != NULL && sensor_trace_replay_open(sensorReplayPath, sensorReplayPace) != 0) ||
+			(sensorCapturePath != NULL && sensor_trace_capture_start(sensorCapturePath) != 0))
 		{
-			perror("Wiring Pi setup failed.");
+			result = EXIT_FAILURE;
 		}
 		else
 		{
-			result = wiringPiSPISetup(Spi_channel, Spi_clock);
-			if (result < 0)
+			/* the command line wins over the store */
+			if (metricsPort < 0)
 			{
-				printf("Can't setup SPI, error %i calling wiringPiSPISetup(%i, %i)  %sn",
-					result, Spi_channel, Spi_clock, strerror(result));
+				metricsPort = (g_config.metricsPort != 0) ? g_config.metricsPort : METRICS_DEFAULT_PORT;
 			}
-			else
+			if (metricsPort != 0 && metrics_server_start((unsigned short)metricsPort) != 0)
+			{
+				printf("Continuing without the metrics endpoint\n");
+			}
+			if (compressThresholdBytes < 0)
+			{
+				compressThresholdBytes = (int)g_config.compressThresholdBytes;
+			}
+			if (compressThresholdBytes > 0 && payload_compress_init(PAYLOAD_COMPRESS_DEFAULT_LEVEL) != 0)
+			{
+				printf("Continuing without message compression\n");
+				compressThresholdBytes = 0;
+			}
+			if (sampleBlockSamples < 0)
+			{
+				sampleBlockSamples = (g_config.sampleBlockSamples <= SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES) ? (int)g_config.sampleBlockSamples : SAMPLE_BLOCK_UPLOAD_MAX_SAMPLES;
+			}
+			if (sampleBlockRaw < 0)
+			{
+				sampleBlockRaw = (g_config.sampleBlockRaw != 0);
+			}
+			StartMemoryPools();
+
+			if (gatewayConfig != NULL)
 			{
-				int sensorResult = bme280_init(Spi_channel);
-				if (sensorResult != 1)
+				if ((result = LoadGatewayConfig(gatewayConfig, &g_gateway)) == 0 &&
+					(result = remote_monitoring_gateway_init(&g_gateway)) == 0)
 				{
-					printf("It appears that no BMP280 module on Chip Enable %i is attached. Aborting.\n", Spi_channel);
-					result = 1;
+					remote_monitoring_gateway_run(&g_gateway);
 				}
-				else
+			}
+			else if (g_config.deviceId[0] == '\0' || g_config.connectionString[0] == '\0')
+			{
+				printf("No device id and connection string in %s, fill in config/deviceinfo and remove the store to import it\n", configPath);
+				result = EXIT_FAILURE;
+			}
+			else
+			{
+				result = remote_monitoring_init();
+				if (result == 0)
 				{
-					// Read the Temp & Pressure module.
-					float tempC = -300.0;
-					float pressurePa = -300;
-					float humidityPct = -300;
-					sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
-					if (sensorResult == 1)
-					{
-						printf("Temperature = %.1f *C  Pressure = %.1f Pa  Humidity = %1f %%\n",
-							tempC, pressurePa, humidityPct);
-						result = 0;
-					}
-					else
+					if ((g_readingShm = reading_shm_create(READING_SHM_DEFAULT_NAME)) == NULL)
 					{
-						printf("Unable to read BME280 on pin %i. Aborting.\n", Spi_channel);
-						result = 1;
+						printf("Continuing without publishing readings in shared memory\n");
 					}
+					remote_monitoring_run();
+					reading_shm_destroy(g_readingShm, READING_SHM_DEFAULT_NAME);
+					g_readingShm = NULL;
 				}
+				/* a failed sensor setup leaves the connection started */
+				connection_stop(&g_connection);
 			}
 		}
-	}
-	return result;
-}
 
-int main(void)
-{
-	LoadConfig();
-	int result = remote_monitoring_init();
-	if (result == 0)
-	{
-		remote_monitoring_run();
+		StopSendDispatcher();
+		sensor_trace_capture_stop();
+		sensor_trace_replay_close();
+		payload_compress_deinit();
+		metrics_server_stop();
+		trace_deinit();
+		logger_stop();
+		/* what is still live at the end, a long run's leaks are the top sites */
+		alloc_debug_report();
+		alloc_debug_deinit();
+		/* the clients are gone, no confirmation frees a context any more */
+		mem_pool_deinit();
+
+		if (shutdownRequest == SHUTDOWN_RESTART && result == 0)
+		{
+			/* the twin is cached in the store and the unsent messages in their file, the new image picks both up */
+			if (Lock_fd >= 0)
+			{
+				close_lockfile(Lock_fd);
+				Lock_fd = -1;
+			}
+			printf("Restarting\n");
+			setenv(RESTART_ENV, "1", 1);
+			execv("/proc/self/exe", argv);
+			perror("Restart failed");
+			result = EXIT_FAILURE;
+		}
 	}
 	return result;
 }
\ No newline at end of file
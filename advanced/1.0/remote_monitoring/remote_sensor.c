@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "remote_sensor.h"
+#include "logger.h"
+
+int remote_sensor_open(const char* address, unsigned short port)
+{
+	int result;
+	struct sockaddr_in endpoint;
+
+	memset(&endpoint, 0, sizeof(endpoint));
+	endpoint.sin_family = AF_INET;
+	endpoint.sin_port = htons(port);
+
+	if (inet_pton(AF_INET, address, &endpoint.sin_addr) != 1)
+	{
+		printf("Invalid remote sensor address %s\r\n", address);
+		result = -1;
+	}
+	else if ((result = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	{
+		perror("Failed to create remote sensor socket");
+	}
+	else if (fcntl(result, F_SETFL, fcntl(result, F_GETFL, 0) | O_NONBLOCK) != 0 ||
+		bind(result, (struct sockaddr*)&endpoint, sizeof(endpoint)) != 0)
+	{
+		perror("Failed to bind remote sensor socket");
+		close(result);
+		result = -1;
+	}
+	else
+	{
+		printf("Listening for remote sensors on %s:%u\r\n", address, port);
+	}
+
+	return result;
+}
+
+void remote_sensor_poll(int fd, int timeoutMs, REMOTE_SENSOR_READING_CALLBACK callback, void* context)
+{
+	struct pollfd pollFd;
+
+	pollFd.fd = fd;
+	pollFd.events = POLLIN;
+	pollFd.revents = 0;
+
+	if (poll(&pollFd, 1, timeoutMs) > 0 && (pollFd.revents & POLLIN) != 0)
+	{
+		char datagram[128];
+		ssize_t received;
+
+		while ((received = recv(fd, datagram, sizeof(datagram) - 1, 0)) > 0)
+		{
+			char sensorName[REMOTE_SENSOR_NAME_MAX];
+			float tempC;
+			float pressurePa;
+			float humidityPct;
+
+			datagram[received] = '\0';
+			if (sscanf(datagram, "%31s %f %f %f", sensorName, &tempC, &pressurePa, &humidityPct) != 4)
+			{
+				LOGGER_WARN("Ignoring malformed remote sensor reading: %s\r\n", datagram);
+			}
+			else
+			{
+				callback(sensorName, tempC, pressurePa, humidityPct, context);
+			}
+		}
+	}
+}
+
+void remote_sensor_close(int fd)
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef REMOTE_SENSOR_H
+#define REMOTE_SENSOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Receives readings from sensors attached to other hosts. Each UDP datagram
+ * carries one reading as text:
+ *   <sensor name> <temperature C> <pressure Pa> <humidity %>
+ */
+#define REMOTE_SENSOR_NAME_MAX 32
+
+typedef void(*REMOTE_SENSOR_READING_CALLBACK)(const char* sensorName, float tempC, float pressurePa, float humidityPct, void* context);
+
+/* Returns a non-blocking socket bound to address:port, or -1 */
+int remote_sensor_open(const char* address, unsigned short port);
+
+/* Waits up to timeoutMs for readings and hands every pending one to the callback */
+void remote_sensor_poll(int fd, int timeoutMs, REMOTE_SENSOR_READING_CALLBACK callback, void* context);
+
+void remote_sensor_close(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REMOTE_SENSOR_H */
@@ -1,7 +1,6 @@
 ﻿// Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
-#include "iothubtransportmqtt.h"
 #include "schemalib.h"
 #include "iothub_client.h"
 #include "serializer_devicetwin.h"
@@ -10,6 +9,11 @@
 #include "azure_c_shared_utility/platform.h"
 
 #include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -17,6 +21,16 @@
 #include <wiringPiSPI.h>
 #include "bme280.h"
 #include "locking.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+#include "sensor_trace.h"
+#include "reading_shm.h"
+#include "sample_clock.h"
+#include "message_format.h"
+#include "send_report.h"
+#include "text_file.h"
+#include "transport_select.h"
 
 static const char* deviceId = "[Device Id]";
 static const char* connectionString = "HostName=[IoTHub Name].azure-devices.net;DeviceId=[Device Id];SharedAccessKey=[Device Key]";
@@ -30,12 +44,30 @@ static const char* deviceInfo = "{ \"ObjectType\": \"DeviceInfo\","
 "{\"Name\": \"Temperature\", \"DisplayName\" : \"Temperature\", \"Type\" : \"double\"},"
 "{ \"Name\": \"Humidity\", \"DisplayName\" : \"Humidity\", \"Type\" : \"double\" }] }";
 
-static const char* telemetryData = "{"
-"\"DeviceID\": \"%s\","
-"\"Temperature\" : %f,"
-"\"Humidity\" : %f } ";
-
 static IOTHUB_CLIENT_HANDLE g_iotHubClientHandle = NULL;
+/* the latest readings for other processes on the Pi, NULL when the segment could not be created */
+static READING_SHM* g_readingShm = NULL;
+static SAMPLE_CLOCK g_sampleClock;
+
+#define DEFAULT_TELEMETRY_INTERVAL_MS 3000
+
+/* Benchmark overrides, see PrintUsage */
+static char* trustedCerts = NULL;
+/* --transport, the default when NULL after the arguments are parsed */
+static const TRANSPORT* transport = NULL;
+static unsigned int messageCount = 0;
+static unsigned int intervalOverrideMs = 0;
+static unsigned short metricsPort = METRICS_DEFAULT_PORT;
+static LOGGER_FORMAT_MODE logMode = LOGGER_FORMAT_EAGER;
+static const char* sensorCapturePath = NULL;
+static const char* sensorReplayPath = NULL;
+static SENSOR_REPLAY_PACE sensorReplayPace = SENSOR_REPLAY_REALTIME;
+
+#define CONFIRMATION_DRAIN_TIMEOUT_MS 10000
+/* How often the metrics summary is published as a reported property */
+#define METRICS_REPORT_INTERVAL_US (300 * 1000000ULL)
+
+static SEND_REPORT g_sendReport;
 
 static const int Spi_channel = 0;
 static const int Spi_clock = 1000000L;
@@ -77,26 +109,76 @@ WITH_REPORTED_PROPERTY(ascii_char_ptr_no_quotes, SupportedMethods)
 
 END_NAMESPACE(Contoso);
 
-/* Callback after sending reported properties */
+/* Callback after sending reported properties, the context is the time the update was handed over */
 void deviceTwinCallback(int status_code, void* userContextCallback)
 {
-	(void)(userContextCallback);
-	printf("IoTHub: reported properties delivered with status_code = %u\n", status_code);
+	uint64_t* sentAtUs = userContextCallback;
+
+	LOGGER_INFO("IoTHub: reported properties delivered with status_code = %d\n", status_code);
+	if (status_code < 200 || status_code >= 300)
+	{
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+	}
+	else if (sentAtUs != NULL)
+	{
+		metrics_histogram_observe(METRIC_TWIN_ROUNDTRIP_LATENCY, metrics_now_us() - *sentAtUs);
+	}
+	free(sentAtUs);
+}
+
+static IOTHUB_CLIENT_RESULT SendReportedState(Thermostat* thermostat)
+{
+	IOTHUB_CLIENT_RESULT result;
+	uint64_t* sentAtUs = malloc(sizeof(uint64_t));
+
+	if (sentAtUs != NULL)
+	{
+		*sentAtUs = metrics_now_us();
+	}
+	metrics_counter_add(METRIC_TWIN_REPORTS, 1);
+	if ((result = IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, sentAtUs)) != IOTHUB_CLIENT_OK)
+	{
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+		free(sentAtUs);
+	}
+
+	return result;
+}
+
+/* Publishes the compact metrics summary next to the model's reported properties */
+static void SendMetricsReport(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
+{
+	unsigned char report[512];
+	size_t length = metrics_format_reported((char*)report, sizeof(report));
+	uint64_t* sentAtUs = malloc(sizeof(uint64_t));
+
+	if (sentAtUs != NULL)
+	{
+		*sentAtUs = metrics_now_us();
+	}
+	metrics_counter_add(METRIC_TWIN_REPORTS, 1);
+	if (length == 0 ||
+		IoTHubClient_SendReportedState(iotHubClientHandle, report, length, deviceTwinCallback, sentAtUs) != IOTHUB_CLIENT_OK)
+	{
+		LOGGER_WARN("Failed to report metrics\r\n");
+		metrics_counter_add(METRIC_TWIN_REPORT_FAILURES, 1);
+		free(sentAtUs);
+	}
 }
 
 void onDesiredTelemetryInterval(void* argument)
 {
 	/* By convention 'argument' is of the type of the MODEL */
 	Thermostat* thermostat = argument;
-	printf("Received a new desired_TelemetryInterval = %d\r\n", thermostat->TelemetryInterval);
+	LOGGER_INFO("Received a new desired_TelemetryInterval = %d\r\n", thermostat->TelemetryInterval);
 	thermostat->Config.TelemetryInterval = thermostat->TelemetryInterval;
-	if (IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
+	if (SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
 	{
-		printf("Report Config.TelemetryInterval property failed");
+		LOGGER_WARN("Report Config.TelemetryInterval property failed");
 	}
 	else
 	{
-		printf("Report new value of Config.TelemetryInterval property: %d\r\n", thermostat->Config.TelemetryInterval);
+		LOGGER_INFO("Report new value of Config.TelemetryInterval property: %d\r\n", thermostat->Config.TelemetryInterval);
 	}
 }
 
@@ -127,23 +209,67 @@ METHODRETURN_HANDLE LightBlink(Thermostat* thermostat)
 	return MethodReturn_Create(201, "\"light blink success\"");
 }
 
+/* Measures the time from handing a message to the SDK until the hub acknowledged it */
+static void SendConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+	uint64_t latencyUs = send_report_confirmed(&g_sendReport, userContextCallback, result == IOTHUB_CLIENT_CONFIRMATION_OK);
+
+	metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, -1);
+	if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+	{
+		metrics_counter_add(METRIC_MESSAGES_CONFIRMED, 1);
+		metrics_histogram_observe(METRIC_SEND_CONFIRM_LATENCY, latencyUs);
+	}
+	else
+	{
+		metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+	}
+}
+
+/* The shared send report, then what the benchmark compares transports by */
+static void PrintSendReport(void)
+{
+	send_report_print_costs(send_report_print(&g_sendReport, transport->name));
+}
+
 /* Send data to IoT Hub */
 static void sendMessage(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const unsigned char* buffer, size_t size)
 {
+	TRACE_BEGIN(createSpan, "IoTHubMessage_CreateFromByteArray");
 	IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromByteArray(buffer, size);
+	TRACE_END(createSpan);
 	if (messageHandle == NULL)
 	{
-		printf("unable to create a new IoTHubMessage\r\n");
+		LOGGER_ERROR("unable to create a new IoTHubMessage\r\n");
+		metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
 	}
 	else
 	{
-		if (IoTHubClient_SendEventAsync(iotHubClientHandle, messageHandle, NULL, NULL) != IOTHUB_CLIENT_OK)
+		void* sentAtUs = send_report_sent(&g_sendReport);
+		if (sentAtUs == NULL)
 		{
-			printf("failed to hand over the message to IoTHubClient");
+			LOGGER_ERROR("unable to allocate the send context\r\n");
+			metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
 		}
 		else
 		{
-			printf("IoTHubClient accepted the message for delivery\r\n");
+			metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, 1);
+
+			TRACE_BEGIN(queueSpan, "IoTHubClient_SendEventAsync");
+			IOTHUB_CLIENT_RESULT sendResult = IoTHubClient_SendEventAsync(iotHubClientHandle, messageHandle, SendConfirmationCallback, sentAtUs);
+			TRACE_END(queueSpan);
+			if (sendResult != IOTHUB_CLIENT_OK)
+			{
+				LOGGER_ERROR("failed to hand over the message to IoTHubClient");
+				send_report_unsent(&g_sendReport, sentAtUs);
+				metrics_gauge_add(METRIC_SEND_QUEUE_DEPTH, -1);
+				metrics_counter_add(METRIC_MESSAGES_DROPPED, 1);
+			}
+			else
+			{
+				LOGGER_DEBUG("IoTHubClient accepted the message for delivery\r\n");
+				metrics_counter_add(METRIC_MESSAGES_SENT, 1);
+			}
 		}
 
 		IoTHubMessage_Destroy(messageHandle);
@@ -155,7 +281,7 @@ void SendDeviceInfo(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
 {
 	char* buffer = malloc(sizeof(char) * 512);
 	sprintf(buffer, deviceInfo, deviceId);
-	printf("send device info: %s %d\r\n", buffer, strlen(buffer));
+	LOGGER_INFO("send device info: %s %zu\r\n", buffer, strlen(buffer));
 	sendMessage(iotHubClientHandle, buffer, strlen(buffer));
 }
 
@@ -164,28 +290,83 @@ void SendTelemetryData(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
 	float tempC = -300.0;
 	float pressurePa = -300;
 	float humidityPct = -300;
+	SAMPLE_STAMP stamp;
 
+	TRACE_BEGIN(cycleSpan, "telemetry_cycle");
 	int sensorResult = bme280_read_sensors(&tempC, &pressurePa, &humidityPct);
+	sample_clock_stamp(&g_sampleClock, &stamp);
 
 	if (sensorResult == 1)
 	{
-		printf("Read Sensor Data: Humidity = %.1f%% Temperature = %.1f*C \n",
+		reading_shm_publish(g_readingShm, &stamp, tempC, pressurePa, humidityPct);
+		LOGGER_DEBUG("Read Sensor Data: Humidity = %.1f%% Temperature = %.1f*C \n",
 			humidityPct, tempC);
 	}
 	else
 	{
-		printf("Read Sensor Data Failed, send simulated data Humidity = %.1f%% Temperature = %.1f*C \n", humidityPct, tempC);
+		LOGGER_WARN("Read Sensor Data Failed, send simulated data Humidity = %.1f%% Temperature = %.1f*C \n", humidityPct, tempC);
 	}
 
-	char* buffer = malloc(sizeof(char) * 256);
-	sprintf(buffer, telemetryData, deviceId, tempC , humidityPct);
-	printf("Sending sensor value: %s %d\r\n", buffer, strlen(buffer));
-	sendMessage(iotHubClientHandle, buffer, strlen(buffer));
+	uint64_t serializeStartUs = metrics_now_us();
+	TRACE_BEGIN(serializeSpan, "sprintf_telemetry");
+	char* buffer = malloc(MESSAGE_FORMAT_TELEMETRY_SIZE);
+	size_t length = (buffer == NULL) ? 0 : message_format_telemetry(buffer, MESSAGE_FORMAT_TELEMETRY_SIZE, deviceId, &stamp, tempC, humidityPct);
+	TRACE_END(serializeSpan);
+	metrics_histogram_observe(METRIC_SERIALIZE_LATENCY, metrics_now_us() - serializeStartUs);
+	if (length == 0)
+	{
+		LOGGER_ERROR("Failed to format the sensor values\r\n");
+		free(buffer);
+	}
+	else
+	{
+		LOGGER_INFO("Sending sensor value: %s %zu\r\n", buffer, length);
+		sendMessage(iotHubClientHandle, buffer, length);
+	}
+	TRACE_END(cycleSpan);
+}
+
+/* Sends telemetry until --count is reached, the thermostat is NULL on transports without a twin */
+static void RunTelemetryLoop(IOTHUB_CLIENT_HANDLE iotHubClientHandle, Thermostat* thermostat)
+{
+	uint64_t lastMetricsReportUs = metrics_now_us();
+
+	for (unsigned int messagesSent = 0; messageCount == 0 || messagesSent < messageCount; messagesSent++)
+	{
+		SendTelemetryData(iotHubClientHandle);
+		if (sensor_trace_replay_finished())
+		{
+			LOGGER_INFO("Sensor replay finished after %u messages", messagesSent + 1);
+			break;
+		}
+
+		if (thermostat != NULL && metrics_now_us() - lastMetricsReportUs >= METRICS_REPORT_INTERVAL_US)
+		{
+			SendMetricsReport(iotHubClientHandle);
+			lastMetricsReportUs = metrics_now_us();
+		}
+
+		/* a replay is paced by the capture itself */
+		if (!sensor_trace_replaying())
+		{
+			ThreadAPI_Sleep(intervalOverrideMs != 0 ? intervalOverrideMs :
+				thermostat != NULL ? thermostat->TelemetryInterval * 1000 : DEFAULT_TELEMETRY_INTERVAL_MS);
+		}
+	}
+
+	(void)send_report_wait(&g_sendReport, CONFIRMATION_DRAIN_TIMEOUT_MS);
+	PrintSendReport();
 }
 
 void remote_monitoring_run(void)
 {
-	if (platform_init() != 0)
+	int reporting = (send_report_init(&g_sendReport) == 0);
+
+	if (!reporting)
+	{
+		printf("Failed to initialize the send report.\n");
+	}
+	else if (platform_init() != 0)
 	{
 		printf("Failed to initialize the platform.\n");
 	}
@@ -197,7 +378,7 @@ void remote_monitoring_run(void)
 		}
 		else
 		{
-			IOTHUB_CLIENT_HANDLE iotHubClientHandle = IoTHubClient_CreateFromConnectionString(connectionString, MQTT_Protocol);
+			IOTHUB_CLIENT_HANDLE iotHubClientHandle = IoTHubClient_CreateFromConnectionString(connectionString, transport->protocol);
 			g_iotHubClientHandle = iotHubClientHandle;
 			if (iotHubClientHandle == NULL)
 			{
@@ -212,8 +393,22 @@ void remote_monitoring_run(void)
 					printf("Failed to set option \"TrustedCerts\"\n");
 				}
 #endif // MBED_BUILD_TIMESTAMP
-				Thermostat* thermostat = IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle);
-				if (thermostat == NULL)
+				if (trustedCerts != NULL && IoTHubClient_SetOption(iotHubClientHandle, "TrustedCerts", trustedCerts) != IOTHUB_CLIENT_OK)
+				{
+					printf("Failed to set option \"TrustedCerts\"\n");
+				}
+				if (transport_configure(iotHubClientHandle, transport) != 0)
+				{
+					printf("Failed to set the %s transport options\n", transport->name);
+				}
+				Thermostat* thermostat = transport->hasTwin ? IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle) : NULL;
+				if (!transport->hasTwin)
+				{
+					printf("Send DeviceInfo object to IoT Hub at startup\n");
+					SendDeviceInfo(iotHubClientHandle);
+					RunTelemetryLoop(iotHubClientHandle, NULL);
+				}
+				else if (thermostat == NULL)
 				{
 					printf("Failure in IoTHubDeviceTwin_CreateThermostat\n");
 				}
@@ -226,7 +421,7 @@ void remote_monitoring_run(void)
 					thermostat->SupportedMethods = supportedMethod;
 
 					/* Send reported properties to IoT Hub */
-					if (IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
+					if (SendReportedState(thermostat) != IOTHUB_CLIENT_OK)
 					{
 						printf("Failed sending serialized reported state\n");
 					}
@@ -237,24 +432,23 @@ void remote_monitoring_run(void)
 						SendDeviceInfo(iotHubClientHandle);
 
 						/* set default telemetry interval */
-						thermostat->TelemetryInterval = 3;
-
-						while (1)
-						{
-							SendTelemetryData(iotHubClientHandle);
+						thermostat->TelemetryInterval = DEFAULT_TELEMETRY_INTERVAL_MS / 1000;
 
-							ThreadAPI_Sleep(thermostat->TelemetryInterval * 1000);
-						}
-
-						IoTHubDeviceTwin_DestroyThermostat(thermostat);
+						RunTelemetryLoop(iotHubClientHandle, thermostat);
 					}
+					IoTHubDeviceTwin_DestroyThermostat(thermostat);
 				}
 				IoTHubClient_Destroy(iotHubClientHandle);
 			}
 			serializer_deinit();
 		}
+		platform_deinit();
+	}
+
+	if (reporting)
+	{
+		send_report_deinit(&g_sendReport);
 	}
-	platform_deinit();
 }
 
 int remote_monitoring_init(void)
@@ -268,16 +462,25 @@ int remote_monitoring_init(void)
 		perror("Dropping privileges failed. (did you use sudo?)n");
 		result = EXIT_FAILURE;
 	}
+	else if (sensorReplayPath != NULL && sensor_trace_replay_open(sensorReplayPath, sensorReplayPace) != 0)
+	{
+		result = EXIT_FAILURE;
+	}
+	else if (sensorCapturePath != NULL && sensor_trace_capture_start(sensorCapturePath) != 0)
+	{
+		result = EXIT_FAILURE;
+	}
 	else
 	{
-		result = wiringPiSetup();
+		/* a replay serves every sensor read from the capture, the SPI bus is not touched */
+		result = sensor_trace_replaying() ? 0 : wiringPiSetup();
 		if (result != 0)
 		{
 			perror("Wiring Pi setup failed.");
 		}
 		else
 		{
-			result = wiringPiSPISetup(Spi_channel, Spi_clock);
+			result = sensor_trace_replaying() ? 0 : wiringPiSPISetup(Spi_channel, Spi_clock);
 			if (result < 0)
 			{
 				printf("Can't setup SPI, error %i calling wiringPiSPISetup(%i, %i)  %sn",
@@ -316,12 +519,151 @@ int remote_monitoring_init(void)
 	return result;
 }
 
-int main(void)
+static void PrintUsage(const char* program)
 {
-	int result = remote_monitoring_init();
-	if (result == 0)
+	printf("usage: %s [options]\n"
+		"  --connection-string <cs>    connect with this device connection string instead of the built-in one\n"
+		"  --trusted-certs <file>      PEM certificates to trust, e.g. for the local benchmark stand-in\n"
+		"  --transport <name>          mqtt (default), mqtt-ws, amqp, amqp-ws, http or http-batch; http sends telemetry only\n"
+		"  --count <n>                 stop after n telemetry messages and print a send report\n"
+		"  --interval-ms <ms>          telemetry interval overriding the device twin setting\n"
+		"  --metrics-port <port>       serve Prometheus metrics on 127.0.0.1:<port>, 0 disables (default %u)\n"
+		"  --log-level <level>         error, warn, info (default) or debug\n"
+		"  --log-mode <mode>           eager (default) formats log records on the caller, deferred on the writer thread\n"
+		"  --capture-sensor <file>     record every BME280 register read to file\n"
+		"  --replay-sensor <file>      read the BME280 from a capture instead of SPI, exit when it runs out\n"
+		"  --replay-pace <pace>        realtime (default) keeps the captured timing, max replays without waiting\n",
+		program, METRICS_DEFAULT_PORT);
+}
+
+int main(int argc, char** argv)
+{
+	int result = 0;
+
+	for (int i = 1; i < argc && result == 0; i += 2)
 	{
-		remote_monitoring_run();
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (value == NULL)
+		{
+			result = __LINE__;
+		}
+		else if (strcmp(argv[i], "--connection-string") == 0)
+		{
+			connectionString = value;
+		}
+		else if (strcmp(argv[i], "--trusted-certs") == 0)
+		{
+			if ((trustedCerts = text_file_read(value)) == NULL)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--transport") == 0)
+		{
+			if ((transport = transport_find(value)) == NULL)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--count") == 0)
+		{
+			messageCount = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--interval-ms") == 0)
+		{
+			intervalOverrideMs = (unsigned int)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--metrics-port") == 0)
+		{
+			metricsPort = (unsigned short)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--log-level") == 0)
+		{
+			if ((logger_level = logger_parse_level(value)) < 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--log-mode") == 0)
+		{
+			if (strcmp(value, "deferred") == 0)
+			{
+				logMode = LOGGER_FORMAT_DEFERRED;
+			}
+			else if (strcmp(value, "eager") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else if (strcmp(argv[i], "--capture-sensor") == 0)
+		{
+			sensorCapturePath = value;
+		}
+		else if (strcmp(argv[i], "--replay-sensor") == 0)
+		{
+			sensorReplayPath = value;
+		}
+		else if (strcmp(argv[i], "--replay-pace") == 0)
+		{
+			if (strcmp(value, "max") == 0)
+			{
+				sensorReplayPace = SENSOR_REPLAY_MAX_SPEED;
+			}
+			else if (strcmp(value, "realtime") != 0)
+			{
+				result = __LINE__;
+			}
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
+
+	if (transport == NULL)
+	{
+		transport = transport_default();
 	}
+
+	if (result == 0 && sensorCapturePath != NULL && sensorReplayPath != NULL)
+	{
+		printf("--capture-sensor and --replay-sensor cannot be combined\n");
+		result = __LINE__;
+	}
+
+	if (result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		(void)logger_start(logMode, LOGGER_DEFAULT_RATE_LIMIT);
+		(void)trace_init(TRACE_DEFAULT_PATH_PREFIX);
+		result = remote_monitoring_init();
+		if (result == 0)
+		{
+			if (metricsPort != 0 && metrics_server_start(metricsPort) != 0)
+			{
+				printf("Continuing without the metrics endpoint\n");
+			}
+			if ((g_readingShm = reading_shm_create(READING_SHM_DEFAULT_NAME)) == NULL)
+			{
+				printf("Continuing without publishing readings in shared memory\n");
+			}
+			remote_monitoring_run();
+			reading_shm_destroy(g_readingShm, READING_SHM_DEFAULT_NAME);
+			g_readingShm = NULL;
+			metrics_server_stop();
+		}
+		sensor_trace_capture_stop();
+		sensor_trace_replay_close();
+		trace_deinit();
+		logger_stop();
+	}
+
+	free(trustedCerts);
+
 	return result;
 }
\ No newline at end of file
@@ -0,0 +1,609 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Local stand-in for the IoT Hub MQTT endpoint used by the end-to-end benchmarks.
+
+Implements the subset of MQTT 3.1.1 and of the IoT Hub topic layout that the
+remote monitoring samples use: device-to-cloud telemetry, device twin GET and
+reported PATCH, desired property pushes and direct method invocation.
+Credentials are accepted without validation. QoS 1 publishes are acknowledged
+immediately (or after --ack-delay-ms), so the devices measure their own send
+path rather than a cloud round trip.
+
+The HTTPS port serves the same MQTT session over WebSockets
+(/$iothub/websocket) and the device-to-cloud part of the HTTP REST API,
+single and batched events. AMQP is not implemented. Bytes are counted per
+transport above TLS, WebSocket framing and HTTP headers included.
+"""
+
+import argparse
+import asyncio
+import base64
+import hashlib
+import json
+import signal
+import ssl
+import sys
+import time
+from urllib.parse import parse_qs
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+SUBSCRIBE = 8
+SUBACK = 9
+UNSUBSCRIBE = 10
+UNSUBACK = 11
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+
+def encode_length(length):
+    encoded = bytearray()
+    while True:
+        digit = length % 128
+        length //= 128
+        if length > 0:
+            digit |= 0x80
+        encoded.append(digit)
+        if length == 0:
+            return bytes(encoded)
+
+
+def encode_string(value):
+    data = value.encode("utf-8")
+    return len(data).to_bytes(2, "big") + data
+
+
+def decode_string(buffer, offset):
+    length = int.from_bytes(buffer[offset:offset + 2], "big")
+    return buffer[offset + 2:offset + 2 + length].decode("utf-8"), offset + 2 + length
+
+
+def topic_matches(topic_filter, topic):
+    filter_levels = topic_filter.split("/")
+    topic_levels = topic.split("/")
+    for index, level in enumerate(filter_levels):
+        if level == "#":
+            return True
+        if index >= len(topic_levels):
+            return False
+        if level != "+" and level != topic_levels[index]:
+            return False
+    return len(filter_levels) == len(topic_levels)
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0.0
+    rank = max(1, int(round(pct / 100.0 * len(sorted_values))))
+    return sorted_values[min(rank, len(sorted_values)) - 1]
+
+
+WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+
+class CountingStream:
+    """Wraps an asyncio reader and writer pair and adds the bytes to the transport's counters.
+
+    Without a transport the bytes are held back until set_transport names one,
+    the HTTPS port only knows after the first request what it is serving.
+    """
+
+    def __init__(self, reader, writer, stats, transport=None):
+        self.reader = reader
+        self.writer = writer
+        self.stats = stats
+        self.transport = transport
+        self.pending = [0, 0]
+
+    def set_transport(self, transport):
+        self.transport = transport
+        self.count(*self.pending)
+
+    def count(self, received, sent):
+        if self.transport is None:
+            self.pending[0] += received
+            self.pending[1] += sent
+        else:
+            self.stats.record_wire(self.transport, received, sent)
+
+    async def readexactly(self, count):
+        data = await self.reader.readexactly(count)
+        self.count(len(data), 0)
+        return data
+
+    async def readuntil(self, separator):
+        data = await self.reader.readuntil(separator)
+        self.count(len(data), 0)
+        return data
+
+    def write(self, data):
+        self.count(0, len(data))
+        self.writer.write(data)
+
+    async def drain(self):
+        await self.writer.drain()
+
+    def close(self):
+        self.writer.close()
+
+
+class WebSocketStream:
+    """Byte stream over the binary messages of a server side WebSocket."""
+
+    def __init__(self, stream):
+        self.stream = stream
+        self.buffer = bytearray()
+
+    async def read_frame(self):
+        header = await self.stream.readexactly(2)
+        opcode = header[0] & 0x0F
+        length = header[1] & 0x7F
+        if length == 126:
+            length = int.from_bytes(await self.stream.readexactly(2), "big")
+        elif length == 127:
+            length = int.from_bytes(await self.stream.readexactly(8), "big")
+        mask = await self.stream.readexactly(4) if header[1] & 0x80 else b"\x00\x00\x00\x00"
+        payload = bytearray(await self.stream.readexactly(length)) if length > 0 else bytearray()
+        for index in range(len(payload)):
+            payload[index] ^= mask[index % 4]
+        return opcode, bytes(payload)
+
+    def send_frame(self, opcode, payload):
+        length = len(payload)
+        if length < 126:
+            header = bytes([0x80 | opcode, length])
+        elif length < 65536:
+            header = bytes([0x80 | opcode, 126]) + length.to_bytes(2, "big")
+        else:
+            header = bytes([0x80 | opcode, 127]) + length.to_bytes(8, "big")
+        self.stream.write(header + payload)
+
+    async def readexactly(self, count):
+        while len(self.buffer) < count:
+            opcode, payload = await self.read_frame()
+            if opcode == 0x8:
+                self.send_frame(0x8, payload[0:2])
+                raise asyncio.IncompleteReadError(bytes(self.buffer), count)
+            elif opcode == 0x9:
+                self.send_frame(0xA, payload)
+            elif opcode in (0x0, 0x1, 0x2):
+                self.buffer += payload
+        data = bytes(self.buffer[:count])
+        del self.buffer[:count]
+        return data
+
+    def write(self, data):
+        self.send_frame(0x2, data)
+
+    async def drain(self):
+        await self.stream.drain()
+
+    def close(self):
+        self.stream.close()
+
+
+async def read_http_request(stream):
+    """Returns method, path, lower-cased headers and body of one request."""
+    head = (await stream.readuntil(b"\r\n\r\n")).decode("latin-1")
+    lines = head.split("\r\n")
+    method, path, _ = lines[0].split(" ", 2)
+    headers = {}
+    for line in lines[1:]:
+        if ":" in line:
+            name, _, value = line.partition(":")
+            headers[name.strip().lower()] = value.strip()
+    if headers.get("expect", "").lower() == "100-continue":
+        stream.write(b"HTTP/1.1 100 Continue\r\n\r\n")
+        await stream.drain()
+    length = int(headers.get("content-length", "0"))
+    body = await stream.readexactly(length) if length > 0 else b""
+    return method, path, headers, body
+
+
+def split_request(topic):
+    """Returns the path part of a topic and the parameters after '?'."""
+    path, _, query = topic.partition("?")
+    return path, {key: values[0] for key, values in parse_qs(query).items()}
+
+
+class Statistics:
+    def __init__(self):
+        self.connections = 0
+        self.telemetry = 0
+        self.telemetry_bytes = 0
+        self.telemetry_compressed = 0
+        self.first_telemetry = None
+        self.last_telemetry = None
+        self.per_device = {}
+        self.twin_gets = 0
+        self.twin_patches = 0
+        self.desired_pushes = 0
+        self.methods_invoked = 0
+        self.method_rtts_ms = []
+        self.wire = {}
+
+    def record_wire(self, transport, received, sent):
+        counters = self.wire.setdefault(transport, [0, 0])
+        counters[0] += received
+        counters[1] += sent
+
+    def record_telemetry(self, device_id, size, content_encoding=None):
+        now = time.monotonic()
+        if content_encoding == "deflate":
+            self.telemetry_compressed += 1
+        if self.first_telemetry is None:
+            self.first_telemetry = now
+        self.last_telemetry = now
+        self.telemetry += 1
+        self.telemetry_bytes += size
+        self.per_device[device_id] = self.per_device.get(device_id, 0) + 1
+
+    def summary(self):
+        window = 0.0
+        if self.first_telemetry is not None and self.last_telemetry > self.first_telemetry:
+            window = self.last_telemetry - self.first_telemetry
+        rtts = sorted(self.method_rtts_ms)
+        summary = {
+            "connections": self.connections,
+            "devices": len(self.per_device),
+            "telemetry_messages": self.telemetry,
+            "telemetry_bytes": self.telemetry_bytes,
+            "telemetry_compressed": self.telemetry_compressed,
+            "telemetry_window_s": round(window, 3),
+            "messages_per_second": round((self.telemetry - 1) / window, 1) if window > 0 else 0.0,
+            "twin_gets": self.twin_gets,
+            "twin_reported_patches": self.twin_patches,
+            "twin_desired_pushes": self.desired_pushes,
+            "methods_invoked": self.methods_invoked,
+            "methods_answered": len(rtts),
+            "method_rtt_p50_ms": round(percentile(rtts, 50), 3),
+            "method_rtt_p99_ms": round(percentile(rtts, 99), 3),
+        }
+        for transport, (received, sent) in sorted(self.wire.items()):
+            summary["%s_bytes_received" % transport] = received
+            summary["%s_bytes_sent" % transport] = sent
+            summary["%s_bytes_per_message" % transport] = round((received + sent) / self.telemetry, 1) if self.telemetry else 0.0
+        return summary
+
+
+class Twin:
+    def __init__(self, desired):
+        self.desired = dict(desired)
+        self.desired["$version"] = 1
+        self.reported = {"$version": 1}
+
+    def merge_reported(self, patch):
+        def merge(target, source):
+            for key, value in source.items():
+                if value is None:
+                    target.pop(key, None)
+                elif isinstance(value, dict) and isinstance(target.get(key), dict):
+                    merge(target[key], value)
+                else:
+                    target[key] = value
+        merge(self.reported, patch)
+        self.reported["$version"] += 1
+        return self.reported["$version"]
+
+
+class DeviceSession:
+    def __init__(self, broker, reader, writer):
+        self.broker = broker
+        self.reader = reader
+        self.writer = writer
+        self.device_id = None
+        self.subscriptions = []
+        self.desired_pushed = False
+        self.pending_methods = {}
+        self.next_rid = 1
+        self.closed = False
+        # the read loop and delayed acks both drain the writer, which takes one caller at a time
+        self.drain_lock = asyncio.Lock()
+
+    def subscribed(self, topic):
+        return any(topic_matches(topic_filter, topic) for topic_filter in self.subscriptions)
+
+    def send(self, packet_type, flags, body):
+        self.writer.write(bytes([(packet_type << 4) | flags]) + encode_length(len(body)) + body)
+
+    def publish(self, topic, payload):
+        # everything the hub sends down is QoS 0 as far as the benchmarks are concerned
+        self.send(PUBLISH, 0, encode_string(topic) + payload)
+
+    async def read_packet(self):
+        first = (await self.reader.readexactly(1))[0]
+        length = 0
+        multiplier = 1
+        while True:
+            digit = (await self.reader.readexactly(1))[0]
+            length += (digit & 0x7F) * multiplier
+            if (digit & 0x80) == 0:
+                break
+            multiplier *= 128
+        body = await self.reader.readexactly(length) if length > 0 else b""
+        return first >> 4, first & 0x0F, body
+
+    async def run(self):
+        try:
+            while True:
+                packet_type, flags, body = await self.read_packet()
+                if packet_type == CONNECT:
+                    self.on_connect(body)
+                elif packet_type == PUBLISH:
+                    self.on_publish(flags, body)
+                elif packet_type == SUBSCRIBE:
+                    self.on_subscribe(body)
+                elif packet_type == UNSUBSCRIBE:
+                    self.send(UNSUBACK, 0, body[0:2])
+                elif packet_type == PINGREQ:
+                    self.send(PINGRESP, 0, b"")
+                elif packet_type == DISCONNECT:
+                    break
+                await self.drain()
+        except (asyncio.IncompleteReadError, ConnectionError, ssl.SSLError):
+            pass
+        finally:
+            self.closed = True
+            self.broker.sessions.discard(self)
+            self.writer.close()
+
+    async def drain(self):
+        async with self.drain_lock:
+            await self.writer.drain()
+
+    def send_ack(self, packet_id):
+        if not self.closed:
+            self.send(PUBACK, 0, packet_id)
+            asyncio.ensure_future(self.drain_quietly())
+
+    async def drain_quietly(self):
+        try:
+            await self.drain()
+        except (ConnectionError, ssl.SSLError):
+            pass
+
+    def on_connect(self, body):
+        _, offset = decode_string(body, 0)
+        offset += 4  # protocol level, connect flags, keep alive
+        self.device_id, offset = decode_string(body, offset)
+        self.broker.stats.connections += 1
+        self.broker.sessions.add(self)
+        self.send(CONNACK, 0, b"\x00\x00")
+
+    def on_subscribe(self, body):
+        packet_id = body[0:2]
+        offset = 2
+        granted = bytearray()
+        desired = False
+        while offset < len(body):
+            topic_filter, offset = decode_string(body, offset)
+            requested_qos = body[offset]
+            offset += 1
+            self.subscriptions.append(topic_filter)
+            granted.append(min(requested_qos, 1))
+            desired = desired or topic_filter.startswith("$iothub/twin/PATCH/properties/desired")
+        self.send(SUBACK, 0, packet_id + bytes(granted))
+        # once per session: later packets subscribe to methods and twin responses
+        if self.broker.desired_patch and desired and not self.desired_pushed:
+            self.desired_pushed = True
+            asyncio.get_event_loop().call_later(self.broker.args.desired_delay, self.push_desired)
+
+    def on_publish(self, flags, body):
+        qos = (flags >> 1) & 0x03
+        topic, offset = decode_string(body, 0)
+        packet_id = None
+        if qos > 0:
+            packet_id = body[offset:offset + 2]
+            offset += 2
+        payload = body[offset:]
+
+        if topic.startswith("devices/") and "/messages/events/" in topic:
+            # system properties follow the path, "$.ce" is the content encoding
+            properties = {key: values[0] for key, values in parse_qs(topic.split("/messages/events/", 1)[1]).items()}
+            self.broker.stats.record_telemetry(self.device_id, len(payload), properties.get("$.ce"))
+        elif topic.startswith("$iothub/twin/GET/"):
+            self.on_twin_get(topic)
+        elif topic.startswith("$iothub/twin/PATCH/properties/reported/"):
+            self.on_twin_patch(topic, payload)
+        elif topic.startswith("$iothub/methods/res/"):
+            self.on_method_response(topic)
+
+        if packet_id is None:
+            pass
+        elif self.broker.args.ack_delay_ms > 0:
+            # scheduled, so the delay adds latency to every publish without holding up the next read
+            asyncio.get_event_loop().call_later(self.broker.args.ack_delay_ms / 1000.0, self.send_ack, packet_id)
+        else:
+            self.send(PUBACK, 0, packet_id)
+
+    def twin(self):
+        return self.broker.twin_for(self.device_id)
+
+    def on_twin_get(self, topic):
+        _, params = split_request(topic)
+        twin = self.twin()
+        self.broker.stats.twin_gets += 1
+        document = json.dumps({"desired": twin.desired, "reported": twin.reported}).encode("utf-8")
+        self.publish("$iothub/twin/res/200/?$rid=%s" % params.get("$rid", "0"), document)
+
+    def on_twin_patch(self, topic, payload):
+        _, params = split_request(topic)
+        self.broker.stats.twin_patches += 1
+        try:
+            version = self.twin().merge_reported(json.loads(payload.decode("utf-8")))
+            self.publish("$iothub/twin/res/204/?$rid=%s&$version=%d" % (params.get("$rid", "0"), version), b"")
+        except ValueError:
+            self.publish("$iothub/twin/res/400/?$rid=%s" % params.get("$rid", "0"), b"")
+
+    def push_desired(self):
+        twin = self.twin()
+        twin.desired.update(self.broker.desired_patch)
+        twin.desired["$version"] += 1
+        patch = dict(self.broker.desired_patch)
+        patch["$version"] = twin.desired["$version"]
+        topic = "$iothub/twin/PATCH/properties/desired/?$version=%d" % twin.desired["$version"]
+        if self.subscribed(topic):
+            self.broker.stats.desired_pushes += 1
+            self.publish(topic, json.dumps(patch).encode("utf-8"))
+
+    def invoke_method(self, name, payload):
+        rid = "%x" % self.next_rid
+        self.next_rid += 1
+        topic = "$iothub/methods/POST/%s/?$rid=%s" % (name, rid)
+        if self.subscribed(topic):
+            self.pending_methods[rid] = time.monotonic()
+            self.broker.stats.methods_invoked += 1
+            self.publish(topic, payload)
+
+    def on_method_response(self, topic):
+        _, params = split_request(topic)
+        sent = self.pending_methods.pop(params.get("$rid", ""), None)
+        if sent is not None:
+            self.broker.stats.method_rtts_ms.append((time.monotonic() - sent) * 1000.0)
+
+
+class Broker:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Statistics()
+        self.sessions = set()
+        self.twins = {}
+        self.desired_patch = json.loads(args.desired) if args.desired else {}
+
+    def twin_for(self, device_id):
+        if device_id not in self.twins:
+            self.twins[device_id] = Twin(self.desired_patch)
+        return self.twins[device_id]
+
+    async def on_client(self, reader, writer):
+        stream = CountingStream(reader, writer, self.stats, "mqtt")
+        await DeviceSession(self, stream, stream).run()
+
+    async def on_https_client(self, reader, writer):
+        """MQTT over WebSockets or HTTP REST, told apart by the first request."""
+        stream = CountingStream(reader, writer, self.stats)
+        try:
+            method, path, headers, body = await read_http_request(stream)
+            if headers.get("upgrade", "").lower() == "websocket":
+                stream.set_transport("mqtt-ws")
+                accept = base64.b64encode(hashlib.sha1((headers["sec-websocket-key"] + WEBSOCKET_GUID).encode("ascii")).digest()).decode("ascii")
+                response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n" % accept
+                if "sec-websocket-protocol" in headers:
+                    response += "Sec-WebSocket-Protocol: %s\r\n" % headers["sec-websocket-protocol"].split(",")[0].strip()
+                stream.write((response + "\r\n").encode("latin-1"))
+                websocket = WebSocketStream(stream)
+                await DeviceSession(self, websocket, websocket).run()
+                return
+            stream.set_transport("http")
+            self.stats.connections += 1
+            while True:
+                stream.write(self.on_http_request(method, path, headers, body))
+                await stream.drain()
+                method, path, headers, body = await read_http_request(stream)
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError, ssl.SSLError, ValueError, KeyError):
+            pass
+        finally:
+            stream.close()
+
+    def on_http_request(self, method, path, headers, body):
+        """Returns the response to one of the REST calls of the SDK's HTTP transport."""
+        parts = path.split("?", 1)[0].strip("/").split("/")
+        device_id = parts[1] if len(parts) > 1 else ""
+        if method == "POST" and parts[2:] == ["messages", "events"]:
+            if headers.get("content-type", "").startswith("application/vnd.microsoft.iothub.json"):
+                # a batch: JSON array of {"body": base64, "base64Encoded": true, "properties": {...}}
+                for event in json.loads(body.decode("utf-8")):
+                    payload = base64.b64decode(event["body"]) if event.get("base64Encoded") else event["body"].encode("utf-8")
+                    self.stats.record_telemetry(device_id, len(payload), event.get("properties", {}).get("iothub-contentencoding"))
+            else:
+                self.stats.record_telemetry(device_id, len(body), headers.get("iothub-contentencoding"))
+            status = "204 No Content"
+        elif method == "GET" and [part.lower() for part in parts[2:]] == ["messages", "devicebound"]:
+            # cloud-to-device poll, never anything queued
+            status = "204 No Content"
+        else:
+            status = "404 Not Found"
+        return ("HTTP/1.1 %s\r\nContent-Length: 0\r\n\r\n" % status).encode("latin-1")
+
+    async def invoke_methods(self):
+        while True:
+            await asyncio.sleep(self.args.method_interval)
+            for session in list(self.sessions):
+                session.invoke_method(self.args.method, self.args.method_payload.encode("utf-8"))
+                await session.drain()
+
+
+def create_ssl_context(args):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(args.cert, args.key)
+    return context
+
+
+async def serve(args):
+    broker = Broker(args)
+    context = create_ssl_context(args)
+    server = await asyncio.start_server(broker.on_client, args.host, args.port, ssl=context)
+    https_server = None
+    if args.https_port > 0:
+        https_server = await asyncio.start_server(broker.on_https_client, args.host, args.https_port, ssl=context)
+    stop = asyncio.Event()
+    loop = asyncio.get_event_loop()
+    for signum in (signal.SIGINT, signal.SIGTERM):
+        loop.add_signal_handler(signum, stop.set)
+    if args.duration > 0:
+        loop.call_later(args.duration, stop.set)
+
+    method_task = None
+    if args.method and args.method_interval > 0:
+        method_task = asyncio.ensure_future(broker.invoke_methods())
+
+    print("iothub stand-in listening on %s:%d" % (args.host, args.port), flush=True)
+    if https_server is not None:
+        print("iothub stand-in listening on %s:%d for MQTT over WebSockets and HTTP" % (args.host, args.https_port), flush=True)
+    await stop.wait()
+
+    if method_task is not None:
+        method_task.cancel()
+    server.close()
+    if https_server is not None:
+        https_server.close()
+    for session in list(broker.sessions):
+        session.writer.close()
+    return broker.stats.summary()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8883)
+    parser.add_argument("--https-port", type=int, default=0, help="also serve MQTT over WebSockets and HTTP here, IoT Hub uses 443")
+    parser.add_argument("--cert", required=True, help="PEM server certificate the devices are told to trust")
+    parser.add_argument("--key", required=True, help="PEM private key of --cert")
+    parser.add_argument("--duration", type=float, default=0, help="stop after this many seconds, 0 waits for a signal")
+    parser.add_argument("--ack-delay-ms", type=float, default=0, help="artificial delay before each PUBACK")
+    parser.add_argument("--desired", default="", help="JSON desired properties returned by twin GET and pushed once")
+    parser.add_argument("--desired-delay", type=float, default=1.0, help="seconds after subscribe before the desired push")
+    parser.add_argument("--method", default="", help="direct method to invoke periodically on every device")
+    parser.add_argument("--method-payload", default="{}")
+    parser.add_argument("--method-interval", type=float, default=0)
+    parser.add_argument("--report", default="", help="also write the summary as JSON to this file")
+    args = parser.parse_args()
+
+    summary = asyncio.run(serve(args))
+
+    print("==== iothub stand-in report ====")
+    for key, value in summary.items():
+        print("%-30s %s" % (key + ":", value))
+    if args.report:
+        with open(args.report, "w") as report:
+            json.dump(summary, report, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
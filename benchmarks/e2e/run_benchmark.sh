@@ -0,0 +1,163 @@
+#!/bin/bash
+#Copyright (c) Microsoft. All rights reserved.
+#Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+# Runs a remote_monitoring binary against the local IoT Hub stand-in and
+# prints the device side send report followed by the stand-in report. With
+# -t it runs once per transport and ends with a comparison table.
+
+set -e
+
+script_dir=$(cd "$(dirname "$0")" && pwd)
+binary=
+message_count=1000
+interval_ms=10
+ack_delay_ms=0
+desired=
+method=
+method_interval=0
+report_dir=
+transports=
+extra_args=
+
+usage ()
+{
+    echo "run_benchmark.sh -b <remote_monitoring binary> [options]"
+    echo "options"
+    echo " -b, --binary <path>           simulator or basic remote_monitoring binary to benchmark"
+    echo " -n, --count <n>               telemetry messages to send (default $message_count)"
+    echo " -i, --interval-ms <ms>        delay between telemetry messages (default $interval_ms)"
+    echo " --ack-delay-ms <ms>           artificial hub acknowledgement delay (default $ack_delay_ms)"
+    echo " --desired <json>              desired properties the stand-in pushes after connect"
+    echo " --method <name>               direct method the stand-in invokes periodically"
+    echo " --method-interval <s>         seconds between method invocations"
+    echo " -t, --transports <list>       comma separated transports, e.g. mqtt,mqtt-ws,http,http-batch"
+    echo " --report-dir <dir>            keep the reports in this directory"
+    echo " -- <args>                     pass the remaining arguments to the binary"
+    exit 1
+}
+
+process_args ()
+{
+    while [ $# -gt 0 ]
+    do
+        case "$1" in
+            "-b" | "--binary" ) binary="$2"; shift;;
+            "-n" | "--count" ) message_count="$2"; shift;;
+            "-i" | "--interval-ms" ) interval_ms="$2"; shift;;
+            "--ack-delay-ms" ) ack_delay_ms="$2"; shift;;
+            "--desired" ) desired="$2"; shift;;
+            "--method" ) method="$2"; shift;;
+            "--method-interval" ) method_interval="$2"; shift;;
+            "-t" | "--transports" ) transports="$2"; shift;;
+            "--report-dir" ) report_dir="$2"; shift;;
+            "--" ) shift; extra_args="$*"; break;;
+            * ) usage;;
+        esac
+        shift
+    done
+
+    if [ -z "$binary" ]
+    then
+        usage
+    fi
+}
+
+process_args "$@"
+
+work_dir=$(mktemp -d)
+if [ -z "$report_dir" ]
+then
+    report_dir=$work_dir
+fi
+mkdir -p "$report_dir"
+
+cleanup ()
+{
+    if [ -n "$standin_pid" ] && kill -0 $standin_pid 2> /dev/null
+    then
+        kill $standin_pid
+        wait $standin_pid || true
+    fi
+    rm -rf "$work_dir"
+}
+trap cleanup EXIT
+
+# The SDK always connects to <hub>.<suffix>:8883 (443 for WebSockets and HTTP) over TLS, so the stand-in
+# presents a throw-away certificate for 127.0.0.1 which the binary is told to trust.
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=127.0.0.1" \
+    -addext "subjectAltName=IP:127.0.0.1,DNS:localhost" \
+    -keyout "$work_dir/standin.key" -out "$work_dir/standin.pem" 2> /dev/null
+
+# "127.0.0.1" splits into hub name "127" and suffix "0.0.1", which the SDK joins back together
+connection_string="HostName=127.0.0.1;DeviceId=benchmark-device;SharedAccessKey=c3RhbmRpbi1kZXZpY2Uta2V5"
+
+# run_once <output dir> [transport], a fresh stand-in per run keeps the reports apart
+run_once ()
+{
+    local output_dir="$1"
+    local transport_args=
+    local https_port=0
+
+    mkdir -p "$output_dir"
+    if [ -n "$2" ]
+    then
+        transport_args="--transport $2"
+        # MQTT over WebSockets and HTTP go to port 443, which needs root or CAP_NET_BIND_SERVICE
+        if [ "$2" != "mqtt" ]
+        then
+            https_port=443
+        fi
+    fi
+
+    python3 "$script_dir/iothub_standin.py" --cert "$work_dir/standin.pem" --key "$work_dir/standin.key" --https-port $https_port \
+        --ack-delay-ms "$ack_delay_ms" --desired "$desired" --method "$method" --method-interval "$method_interval" \
+        --report "$output_dir/standin_report.json" > "$output_dir/standin_output.txt" 2>&1 &
+    standin_pid=$!
+
+    for attempt in $(seq 1 50)
+    do
+        if grep -q "listening" "$output_dir/standin_output.txt" 2> /dev/null
+        then
+            break
+        fi
+        sleep 0.1
+    done
+
+    "$binary" --connection-string "$connection_string" --trusted-certs "$work_dir/standin.pem" $transport_args \
+        --count "$message_count" --interval-ms "$interval_ms" $extra_args > "$output_dir/device_output.txt" 2>&1 || true
+
+    sed -n '/==== send report ====/,$p' "$output_dir/device_output.txt"
+
+    kill $standin_pid
+    wait $standin_pid || true
+    standin_pid=
+    cat "$output_dir/standin_output.txt"
+}
+
+if [ -z "$transports" ]
+then
+    run_once "$report_dir"
+    exit 0
+fi
+
+for transport in ${transports//,/ }
+do
+    echo "==== $transport ===="
+    run_once "$report_dir/$transport" "$transport"
+done
+
+# one row per transport: the device's own report next to the bytes the stand-in saw
+printf "\n%-12s %10s %12s %12s %14s %14s %12s\n" transport "msg/s" "p50 ms" "p99 ms" "device B/msg" "hub B/msg" "cpu ms/msg"
+for transport in ${transports//,/ }
+do
+    output="$report_dir/$transport/device_output.txt"
+    throughput=$(sed -n 's/^throughput: \([0-9.]*\).*/\1/p' "$output")
+    p50=$(sed -n 's/.*latency: p50 \([0-9.]*\) ms.*/\1/p' "$output")
+    p99=$(sed -n 's/.*, p99 \([0-9.]*\) ms.*/\1/p' "$output")
+    device_bytes=$(sed -n 's/^wire bytes: [0-9]*, \([0-9.]*\) per.*/\1/p' "$output")
+    cpu=$(sed -n 's/.* system, \([0-9.]*\) ms per.*/\1/p' "$output")
+    hub_bytes=$(python3 -c "import json, sys; print(json.load(open(sys.argv[1])).get(sys.argv[2] + '_bytes_per_message', '-'))" \
+        "$report_dir/$transport/standin_report.json" "${transport%-batch}" 2> /dev/null || echo "-")
+    printf "%-12s %10s %12s %12s %14s %14s %12s\n" "$transport" "${throughput:--}" "${p50:--}" "${p99:--}" "${device_bytes:--}" "$hub_bytes" "${cpu:--}"
+done
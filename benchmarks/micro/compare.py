@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Compares two microbenchmarks --json result files and fails on regressions."""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    return report.get("label", path), {r["name"]: r for r in report["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="allowed slowdown of the median in percent (default 10)")
+    args = parser.parse_args()
+
+    baseline_label, baseline = load(args.baseline)
+    current_label, current = load(args.current)
+
+    print(f"{'benchmark':32} {baseline_label:>14} {current_label:>14} {'change':>9}")
+    regressions = []
+    for name, result in current.items():
+        if name not in baseline:
+            print(f"{name:32} {'-':>14} {result['median']:14.1f} {'new':>9}")
+            continue
+        before = baseline[name]["median"]
+        change = (result["median"] - before) / before * 100.0 if before > 0 else 0.0
+        marker = ""
+        if change > args.threshold:
+            regressions.append(name)
+            marker = " !"
+        print(f"{name:32} {before:14.1f} {result['median']:14.1f} {change:+8.1f}%{marker}")
+
+    if regressions:
+        print(f"{len(regressions)} benchmark(s) slower than the {args.threshold:.0f}% threshold: {', '.join(regressions)}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,16 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIRINGPI_H
+#define WIRINGPI_H
+
+/* The subset of wiringPi the sensor code uses, backed by fake_spi.c */
+#define INPUT 0
+#define OUTPUT 1
+
+int wiringPiSetup(void);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+void delay(unsigned int howLong);
+
+#endif /* WIRINGPI_H */
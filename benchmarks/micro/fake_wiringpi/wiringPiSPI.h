@@ -0,0 +1,10 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef WIRINGPISPI_H
+#define WIRINGPISPI_H
+
+int wiringPiSPISetup(int channel, int speed);
+int wiringPiSPIDataRW(int channel, unsigned char* data, int len);
+
+#endif /* WIRINGPISPI_H */
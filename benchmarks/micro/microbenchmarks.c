@@ -0,0 +1,388 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_IOTHUB_CLIENT
+#include "iothub_message.h"
+#endif
+
+#include "bme280.h"
+#include "mem_pool.h"
+#include "message_format.h"
+#include "sample_clock.h"
+
+/*
+ * Microbenchmarks for the per-cycle work of remote_monitoring. Each benchmark
+ * runs in batches until a time budget is used up; the reported figure is the
+ * median nanoseconds per operation over the batches, min and max show the
+ * spread. --json writes the results for compare.py.
+ */
+#define BATCHES 31
+#define INPUTS 1024
+/* the sample times start here, one second apart */
+#define SAMPLE_UNIX_US 1760779812345678ULL
+/* ten digits, like most of the epochs drawn at random */
+#define SAMPLE_EPOCH 2654435769u
+
+/* one of the firmware update reports of the advanced sample */
+static const char* firmwareReport =
+"{ 'Method' : { 'UpdateFirmware': { 'Download' : { 'Duration-s': %u, 'LastUpdate': '%s', 'Status': 'Complete' } } } }";
+
+typedef struct BENCHMARK_INPUTS_TAG
+{
+	bme280_calib_data_t calibration;
+	bme280_device_t device;
+	int32_t adcT[INPUTS];
+	int32_t adcP[INPUTS];
+	int32_t adcH[INPUTS];
+	int32_t tFine[INPUTS];
+	float tempC[INPUTS];
+	float humidityPct[INPUTS];
+} BENCHMARK_INPUTS;
+
+typedef uint64_t(*BENCHMARK_FUNCTION)(BENCHMARK_INPUTS* inputs, size_t iterations);
+
+typedef struct BENCHMARK_TAG
+{
+	const char* name;
+	BENCHMARK_FUNCTION run;
+} BENCHMARK;
+
+typedef struct BENCHMARK_RESULT_TAG
+{
+	const char* name;
+	uint64_t iterations;
+	double medianNs;
+	double minNs;
+	double maxNs;
+} BENCHMARK_RESULT;
+
+static const char* deviceId = "benchmark-device";
+/* the small and message classes of the advanced sample, reports come from the message class */
+static const MEM_POOL_CLASS Pool_classes[] = { { 64, 32 }, { 1024, 64 } };
+
+static uint64_t NowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static uint64_t CompensateTemperature(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		int32_t tFine;
+		sink += (uint64_t)bme280_compensate_T_int32(&inputs->calibration, inputs->adcT[i % INPUTS], &tFine);
+		sink += (uint64_t)tFine;
+	}
+
+	return sink;
+}
+
+static uint64_t CompensatePressure(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		sink += bme280_compensate_P_int64(&inputs->calibration, inputs->adcP[i % INPUTS], inputs->tFine[i % INPUTS]);
+	}
+
+	return sink;
+}
+
+static uint64_t CompensateHumidity(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		sink += bme280_compensate_H_int32(&inputs->calibration, inputs->adcH[i % INPUTS], inputs->tFine[i % INPUTS]);
+	}
+
+	return sink;
+}
+
+/* The whole sensor read over the fake SPI backend: status poll, burst read, compensation */
+static uint64_t ReadDevice(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		float tempC;
+		float pressurePa;
+		float humidityPct;
+		sink += (uint64_t)bme280_read_device(&inputs->device, &tempC, &pressurePa, &humidityPct);
+		sink += (uint64_t)tempC;
+	}
+
+	return sink;
+}
+
+/* SendSensorValues: format the sample time and the telemetry JSON */
+static uint64_t FormatTelemetry(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		char buffer[MESSAGE_FORMAT_TELEMETRY_SIZE];
+		SAMPLE_STAMP stamp = { SAMPLE_UNIX_US + i * 1000000ULL, i * 1000000ULL, (uint32_t)i, SAMPLE_EPOCH };
+
+		sink += message_format_telemetry(buffer, sizeof(buffer), deviceId, &stamp, inputs->tempC[i % INPUTS], inputs->humidityPct[i % INPUTS]);
+	}
+
+	return sink;
+}
+
+#ifdef HAVE_IOTHUB_CLIENT
+/* sendMessage up to the hand over: telemetry JSON plus the IoTHubMessage that copies it */
+static uint64_t ConstructMessage(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		char buffer[MESSAGE_FORMAT_TELEMETRY_SIZE];
+		SAMPLE_STAMP stamp = { SAMPLE_UNIX_US + i * 1000000ULL, i * 1000000ULL, (uint32_t)i, SAMPLE_EPOCH };
+		size_t length = message_format_telemetry(buffer, sizeof(buffer), deviceId, &stamp, inputs->tempC[i % INPUTS], inputs->humidityPct[i % INPUTS]);
+		IOTHUB_MESSAGE_HANDLE messageHandle;
+
+		if ((messageHandle = IoTHubMessage_CreateFromByteArray((const unsigned char*)buffer, length)) != NULL)
+		{
+			sink += length;
+			IoTHubMessage_Destroy(messageHandle);
+		}
+	}
+
+	return sink;
+}
+#endif
+
+/* UpdateReportedProperties: the two-pass vsnprintf into a block from the memory pools */
+static uint64_t FormatReportedProperties(BENCHMARK_INPUTS* inputs, size_t iterations)
+{
+	uint64_t sink = 0;
+	(void)inputs;
+
+	for (size_t i = 0; i < iterations; i++)
+	{
+		size_t length;
+		unsigned char* report = message_format_alloc(&length, firmwareReport, (unsigned int)(i % 600), "2017-05-04 10:20:30");
+
+		if (report != NULL)
+		{
+			sink += length;
+			mem_pool_free(report);
+		}
+	}
+
+	return sink;
+}
+
+static const BENCHMARK Benchmarks[] =
+{
+	{ "bme280_compensate_T_int32", CompensateTemperature },
+	{ "bme280_compensate_P_int64", CompensatePressure },
+	{ "bme280_compensate_H_int32", CompensateHumidity },
+	{ "bme280_read_device_fake_spi", ReadDevice },
+	{ "telemetry_json_sprintf", FormatTelemetry },
+#ifdef HAVE_IOTHUB_CLIENT
+	{ "send_message_construction", ConstructMessage },
+#endif
+	{ "reported_properties_format", FormatReportedProperties }
+};
+
+static int CompareDouble(const void* left, const void* right)
+{
+	double a = *(const double*)left;
+	double b = *(const double*)right;
+	return (a > b) - (a < b);
+}
+
+static void PrepareInputs(BENCHMARK_INPUTS* inputs)
+{
+	srand(1);
+	for (size_t i = 0; i < INPUTS; i++)
+	{
+		/* raw readings from about 0 to 40 C, 950 to 1050 hPa and 10 to 90 % */
+		inputs->adcT[i] = 480000 + rand() % 80000;
+		inputs->adcP[i] = 380000 + rand() % 60000;
+		inputs->adcH[i] = 0x4000 + rand() % 0x4000;
+		inputs->tempC[i] = (float)(rand() % 4000) / 100.0f;
+		inputs->humidityPct[i] = (float)(rand() % 8000) / 100.0f + 10.0f;
+		(void)bme280_compensate_T_int32(&inputs->calibration, inputs->adcT[i], &inputs->tFine[i]);
+	}
+}
+
+/* Grows the batch until it takes about budgetNs / BATCHES, then times BATCHES batches */
+static BENCHMARK_RESULT RunBenchmark(const BENCHMARK* benchmark, BENCHMARK_INPUTS* inputs, uint64_t budgetNs)
+{
+	static volatile uint64_t sink;
+	BENCHMARK_RESULT result;
+	double perOpNs[BATCHES];
+	uint64_t batchNs = budgetNs / BATCHES;
+	size_t batch = 1;
+
+	for (;;)
+	{
+		uint64_t start = NowNs();
+		sink += benchmark->run(inputs, batch);
+		if (NowNs() - start >= batchNs / 4 || batch >= ((size_t)1 << 30))
+		{
+			break;
+		}
+		batch *= 2;
+	}
+	batch *= 4;
+
+	for (int i = 0; i < BATCHES; i++)
+	{
+		uint64_t start = NowNs();
+		sink += benchmark->run(inputs, batch);
+		perOpNs[i] = (double)(NowNs() - start) / (double)batch;
+	}
+	qsort(perOpNs, BATCHES, sizeof(double), CompareDouble);
+
+	result.name = benchmark->name;
+	result.iterations = (uint64_t)batch * BATCHES;
+	result.medianNs = perOpNs[BATCHES / 2];
+	result.minNs = perOpNs[0];
+	result.maxNs = perOpNs[BATCHES - 1];
+
+	return result;
+}
+
+static int WriteJson(const char* path, const char* label, const BENCHMARK_RESULT* results, size_t count)
+{
+	int result;
+	FILE* fp;
+
+	if ((fp = fopen(path, "w")) == NULL)
+	{
+		printf("Failed to open %s\n", path);
+		result = __LINE__;
+	}
+	else
+	{
+		fprintf(fp, "{\n  \"label\": \"%s\",\n  \"timestamp\": %ld,\n  \"unit\": \"ns/op\",\n  \"results\": [", label, (long)time(NULL));
+		for (size_t i = 0; i < count; i++)
+		{
+			fprintf(fp, "%s\n    { \"name\": \"%s\", \"iterations\": %llu, \"median\": %.3f, \"min\": %.3f, \"max\": %.3f }",
+				(i == 0) ? "" : ",", results[i].name, (unsigned long long)results[i].iterations,
+				results[i].medianNs, results[i].minNs, results[i].maxNs);
+		}
+		fprintf(fp, "\n  ]\n}\n");
+		fclose(fp);
+		result = 0;
+	}
+
+	return result;
+}
+
+static void PrintUsage(const char* program)
+{
+	printf("usage: %s [options]\n"
+		"  --json <file>       write the results as JSON\n"
+		"  --label <text>      label stored with the JSON results, e.g. the firmware version\n"
+		"  --filter <text>     run only benchmarks whose name contains text\n"
+		"  --time-ms <ms>      time budget per benchmark (default 1000)\n", program);
+}
+
+int main(int argc, char** argv)
+{
+	int result = 0;
+	const char* jsonPath = NULL;
+	const char* label = "unlabeled";
+	const char* filter = NULL;
+	unsigned long budgetMs = 1000;
+
+	for (int i = 1; i < argc && result == 0; i += 2)
+	{
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (value == NULL)
+		{
+			result = __LINE__;
+		}
+		else if (strcmp(argv[i], "--json") == 0)
+		{
+			jsonPath = value;
+		}
+		else if (strcmp(argv[i], "--label") == 0)
+		{
+			label = value;
+		}
+		else if (strcmp(argv[i], "--filter") == 0)
+		{
+			filter = value;
+		}
+		else if (strcmp(argv[i], "--time-ms") == 0)
+		{
+			budgetMs = strtoul(value, NULL, 10);
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
+
+	if (result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		static BENCHMARK_INPUTS inputs;
+		BENCHMARK_RESULT results[sizeof(Benchmarks) / sizeof(Benchmarks[0])];
+		size_t count = 0;
+
+		if (bme280_init_device(&inputs.device, 0) != 1)
+		{
+			printf("Fake BME280 did not initialize\n");
+			result = EXIT_FAILURE;
+		}
+		else if (mem_pool_init(Pool_classes, sizeof(Pool_classes) / sizeof(Pool_classes[0])) != 0)
+		{
+			printf("Memory pools did not initialize\n");
+			result = EXIT_FAILURE;
+		}
+		else
+		{
+			inputs.calibration = inputs.device.Calib_data;
+			PrepareInputs(&inputs);
+
+			printf("%-32s %14s %12s %12s %12s\n", "benchmark", "iterations", "median ns", "min ns", "max ns");
+			for (size_t i = 0; i < sizeof(Benchmarks) / sizeof(Benchmarks[0]); i++)
+			{
+				if (filter == NULL || strstr(Benchmarks[i].name, filter) != NULL)
+				{
+					results[count] = RunBenchmark(&Benchmarks[i], &inputs, (uint64_t)budgetMs * 1000000ULL);
+					printf("%-32s %14llu %12.1f %12.1f %12.1f\n", results[count].name,
+						(unsigned long long)results[count].iterations,
+						results[count].medianNs, results[count].minNs, results[count].maxNs);
+					count++;
+				}
+			}
+
+			if (jsonPath != NULL && WriteJson(jsonPath, label, results, count) != 0)
+			{
+				result = EXIT_FAILURE;
+			}
+			mem_pool_deinit();
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,343 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "message_format.h"
+#include "payload_compress.h"
+#include "sample_clock.h"
+
+/*
+ * What payload_compress costs and saves on the messages remote_monitoring
+ * sends: single readings, arrays of 2 to 32 readings as a batching sender
+ * would build them, the window summary and the anomaly alert. For each
+ * message and level it prints the body size, the compressed size without and
+ * with the preset dictionary, and the median nanoseconds of one
+ * payload_compress. Run it on the target to pick --compress-threshold: the
+ * smallest body where the bytes saved are worth the time spent.
+ */
+#define MESSAGES 256
+#define BODY_SIZE 8192
+#define ROUNDS 15
+
+/* Keep in sync with the summary format in remote_monitoring.c, the telemetry comes from message_format.h */
+static const char* summaryData = "{"
+"\"DeviceID\": \"%s\","
+"\"Temperature\" : %f,"
+"\"Humidity\" : %f,"
+"\"WindowStart\" : \"%s\","
+"\"WindowEnd\" : \"%s\","
+"\"FirstSequence\" : %u,"
+"\"LastSequence\" : %u,"
+"\"Epoch\" : %u,"
+"\"WindowSeconds\" : %.1f,"
+"\"Samples\" : %zu,"
+"\"TemperatureStats\" : { \"Min\" : %f, \"Max\" : %f, \"StdDev\" : %f, \"P50\" : %f, \"P95\" : %f },"
+"\"HumidityStats\" : { \"Min\" : %f, \"Max\" : %f, \"StdDev\" : %f, \"P50\" : %f, \"P95\" : %f } }";
+
+static const char* alertData = "{"
+"\"DeviceID\": \"%s\","
+"\"Alert\" : \"%s\","
+"\"Sensor\" : \"%s\","
+"\"Value\" : %f,"
+"\"Mean\" : %f,"
+"\"ZScore\" : %f,"
+"\"RatePerMinute\" : %f,"
+"\"SampleTime\" : \"%s\","
+"\"Series\" : \"%s\","
+"\"Sequence\" : %u,"
+"\"Epoch\" : %u } ";
+
+static const char* deviceId = "benchmark-device";
+/* samples are a second apart, with the few milliseconds of jitter of the sampling loop */
+#define SAMPLE_UNIX_US 1760779812345678ULL
+#define SAMPLE_INTERVAL_US 1000000ULL
+/* ten digits, like most of the epochs drawn at random */
+#define SAMPLE_EPOCH 2654435769u
+
+typedef struct MESSAGE_SET_TAG
+{
+	const char* name;
+	size_t count;
+	size_t sizes[MESSAGES];
+	unsigned char bodies[MESSAGES][BODY_SIZE];
+} MESSAGE_SET;
+
+static uint64_t NowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int CompareU64(const void* left, const void* right)
+{
+	uint64_t a = *(const uint64_t*)left;
+	uint64_t b = *(const uint64_t*)right;
+	return (a > b) - (a < b);
+}
+
+/* A random walk around room conditions, the way the BME280 readings move */
+static void NextReading(double* tempC, double* humidityPct)
+{
+	*tempC += ((rand() % 21) - 10) / 100.0;
+	*humidityPct += ((rand() % 41) - 20) / 100.0;
+}
+
+static void BuildTelemetry(MESSAGE_SET* set, size_t samples)
+{
+	double tempC = 21.5;
+	double humidityPct = 45.0;
+	uint32_t sequence = 0;
+
+	for (size_t m = 0; m < MESSAGES; m++)
+	{
+		char* body = (char*)set->bodies[m];
+		size_t length = 0;
+
+		if (samples > 1)
+		{
+			body[length++] = '[';
+		}
+		for (size_t s = 0; s < samples; s++)
+		{
+			SAMPLE_STAMP stamp = { SAMPLE_UNIX_US + sequence * SAMPLE_INTERVAL_US + (uint64_t)(rand() % 5000), 0, sequence, SAMPLE_EPOCH };
+
+			NextReading(&tempC, &humidityPct);
+			length += message_format_telemetry(body + length, BODY_SIZE - length, deviceId, &stamp, (float)tempC, (float)humidityPct);
+			sequence++;
+			if (samples > 1)
+			{
+				body[length++] = (s + 1 < samples) ? ',' : ']';
+			}
+		}
+		set->sizes[m] = length;
+	}
+	set->count = MESSAGES;
+}
+
+static void BuildSummaries(MESSAGE_SET* set)
+{
+	double tempC = 21.5;
+	double humidityPct = 45.0;
+
+	for (size_t m = 0; m < MESSAGES; m++)
+	{
+		char windowStart[SAMPLE_CLOCK_TEXT_SIZE];
+		char windowEnd[SAMPLE_CLOCK_TEXT_SIZE];
+
+		NextReading(&tempC, &humidityPct);
+		(void)sample_clock_format(SAMPLE_UNIX_US + m * 60 * SAMPLE_INTERVAL_US, windowStart, sizeof(windowStart));
+		(void)sample_clock_format(SAMPLE_UNIX_US + (m * 60 + 59) * SAMPLE_INTERVAL_US, windowEnd, sizeof(windowEnd));
+		set->sizes[m] = (size_t)snprintf((char*)set->bodies[m], BODY_SIZE, summaryData, deviceId, tempC, humidityPct,
+			windowStart, windowEnd, (unsigned int)(m * 60), (unsigned int)(m * 60 + 59), SAMPLE_EPOCH, 59.0, (size_t)60,
+			tempC - 0.3, tempC + 0.4, 0.12, tempC + 0.01, tempC + 0.3,
+			humidityPct - 1.1, humidityPct + 0.9, 0.45, humidityPct - 0.05, humidityPct + 0.8);
+	}
+	set->count = MESSAGES;
+}
+
+static void BuildAlerts(MESSAGE_SET* set)
+{
+	double tempC = 21.5;
+	double humidityPct = 45.0;
+
+	for (size_t m = 0; m < MESSAGES; m++)
+	{
+		char sampleTime[SAMPLE_CLOCK_TEXT_SIZE];
+
+		NextReading(&tempC, &humidityPct);
+		(void)sample_clock_format(SAMPLE_UNIX_US + m * 37 * SAMPLE_INTERVAL_US, sampleTime, sizeof(sampleTime));
+		set->sizes[m] = (size_t)snprintf((char*)set->bodies[m], BODY_SIZE, alertData, deviceId,
+			(m % 2) ? "RateOfChange" : "ZScore", (m % 3) ? "Temperature" : "Humidity",
+			tempC + 5.0, tempC, 4.2 + (m % 7) / 10.0, (m % 2) ? 1.8 : 0.0, sampleTime,
+			(m % 5) ? "Watch" : "Telemetry", (unsigned int)(m * 37), SAMPLE_EPOCH);
+	}
+	set->count = MESSAGES;
+}
+
+/* Compressed size without the dictionary, with the same window and memory as payload_compress */
+static size_t CompressPlain(const unsigned char* body, size_t size, int level)
+{
+	unsigned char out[BODY_SIZE + 64];
+	z_stream stream;
+	size_t result = 0;
+
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, level, Z_DEFLATED, 12, 5, Z_DEFAULT_STRATEGY) == Z_OK)
+	{
+		stream.next_in = (Bytef*)body;
+		stream.avail_in = (uInt)size;
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+		{
+			result = (size_t)stream.total_out;
+		}
+		(void)deflateEnd(&stream);
+	}
+
+	return result;
+}
+
+/* Inflates with the dictionary and compares, a benchmark of a broken encoder is worthless */
+static int Verify(const unsigned char* body, size_t size, const unsigned char* compressed, size_t compressedSize)
+{
+	unsigned char out[BODY_SIZE];
+	const unsigned char* dictionary;
+	size_t dictionarySize;
+	z_stream stream;
+	int result = -1;
+
+	dictionary = payload_compress_dictionary(&dictionarySize);
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) == Z_OK)
+	{
+		int status;
+
+		stream.next_in = (Bytef*)compressed;
+		stream.avail_in = (uInt)compressedSize;
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		status = inflate(&stream, Z_FINISH);
+		if (status == Z_NEED_DICT && stream.adler == payload_compress_dictionary_id() &&
+			inflateSetDictionary(&stream, dictionary, (uInt)dictionarySize) == Z_OK)
+		{
+			status = inflate(&stream, Z_FINISH);
+		}
+		if (status == Z_STREAM_END && stream.total_out == size && memcmp(out, body, size) == 0)
+		{
+			result = 0;
+		}
+		(void)inflateEnd(&stream);
+	}
+
+	return result;
+}
+
+static int Measure(const MESSAGE_SET* set, int level)
+{
+	static uint64_t roundNs[ROUNDS];
+	unsigned char out[BODY_SIZE];
+	size_t rawBytes = 0;
+	size_t plainBytes = 0;
+	size_t dictionaryBytes = 0;
+	double medianNs;
+	int result = 0;
+
+	if (payload_compress_init(level) != 0)
+	{
+		result = __LINE__;
+	}
+	else
+	{
+		for (size_t m = 0; m < set->count && result == 0; m++)
+		{
+			size_t size = payload_compress(set->bodies[m], set->sizes[m], out, sizeof(out));
+
+			rawBytes += set->sizes[m];
+			plainBytes += CompressPlain(set->bodies[m], set->sizes[m], level);
+			/* a body that does not shrink is sent as it is */
+			dictionaryBytes += (size != 0) ? size : set->sizes[m];
+			if (size != 0 && Verify(set->bodies[m], set->sizes[m], out, size) != 0)
+			{
+				printf("%s: message %zu does not inflate to its body\n", set->name, m);
+				result = __LINE__;
+			}
+		}
+
+		for (int round = 0; round < ROUNDS && result == 0; round++)
+		{
+			uint64_t startNs = NowNs();
+			for (size_t m = 0; m < set->count; m++)
+			{
+				(void)payload_compress(set->bodies[m], set->sizes[m], out, sizeof(out));
+			}
+			roundNs[round] = NowNs() - startNs;
+		}
+	}
+
+	if (result == 0)
+	{
+		qsort(roundNs, ROUNDS, sizeof(uint64_t), CompareU64);
+		medianNs = (double)roundNs[ROUNDS / 2] / set->count;
+		printf("%-14s %5d %9.1f %9.1f %9.1f %7.1f%% %9.0f %9.1f\n", set->name, level,
+			(double)rawBytes / set->count, (double)plainBytes / set->count, (double)dictionaryBytes / set->count,
+			100.0 * dictionaryBytes / rawBytes, medianNs,
+			(rawBytes > dictionaryBytes) ? medianNs * set->count / (rawBytes - dictionaryBytes) : 0.0);
+	}
+
+	return result;
+}
+
+static void PrintUsage(const char* program)
+{
+	printf("usage: %s [options]\n"
+		"  --level <0-9>       measure only this deflate level (default 1, 6 and 9)\n", program);
+}
+
+int main(int argc, char** argv)
+{
+	static MESSAGE_SET sets[8];
+	static const size_t batchSizes[] = { 1, 2, 4, 8, 16, 32 };
+	int levels[] = { 1, PAYLOAD_COMPRESS_DEFAULT_LEVEL, 9 };
+	size_t levelCount = sizeof(levels) / sizeof(levels[0]);
+	size_t setCount = 0;
+	int result = 0;
+
+	for (int i = 1; i < argc && result == 0; i++)
+	{
+		if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+		{
+			levels[0] = atoi(argv[++i]);
+			levelCount = 1;
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
+
+	if (result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		static char names[sizeof(batchSizes) / sizeof(batchSizes[0])][16];
+
+		srand(1);
+		for (size_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); b++)
+		{
+			snprintf(names[b], sizeof(names[b]), "telemetry x%zu", batchSizes[b]);
+			sets[setCount].name = names[b];
+			BuildTelemetry(&sets[setCount++], batchSizes[b]);
+		}
+		sets[setCount].name = "summary";
+		BuildSummaries(&sets[setCount++]);
+		sets[setCount].name = "alert";
+		BuildAlerts(&sets[setCount++]);
+
+		printf("%-14s %5s %9s %9s %9s %8s %9s %9s\n", "message", "level", "bytes", "plain", "dict", "ratio", "ns", "ns/saved");
+		for (size_t l = 0; l < levelCount && result == 0; l++)
+		{
+			for (size_t s = 0; s < setCount && result == 0; s++)
+			{
+				if (Measure(&sets[s], levels[l]) != 0)
+				{
+					result = EXIT_FAILURE;
+				}
+			}
+		}
+		payload_compress_deinit();
+	}
+
+	return result;
+}
@@ -0,0 +1,169 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bme280.h"
+#include "sensor_trace.h"
+
+/*
+ * Feeds a sensor capture (remote_monitoring --capture-sensor) through this
+ * build's BME280 driver and compensation. The decoded readings go to a CSV
+ * file so the output of two builds can be diffed; the timing summary shows
+ * what one bme280_read_device costs without the SPI bus.
+ */
+#define SENSOR_REPLAY_CHIPS 2
+
+static uint64_t NowNs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static int CompareU64(const void* left, const void* right)
+{
+	uint64_t a = *(const uint64_t*)left;
+	uint64_t b = *(const uint64_t*)right;
+	return (a > b) - (a < b);
+}
+
+static void PrintUsage(const char* program)
+{
+	printf("usage: %s <capture> [options]\n"
+		"  --csv <file>        write capture time, chip enable, temperature, pressure and humidity per reading\n"
+		"  --realtime          pace the readings like the capture instead of replaying at full speed\n", program);
+}
+
+int main(int argc, char** argv)
+{
+	int result = 0;
+	const char* csvPath = NULL;
+	SENSOR_REPLAY_PACE pace = SENSOR_REPLAY_MAX_SPEED;
+
+	for (int i = 2; i < argc && result == 0; i++)
+	{
+		if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+		{
+			csvPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--realtime") == 0)
+		{
+			pace = SENSOR_REPLAY_REALTIME;
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
+
+	if (argc < 2 || result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else if (sensor_trace_replay_open(argv[1], pace) != 0)
+	{
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		FILE* csv = NULL;
+		uint64_t* readNs = NULL;
+		size_t readCount = 0;
+		size_t readCapacity = 0;
+		uint64_t replayStart = NowNs();
+
+		if (csvPath != NULL && (csv = fopen(csvPath, "w")) == NULL)
+		{
+			printf("Failed to create %s\n", csvPath);
+			result = EXIT_FAILURE;
+		}
+		else
+		{
+			if (csv != NULL)
+			{
+				fprintf(csv, "capture_us,chip_enable,temperature_c,pressure_pa,humidity_pct\n");
+			}
+
+			for (int chip = 0; chip < SENSOR_REPLAY_CHIPS && result == 0; chip++)
+			{
+				bme280_device_t device;
+				float tempC;
+				float pressurePa;
+				float humidityPct;
+
+				if (!sensor_trace_replay_has_chip(chip))
+				{
+					continue;
+				}
+				if (bme280_init_device(&device, chip) != 1)
+				{
+					printf("Chip enable %d in the capture does not identify as a BME280\n", chip);
+					result = EXIT_FAILURE;
+					break;
+				}
+
+				for (;;)
+				{
+					uint64_t start = NowNs();
+					if (bme280_read_device(&device, &tempC, &pressurePa, &humidityPct) != 1)
+					{
+						break;
+					}
+					start = NowNs() - start;
+
+					if (readCount == readCapacity)
+					{
+						size_t newCapacity = (readCapacity == 0) ? 4096 : readCapacity * 2;
+						uint64_t* grown = realloc(readNs, newCapacity * sizeof(uint64_t));
+						if (grown == NULL)
+						{
+							result = EXIT_FAILURE;
+							break;
+						}
+						readNs = grown;
+						readCapacity = newCapacity;
+					}
+					readNs[readCount++] = start;
+
+					if (csv != NULL)
+					{
+						fprintf(csv, "%llu,%d,%.2f,%.2f,%.3f\n",
+							(unsigned long long)sensor_trace_replay_timestamp_us(), chip, tempC, pressurePa, humidityPct);
+					}
+				}
+			}
+
+			if (csv != NULL)
+			{
+				fclose(csv);
+			}
+		}
+
+		if (result == 0)
+		{
+			double elapsedSeconds = (NowNs() - replayStart) / 1e9;
+
+			printf("readings: %zu in %.3f s\n", readCount, elapsedSeconds);
+			if (readCount > 0)
+			{
+				qsort(readNs, readCount, sizeof(uint64_t), CompareU64);
+				printf("bme280_read_device: p50 %llu ns, p99 %llu ns, max %llu ns\n",
+					(unsigned long long)readNs[readCount / 2],
+					(unsigned long long)readNs[(readCount * 99) / 100],
+					(unsigned long long)readNs[readCount - 1]);
+			}
+		}
+
+		free(readNs);
+		sensor_trace_replay_close();
+	}
+
+	return result;
+}
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ADAPTIVE_INTERVAL_H
+#define ADAPTIVE_INTERVAL_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Picks the telemetry interval from how fast the readings move. A reading is
+ * worth sending once temperature or humidity has moved by about one step
+ * (ADAPTIVE_INTERVAL_*_STEP), so the interval is the time one step takes at
+ * the smoothed rate of change, clamped to [minMs, maxMs]. A jump is followed
+ * at once, the interval only grows back as the smoothed rate decays.
+ */
+#define ADAPTIVE_INTERVAL_TEMPERATURE_STEP_C 0.2
+#define ADAPTIVE_INTERVAL_HUMIDITY_STEP_PCT 1.0
+/* weight of the newest rate in the moving average */
+#define ADAPTIVE_INTERVAL_SMOOTHING 0.25
+/* the hub is not meant for faster telemetry than this */
+#define ADAPTIVE_INTERVAL_FLOOR_MS 100
+
+typedef struct ADAPTIVE_INTERVAL_TAG
+{
+	int primed;
+	uint64_t lastUs;
+	double lastTemperatureC;
+	double lastHumidityPct;
+	/* steps per second */
+	double smoothedRate;
+	unsigned int intervalMs;
+} ADAPTIVE_INTERVAL;
+
+void adaptive_interval_init(ADAPTIVE_INTERVAL* adaptive, unsigned int initialMs);
+
+/* Feeds one reading taken at nowUs and returns the interval until the next one */
+unsigned int adaptive_interval_next(ADAPTIVE_INTERVAL* adaptive, uint64_t nowUs, float temperatureC, float humidityPct,
+	unsigned int minMs, unsigned int maxMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADAPTIVE_INTERVAL_H */
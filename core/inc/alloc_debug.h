@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ALLOC_DEBUG_H
+#define ALLOC_DEBUG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Heap accounting, compiled in with the enable_alloc_debug CMake option
+ * (ENABLE_ALLOC_DEBUG). It replaces malloc, calloc, realloc and free for the
+ * whole process, the SDK included, and passes them on to glibc. Every live
+ * allocation is counted against the code that made it, the return address of
+ * the call, so SIGUSR2 or alloc_debug_report lists the call sites holding the
+ * most bytes. A site that keeps growing over the days is a leak.
+ *
+ * alloc_debug_seal marks the end of startup. From then on each site that
+ * still allocates is counted; in check mode the first allocation of each
+ * site is also reported on stderr with its backtrace. The steady state should
+ * leave only the SDK's per-message allocations there.
+ *
+ * Without ENABLE_ALLOC_DEBUG every call expands to nothing; asking for check
+ * mode then fails.
+ */
+#ifdef ENABLE_ALLOC_DEBUG
+
+/* Installs the SIGUSR2 handler, check 1 reports allocations after alloc_debug_seal */
+int alloc_debug_init(int check);
+void alloc_debug_deinit(void);
+void alloc_debug_seal(void);
+/* Writes the call sites holding the most live bytes to stderr */
+void alloc_debug_report(void);
+
+#else
+
+#define alloc_debug_init(check) ((check) ? (printf("Allocation checks are not compiled in, see enable_alloc_debug\n"), -1) : 0)
+#define alloc_debug_deinit() ((void)0)
+#define alloc_debug_seal() ((void)0)
+#define alloc_debug_report() ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ALLOC_DEBUG_H */
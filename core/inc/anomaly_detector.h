@@ -0,0 +1,91 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef ANOMALY_DETECTOR_H
+#define ANOMALY_DETECTOR_H
+
+#include <stdint.h>
+
+#include "edge_aggregate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Streaming anomaly detection on the sensor samples. Each channel keeps an
+ * exponentially weighted mean and variance; a sample whose z-score against
+ * them reaches zThreshold is an anomaly. Independently, a temperature change
+ * faster than rateThreshold degrees per minute is one. After an anomaly the
+ * channel stays quiet until a sample is back within half the thresholds, so a
+ * sustained excursion raises one alert rather than one per sample.
+ *
+ * The rate is the slope of a least-squares line through the temperature
+ * samples, weighted down with a time constant of ANOMALY_DETECTOR_RATE_WINDOW_S
+ * seconds, and is checked once the samples span that long. The slope between
+ * two reads a second apart would turn one 0.01 C step of the sensor into
+ * 0.6 C/min; over a minute of samples the noise averages out, whatever the
+ * sampling period.
+ */
+#define ANOMALY_DETECTOR_SMOOTHING 0.05
+/* samples before the z-score is trusted */
+#define ANOMALY_DETECTOR_WARMUP 20
+#define ANOMALY_DETECTOR_RATE_WINDOW_S 60
+
+typedef enum ANOMALY_KIND_TAG
+{
+	ANOMALY_NONE,
+	ANOMALY_ZSCORE,
+	ANOMALY_RATE
+} ANOMALY_KIND;
+
+typedef struct ANOMALY_EVENT_TAG
+{
+	ANOMALY_KIND kind;
+	EDGE_CHANNEL channel;
+	double value;
+	double mean;
+	double zscore;
+	/* units per minute */
+	double rate;
+} ANOMALY_EVENT;
+
+typedef struct ANOMALY_CHANNEL_TAG
+{
+	double mean;
+	double variance;
+	int alerting;
+} ANOMALY_CHANNEL;
+
+/* Weighted sums of the temperature samples for the slope, times in seconds before the latest sample */
+typedef struct ANOMALY_TREND_TAG
+{
+	double weight;
+	double time;
+	double time2;
+	double value;
+	double timeValue;
+} ANOMALY_TREND;
+
+typedef struct ANOMALY_DETECTOR_TAG
+{
+	/* 0 disables the check */
+	double zThreshold;
+	double rateThreshold;
+	unsigned int samples;
+	uint64_t firstUs;
+	uint64_t lastUs;
+	ANOMALY_CHANNEL channels[EDGE_CHANNEL_COUNT];
+	ANOMALY_TREND trend;
+} ANOMALY_DETECTOR;
+
+void anomaly_detector_init(ANOMALY_DETECTOR* detector, double zThreshold, double rateThresholdPerMinute);
+
+/* Feeds one sample, returns 1 and fills event when it starts an anomaly */
+int anomaly_detector_add(ANOMALY_DETECTOR* detector, uint64_t nowUs, const double values[EDGE_CHANNEL_COUNT], ANOMALY_EVENT* event);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ANOMALY_DETECTOR_H */
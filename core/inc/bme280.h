@@ -0,0 +1,127 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// bme280.h:
+// SPI based interface to read temperature, pressure and humidity samples from
+// a BME280 module.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __BME280_H
+#define __BME280_H
+
+#include <stdint.h>
+
+// Calibration data as read from the device.
+typedef struct
+{
+  uint16_t dig_T1;
+  int16_t  dig_T2;
+  int16_t  dig_T3;
+
+  uint16_t dig_P1;
+  int16_t  dig_P2;
+  int16_t  dig_P3;
+  int16_t  dig_P4;
+  int16_t  dig_P5;
+  int16_t  dig_P6;
+  int16_t  dig_P7;
+  int16_t  dig_P8;
+  int16_t  dig_P9;
+
+  uint8_t  dig_H1;
+  int16_t  dig_H2;
+  uint16_t dig_H3;
+  int16_t  dig_H4;
+  int16_t  dig_H5;
+  int8_t   dig_H6;
+} bme280_calib_data_t;
+
+// One BME280 module. Several modules (one per SPI chip enable) can be used
+// side by side, each with its own calibration data.
+typedef struct
+{
+  int Chip_enable__i;
+  bme280_calib_data_t Calib_data;
+} bme280_device_t;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Call this after setting the chip select (or SPI Enable) pin (via
+// bme280_set_cs_pin()), and before calling the bmp280_read function.
+// Return: 0 if the module was not found.
+//         1 if the module was readable, and verified to be a BMP280, and the
+//           calibration data was read.
+int bme280_init(int Chip_enable_to_use__i);
+
+///////////////////////////////////////////////////////////////////////////////
+// Prerequisite:
+// You must call wiringPiSetup before calling this function. For example:
+//  int Result__i = wiringPiSetup();
+//  if (Result__i != 0) exit(Result__i);
+// You must call wiringPiSPISetup before calling this function. For example:
+//  int Spi_fd__i = wiringPiSPISetup(Spi_channel__i, Spi_clock__i);
+//  if (Spi_fd__i < 0)
+//  {
+//    printf("Can't setup SPI, error %i calling wiringPiSPISetup(%i, %i)  %s\n",
+//      Spi_fd__i, Spi_channel__i, Spi_clock__i, strerror(Spi_fd__i));
+//    exit(Spi_fd__i);
+//  }
+//
+// Param: Temp_C__fp  Pointer to a float to receive the current temperature in
+//                    degrees Celcius. Only set if read is successful.
+// Param: Pres_Pa__fp  Pointer to a float to receive the current pressure
+//                     as hPa. Only set if read is successful.
+// Param: Hum_pct__fp  Pointer to a float to receive the current humidity
+//                     as a percentage. Only set if read is successful.
+// Return: If wiringPi gets an error, this will be < 0
+//         If the read attempts fail, this will be 1
+//         If the read succeeds within the available retries, returns 0
+int bme280_read_sensors(float * Temp_C__fp, float * Pres_Pa__fp,
+  float * Hum_pct__fp);
+
+///////////////////////////////////////////////////////////////////////////////
+// Same as bme280_init and bme280_read_sensors, for the module described by
+// Device__p instead of the single module used by those functions.
+int bme280_init_device(bme280_device_t * Device__p, int Chip_enable_to_use__i);
+int bme280_read_device(bme280_device_t * Device__p, float * Temp_C__fp,
+  float * Pres_Pa__fp, float * Hum_pct__fp);
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw ADC values of one measurement, 20-bit temperature and pressure and
+// 16-bit humidity, exactly as bme280_read_device feeds them to the
+// compensation formulas.
+typedef struct
+{
+  int32_t adc_T;
+  int32_t adc_P;
+  int32_t adc_H;
+} bme280_raw_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Like bme280_read_sensors and bme280_read_device, without the compensation.
+// Return: 1 if the read succeeded, 0 otherwise.
+int bme280_read_raw(bme280_raw_t * Raw__p);
+int bme280_read_raw_device(bme280_device_t * Device__p, bme280_raw_t * Raw__p);
+
+///////////////////////////////////////////////////////////////////////////////
+// The calibration data of the module used by bme280_init(), valid after a
+// successful bme280_init().
+const bme280_calib_data_t * bme280_calibration(void);
+
+///////////////////////////////////////////////////////////////////////////////
+// Compensation formulas from the BME280 datasheet. They only depend on the
+// calibration data, so they can be used without a module attached; they live
+// in bme280_compensate.c, which builds without wiringPi.
+// bme280_compensate_T_int32 returns DegC * 100 and stores t_fine, which the
+// pressure and humidity formulas need, in T_fine__i32p.
+// bme280_compensate_P_int64 returns Pa in Q24.8 format.
+// bme280_compensate_H_int32 returns %RH in Q22.10 format.
+int32_t bme280_compensate_T_int32(const bme280_calib_data_t * Calib__p,
+  int32_t adc_T, int32_t * T_fine__i32p);
+uint32_t bme280_compensate_P_int64(const bme280_calib_data_t * Calib__p,
+  int32_t adc_P, int32_t T_fine__i32);
+uint32_t bme280_compensate_H_int32(const bme280_calib_data_t * Calib__p,
+  int32_t adc_H, int32_t T_fine__i32);
+
+#endif//__BME280_H
+
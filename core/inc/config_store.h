@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Device configuration and update state in one binary file:
+ *
+ *   header:  "RMSTORE\0" u16 version u16 header size u32 payload length
+ *            u32 CRC-32 of the payload u32 generation
+ *   payload: records of u16 key, u16 length, <length> bytes, little endian
+ *
+ * Loading maps the file read-only and rejects it unless the magic, version,
+ * length and checksum all match. Saving writes a temporary file next to it,
+ * fsyncs it and renames it over the old one, so after a power cut the file
+ * holds either the previous or the new contents. Keys a build does not know
+ * are skipped, new settings only need a new key.
+ */
+#define CONFIG_STORE_VERSION 1
+#define CONFIG_STORE_ENV "REMOTE_MONITORING_CONFIG"
+#define CONFIG_STORE_DEFAULT_PATH "/home/pi/iot-remote-monitoring-c-raspberrypi-getstartedkit/advanced/config/store"
+
+#define CONFIG_STORE_DEVICE_ID_SIZE 129
+#define CONFIG_STORE_CONNECTION_STRING_SIZE 512
+#define CONFIG_STORE_TRANSPORT_SIZE 16
+
+typedef enum CONFIG_STORE_RESULT_TAG
+{
+	CONFIG_STORE_OK,
+	CONFIG_STORE_MISSING,
+	CONFIG_STORE_CORRUPT,
+	CONFIG_STORE_ERROR
+} CONFIG_STORE_RESULT;
+
+typedef struct CONFIG_STORE_TAG
+{
+	/* bumped by every save */
+	uint32_t generation;
+
+	char deviceId[CONFIG_STORE_DEVICE_ID_SIZE];
+	char connectionString[CONFIG_STORE_CONNECTION_STRING_SIZE];
+
+	/* firmware update anchors in unix seconds, 0 when no update is in progress */
+	int64_t updateBegin;
+	int64_t rebootBegin;
+
+	/* added to every reading before it is sent */
+	float temperatureOffsetC;
+	float pressureOffsetPa;
+	float humidityOffsetPct;
+
+	/* tuning knobs, 0 keeps the built-in default */
+	uint32_t telemetryIntervalS;
+	/* the millisecond interval wins over the seconds, adaptive telemetry when min < max */
+	uint32_t telemetryIntervalMs;
+	uint32_t telemetryIntervalMinMs;
+	uint32_t telemetryIntervalMaxMs;
+	/* one summary per window instead of every reading when the window is set, 0 hop tumbles */
+	uint32_t aggregationWindowS;
+	uint32_t aggregationHopS;
+	/* anomaly alerts, a negative threshold disables that check */
+	float anomalyZThreshold;
+	float anomalyRatePerMinute;
+	uint32_t anomalySampleMs;
+	/* IoT Hub connection, a retry timeout of 0 retries forever */
+	uint32_t sasTokenLifetimeS;
+	uint32_t retryTimeoutS;
+	/* mqtt, mqtt-ws, amqp, amqp-ws, http or http-batch, empty keeps mqtt */
+	char transport[CONFIG_STORE_TRANSPORT_SIZE];
+	/* message bodies of at least this many bytes are deflated, 0 sends them as they are */
+	uint32_t compressThresholdBytes;
+	/* readings per sample block message instead of one JSON message each, 0 sends JSON */
+	uint32_t sampleBlockSamples;
+	/* the blocks carry raw BME280 frames for the backend to compensate when not 0 */
+	uint32_t sampleBlockRaw;
+	uint16_t metricsPort;
+} CONFIG_STORE;
+
+/* The explicit path if given, else $REMOTE_MONITORING_CONFIG, else the default */
+const char* config_store_path(const char* explicitPath);
+
+void config_store_defaults(CONFIG_STORE* config);
+CONFIG_STORE_RESULT config_store_load(const char* path, CONFIG_STORE* config);
+CONFIG_STORE_RESULT config_store_save(const char* path, CONFIG_STORE* config);
+
+/*
+ * Seeds a configuration from the text files used before the store: deviceinfo
+ * (device id and connection string lines) and lastupdate (update and reboot
+ * begin times), both read from the directory of path.
+ */
+CONFIG_STORE_RESULT config_store_import_legacy(const char* path, CONFIG_STORE* config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_STORE_H */
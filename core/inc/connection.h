@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "iothub_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Owns the IoT Hub client of the single device sample. connection_start
+ * initializes the platform and creates the client on a thread of its own,
+ * and registering the status callback starts the SDK worker, so TLS setup and
+ * the MQTT connect overlap the sensor initialization. Every client, the
+ * gateway identities included, goes through connection_configure:
+ *
+ *   SAS tokens   the SDK signs one token per lifetime and reuses it for every
+ *                reconnect until it expires, a longer lifetime means fewer
+ *                signatures and fewer token refreshes
+ *   backoff      the SDK's exponential backoff with jitter, so a fleet that
+ *                lost the hub at the same moment does not come back in step
+ *   metrics      time to the first connect, time to reconnect after a loss,
+ *                reconnect count and the connected gauge
+ */
+#define CONNECTION_DEFAULT_SAS_TOKEN_LIFETIME_S 3600
+/* 0 retries forever */
+#define CONNECTION_DEFAULT_RETRY_TIMEOUT_S 0
+
+typedef struct CONNECTION_OPTIONS_TAG
+{
+	unsigned int sasTokenLifetimeS;
+	unsigned int retryTimeoutS;
+} CONNECTION_OPTIONS;
+
+typedef struct CONNECTION_TAG
+{
+	const char* connectionString;
+	IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol;
+	CONNECTION_OPTIONS options;
+	IOTHUB_CLIENT_HANDLE clientHandle;
+	pthread_t thread;
+	int threadStarted;
+	int platformReady;
+	/* updated from the SDK worker thread */
+	int connected;
+	uint64_t startUs;
+	uint64_t lostUs;
+} CONNECTION;
+
+/* Starts creating the client in the background, returns 0 when the thread runs */
+int connection_start(CONNECTION* connection, const char* connectionString, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol, const CONNECTION_OPTIONS* options);
+
+/* Waits for connection_start to finish, returns the client or NULL */
+IOTHUB_CLIENT_HANDLE connection_wait(CONNECTION* connection);
+
+/* Applies the options to a client and tracks its status, connection only holds the status */
+int connection_configure(CONNECTION* connection, IOTHUB_CLIENT_HANDLE clientHandle, const CONNECTION_OPTIONS* options);
+
+/* Destroys the client and releases the platform, safe to call more than once */
+void connection_stop(CONNECTION* connection);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONNECTION_H */
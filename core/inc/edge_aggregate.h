@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef EDGE_AGGREGATE_H
+#define EDGE_AGGREGATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Windowed statistics over the sensor samples, so one summary can be sent per
+ * window instead of every reading. A window of windowMs is summarized every
+ * hopMs; hop 0 or equal to the window gives tumbling windows, a shorter hop
+ * sliding ones. Every update is O(1):
+ *
+ *   mean and standard deviation  Welford, samples leaving a sliding window are
+ *                                removed again
+ *   min and max                  monotonic deques over the samples in the window
+ *   p50 and p95                  P-squared estimators; these cover the samples
+ *                                since the previous summary, which is the whole
+ *                                window when the windows tumble
+ *
+ * Windows follow the monotonic clock of the sample stamps, a summary carries
+ * the stamps of its first and last sample.
+ */
+typedef enum EDGE_CHANNEL_TAG
+{
+	EDGE_CHANNEL_TEMPERATURE,
+	EDGE_CHANNEL_HUMIDITY,
+	EDGE_CHANNEL_COUNT
+} EDGE_CHANNEL;
+
+/* a longer window at a faster rate drops its oldest samples early */
+#define EDGE_AGGREGATE_MAX_SAMPLES 1024
+
+typedef struct EDGE_P2_QUANTILE_TAG
+{
+	double quantile;
+	int count;
+	/* marker heights and positions, desired positions and their increments */
+	double height[5];
+	double position[5];
+	double desired[5];
+	double increment[5];
+} EDGE_P2_QUANTILE;
+
+typedef struct EDGE_DEQUE_TAG
+{
+	/* sample sequence numbers, monotonic in value from front to back */
+	uint64_t items[EDGE_AGGREGATE_MAX_SAMPLES];
+	uint64_t front;
+	uint64_t back;
+} EDGE_DEQUE;
+
+typedef struct EDGE_CHANNEL_STATE_TAG
+{
+	double mean;
+	double m2;
+	EDGE_DEQUE minimum;
+	EDGE_DEQUE maximum;
+	EDGE_P2_QUANTILE p50;
+	EDGE_P2_QUANTILE p95;
+} EDGE_CHANNEL_STATE;
+
+typedef struct EDGE_CHANNEL_SUMMARY_TAG
+{
+	double mean;
+	double stddev;
+	double min;
+	double max;
+	double p50;
+	double p95;
+} EDGE_CHANNEL_SUMMARY;
+
+typedef struct EDGE_SUMMARY_TAG
+{
+	SAMPLE_STAMP first;
+	SAMPLE_STAMP last;
+	size_t count;
+	EDGE_CHANNEL_SUMMARY channels[EDGE_CHANNEL_COUNT];
+} EDGE_SUMMARY;
+
+typedef struct EDGE_AGGREGATE_TAG
+{
+	uint64_t windowUs;
+	uint64_t hopUs;
+	uint64_t nextSummaryUs;
+	/* samples ever added, a sample's slot is its sequence number modulo the capacity */
+	uint64_t added;
+	uint64_t oldest;
+	SAMPLE_STAMP stamps[EDGE_AGGREGATE_MAX_SAMPLES];
+	double values[EDGE_AGGREGATE_MAX_SAMPLES][EDGE_CHANNEL_COUNT];
+	EDGE_CHANNEL_STATE channels[EDGE_CHANNEL_COUNT];
+} EDGE_AGGREGATE;
+
+void edge_aggregate_init(EDGE_AGGREGATE* aggregate, unsigned int windowMs, unsigned int hopMs);
+
+/* Adds a sample, returns 1 and fills summary when a window is complete */
+int edge_aggregate_add(EDGE_AGGREGATE* aggregate, const SAMPLE_STAMP* stamp, const double values[EDGE_CHANNEL_COUNT], EDGE_SUMMARY* summary);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EDGE_AGGREGATE_H */
@@ -0,0 +1,37 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Log-linear buckets: exact below 16us, then 8 sub-buckets per power of two (<= 12.5% error) */
+#define LATENCY_HISTOGRAM_LINEAR_BUCKETS 16
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 8
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_LINEAR_BUCKETS + 36 * LATENCY_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct LATENCY_HISTOGRAM_TAG
+{
+	uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+} LATENCY_HISTOGRAM;
+
+void latency_histogram_reset(LATENCY_HISTOGRAM* histogram);
+void latency_histogram_record(LATENCY_HISTOGRAM* histogram, uint64_t value_us);
+void latency_histogram_merge(LATENCY_HISTOGRAM* destination, const LATENCY_HISTOGRAM* source);
+
+/* Returns the upper bound of the bucket holding the given percentile (0-100), 0 when empty */
+uint64_t latency_histogram_percentile(const LATENCY_HISTOGRAM* histogram, double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LATENCY_HISTOGRAM_H */
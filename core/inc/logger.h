@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Leveled logging that keeps console I/O off the telemetry loop. A call
+ * copies its record into a lock-free ring buffer and returns; a background
+ * thread formats and writes the records to stdout. When the ring is full the
+ * record is dropped and counted instead of blocking the caller.
+ *
+ * Calls above LOGGER_COMPILE_LEVEL compile to nothing, calls above the
+ * runtime logger_level cost one comparison. Every call site is limited to
+ * logger_start's rateLimitPerSecond records per second and the next record
+ * that gets through tells how many were suppressed.
+ *
+ * The format must be a string literal: in deferred mode the arguments are
+ * stored in binary form and formatted by the writer thread.
+ */
+#define LOGGER_LEVEL_ERROR 0
+#define LOGGER_LEVEL_WARN 1
+#define LOGGER_LEVEL_INFO 2
+#define LOGGER_LEVEL_DEBUG 3
+
+#ifndef LOGGER_COMPILE_LEVEL
+#define LOGGER_COMPILE_LEVEL LOGGER_LEVEL_DEBUG
+#endif
+
+#define LOGGER_DEFAULT_RATE_LIMIT 20
+
+typedef enum LOGGER_FORMAT_MODE_TAG
+{
+	/* format on the calling thread, the ring holds text */
+	LOGGER_FORMAT_EAGER,
+	/* copy the raw arguments, the writer thread formats them */
+	LOGGER_FORMAT_DEFERRED
+} LOGGER_FORMAT_MODE;
+
+typedef struct LOGGER_SITE_TAG
+{
+	int level;
+	const char* file;
+	int line;
+	uint64_t window;
+	uint32_t count;
+	uint32_t suppressed;
+} LOGGER_SITE;
+
+extern int logger_level;
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void logger_write(LOGGER_SITE* site, const char* format, ...);
+
+/* Until logger_start and after logger_stop records are written synchronously */
+int logger_start(LOGGER_FORMAT_MODE mode, unsigned int rateLimitPerSecond);
+/* Writes the records still in the ring and stops the writer thread */
+void logger_stop(void);
+
+/* Accepts error, warn, info and debug, returns -1 for anything else */
+int logger_parse_level(const char* name);
+
+#define LOGGER_LOG(level, ...) \
+	do \
+	{ \
+		if ((level) <= LOGGER_COMPILE_LEVEL && (level) <= logger_level) \
+		{ \
+			static LOGGER_SITE logger_site = { (level), __FILE__, __LINE__, 0, 0, 0 }; \
+			logger_write(&logger_site, __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define LOGGER_ERROR(...) LOGGER_LOG(LOGGER_LEVEL_ERROR, __VA_ARGS__)
+#define LOGGER_WARN(...) LOGGER_LOG(LOGGER_LEVEL_WARN, __VA_ARGS__)
+#define LOGGER_INFO(...) LOGGER_LOG(LOGGER_LEVEL_INFO, __VA_ARGS__)
+#define LOGGER_DEBUG(...) LOGGER_LOG(LOGGER_LEVEL_DEBUG, __VA_ARGS__)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOGGER_H */
@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MEM_POOL_H
+#define MEM_POOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fixed size block pools for the memory the application takes per message,
+ * so a device that runs for months does not fragment its heap. mem_pool_init
+ * carves all classes out of one arena at startup, sized for the most the
+ * application can hold at once, e.g. what its send lanes can queue. The
+ * arena is one large allocation, so the kernel maps its pages on first use
+ * and the resident size grows to the peak and no further.
+ *
+ * mem_pool_alloc takes a block of the smallest class that fits. When that
+ * class is used up, or nothing fits, it falls back to malloc and counts
+ * METRIC_POOL_FALLBACKS, so a pool sized too small shows up without failing.
+ * mem_pool_free takes blocks from either, and so does it before init and
+ * after deinit, when every allocation goes to the heap. Thread safe.
+ */
+#define MEM_POOL_MAX_CLASSES 4
+/* blocks are rounded up to this, it aligns every type */
+#define MEM_POOL_ALIGNMENT 16
+
+typedef struct MEM_POOL_CLASS_TAG
+{
+	size_t blockSize;
+	size_t blocks;
+} MEM_POOL_CLASS;
+
+typedef struct MEM_POOL_STATS_TAG
+{
+	size_t blockSize;
+	size_t blocks;
+	size_t inUse;
+	/* the most blocks in use at once since init */
+	size_t peak;
+	/* allocations of this class served by the heap */
+	size_t fallbacks;
+} MEM_POOL_STATS;
+
+/* Classes in ascending block size, a class without blocks is left out. Returns 0 on success */
+int mem_pool_init(const MEM_POOL_CLASS* classes, size_t count);
+/* Once nothing allocated from the pools is used anymore */
+void mem_pool_deinit(void);
+
+void* mem_pool_alloc(size_t size);
+void mem_pool_free(void* block);
+
+/* Fills up to count classes, returns the number of classes */
+size_t mem_pool_stats(MEM_POOL_STATS* stats, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEM_POOL_H */
@@ -0,0 +1,34 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MESSAGE_FORMAT_H
+#define MESSAGE_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "sample_clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The text the samples send per reading and per twin update, in one place so
+ * the samples and the microbenchmarks format it with the same code.
+ */
+/* the longest telemetry message with a 128 character device id, and its terminator */
+#define MESSAGE_FORMAT_TELEMETRY_SIZE 320
+
+/* The telemetry JSON of one reading, returns its length or 0 when buffer is too small */
+size_t message_format_telemetry(char* buffer, size_t size, const char* deviceId, const SAMPLE_STAMP* stamp, float tempC, float humidityPct);
+
+/* printf into a block from the memory pools, free it with mem_pool_free. NULL when it could not be allocated */
+unsigned char* message_format_alloc(size_t* length, const char* format, ...);
+unsigned char* message_format_valloc(size_t* length, const char* format, va_list args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESSAGE_FORMAT_H */
@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Process wide telemetry pipeline metrics. Every metric is a fixed slot, so
+ * updating one is a single relaxed atomic add with no registration, locking
+ * or allocation on the hot path.
+ */
+typedef enum METRIC_COUNTER_TAG
+{
+	METRIC_SPI_TRANSACTIONS,
+	METRIC_SPI_ERRORS,
+	METRIC_SENSOR_READ_FAILURES,
+	METRIC_MESSAGES_SENT,
+	METRIC_MESSAGES_CONFIRMED,
+	METRIC_MESSAGES_DROPPED,
+	METRIC_TWIN_REPORTS,
+	METRIC_TWIN_REPORT_FAILURES,
+	METRIC_ANOMALY_ALERTS,
+	METRIC_RECONNECTS,
+	METRIC_MESSAGES_COMPRESSED,
+	METRIC_COMPRESSION_SAVED_BYTES,
+	METRIC_MESSAGES_RETRIED,
+	METRIC_MESSAGES_EXPIRED,
+	METRIC_CLOCK_STEPS,
+	METRIC_POOL_FALLBACKS,
+	METRIC_MESSAGES_ABANDONED,
+	METRIC_COUNTER_COUNT
+} METRIC_COUNTER;
+
+typedef enum METRIC_GAUGE_TAG
+{
+	/* messages handed to the SDK and not yet confirmed */
+	METRIC_SEND_QUEUE_DEPTH,
+	METRIC_HUB_CONNECTED,
+	/* messages waiting in the send lanes, not yet handed to the SDK */
+	METRIC_SEND_LANE_BACKLOG,
+	/* blocks taken from the startup memory pools */
+	METRIC_POOL_BLOCKS_IN_USE,
+	METRIC_GAUGE_COUNT
+} METRIC_GAUGE;
+
+typedef enum METRIC_HISTOGRAM_TAG
+{
+	METRIC_SENSOR_READ_LATENCY,
+	METRIC_SERIALIZE_LATENCY,
+	METRIC_SEND_CONFIRM_LATENCY,
+	METRIC_TWIN_ROUNDTRIP_LATENCY,
+	METRIC_ALERT_LATENCY,
+	METRIC_CONNECT_LATENCY,
+	METRIC_RECONNECT_LATENCY,
+	METRIC_ALERT_LANE_WAIT,
+	METRIC_SAMPLE_WAKE_LATENCY,
+	METRIC_HISTOGRAM_COUNT
+} METRIC_HISTOGRAM;
+
+/* Upper bounds in microseconds, the last bucket is +Inf */
+#define METRICS_HISTOGRAM_BUCKETS 17
+
+#define METRICS_DEFAULT_PORT 9110
+
+uint64_t metrics_now_us(void);
+
+void metrics_counter_add(METRIC_COUNTER counter, uint64_t value);
+void metrics_gauge_add(METRIC_GAUGE gauge, int64_t delta);
+void metrics_histogram_observe(METRIC_HISTOGRAM histogram, uint64_t value_us);
+
+uint64_t metrics_counter_get(METRIC_COUNTER counter);
+/* Upper bound of the bucket holding the percentile, in microseconds */
+uint64_t metrics_histogram_percentile(METRIC_HISTOGRAM histogram, double percentile);
+
+/* Both return the formatted length, or 0 when the buffer is too small */
+size_t metrics_format_prometheus(char* buffer, size_t size);
+size_t metrics_format_reported(char* buffer, size_t size);
+
+/* Serves metrics_format_prometheus on 127.0.0.1:port from a background thread */
+int metrics_server_start(unsigned short port);
+void metrics_server_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef PAYLOAD_COMPRESS_H
+#define PAYLOAD_COMPRESS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Deflate for message bodies, primed with a dictionary of the keys and
+ * constants of our JSON formats. A message of a few hundred bytes repeats
+ * little of itself, the dictionary is what makes it compress: the keys become
+ * back references from the first byte on.
+ *
+ * The output is a zlib stream (RFC 1950) whose header carries the Adler-32 of
+ * the dictionary. A consumer inflates it with the same dictionary, in Python:
+ *
+ *     zlib.decompressobj(zdict=dictionary).decompress(body)
+ *
+ * The dictionary is part of the wire format, change it only together with the
+ * consumers, and update PAYLOAD_COMPRESS_DICTIONARY_ID with it; the payload
+ * compress test fails until both agree. A consumer keeps every dictionary it
+ * may still receive and picks the one whose id is in the body's header, a
+ * body whose id it does not know fails to inflate instead of decoding to
+ * garbage.
+ */
+/*
+ * Adler-32 of the dictionary. 0x11ba2c88 added the Epoch and Series keys,
+ * 0xe2b216e8 was the first dictionary.
+ */
+#define PAYLOAD_COMPRESS_DICTIONARY_ID 0x11ba2c88UL
+/* the content-encoding system property of a compressed message */
+#define PAYLOAD_COMPRESS_ENCODING "deflate"
+/*
+ * The body size from which compression pays, measured with
+ * benchmarks/micro/payload_compression.c: a single reading or an alert saves
+ * less than the MQTT and TLS framing of the message adds, two readings or a
+ * summary shrink to a third of their size.
+ */
+#define PAYLOAD_COMPRESS_SUGGESTED_THRESHOLD 160
+#define PAYLOAD_COMPRESS_DEFAULT_LEVEL 6
+
+/* Sets up the compressor, 0 on success; called again it switches the level */
+int payload_compress_init(int level);
+void payload_compress_deinit(void);
+
+/*
+ * Compresses size bytes of body into out and returns the compressed size, or
+ * 0 when the compressor is not set up or the result would not be smaller than
+ * the body; send the body as it is then. Thread-safe.
+ */
+size_t payload_compress(const unsigned char* body, size_t size, unsigned char* out, size_t outSize);
+
+/* The preset dictionary, for consumers and tools */
+const unsigned char* payload_compress_dictionary(size_t* size);
+/* Adler-32 of the dictionary, as found in the header of every compressed body */
+unsigned long payload_compress_dictionary_id(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAYLOAD_COMPRESS_H */
@@ -0,0 +1,96 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef READING_SHM_H
+#define READING_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_clock.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The latest sensor readings in a POSIX shared memory segment, for other
+ * processes on the device that would otherwise have to open the SPI bus or
+ * parse the log. The sample is the only writer; any number of readers map the
+ * segment read-only and never block it.
+ *
+ * The segment is a header followed by a ring of the last READING_SHM_HISTORY
+ * samples, guarded by a seqlock: the writer makes the sequence odd, updates one
+ * slot and the published count, then makes it even again. A reader takes the
+ * sequence, reads the fields in place and retries if the sequence was odd or
+ * has moved on. A publish touches one slot, so a retry is rare and short.
+ *
+ * Zero-copy access to a single field:
+ *
+ *     uint32_t sequence;
+ *     float tempC;
+ *     do
+ *     {
+ *         sequence = reading_shm_read_begin(shm);
+ *         tempC = reading_shm_latest_slot(shm)->temperatureC;
+ *     } while (reading_shm_read_retry(shm, sequence));
+ */
+#define READING_SHM_DEFAULT_NAME "/remote_monitoring_reading"
+#define READING_SHM_MAGIC "RMREADNG"
+#define READING_SHM_VERSION 1
+#define READING_SHM_HISTORY 64
+
+typedef struct READING_SAMPLE_TAG
+{
+	/* CLOCK_MONOTONIC, comparable between processes until the next boot */
+	uint64_t monotonicUs;
+	uint64_t unixUs;
+	float temperatureC;
+	float pressurePa;
+	float humidityPct;
+	/* the sample's sequence number, see sample_clock.h; was reserved and 0 */
+	uint32_t sequence;
+} READING_SAMPLE;
+
+typedef struct READING_SHM_TAG
+{
+	char magic[8];
+	uint16_t version;
+	uint16_t historySize;
+	uint32_t sampleSize;
+	int32_t writerPid;
+	/* seqlock, odd while the writer updates the segment */
+	uint32_t sequence;
+	/* samples published so far, the latest is history[(published - 1) % READING_SHM_HISTORY] */
+	uint64_t published;
+	READING_SAMPLE history[READING_SHM_HISTORY];
+} READING_SHM;
+
+/* Writer: creates or takes over the named segment, NULL on failure */
+READING_SHM* reading_shm_create(const char* name);
+/* The sample keeps the stamp taken at its read */
+void reading_shm_publish(READING_SHM* shm, const SAMPLE_STAMP* stamp, float temperatureC, float pressurePa, float humidityPct);
+/* Unmaps and removes the segment, readers that still map it see the writer gone */
+void reading_shm_destroy(READING_SHM* shm, const char* name);
+
+/* Reader: maps an existing segment read-only, NULL when it is missing or of another version */
+const READING_SHM* reading_shm_open(const char* name);
+void reading_shm_close(const READING_SHM* shm);
+
+uint32_t reading_shm_read_begin(const READING_SHM* shm);
+/* Nonzero when what was read since reading_shm_read_begin may be torn */
+int reading_shm_read_retry(const READING_SHM* shm, uint32_t sequence);
+const READING_SAMPLE* reading_shm_latest_slot(const READING_SHM* shm);
+
+/* Copies the latest sample, returns 0, or -1 when nothing was published yet */
+int reading_shm_latest(const READING_SHM* shm, READING_SAMPLE* sample);
+/* Copies up to count samples, newest first, returns how many */
+size_t reading_shm_history(const READING_SHM* shm, READING_SAMPLE* samples, size_t count);
+/* Nonzero while the writing process exists */
+int reading_shm_writer_alive(const READING_SHM* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* READING_SHM_H */
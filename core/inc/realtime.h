@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Scheduling options for the thread that samples the sensor, so other
+ * workloads on the Pi do not delay its reads:
+ *
+ *   cpu         pins the thread to one core, -1 leaves it on all of them
+ *   priority    runs it under SCHED_FIFO at 1 (lowest) to 99, ahead of every
+ *               normal process; 0 keeps the normal scheduler
+ *   lockMemory  locks the pages of the process in memory, so a read never
+ *               waits for one to come back from swap, and prefaults
+ *               REALTIME_PREFAULT_STACK_BYTES of the thread's stack
+ *
+ * The options apply to the calling thread only, threads it starts afterwards
+ * inherit them; call it once the other threads run. SCHED_FIFO needs root or
+ * CAP_SYS_NICE and locking memory root or CAP_IPC_LOCK, or matching
+ * RLIMIT_RTPRIO and RLIMIT_MEMLOCK limits. The kernel keeps 5% of each second
+ * for normal processes (sched_rt_runtime_us), a thread that spins cannot
+ * lock up the Pi.
+ */
+#define REALTIME_MAX_PRIORITY 99
+#define REALTIME_PREFAULT_STACK_BYTES (256 * 1024)
+
+typedef struct REALTIME_OPTIONS_TAG
+{
+	int cpu;
+	int priority;
+	int lockMemory;
+} REALTIME_OPTIONS;
+
+/* No pinning, the normal scheduler and no locked memory */
+void realtime_defaults(REALTIME_OPTIONS* options);
+
+/* Applies every option it can and logs the others, returns 0 when all of them applied */
+int realtime_apply(const REALTIME_OPTIONS* options);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REALTIME_H */
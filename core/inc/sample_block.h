@@ -0,0 +1,158 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SAMPLE_BLOCK_H
+#define SAMPLE_BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A block of temperature and humidity samples, bit-packed in the manner of
+ * Gorilla (Pelkonen et al., VLDB 2015) for uploads at rates where a JSON
+ * message per reading is too much. Regular sampling makes the delta of the
+ * timestamp deltas 0, slowly moving readings make the change from one value to
+ * the next a few counts, and both cost a handful of bits.
+ *
+ * The values are fixed point before they are encoded: 0.01 C and 0.01 %RH.
+ * That is the BME280's own temperature resolution, humidity loses at most
+ * 0.005 %RH. Plain deltas of these integers take fewer bits than Gorilla's
+ * XOR of IEEE floats. Timestamps are counted in ticks of tickMs. Every sample
+ * keeps the sequence number of its stamp (sample_clock.h), consecutive
+ * numbers cost a bit. The samples of a block share the epoch of their stamps,
+ * the block carries it once.
+ *
+ * A raw block carries the BME280's ADC values instead, for a backend that
+ * runs the compensation itself (bme280_compensate.c) with the calibration
+ * data the device reports.
+ *
+ * Layout, little-endian:
+ *
+ *   0   format, SAMPLE_BLOCK_FORMAT_READINGS or SAMPLE_BLOCK_FORMAT_RAW,
+ *       with SAMPLE_BLOCK_FLAG_SEQUENCED and SAMPLE_BLOCK_FLAG_EPOCH
+ *   1   sample count, 16 bits
+ *   3   tick in milliseconds, 16 bits
+ *   5   unix milliseconds of the first sample, 64 bits
+ *   13  bit stream, most significant bit first, per sample:
+ *       first sample: the epoch in 32 bits, its sequence number in 32 bits
+ *       later samples: delta of the tick delta, delta of the sequence delta
+ *       (the delta before the second sample counts as 1), then
+ *       readings: change of the temperature, change of the humidity
+ *       raw: adc_T in 20 bits, adc_P in 20 bits, adc_H in 16 bits
+ *
+ * Blocks without SAMPLE_BLOCK_FLAG_SEQUENCED, from before the sequence
+ * numbers, have no sequence numbers in the stream, blocks without
+ * SAMPLE_BLOCK_FLAG_EPOCH no epoch; they still decode.
+ *
+ * Every number in the stream is a signed integer with a prefix:
+ *
+ *   0                      0
+ *   10   + 4 bits          -8 .. 7
+ *   110  + 7 bits          -64 .. 63
+ *   1110 + 12 bits         -2048 .. 2047
+ *   1111 + 32 bits         anything else
+ *
+ * core/tools/sample_block.py is the reference decoder for the backend.
+ */
+#define SAMPLE_BLOCK_FORMAT_READINGS 1
+#define SAMPLE_BLOCK_FORMAT_RAW 2
+#define SAMPLE_BLOCK_FLAG_SEQUENCED 0x80
+#define SAMPLE_BLOCK_FLAG_EPOCH 0x40
+#define SAMPLE_BLOCK_HEADER_SIZE 13
+#define SAMPLE_BLOCK_MAX_SAMPLES 65535
+/* the most a sample can take, four escaped numbers; the first takes at most 64 + 2 * 36, a raw frame at most 2 * 36 + 56 */
+#define SAMPLE_BLOCK_MAX_SAMPLE_BITS (4 * 36)
+/* a buffer that holds any block of samples */
+#define SAMPLE_BLOCK_SIZE(samples) (SAMPLE_BLOCK_HEADER_SIZE + ((samples) * SAMPLE_BLOCK_MAX_SAMPLE_BITS + 7) / 8)
+#define SAMPLE_BLOCK_DEFAULT_TICK_MS 10
+
+typedef struct SAMPLE_BLOCK_ENCODER_TAG
+{
+	unsigned char* buffer;
+	size_t capacity;
+	size_t bits;
+	uint8_t format;
+	uint16_t tickMs;
+	uint16_t count;
+	uint64_t firstUnixMs;
+	int64_t lastTick;
+	int64_t lastTickDelta;
+	uint32_t epoch;
+	uint32_t lastSequence;
+	int64_t lastSequenceDelta;
+	int32_t lastTemperature;
+	int32_t lastHumidity;
+} SAMPLE_BLOCK_ENCODER;
+
+typedef struct SAMPLE_BLOCK_DECODER_TAG
+{
+	const unsigned char* block;
+	size_t size;
+	size_t bit;
+	/* the flags are masked off into sequenced and epoch */
+	uint8_t format;
+	int sequenced;
+	/* the epoch of the block's samples, 0 in blocks without one */
+	uint32_t epoch;
+	uint16_t tickMs;
+	uint16_t count;
+	uint16_t decoded;
+	uint64_t firstUnixMs;
+	int64_t lastTick;
+	int64_t lastTickDelta;
+	uint32_t lastSequence;
+	int64_t lastSequenceDelta;
+	int32_t lastTemperature;
+	int32_t lastHumidity;
+} SAMPLE_BLOCK_DECODER;
+
+typedef struct SAMPLE_BLOCK_SAMPLE_TAG
+{
+	uint64_t unixMs;
+	uint32_t sequence;
+	float temperatureC;
+	float humidityPct;
+} SAMPLE_BLOCK_SAMPLE;
+
+typedef struct SAMPLE_BLOCK_RAW_FRAME_TAG
+{
+	uint64_t unixMs;
+	uint32_t sequence;
+	int32_t adcT;
+	int32_t adcP;
+	int32_t adcH;
+} SAMPLE_BLOCK_RAW_FRAME;
+
+/* Starts an empty block of readings in buffer, tickMs 0 takes the default */
+void sample_block_begin(SAMPLE_BLOCK_ENCODER* encoder, unsigned char* buffer, size_t capacity, unsigned int tickMs);
+/* The same for a block of raw frames */
+void sample_block_begin_raw(SAMPLE_BLOCK_ENCODER* encoder, unsigned char* buffer, size_t capacity, unsigned int tickMs);
+
+/*
+ * Appends a sample, 0 on success. -1 when the block is full or the sample is
+ * earlier than the last one, too far from it or of another epoch; finish the
+ * block and start another one then.
+ */
+int sample_block_add(SAMPLE_BLOCK_ENCODER* encoder, uint64_t unixMs, uint32_t epoch, uint32_t sequence, float temperatureC, float humidityPct);
+/* The same for a raw frame, the ADC values are masked to their width */
+int sample_block_add_raw(SAMPLE_BLOCK_ENCODER* encoder, uint64_t unixMs, uint32_t epoch, uint32_t sequence, int32_t adcT, int32_t adcP, int32_t adcH);
+
+/* Completes the header and returns the size of the block, 0 when it is empty */
+size_t sample_block_finish(SAMPLE_BLOCK_ENCODER* encoder);
+
+/* Reference decoder: 0 when the header and the epoch are valid, decoder->format tells which of the next functions applies */
+int sample_block_decode_begin(SAMPLE_BLOCK_DECODER* decoder, const unsigned char* block, size_t size);
+
+/* 1 with the next sample, 0 after the last one, -1 when the block is truncated or of the other format; sequence 0 in an unflagged block */
+int sample_block_decode_next(SAMPLE_BLOCK_DECODER* decoder, SAMPLE_BLOCK_SAMPLE* sample);
+int sample_block_decode_next_raw(SAMPLE_BLOCK_DECODER* decoder, SAMPLE_BLOCK_RAW_FRAME* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_BLOCK_H */
@@ -0,0 +1,93 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stamps for the sensor samples, taken right after the SPI read. Every
+ * encoding carries the stamp of its samples, so the backend orders a series
+ * by when it was measured rather than by when the hub enqueued it, which
+ * aggregation, sample blocks, the send lanes and the unsent file all delay.
+ *
+ *   unixUs       CLOCK_REALTIME, what the messages carry
+ *   monotonicUs  CLOCK_MONOTONIC, the metrics_now_us clock, for intervals on
+ *                the device
+ *   sequence     one more per read of the series, from 0 when the process
+ *                starts: a gap is a read of the series that failed or whose
+ *                message was left out or lost, and samples keep their order
+ *                when the clock steps
+ *   epoch        drawn at random when the process starts, never 0: the
+ *                sequence starts over with every run, a restart, a SIGHUP
+ *                re-exec or a resend from the unsent file, and the backend
+ *                tells the runs apart by (epoch, sequence)
+ *
+ * The realtime clock can step, when NTP first sets it after boot or someone
+ * runs date. Each stamp compares the offset between the two clocks with the
+ * previous stamp's; a change beyond SAMPLE_CLOCK_STEP_THRESHOLD_US plus what
+ * slewing at SAMPLE_CLOCK_MAX_SLEW_PPM explains is a step. Steps are logged,
+ * counted in METRIC_CLOCK_STEPS and kept for sample_clock_last_step. The
+ * stamps are not corrected, the sequence numbers line a stepped series up.
+ *
+ * A sensor replay sets a source, the capture time of the read just served:
+ * unixUs is the capture time, and monotonicUs advances with it from the
+ * monotonic clock at the first replayed stamp, never going back, so windows
+ * and rates cover the captured span even when the replay runs at full speed.
+ */
+#define SAMPLE_CLOCK_STEP_THRESHOLD_US 50000
+#define SAMPLE_CLOCK_MAX_SLEW_PPM 500
+/* "2026-10-18T09:30:12.345678Z" and its terminator */
+#define SAMPLE_CLOCK_TEXT_SIZE 28
+
+typedef struct SAMPLE_STAMP_TAG
+{
+	uint64_t unixUs;
+	uint64_t monotonicUs;
+	uint32_t sequence;
+	uint32_t epoch;
+} SAMPLE_STAMP;
+
+/* One per series of samples, zero initialized; a gateway keeps one per identity. Reads that no message carries get a series of their own */
+typedef struct SAMPLE_CLOCK_TAG
+{
+	uint32_t next;
+} SAMPLE_CLOCK;
+
+typedef struct SAMPLE_CLOCK_STEP_TAG
+{
+	/* CLOCK_REALTIME of the first stamp after the step */
+	uint64_t unixUs;
+	/* how far the clock moved beyond the elapsed time, negative when it went back */
+	int64_t stepUs;
+} SAMPLE_CLOCK_STEP;
+
+/* Unix microseconds of the sample just read, 0 when there is none */
+typedef uint64_t (*SAMPLE_CLOCK_SOURCE)(void);
+
+/* Stamps take their time from source instead of the clocks, NULL goes back to the clocks */
+void sample_clock_set_source(SAMPLE_CLOCK_SOURCE source);
+
+/* Stamps a sample of the series, thread safe */
+void sample_clock_stamp(SAMPLE_CLOCK* clock, SAMPLE_STAMP* stamp);
+
+/* The epoch of this process, the one every stamp carries */
+uint32_t sample_clock_epoch(void);
+
+/* Returns the steps seen so far, fills last with the latest one when there was one */
+uint64_t sample_clock_last_step(SAMPLE_CLOCK_STEP* last);
+
+/* ISO 8601 in UTC with microseconds, returns the length or 0 when text is too small */
+size_t sample_clock_format(uint64_t unixUs, char* text, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLE_CLOCK_H */
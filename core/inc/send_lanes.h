@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SEND_LANES_H
+#define SEND_LANES_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Outbound messages wait in one lane per class instead of going to the SDK as
+ * they are made. A lane hands over at most maxInFlight unconfirmed messages,
+ * so the SDK's own first-in first-out queue never holds more than the sum of
+ * the limits. After an outage an alert waits behind that handful, not behind
+ * hours of telemetry, and twin updates do not wait behind a long backlog
+ * either. Among the lanes with a message and a free slot, the next one is
+ * picked by smooth weighted round robin: over any stretch of time a lane gets
+ * its weight's share of the hand overs, without bursts.
+ *
+ * Delivery per lane:
+ *
+ *   at-least-once  a message the hub did not confirm goes back to the head of
+ *                  its lane and is sent again after a backoff that doubles with
+ *                  every attempt, on shutdown it is kept in the unsent file;
+ *                  the hub may see it twice. After maxAttempts it is given up
+ *   best-effort    a message that waited longer than timeoutMs, or was not
+ *                  confirmed, is dropped and never kept
+ *
+ * timeoutMs is also the SDK's message timeout for the lane. A full lane drops
+ * its oldest message, whatever its delivery, so memory stays bounded; a retry
+ * going back into a full lane drops the newest instead, it keeps its place.
+ */
+#define SEND_LANES_RETRY_BACKOFF_MS 1000
+#define SEND_LANES_RETRY_BACKOFF_MAX_MS 60000
+
+typedef enum SEND_LANE_TAG
+{
+	SEND_LANE_ALERT,
+	SEND_LANE_TELEMETRY,
+	/* sample blocks and the messages a previous run left unsent */
+	SEND_LANE_BULK,
+	SEND_LANE_DIAGNOSTICS,
+	SEND_LANE_COUNT
+} SEND_LANE;
+
+typedef enum SEND_DELIVERY_TAG
+{
+	SEND_DELIVERY_AT_LEAST_ONCE,
+	SEND_DELIVERY_BEST_EFFORT
+} SEND_DELIVERY;
+
+typedef struct SEND_LANE_CONFIG_TAG
+{
+	unsigned int weight;
+	unsigned int maxInFlight;
+	unsigned int maxQueued;
+	unsigned int timeoutMs;
+	SEND_DELIVERY delivery;
+	/* hand overs of an at-least-once message before it is given up */
+	unsigned int maxAttempts;
+} SEND_LANE_CONFIG;
+
+/* Embedded in the caller's message, the lanes never allocate */
+typedef struct SEND_LANE_ITEM_TAG
+{
+	struct SEND_LANE_ITEM_TAG* next;
+	SEND_LANE lane;
+	uint64_t queuedUs;
+	unsigned int attempts;
+	/* a retry waits for its backoff at the head of its lane */
+	uint64_t notBeforeUs;
+} SEND_LANE_ITEM;
+
+typedef enum SEND_LANE_OUTCOME_TAG
+{
+	/* the caller is done with the message */
+	SEND_LANE_DONE,
+	/* back at the head of its lane */
+	SEND_LANE_REQUEUED,
+	/* undelivered after the lane's attempts, the caller is done with it */
+	SEND_LANE_ABANDONED
+} SEND_LANE_OUTCOME;
+
+typedef struct SEND_LANE_STATE_TAG
+{
+	SEND_LANE_CONFIG config;
+	SEND_LANE_ITEM* head;
+	SEND_LANE_ITEM* tail;
+	size_t queued;
+	size_t inFlight;
+	/* the smooth weighted round robin's running score */
+	long current;
+} SEND_LANE_STATE;
+
+typedef struct SEND_LANES_TAG
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	SEND_LANE_STATE lanes[SEND_LANE_COUNT];
+	/* pushes and completions, against the count the last pop saw */
+	uint64_t changes;
+	uint64_t changesSeen;
+} SEND_LANES;
+
+/* The defaults: alerts first, telemetry, then bulk and diagnostics; only diagnostics are best effort */
+void send_lanes_defaults(SEND_LANE_CONFIG configs[SEND_LANE_COUNT]);
+
+/*
+ * Overrides one lane from "<lane>,<weight>,<in flight>,<queued>,<timeout ms>,<delivery>[,<attempts>]",
+ * lane alert|telemetry|bulk|diagnostics and delivery at-least-once|best-effort.
+ * Without attempts the lane keeps its current maximum. Returns 0 on success.
+ */
+int send_lanes_parse(const char* text, SEND_LANE_CONFIG configs[SEND_LANE_COUNT]);
+
+const char* send_lanes_name(SEND_LANE lane);
+
+int send_lanes_init(SEND_LANES* lanes, const SEND_LANE_CONFIG configs[SEND_LANE_COUNT]);
+void send_lanes_deinit(SEND_LANES* lanes);
+
+const SEND_LANE_CONFIG* send_lanes_config(const SEND_LANES* lanes, SEND_LANE lane);
+
+/* Queues a message at the tail of its lane, returns the message a full lane dropped for it or NULL */
+SEND_LANE_ITEM* send_lanes_push(SEND_LANES* lanes, SEND_LANE_ITEM* item, SEND_LANE lane, uint64_t nowUs);
+
+/*
+ * Takes the next message to hand over, it counts as in flight until
+ * send_lanes_complete. NULL when no lane has a message and a free slot, or
+ * only retries still waiting for their backoff.
+ * Best-effort messages that waited too long are unlinked into *expired, a
+ * list through next, for the caller to free.
+ */
+SEND_LANE_ITEM* send_lanes_pop(SEND_LANES* lanes, uint64_t nowUs, SEND_LANE_ITEM** expired);
+
+/*
+ * Frees the slot of a message that was confirmed (delivered 1), or that was
+ * not or could not be handed over (delivered 0). An undelivered at-least-once
+ * message goes back to its lane unless it used up the lane's attempts. When
+ * the lane is full the newest message makes room, it is returned in *dropped
+ * for the caller to free, else *dropped is NULL.
+ */
+SEND_LANE_OUTCOME send_lanes_complete(SEND_LANES* lanes, SEND_LANE_ITEM* item, int delivered, uint64_t nowUs, SEND_LANE_ITEM** dropped);
+
+/* Waits up to timeoutMs for a push or a completion, unless there was one since the last send_lanes_pop */
+void send_lanes_wait(SEND_LANES* lanes, unsigned int timeoutMs);
+void send_lanes_wake(SEND_LANES* lanes);
+
+/* Messages queued and in flight */
+size_t send_lanes_pending(SEND_LANES* lanes);
+
+/* Empties the lanes, returns their messages lane by lane, oldest first, as a list through next */
+SEND_LANE_ITEM* send_lanes_take_queued(SEND_LANES* lanes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEND_LANES_H */
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SEND_REPORT_H
+#define SEND_REPORT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "latency_histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counts the messages a sample hands to the SDK and the confirmations the hub
+ * sends back, for the report at the end of a --count run: throughput and the
+ * latency from the hand over to the confirmation. Thread safe, confirmations
+ * arrive on the SDK's thread.
+ */
+typedef struct SEND_REPORT_TAG
+{
+	pthread_mutex_t lock;
+	size_t sent;
+	size_t confirmed;
+	size_t failed;
+	uint64_t firstSentUs;
+	uint64_t lastConfirmedUs;
+	LATENCY_HISTOGRAM latency;
+} SEND_REPORT;
+
+/* Returns 0 on success */
+int send_report_init(SEND_REPORT* report);
+void send_report_deinit(SEND_REPORT* report);
+
+/* Counts a message before it is handed over, the confirmation can arrive first. Returns the context for its confirmation, NULL when it could not be allocated */
+void* send_report_sent(SEND_REPORT* report);
+/* The hand over failed, takes the count back and frees context */
+void send_report_unsent(SEND_REPORT* report, void* context);
+/* Counts the confirmation of the message context was returned for and frees it, returns the microseconds since the hand over */
+uint64_t send_report_confirmed(SEND_REPORT* report, void* context, int delivered);
+
+/* Waits up to timeoutMs for the confirmations still outstanding, returns how many are left */
+size_t send_report_wait(SEND_REPORT* report, unsigned int timeoutMs);
+/* Prints the header and the counts, throughput and latency, a NULL transport name is left out. Returns the confirmed messages */
+size_t send_report_print(SEND_REPORT* report, const char* transportName);
+/*
+ * Prints what the benchmark compares transports by besides the report: the TCP
+ * bytes of the sockets still open, TLS and transport framing included, and the
+ * CPU time, both per confirmed message, and the peak RSS. Must run before the
+ * client is destroyed; a transport that reconnects in between loses the
+ * earlier connections' bytes.
+ */
+void send_report_print_costs(size_t confirmed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEND_REPORT_H */
@@ -0,0 +1,76 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef SENSOR_TRACE_H
+#define SENSOR_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Record and replay of BME280 register reads. Capture appends every register
+ * read the driver makes (calibration, chip id and measurement bursts, not the
+ * status polls) to a binary file:
+ *
+ *   header:  "BMETRACE" u16 version u16 reserved u32 reserved u64 start (unix us)
+ *   record:  u8 chip enable, u8 register, u8 length, LEB128 microseconds since
+ *            the previous record, <length> register bytes
+ *
+ * Replay serves the driver's reads from the file instead of SPI, so the real
+ * bme280.c decoding and compensation run on recorded field data. Every read of
+ * the measurement registers advances to the next recorded burst of that chip
+ * enable, either at once or paced like the capture.
+ *
+ * Without ENABLE_SENSOR_TRACE the driver hooks expand to nothing, so a shipped
+ * build reads SPI directly; starting a capture or a replay then fails.
+ */
+#define SENSOR_TRACE_VERSION 1
+
+typedef enum SENSOR_REPLAY_PACE_TAG
+{
+	SENSOR_REPLAY_MAX_SPEED,
+	SENSOR_REPLAY_REALTIME
+} SENSOR_REPLAY_PACE;
+
+#ifdef ENABLE_SENSOR_TRACE
+
+int sensor_trace_capture_start(const char* path);
+void sensor_trace_capture_stop(void);
+/* Called by the driver after each successful register read */
+void sensor_trace_capture_read(int chipEnable, uint8_t reg, const uint8_t* data, int length);
+
+int sensor_trace_replay_open(const char* path, SENSOR_REPLAY_PACE pace);
+void sensor_trace_replay_close(void);
+int sensor_trace_replaying(void);
+/* Fills data like an SPI read would and returns the byte count, 0 once the trace is exhausted */
+int sensor_trace_replay_read(int chipEnable, uint8_t reg, uint8_t* data, int length);
+int sensor_trace_replay_has_chip(int chipEnable);
+int sensor_trace_replay_finished(void);
+/* Capture time of the burst served last, unix microseconds */
+uint64_t sensor_trace_replay_timestamp_us(void);
+
+#else
+
+#define sensor_trace_capture_start(path) (printf("Sensor capture is not compiled in, see enable_sensor_trace\n"), -1)
+#define sensor_trace_capture_stop() ((void)0)
+#define sensor_trace_capture_read(chipEnable, reg, data, length) ((void)0)
+
+#define sensor_trace_replay_open(path, pace) (printf("Sensor replay is not compiled in, see enable_sensor_trace\n"), -1)
+#define sensor_trace_replay_close() ((void)0)
+#define sensor_trace_replaying() 0
+#define sensor_trace_replay_read(chipEnable, reg, data, length) 0
+#define sensor_trace_replay_has_chip(chipEnable) 0
+#define sensor_trace_replay_finished() 0
+#define sensor_trace_replay_timestamp_us() ((uint64_t)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SENSOR_TRACE_H */
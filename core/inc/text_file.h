@@ -0,0 +1,18 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TEXT_FILE_H
+#define TEXT_FILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reads a whole file into a terminated string the caller frees, NULL when it could not be read */
+char* text_file_read(const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEXT_FILE_H */
@@ -0,0 +1,64 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Span tracing for the telemetry hot path, compiled in with the enable_tracing
+ * CMake option (ENABLE_TRACING). Each thread records its spans into its own
+ * ring buffer, so recording is two clock reads and a store. SIGUSR1 dumps the
+ * buffered spans of all threads as Chrome trace event JSON, which loads in
+ * chrome://tracing and ui.perfetto.dev.
+ *
+ *     TRACE_BEGIN(span, "sprintf_telemetry");
+ *     ...
+ *     TRACE_END(span);
+ *
+ * Span names must be string literals. Without ENABLE_TRACING every macro
+ * expands to nothing.
+ */
+#ifdef ENABLE_TRACING
+
+typedef struct TRACE_SPAN_TAG
+{
+	const char* name;
+	uint64_t start_ns;
+} TRACE_SPAN;
+
+/* Installs the SIGUSR1 handler, dumps go to <pathPrefix>-<pid>-<n>.json */
+int trace_init(const char* pathPrefix);
+void trace_deinit(void);
+/* Writes a dump right away, e.g. before the process exits */
+void trace_dump(void);
+
+uint64_t trace_now_ns(void);
+void trace_record(const TRACE_SPAN* span);
+
+#define TRACE_BEGIN(span, spanName) TRACE_SPAN span = { (spanName), trace_now_ns() }
+#define TRACE_END(span) trace_record(&(span))
+
+#else
+
+#define trace_init(pathPrefix) 0
+#define trace_deinit() ((void)0)
+#define trace_dump() ((void)0)
+
+#define TRACE_BEGIN(span, spanName) ((void)0)
+#define TRACE_END(span) ((void)0)
+
+#endif
+
+#define TRACE_DEFAULT_PATH_PREFIX "/tmp/remote_monitoring_trace"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,44 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef TRANSPORT_SELECT_H
+#define TRANSPORT_SELECT_H
+
+#include <stdbool.h>
+
+#include "iothub_client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The IoT Hub transports a sample can be switched to by name, with --transport
+ * or the store's transport key. HTTP has neither the device twin nor direct
+ * methods, over it a sample only sends telemetry; http-batch lets the SDK pack
+ * the queued messages into one request. AMQP and HTTP are left out when
+ * build.sh runs with --no-amqp or --no-http.
+ */
+
+typedef struct TRANSPORT_TAG
+{
+	const char* name;
+	IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol;
+	bool hasTwin;
+	bool batching;
+} TRANSPORT;
+
+/* Returns the transport called name, NULL when it is unknown or not built in */
+const TRANSPORT* transport_find(const char* name);
+
+/* mqtt, always built in */
+const TRANSPORT* transport_default(void);
+
+/* Sets the client options the transport needs, returns 0 on success */
+int transport_configure(IOTHUB_CLIENT_HANDLE clientHandle, const TRANSPORT* transport);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_SELECT_H */
@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <string.h>
+
+#include "adaptive_interval.h"
+
+void adaptive_interval_init(ADAPTIVE_INTERVAL* adaptive, unsigned int initialMs)
+{
+	memset(adaptive, 0, sizeof(ADAPTIVE_INTERVAL));
+	adaptive->intervalMs = initialMs;
+}
+
+unsigned int adaptive_interval_next(ADAPTIVE_INTERVAL* adaptive, uint64_t nowUs, float temperatureC, float humidityPct,
+	unsigned int minMs, unsigned int maxMs)
+{
+	double intervalMs;
+
+	if (minMs < ADAPTIVE_INTERVAL_FLOOR_MS)
+	{
+		minMs = ADAPTIVE_INTERVAL_FLOOR_MS;
+	}
+	if (maxMs < minMs)
+	{
+		maxMs = minMs;
+	}
+
+	if (!adaptive->primed || nowUs <= adaptive->lastUs)
+	{
+		/* nothing to compare with yet, start from the slow end */
+		intervalMs = (adaptive->primed) ? adaptive->intervalMs : maxMs;
+	}
+	else
+	{
+		double elapsedS = (nowUs - adaptive->lastUs) / 1e6;
+		double steps = fmax(fabs(temperatureC - adaptive->lastTemperatureC) / ADAPTIVE_INTERVAL_TEMPERATURE_STEP_C,
+			fabs(humidityPct - adaptive->lastHumidityPct) / ADAPTIVE_INTERVAL_HUMIDITY_STEP_PCT);
+		double rate = steps / elapsedS;
+
+		adaptive->smoothedRate += ADAPTIVE_INTERVAL_SMOOTHING * (rate - adaptive->smoothedRate);
+		rate = fmax(rate, adaptive->smoothedRate);
+		intervalMs = (rate > 0) ? 1000.0 / rate : maxMs;
+	}
+
+	if (intervalMs < minMs)
+	{
+		intervalMs = minMs;
+	}
+	else if (intervalMs > maxMs)
+	{
+		intervalMs = maxMs;
+	}
+
+	adaptive->primed = 1;
+	adaptive->lastUs = nowUs;
+	adaptive->lastTemperatureC = temperatureC;
+	adaptive->lastHumidityPct = humidityPct;
+	adaptive->intervalMs = (unsigned int)intervalMs;
+
+	return adaptive->intervalMs;
+}
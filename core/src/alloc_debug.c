@@ -0,0 +1,467 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include "alloc_debug.h"
+
+#ifdef ENABLE_ALLOC_DEBUG
+
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* live allocations tracked at once, a power of two; beyond three quarters of it they are only counted */
+#define ALLOC_DEBUG_BLOCKS 65536
+/* call sites told apart, a power of two; the rest share one entry */
+#define ALLOC_DEBUG_SITES 1024
+#define ALLOC_DEBUG_REPORT_SITES 20
+#define ALLOC_DEBUG_BACKTRACE_DEPTH 16
+
+/* glibc's allocator behind the replacements */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* block, size_t size);
+extern void __libc_free(void* block);
+
+typedef struct ALLOC_SITE_TAG
+{
+	/* the return address of the malloc call, NULL for the sites that did not fit */
+	void* caller;
+	size_t liveBytes;
+	size_t liveBlocks;
+	uint64_t allocations;
+	/* those made after alloc_debug_seal */
+	uint64_t lateAllocations;
+} ALLOC_SITE;
+
+typedef struct ALLOC_BLOCK_TAG
+{
+	void* block;
+	size_t size;
+	ALLOC_SITE* site;
+} ALLOC_BLOCK;
+
+/* the tables are static, the accounting itself never allocates */
+static ALLOC_BLOCK Blocks[ALLOC_DEBUG_BLOCKS];
+static size_t Block_count;
+static ALLOC_SITE Sites[ALLOC_DEBUG_SITES];
+static ALLOC_SITE Other_site;
+static uint64_t Untracked;
+static pthread_mutex_t Alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+/* set while a replacement runs its own code, what that allocates is passed through */
+static __thread int In_hook;
+static int Sealed;
+static int Check;
+
+static pthread_mutex_t Report_lock = PTHREAD_MUTEX_INITIALIZER;
+static ALLOC_SITE Report_sites[ALLOC_DEBUG_SITES + 1];
+static int Signal_pipe[2] = { -1, -1 };
+static pthread_t Report_thread;
+static struct sigaction Previous_action;
+
+static size_t HashPointer(const void* pointer, size_t mask)
+{
+	uint64_t value = (uint64_t)(uintptr_t)pointer;
+
+	value ^= value >> 33;
+	value *= 0xff51afd7ed558ccdULL;
+	value ^= value >> 33;
+	return (size_t)value & mask;
+}
+
+static ALLOC_SITE* FindSite(void* caller)
+{
+	size_t slot = HashPointer(caller, ALLOC_DEBUG_SITES - 1);
+	ALLOC_SITE* result = &Other_site;
+
+	for (size_t probes = 0; probes < ALLOC_DEBUG_SITES; probes++)
+	{
+		ALLOC_SITE* site = &Sites[slot];
+
+		if (site->caller == caller || site->caller == NULL)
+		{
+			site->caller = caller;
+			result = site;
+			break;
+		}
+		slot = (slot + 1) & (ALLOC_DEBUG_SITES - 1);
+	}
+
+	return result;
+}
+
+/* Called with Alloc_lock held, returns the block's entry or NULL */
+static ALLOC_BLOCK* FindBlock(const void* block)
+{
+	size_t slot = HashPointer(block, ALLOC_DEBUG_BLOCKS - 1);
+	ALLOC_BLOCK* result = NULL;
+
+	while (Blocks[slot].block != NULL)
+	{
+		if (Blocks[slot].block == block)
+		{
+			result = &Blocks[slot];
+			break;
+		}
+		slot = (slot + 1) & (ALLOC_DEBUG_BLOCKS - 1);
+	}
+
+	return result;
+}
+
+/* Called with Alloc_lock held, closes the gap by moving up the entries probed past it */
+static void RemoveBlock(ALLOC_BLOCK* entry)
+{
+	size_t gap = (size_t)(entry - Blocks);
+	size_t slot = gap;
+
+	entry->site->liveBytes -= entry->size;
+	entry->site->liveBlocks--;
+	for (;;)
+	{
+		size_t home;
+
+		slot = (slot + 1) & (ALLOC_DEBUG_BLOCKS - 1);
+		if (Blocks[slot].block == NULL)
+		{
+			break;
+		}
+		home = HashPointer(Blocks[slot].block, ALLOC_DEBUG_BLOCKS - 1);
+		/* an entry stays when its home is cyclically after the gap, up to where it is */
+		if ((gap <= slot) ? (gap < home && home <= slot) : (gap < home || home <= slot))
+		{
+			continue;
+		}
+		Blocks[gap] = Blocks[slot];
+		gap = slot;
+	}
+	Blocks[gap].block = NULL;
+	Block_count--;
+}
+
+/* Called with Alloc_lock held */
+static void InsertBlock(void* block, size_t size, ALLOC_SITE* site)
+{
+	if (Block_count >= ALLOC_DEBUG_BLOCKS / 4 * 3)
+	{
+		Untracked++;
+	}
+	else
+	{
+		size_t slot = HashPointer(block, ALLOC_DEBUG_BLOCKS - 1);
+
+		while (Blocks[slot].block != NULL)
+		{
+			slot = (slot + 1) & (ALLOC_DEBUG_BLOCKS - 1);
+		}
+		Blocks[slot].block = block;
+		Blocks[slot].size = size;
+		Blocks[slot].site = site;
+		Block_count++;
+		site->liveBytes += size;
+		site->liveBlocks++;
+	}
+}
+
+static void ReportLate(size_t size, void* caller)
+{
+	void* frames[ALLOC_DEBUG_BACKTRACE_DEPTH];
+	int depth = backtrace(frames, ALLOC_DEBUG_BACKTRACE_DEPTH);
+
+	dprintf(STDERR_FILENO, "Allocation of %zu bytes after startup, the first from %p:\n", size, caller);
+	/* from the replacement that was called, ReportLate and Track left out */
+	if (depth > 2)
+	{
+		backtrace_symbols_fd(frames + 2, depth - 2, STDERR_FILENO);
+	}
+}
+
+static void Track(void* block, size_t size, void* caller)
+{
+	if (!In_hook)
+	{
+		ALLOC_SITE* site;
+		int report = 0;
+
+		In_hook = 1;
+		(void)pthread_mutex_lock(&Alloc_lock);
+		site = FindSite(caller);
+		site->allocations++;
+		if (Sealed)
+		{
+			report = (site->lateAllocations++ == 0) && Check;
+		}
+		InsertBlock(block, size, site);
+		(void)pthread_mutex_unlock(&Alloc_lock);
+
+		if (report)
+		{
+			ReportLate(size, caller);
+		}
+		In_hook = 0;
+	}
+}
+
+/* Before the block goes back to glibc, which may hand it to another thread right away */
+static void Untrack(void* block, ALLOC_BLOCK* removed)
+{
+	ALLOC_BLOCK* entry;
+
+	(void)pthread_mutex_lock(&Alloc_lock);
+	if ((entry = FindBlock(block)) != NULL)
+	{
+		if (removed != NULL)
+		{
+			*removed = *entry;
+		}
+		RemoveBlock(entry);
+	}
+	else if (removed != NULL)
+	{
+		removed->block = NULL;
+	}
+	(void)pthread_mutex_unlock(&Alloc_lock);
+}
+
+void* malloc(size_t size)
+{
+	void* result = __libc_malloc(size);
+
+	if (result != NULL)
+	{
+		Track(result, size, __builtin_return_address(0));
+	}
+
+	return result;
+}
+
+void* calloc(size_t count, size_t size)
+{
+	void* result = __libc_calloc(count, size);
+
+	if (result != NULL)
+	{
+		Track(result, count * size, __builtin_return_address(0));
+	}
+
+	return result;
+}
+
+void* realloc(void* block, size_t size)
+{
+	void* caller = __builtin_return_address(0);
+	ALLOC_BLOCK previous = { NULL, 0, NULL };
+	void* result;
+
+	if (block != NULL)
+	{
+		Untrack(block, &previous);
+	}
+	result = __libc_realloc(block, size);
+	if (result != NULL)
+	{
+		Track(result, size, caller);
+	}
+	else if (size != 0 && previous.block != NULL)
+	{
+		/* the block is still the caller's, it counts where it did */
+		(void)pthread_mutex_lock(&Alloc_lock);
+		InsertBlock(block, previous.size, previous.site);
+		(void)pthread_mutex_unlock(&Alloc_lock);
+	}
+
+	return result;
+}
+
+void free(void* block)
+{
+	if (block != NULL)
+	{
+		Untrack(block, NULL);
+		__libc_free(block);
+	}
+}
+
+void alloc_debug_report(void)
+{
+	size_t liveBytes = 0;
+	size_t liveBlocks = 0;
+	uint64_t untracked;
+	size_t count = 0;
+
+	(void)pthread_mutex_lock(&Report_lock);
+	In_hook = 1;
+	(void)pthread_mutex_lock(&Alloc_lock);
+	for (size_t i = 0; i < ALLOC_DEBUG_SITES; i++)
+	{
+		if (Sites[i].caller != NULL)
+		{
+			Report_sites[count++] = Sites[i];
+		}
+	}
+	if (Other_site.allocations > 0)
+	{
+		Report_sites[count++] = Other_site;
+	}
+	untracked = Untracked;
+	(void)pthread_mutex_unlock(&Alloc_lock);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		liveBytes += Report_sites[i].liveBytes;
+		liveBlocks += Report_sites[i].liveBlocks;
+	}
+	dprintf(STDERR_FILENO, "Heap: %zu bytes live in %zu blocks from %zu call sites, %llu allocations not tracked\n",
+		liveBytes, liveBlocks, count, (unsigned long long)untracked);
+
+	/* the sites holding the most, a partial selection sort puts them first */
+	for (size_t i = 0; i < count && i < ALLOC_DEBUG_REPORT_SITES; i++)
+	{
+		size_t largest = i;
+		ALLOC_SITE site;
+
+		for (size_t j = i + 1; j < count; j++)
+		{
+			if (Report_sites[j].liveBytes > Report_sites[largest].liveBytes)
+			{
+				largest = j;
+			}
+		}
+		site = Report_sites[largest];
+		Report_sites[largest] = Report_sites[i];
+		Report_sites[i] = site;
+
+		dprintf(STDERR_FILENO, "%10zu bytes %7zu blocks %9llu allocations %9llu after startup  ",
+			site.liveBytes, site.liveBlocks, (unsigned long long)site.allocations, (unsigned long long)site.lateAllocations);
+		if (site.caller != NULL)
+		{
+			backtrace_symbols_fd(&site.caller, 1, STDERR_FILENO);
+		}
+		else
+		{
+			dprintf(STDERR_FILENO, "(sites beyond the first %u)\n", ALLOC_DEBUG_SITES);
+		}
+	}
+	In_hook = 0;
+	(void)pthread_mutex_unlock(&Report_lock);
+}
+
+void alloc_debug_seal(void)
+{
+	void* frame;
+
+	/* the first backtrace loads the unwinder, which allocates; better now than in a report */
+	(void)backtrace(&frame, 1);
+	(void)pthread_mutex_lock(&Alloc_lock);
+	Sealed = 1;
+	(void)pthread_mutex_unlock(&Alloc_lock);
+	if (Check)
+	{
+		printf("Allocation check: startup is done, every further allocation site is reported once\r\n");
+	}
+}
+
+static void OnReportSignal(int signalNumber)
+{
+	int savedErrno = errno;
+	char byte = 0;
+
+	(void)signalNumber;
+	/* only async-signal-safe work here, the report thread does the rest */
+	(void)write(Signal_pipe[1], &byte, 1);
+	errno = savedErrno;
+}
+
+static void* ReportThread(void* arg)
+{
+	char byte;
+	ssize_t received;
+
+	(void)arg;
+	while ((received = read(Signal_pipe[0], &byte, 1)) != 0)
+	{
+		if (received < 0 && errno != EINTR)
+		{
+			break;
+		}
+		if (received == 1)
+		{
+			if (byte != 0)
+			{
+				/* written by alloc_debug_deinit */
+				break;
+			}
+			alloc_debug_report();
+		}
+	}
+
+	return NULL;
+}
+
+int alloc_debug_init(int check)
+{
+	int result;
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnReportSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	Check = check;
+	if (Signal_pipe[0] >= 0)
+	{
+		result = 0;
+	}
+	else if (pipe(Signal_pipe) != 0)
+	{
+		perror("Failed to create the heap report signal pipe");
+		result = __LINE__;
+	}
+	else if (fcntl(Signal_pipe[1], F_SETFL, fcntl(Signal_pipe[1], F_GETFL, 0) | O_NONBLOCK) != 0 ||
+		pthread_create(&Report_thread, NULL, ReportThread, NULL) != 0)
+	{
+		printf("Failed to start the heap report thread\r\n");
+		close(Signal_pipe[0]);
+		close(Signal_pipe[1]);
+		Signal_pipe[0] = Signal_pipe[1] = -1;
+		result = __LINE__;
+	}
+	else if (sigaction(SIGUSR2, &action, &Previous_action) != 0)
+	{
+		perror("Failed to install the SIGUSR2 handler");
+		result = __LINE__;
+	}
+	else
+	{
+		printf("Heap accounting enabled, kill -USR2 %ld lists the call sites holding the most memory\r\n", (long)getpid());
+		result = 0;
+	}
+
+	return result;
+}
+
+void alloc_debug_deinit(void)
+{
+	if (Signal_pipe[0] >= 0)
+	{
+		char stop = 1;
+
+		(void)sigaction(SIGUSR2, &Previous_action, NULL);
+		(void)write(Signal_pipe[1], &stop, 1);
+		pthread_join(Report_thread, NULL);
+		close(Signal_pipe[0]);
+		close(Signal_pipe[1]);
+		Signal_pipe[0] = Signal_pipe[1] = -1;
+	}
+}
+
+#endif /* ENABLE_ALLOC_DEBUG */
@@ -0,0 +1,113 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <string.h>
+
+#include "anomaly_detector.h"
+
+/* below the sensor noise, keeps a very steady signal from turning every wobble into a large z-score */
+static const double Min_stddev[EDGE_CHANNEL_COUNT] = { 0.05, 0.5 };
+
+/* Moves the sums to the latest sample and adds it, returns the slope in units per minute */
+static double AddToTrend(ANOMALY_TREND* trend, double elapsedSeconds, double value)
+{
+	double decay = exp(-elapsedSeconds / ANOMALY_DETECTOR_RATE_WINDOW_S);
+	double determinant;
+
+	/* the earlier samples are elapsedSeconds further back now */
+	trend->time2 -= 2 * elapsedSeconds * trend->time - elapsedSeconds * elapsedSeconds * trend->weight;
+	trend->timeValue -= elapsedSeconds * trend->value;
+	trend->time -= elapsedSeconds * trend->weight;
+
+	trend->weight = decay * trend->weight + 1;
+	trend->time *= decay;
+	trend->time2 *= decay;
+	trend->value = decay * trend->value + value;
+	trend->timeValue *= decay;
+
+	determinant = trend->weight * trend->time2 - trend->time * trend->time;
+
+	return (determinant > 0) ? 60 * (trend->weight * trend->timeValue - trend->time * trend->value) / determinant : 0;
+}
+
+void anomaly_detector_init(ANOMALY_DETECTOR* detector, double zThreshold, double rateThresholdPerMinute)
+{
+	memset(detector, 0, sizeof(ANOMALY_DETECTOR));
+	detector->zThreshold = zThreshold;
+	detector->rateThreshold = rateThresholdPerMinute;
+}
+
+int anomaly_detector_add(ANOMALY_DETECTOR* detector, uint64_t nowUs, const double values[EDGE_CHANNEL_COUNT], ANOMALY_EVENT* event)
+{
+	int result = 0;
+	double elapsedSeconds = (detector->samples > 0 && nowUs > detector->lastUs) ? (nowUs - detector->lastUs) / 1e6 : 0;
+	double trendRate;
+
+	if (detector->samples == 0)
+	{
+		detector->firstUs = nowUs;
+	}
+	trendRate = AddToTrend(&detector->trend, elapsedSeconds, values[EDGE_CHANNEL_TEMPERATURE]);
+
+	for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+	{
+		ANOMALY_CHANNEL* state = &detector->channels[channel];
+		double value = values[channel];
+		double zscore = 0;
+		double rate = 0;
+		double difference;
+		int anomalous;
+		int calm;
+
+		if (detector->samples == 0)
+		{
+			state->mean = value;
+			state->variance = 0;
+		}
+
+		if (detector->samples >= ANOMALY_DETECTOR_WARMUP)
+		{
+			zscore = fabs(value - state->mean) / fmax(sqrt(state->variance), Min_stddev[channel]);
+		}
+		/* the rate of change only matters for temperature, the cold chain limit */
+		if (channel == EDGE_CHANNEL_TEMPERATURE && nowUs - detector->firstUs >= ANOMALY_DETECTOR_RATE_WINDOW_S * 1000000ULL)
+		{
+			rate = trendRate;
+		}
+
+		anomalous = (detector->zThreshold > 0 && zscore >= detector->zThreshold) ||
+			(detector->rateThreshold > 0 && fabs(rate) >= detector->rateThreshold);
+		calm = (detector->zThreshold <= 0 || zscore < detector->zThreshold / 2) &&
+			(detector->rateThreshold <= 0 || fabs(rate) < detector->rateThreshold / 2);
+
+		if (anomalous && !state->alerting)
+		{
+			state->alerting = 1;
+			if (!result)
+			{
+				event->kind = (detector->zThreshold > 0 && zscore >= detector->zThreshold) ? ANOMALY_ZSCORE : ANOMALY_RATE;
+				event->channel = (EDGE_CHANNEL)channel;
+				event->value = value;
+				event->mean = state->mean;
+				event->zscore = zscore;
+				event->rate = rate;
+				result = 1;
+			}
+		}
+		else if (state->alerting && calm)
+		{
+			state->alerting = 0;
+		}
+
+		/* exponentially weighted mean and variance */
+		difference = value - state->mean;
+		state->mean += ANOMALY_DETECTOR_SMOOTHING * difference;
+		state->variance = (1 - ANOMALY_DETECTOR_SMOOTHING) * (state->variance + ANOMALY_DETECTOR_SMOOTHING * difference * difference);
+	}
+
+	detector->samples++;
+	detector->lastUs = nowUs;
+
+	return result;
+}
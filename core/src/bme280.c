@@ -7,6 +7,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "bme280.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+#include "sensor_trace.h"
 #include <wiringPi.h>
 #include <wiringPiSPI.h>
 #include <stdint.h>
@@ -16,9 +20,6 @@
 
 #define SENSOR_MODULE_MAX_XFER_LEN (128)
 static int Num_allowed_retries__i = 3;
-static int Chip_enable_selected__i = -1;
-
-#define SHOW_DEBUG_OUTPUT
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -58,61 +59,56 @@ enum
 };
 
 
-// Calibration data as read from the device.
-typedef struct
-{
-  uint16_t dig_T1;
-  int16_t  dig_T2;
-  int16_t  dig_T3;
-
-  uint16_t dig_P1;
-  int16_t  dig_P2;
-  int16_t  dig_P3;
-  int16_t  dig_P4;
-  int16_t  dig_P5;
-  int16_t  dig_P6;
-  int16_t  dig_P7;
-  int16_t  dig_P8;
-  int16_t  dig_P9;
-
-  uint8_t  dig_H1;
-  int16_t  dig_H2;
-  uint16_t dig_H3;
-  int16_t  dig_H4;
-  int16_t  dig_H5;
-  int8_t   dig_H6;
-} bme280_calib_data_t;
-bme280_calib_data_t Calib_data;
+// The module used by bme280_init() and bme280_read_sensors().
+static bme280_device_t Default_device = { .Chip_enable__i = -1 };
 
 
 ///////////////////////////////////////////////////////////////////////////////
-int bme280_read(const uint8_t Register__u8, uint8_t * Data__u8p, uint8_t Num_bytes__u8)
+static int bme280_read(const bme280_device_t * Device__p,
+  const uint8_t Register__u8, uint8_t * Data__u8p, uint8_t Num_bytes__u8)
 {
-  if (Chip_enable_selected__i == -1) { return 0; }
+  if (Device__p->Chip_enable__i == -1) { return 0; }
   if (Num_bytes__u8 >= SENSOR_MODULE_MAX_XFER_LEN) { return 0; }
+  if (sensor_trace_replaying())
+  {
+    return sensor_trace_replay_read(Device__p->Chip_enable__i, Register__u8,
+      Data__u8p, Num_bytes__u8);
+  }
 
   uint8_t Buffer__u8a[SENSOR_MODULE_MAX_XFER_LEN];
   memset(Buffer__u8a, 0, SENSOR_MODULE_MAX_XFER_LEN);
 
   // Set bit 7 high to tell it to read.
   Buffer__u8a[0] = (0x80 | Register__u8);
+  TRACE_BEGIN(Spi_span, "spi_read");
   int Result__i =
-    wiringPiSPIDataRW(Chip_enable_selected__i, Buffer__u8a, Num_bytes__u8 + 1);
+    wiringPiSPIDataRW(Device__p->Chip_enable__i, Buffer__u8a, Num_bytes__u8 + 1);
+  TRACE_END(Spi_span);
+  metrics_counter_add(METRIC_SPI_TRANSACTIONS, 1);
+  if (Result__i != Num_bytes__u8 + 1)
+  {
+    metrics_counter_add(METRIC_SPI_ERRORS, 1);
+  }
   int Out_idx__i = 0;
   while (Out_idx__i < (Result__i - 1))
   {
     Data__u8p[Out_idx__i] = Buffer__u8a[Out_idx__i + 1];
     Out_idx__i++;
   }
+  sensor_trace_capture_read(Device__p->Chip_enable__i, Register__u8,
+    Data__u8p, Result__i - 1);
 
   return Result__i - 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-int bme280_write(const uint8_t Register__u8, const uint8_t * Data__u8p, uint8_t Num_bytes__u8)
+static int bme280_write(const bme280_device_t * Device__p,
+  const uint8_t Register__u8, const uint8_t * Data__u8p, uint8_t Num_bytes__u8)
 {
-  if (Chip_enable_selected__i == -1) { return 0; }
+  if (Device__p->Chip_enable__i == -1) { return 0; }
   if (Num_bytes__u8 > SENSOR_MODULE_MAX_XFER_LEN) { return 0; }
+  // A replayed sensor keeps the configuration it was captured with.
+  if (sensor_trace_replaying()) { return Num_bytes__u8; }
 
   uint8_t Buffer__u8a[SENSOR_MODULE_MAX_XFER_LEN];
 
@@ -127,8 +123,15 @@ int bme280_write(const uint8_t Register__u8, const uint8_t * Data__u8p, uint8_t
     Data__u8p++;
   }
 
-  int Result__i = wiringPiSPIDataRW(Chip_enable_selected__i,
+  TRACE_BEGIN(Spi_span, "spi_write");
+  int Result__i = wiringPiSPIDataRW(Device__p->Chip_enable__i,
     Buffer__u8a, Num_bytes__u8 * 2);
+  TRACE_END(Spi_span);
+  metrics_counter_add(METRIC_SPI_TRANSACTIONS, 1);
+  if (Result__i != Num_bytes__u8 * 2)
+  {
+    metrics_counter_add(METRIC_SPI_ERRORS, 1);
+  }
 
   return Result__i / 2;
 }
@@ -136,192 +139,133 @@ int bme280_write(const uint8_t Register__u8, const uint8_t * Data__u8p, uint8_t
 ///////////////////////////////////////////////////////////////////////////////
 int bme280_init(int Chip_enable_to_use__i)
 {
-  #ifdef SHOW_DEBUG_OUTPUT
-  printf("bme280_init(%i)\n", Chip_enable_to_use__i);
-  #endif
+  return bme280_init_device(&Default_device, Chip_enable_to_use__i);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int bme280_init_device(bme280_device_t * Device__p, int Chip_enable_to_use__i)
+{
+  LOGGER_DEBUG("bme280_init(%i)\n", Chip_enable_to_use__i);
 
   if ((Chip_enable_to_use__i < 0) || (Chip_enable_to_use__i > 1))
   {
     return 0;
   }
-  Chip_enable_selected__i = Chip_enable_to_use__i;
+  Device__p->Chip_enable__i = Chip_enable_to_use__i;
+  bme280_calib_data_t * Calib__p = &Device__p->Calib_data;
 
   // Verify that the chip is really a BME280.
   uint8_t ID_value__u8 = 0;
-  int Bytes_read__i = bme280_read(eBME280reg_CHIPID, &ID_value__u8, 1);
+  int Bytes_read__i = bme280_read(Device__p, eBME280reg_CHIPID, &ID_value__u8, 1);
   if (Bytes_read__i != 1)
   {
     return 0;
   }
-  #ifdef SHOW_DEBUG_OUTPUT
-  printf("Read 0x%02x from register 0x%02x\n", ID_value__u8, eBME280reg_CHIPID);
-  #endif
+  LOGGER_DEBUG("Read 0x%02x from register 0x%02x\n", ID_value__u8, eBME280reg_CHIPID);
 
   if (ID_value__u8 != 0x60)
   {
-    #ifdef SHOW_DEBUG_OUTPUT
-    printf("This is not a BME280. Expecting an ID register value of 0x%02x\n",
+    LOGGER_ERROR("This is not a BME280. Expecting an ID register value of 0x%02x\n",
       0x60);
-    #endif
     return 0;
   }
 
   #define T_P_CALIB_NUM_BYTES (24)
-  Bytes_read__i = bme280_read(eBME280reg_DIG_T1, (uint8_t *)&Calib_data,
+  Bytes_read__i = bme280_read(Device__p, eBME280reg_DIG_T1, (uint8_t *)Calib__p,
     T_P_CALIB_NUM_BYTES);
   if (Bytes_read__i != T_P_CALIB_NUM_BYTES)
   {
-    #ifdef SHOW_DEBUG_OUTPUT
-    printf("Err: Only read %i out of %i calibration data bytes.\n",
+    LOGGER_ERROR("Err: Only read %i out of %i calibration data bytes.\n",
       Bytes_read__i, T_P_CALIB_NUM_BYTES);
-    #endif
     return 0;
   }
   uint8_t Hum_calib_buf__u8a[9];
-  Bytes_read__i += bme280_read(eBME280reg_DIG_H1, &Hum_calib_buf__u8a[0], 1);
+  Bytes_read__i += bme280_read(Device__p, eBME280reg_DIG_H1, &Hum_calib_buf__u8a[0], 1);
   if (Bytes_read__i != T_P_CALIB_NUM_BYTES + 1)
   {
-    #ifdef SHOW_DEBUG_OUTPUT
-    printf("Err: Only read %i out of %i calibration data bytes.\n",
+    LOGGER_ERROR("Err: Only read %i out of %i calibration data bytes.\n",
       Bytes_read__i, T_P_CALIB_NUM_BYTES + 1);
-    #endif
     return 0;
   }
-  Bytes_read__i += bme280_read(eBME280reg_DIG_H2, &Hum_calib_buf__u8a[1], 7);
+  Bytes_read__i += bme280_read(Device__p, eBME280reg_DIG_H2, &Hum_calib_buf__u8a[1], 7);
   if (Bytes_read__i != T_P_CALIB_NUM_BYTES + 8)
   {
-    #ifdef SHOW_DEBUG_OUTPUT
-    printf("Err: Only read %i out of %i calibration data bytes.\n",
+    LOGGER_ERROR("Err: Only read %i out of %i calibration data bytes.\n",
       Bytes_read__i, T_P_CALIB_NUM_BYTES + 8);
-    #endif
     return 0;
   }
-  #ifdef SHOW_DEBUG_OUTPUT
-  printf("Read %i calibration data bytes starting at 0x%02x.\n",
+  LOGGER_DEBUG("Read %i calibration data bytes starting at 0x%02x.\n",
     Bytes_read__i, eBME280reg_DIG_T1);
-  #endif
 
   // Decode the humidity compensation constants.
-  Calib_data.dig_H1 = Hum_calib_buf__u8a[0];
-  Calib_data.dig_H2 = (int16_t)(((uint16_t)Hum_calib_buf__u8a[1])
+  Calib__p->dig_H1 = Hum_calib_buf__u8a[0];
+  Calib__p->dig_H2 = (int16_t)(((uint16_t)Hum_calib_buf__u8a[1])
     + (((uint16_t)Hum_calib_buf__u8a[2]) << 8));
-  Calib_data.dig_H3 = Hum_calib_buf__u8a[3];
-  Calib_data.dig_H4 = (int16_t)((((uint16_t)Hum_calib_buf__u8a[4]) << 4)
+  Calib__p->dig_H3 = Hum_calib_buf__u8a[3];
+  Calib__p->dig_H4 = (int16_t)((((uint16_t)Hum_calib_buf__u8a[4]) << 4)
     + (((uint16_t)Hum_calib_buf__u8a[5]) & 0x0F));
-  Calib_data.dig_H5 = (int16_t)((((uint16_t)Hum_calib_buf__u8a[5]) >> 4)
+  Calib__p->dig_H5 = (int16_t)((((uint16_t)Hum_calib_buf__u8a[5]) >> 4)
     + (((uint16_t)Hum_calib_buf__u8a[6]) << 4));
-  Calib_data.dig_H6 = (int8_t)Hum_calib_buf__u8a[7];
+  Calib__p->dig_H6 = (int8_t)Hum_calib_buf__u8a[7];
 
   // bits 7~5 = 001 = temperature oversampling * 1
   // bits 4~2 = 111 = pressure oversampling * 16
   // bits 1~0 = 11  = normal power mode
   const uint8_t Control_setting__u8 = 0x3F;
-  uint8_t Bytes_written__u8 = bme280_write(eBME280reg_CONTROL,
+  uint8_t Bytes_written__u8 = bme280_write(Device__p, eBME280reg_CONTROL,
     &Control_setting__u8, 1);
   if (Bytes_written__u8 != 1)
   {
-    #ifdef SHOW_DEBUG_OUTPUT
-    printf("Err: Could not write 0x%02x to register 0x%02x.\n",
+    LOGGER_ERROR("Err: Could not write 0x%02x to register 0x%02x.\n",
       Control_setting__u8, eBME280reg_CONTROL);
-    #endif
     return 0;
   }
-  #ifdef SHOW_DEBUG_OUTPUT
-  printf("Wrote 0x%02x to configuration register 0x%02x.\n",
+  LOGGER_DEBUG("Wrote 0x%02x to configuration register 0x%02x.\n",
     Control_setting__u8, eBME280reg_CONTROL);
-  #endif
 
   return 1;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Returns temperature in DegC, resolution is 0.01 DegC.
-// For example: Output value of “5123” equals 51.23 DegC.
-// t_fine is stored globally since it is also used by the pressure comp calc.
-// Note: Must call this before calling compensate_P or compensate_H because of
-// the global t_fine variable.
-int32_t t_fine = 0;
-int32_t bme280_compensate_T_int32(int32_t adc_T)
+int bme280_read_sensors(float * Temp_c__fp, float * Pres_Pa__fp,
+  float * Hum_pct__fp)
 {
-  int32_t var1, var2, T;
-  var1 = ((((adc_T >> 3) - ((int32_t)Calib_data.dig_T1 << 1)))
-    * ((int32_t)Calib_data.dig_T2)) >> 11;
-  var2 = (((((adc_T >> 4) - ((int32_t)Calib_data.dig_T1))
-    * ((adc_T >> 4) - ((int32_t)Calib_data.dig_T1))) >> 12)
-    * ((int32_t)Calib_data.dig_T3)) >> 14;
-  t_fine = var1 + var2;
-  T = (t_fine * 5 + 128) >> 8;
-  return T;
+  return bme280_read_device(&Default_device, Temp_c__fp, Pres_Pa__fp,
+    Hum_pct__fp);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Returns pressure in Pa as unsigned 32 bit integer in Q24.8 format (24
-// integer bits and 8 fractional bits).
-// For example: Output value of “24674867” represents 24674867/256 = 96386.2 Pa
-// = 963.862 hPa
-// Note: Must call compensate_T before calling this because of
-// the global t_fine variable.
-uint32_t bme280_compensate_P_int64(int32_t adc_P)
+int bme280_read_raw(bme280_raw_t * Raw__p)
 {
-  int64_t var1, var2, p;
-  var1 = ((int64_t)t_fine) - 128000LL;
-  var2 = var1 * var1 * (int64_t)Calib_data.dig_P6;
-  var2 = var2 + ((var1*(int64_t)Calib_data.dig_P5) << 17);
-  var2 = var2 + (((int64_t)Calib_data.dig_P4) << 35);
-  var1 = ((var1 * var1 * (int64_t)Calib_data.dig_P3)>>8) + ((var1 * (int64_t)Calib_data.dig_P2) << 12);
-  var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)Calib_data.dig_P1) >> 33;
-  if (var1 == 0)
-  {
-    // Avoid divide by zero exception.
-    return 0;
-  }
-  p = 1048576 - adc_P;
-  p = (((p << 31) - var2) * 3125) / var1;
-  var1 = (((int64_t)Calib_data.dig_P9) * (p >> 13) * (p >> 13)) >> 25;
-  var2 = (((int64_t)Calib_data.dig_P8) * p) >> 19;
-  p = ((p + var1 + var2) >> 8) + (((int64_t)Calib_data.dig_P7) << 4);
-  return (uint32_t)p;
+  return bme280_read_raw_device(&Default_device, Raw__p);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Returns humidity as a relative percentage.
-// Encoded as Q22.10 format (22 integer bits and 10 fractional bits).
-// For example: Output value of “47445” represents 47445/1024 = 46.333 %RH
-// Note: Must call compensate_T before calling this because of
-// the global t_fine variable.
-uint32_t bme280_compensate_H_int32(int32_t adc_H)
+const bme280_calib_data_t * bme280_calibration(void)
 {
-  int32_t v_x1_u32r;
-  v_x1_u32r = (t_fine - ((int32_t)76800L));
-  v_x1_u32r = (((((adc_H << 14) - (((int32_t)Calib_data.dig_H4) << 20)
-    - (((int32_t)Calib_data.dig_H5) * v_x1_u32r)) + ((int32_t)16384)) >> 15)
-    * (((((((v_x1_u32r * ((int32_t)Calib_data.dig_H6)) >> 10)
-    * (((v_x1_u32r * ((int32_t)Calib_data.dig_H3)) >> 11)
-    + ((int32_t)32768))) >> 10) + ((int32_t)2097152))
-    * ((int32_t)Calib_data.dig_H2) + 8192) >> 14));
-  v_x1_u32r = (v_x1_u32r - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7)
-    * ((int32_t)Calib_data.dig_H1)) >> 4));
-  v_x1_u32r = (v_x1_u32r < 0 ? 0 : v_x1_u32r);
-  v_x1_u32r = (v_x1_u32r > 419430400 ? 419430400 : v_x1_u32r);
-  return (uint32_t)(v_x1_u32r >> 12);
+  return &Default_device.Calib_data;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-int bme280_read_sensors(float * Temp_c__fp, float * Pres_Pa__fp,
-  float * Hum_pct__fp)
+// Waits for the module to finish a measurement and reads the ADC values.
+// Returns 1 on success, 0 when the module did not answer.
+static int bme280_read_adc(bme280_device_t * Device__p, bme280_raw_t * Raw__p)
 {
   int Return_status__i = 0;
 
   // Make sure the sensor isn't busy updating values.
+  TRACE_BEGIN(Wait_span, "bme280_status_wait");
   uint8_t Status__u8 = 0x01;
   while ((Status__u8 & 0x01) != 0)
   {
-    uint8_t Num_bytes_read__u8 = bme280_read(eBME280reg_STATUS, &Status__u8, 1);
+    uint8_t Num_bytes_read__u8 = bme280_read(Device__p, eBME280reg_STATUS, &Status__u8, 1);
     if (Num_bytes_read__u8 != 1)
     {
+      TRACE_END(Wait_span);
       return Return_status__i;
     }
   }
+  TRACE_END(Wait_span);
 
   const uint8_t Num_bytes_to_read__u8 = 8;
   uint8_t Buffer__u8a[Num_bytes_to_read__u8];
@@ -329,7 +273,7 @@ int bme280_read_sensors(float * Temp_c__fp, float * Pres_Pa__fp,
   while (Num_retries__i <= Num_allowed_retries__i)
   {
     uint8_t Register__u8 = eBME280reg_PRESDATA;
-    int Num_bytes_read__i = bme280_read(Register__u8, Buffer__u8a,
+    int Num_bytes_read__i = bme280_read(Device__p, Register__u8, Buffer__u8a,
       Num_bytes_to_read__u8);
     if (Num_bytes_read__i == (int)Num_bytes_to_read__u8)
     {
@@ -358,12 +302,11 @@ int bme280_read_sensors(float * Temp_c__fp, float * Pres_Pa__fp,
       int32_t Humidity_raw_adc__i32 = (((int32_t)Buffer__u8a[6]) << 8);
       // Least Significant Bits [7:0] of Humidity ADC value.
       Humidity_raw_adc__i32 += ((int32_t)Buffer__u8a[7]);
-printf("raw H = 0x%08x\n", Humidity_raw_adc__i32);
-
-      *Temp_c__fp = bme280_compensate_T_int32(Temperature_raw_adc__i32) / 100.0;
-      *Pres_Pa__fp = bme280_compensate_P_int64(Pressure_raw_adc__i32) / 256.0;
-      *Hum_pct__fp = bme280_compensate_H_int32(Humidity_raw_adc__i32) / 1024.0;
+      LOGGER_DEBUG("raw H = 0x%08x\n", Humidity_raw_adc__i32);
 
+      Raw__p->adc_T = Temperature_raw_adc__i32;
+      Raw__p->adc_P = Pressure_raw_adc__i32;
+      Raw__p->adc_H = Humidity_raw_adc__i32;
       Return_status__i = 1;
       break;
     }
@@ -375,3 +318,56 @@ printf("raw H = 0x%08x\n", Humidity_raw_adc__i32);
   return Return_status__i;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+int bme280_read_raw_device(bme280_device_t * Device__p, bme280_raw_t * Raw__p)
+{
+  uint64_t Start_us__u64 = metrics_now_us();
+  TRACE_BEGIN(Read_span, "bme280_read_raw_device");
+
+  int Return_status__i = bme280_read_adc(Device__p, Raw__p);
+  if (Return_status__i == 1)
+  {
+    metrics_histogram_observe(METRIC_SENSOR_READ_LATENCY,
+      metrics_now_us() - Start_us__u64);
+  }
+  else
+  {
+    metrics_counter_add(METRIC_SENSOR_READ_FAILURES, 1);
+  }
+
+  TRACE_END(Read_span);
+  return Return_status__i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int bme280_read_device(bme280_device_t * Device__p, float * Temp_c__fp,
+  float * Pres_Pa__fp, float * Hum_pct__fp)
+{
+  uint64_t Start_us__u64 = metrics_now_us();
+  TRACE_BEGIN(Read_span, "bme280_read_device");
+  bme280_raw_t Raw__s;
+
+  int Return_status__i = bme280_read_adc(Device__p, &Raw__s);
+  if (Return_status__i == 1)
+  {
+    TRACE_BEGIN(Compensate_span, "bme280_compensate");
+    int32_t T_fine__i32;
+    *Temp_c__fp = bme280_compensate_T_int32(&Device__p->Calib_data,
+      Raw__s.adc_T, &T_fine__i32) / 100.0;
+    *Pres_Pa__fp = bme280_compensate_P_int64(&Device__p->Calib_data,
+      Raw__s.adc_P, T_fine__i32) / 256.0;
+    *Hum_pct__fp = bme280_compensate_H_int32(&Device__p->Calib_data,
+      Raw__s.adc_H, T_fine__i32) / 1024.0;
+    TRACE_END(Compensate_span);
+
+    metrics_histogram_observe(METRIC_SENSOR_READ_LATENCY,
+      metrics_now_us() - Start_us__u64);
+  }
+  else
+  {
+    metrics_counter_add(METRIC_SENSOR_READ_FAILURES, 1);
+  }
+
+  TRACE_END(Read_span);
+  return Return_status__i;
+}
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// bme280_compensate.c:
+// Compensation formulas from the BME280 datasheet. They depend on nothing but
+// the calibration data and stdint.h, so a backend can build this file on its
+// own to turn raw ADC frames into the values the device would have computed.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "bme280.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns temperature in DegC, resolution is 0.01 DegC.
+// For example: Output value of “5123” equals 51.23 DegC.
+// t_fine is returned through T_fine__i32p since it is also used by the
+// pressure and humidity comp calcs.
+int32_t bme280_compensate_T_int32(const bme280_calib_data_t * Calib__p,
+  int32_t adc_T, int32_t * T_fine__i32p)
+{
+  int32_t var1, var2, T;
+  var1 = ((((adc_T >> 3) - ((int32_t)Calib__p->dig_T1 << 1)))
+    * ((int32_t)Calib__p->dig_T2)) >> 11;
+  var2 = (((((adc_T >> 4) - ((int32_t)Calib__p->dig_T1))
+    * ((adc_T >> 4) - ((int32_t)Calib__p->dig_T1))) >> 12)
+    * ((int32_t)Calib__p->dig_T3)) >> 14;
+  *T_fine__i32p = var1 + var2;
+  T = (*T_fine__i32p * 5 + 128) >> 8;
+  return T;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns pressure in Pa as unsigned 32 bit integer in Q24.8 format (24
+// integer bits and 8 fractional bits).
+// For example: Output value of “24674867” represents 24674867/256 = 96386.2 Pa
+// = 963.862 hPa
+// Note: T_fine__i32 comes from bme280_compensate_T_int32.
+uint32_t bme280_compensate_P_int64(const bme280_calib_data_t * Calib__p,
+  int32_t adc_P, int32_t T_fine__i32)
+{
+  int64_t var1, var2, p;
+  var1 = ((int64_t)T_fine__i32) - 128000LL;
+  var2 = var1 * var1 * (int64_t)Calib__p->dig_P6;
+  var2 = var2 + ((var1*(int64_t)Calib__p->dig_P5) << 17);
+  var2 = var2 + (((int64_t)Calib__p->dig_P4) << 35);
+  var1 = ((var1 * var1 * (int64_t)Calib__p->dig_P3)>>8) + ((var1 * (int64_t)Calib__p->dig_P2) << 12);
+  var1 = (((((int64_t)1) << 47) + var1)) * ((int64_t)Calib__p->dig_P1) >> 33;
+  if (var1 == 0)
+  {
+    // Avoid divide by zero exception.
+    return 0;
+  }
+  p = 1048576 - adc_P;
+  p = (((p << 31) - var2) * 3125) / var1;
+  var1 = (((int64_t)Calib__p->dig_P9) * (p >> 13) * (p >> 13)) >> 25;
+  var2 = (((int64_t)Calib__p->dig_P8) * p) >> 19;
+  p = ((p + var1 + var2) >> 8) + (((int64_t)Calib__p->dig_P7) << 4);
+  return (uint32_t)p;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns humidity as a relative percentage.
+// Encoded as Q22.10 format (22 integer bits and 10 fractional bits).
+// For example: Output value of “47445” represents 47445/1024 = 46.333 %RH
+// Note: T_fine__i32 comes from bme280_compensate_T_int32.
+uint32_t bme280_compensate_H_int32(const bme280_calib_data_t * Calib__p,
+  int32_t adc_H, int32_t T_fine__i32)
+{
+  int32_t v_x1_u32r;
+  v_x1_u32r = (T_fine__i32 - ((int32_t)76800L));
+  v_x1_u32r = (((((adc_H << 14) - (((int32_t)Calib__p->dig_H4) << 20)
+    - (((int32_t)Calib__p->dig_H5) * v_x1_u32r)) + ((int32_t)16384)) >> 15)
+    * (((((((v_x1_u32r * ((int32_t)Calib__p->dig_H6)) >> 10)
+    * (((v_x1_u32r * ((int32_t)Calib__p->dig_H3)) >> 11)
+    + ((int32_t)32768))) >> 10) + ((int32_t)2097152))
+    * ((int32_t)Calib__p->dig_H2) + 8192) >> 14));
+  v_x1_u32r = (v_x1_u32r - (((((v_x1_u32r >> 15) * (v_x1_u32r >> 15)) >> 7)
+    * ((int32_t)Calib__p->dig_H1)) >> 4));
+  v_x1_u32r = (v_x1_u32r < 0 ? 0 : v_x1_u32r);
+  v_x1_u32r = (v_x1_u32r > 419430400 ? 419430400 : v_x1_u32r);
+  return (uint32_t)(v_x1_u32r >> 12);
+}
@@ -0,0 +1,596 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_store.h"
+
+#define CONFIG_STORE_MAGIC "RMSTORE"
+#define CONFIG_STORE_HEADER_SIZE 24
+#define CONFIG_STORE_RECORD_HEADER_SIZE 4
+/* far above anything the records add up to, guards against a bogus length */
+#define CONFIG_STORE_PAYLOAD_MAX 4096
+#define CONFIG_STORE_PATH_MAX 512
+
+typedef enum CONFIG_STORE_KEY_TAG
+{
+	CONFIG_KEY_DEVICE_ID = 1,
+	CONFIG_KEY_CONNECTION_STRING = 2,
+	CONFIG_KEY_UPDATE_BEGIN = 3,
+	CONFIG_KEY_REBOOT_BEGIN = 4,
+	CONFIG_KEY_TEMPERATURE_OFFSET = 5,
+	CONFIG_KEY_PRESSURE_OFFSET = 6,
+	CONFIG_KEY_HUMIDITY_OFFSET = 7,
+	CONFIG_KEY_TELEMETRY_INTERVAL_S = 8,
+	CONFIG_KEY_METRICS_PORT = 9,
+	CONFIG_KEY_TELEMETRY_INTERVAL_MS = 10,
+	CONFIG_KEY_TELEMETRY_INTERVAL_MIN_MS = 11,
+	CONFIG_KEY_TELEMETRY_INTERVAL_MAX_MS = 12,
+	CONFIG_KEY_AGGREGATION_WINDOW = 13,
+	CONFIG_KEY_AGGREGATION_HOP = 14,
+	CONFIG_KEY_ANOMALY_Z_THRESHOLD = 15,
+	CONFIG_KEY_ANOMALY_RATE = 16,
+	CONFIG_KEY_ANOMALY_SAMPLE_MS = 17,
+	CONFIG_KEY_SAS_TOKEN_LIFETIME = 18,
+	CONFIG_KEY_RETRY_TIMEOUT = 19,
+	CONFIG_KEY_COMPRESS_THRESHOLD = 20,
+	CONFIG_KEY_SAMPLE_BLOCK_SAMPLES = 21,
+	CONFIG_KEY_SAMPLE_BLOCK_RAW = 22,
+	CONFIG_KEY_TRANSPORT = 23
+} CONFIG_STORE_KEY;
+
+typedef struct CONFIG_STORE_WRITER_TAG
+{
+	uint8_t buffer[CONFIG_STORE_HEADER_SIZE + CONFIG_STORE_PAYLOAD_MAX];
+	size_t length;
+	int overflow;
+} CONFIG_STORE_WRITER;
+
+/* one save at a time, they share the temporary file */
+static pthread_mutex_t Save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Bitwise, the payload is a few hundred bytes read once at startup */
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+	}
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static void PutLittleEndian(uint8_t* buffer, uint64_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		buffer[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static uint64_t GetLittleEndian(const uint8_t* buffer, int size)
+{
+	uint64_t value = 0;
+
+	for (int i = 0; i < size; i++)
+	{
+		value |= (uint64_t)buffer[i] << (8 * i);
+	}
+
+	return value;
+}
+
+static uint32_t FloatBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float BitsFloat(uint32_t bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static void PutRecord(CONFIG_STORE_WRITER* writer, CONFIG_STORE_KEY key, const void* data, size_t length)
+{
+	if (writer->length + CONFIG_STORE_RECORD_HEADER_SIZE + length > sizeof(writer->buffer))
+	{
+		writer->overflow = 1;
+	}
+	else
+	{
+		PutLittleEndian(writer->buffer + writer->length, key, 2);
+		PutLittleEndian(writer->buffer + writer->length + 2, length, 2);
+		memcpy(writer->buffer + writer->length + CONFIG_STORE_RECORD_HEADER_SIZE, data, length);
+		writer->length += CONFIG_STORE_RECORD_HEADER_SIZE + length;
+	}
+}
+
+static void PutInteger(CONFIG_STORE_WRITER* writer, CONFIG_STORE_KEY key, uint64_t value, int size)
+{
+	uint8_t bytes[8];
+
+	PutLittleEndian(bytes, value, size);
+	PutRecord(writer, key, bytes, (size_t)size);
+}
+
+static void GetString(char* destination, size_t size, const uint8_t* data, size_t length)
+{
+	if (length >= size)
+	{
+		length = size - 1;
+	}
+	memcpy(destination, data, length);
+	destination[length] = '\0';
+}
+
+static void ParseRecord(CONFIG_STORE* config, CONFIG_STORE_KEY key, const uint8_t* data, size_t length)
+{
+	switch (key)
+	{
+	case CONFIG_KEY_DEVICE_ID:
+		GetString(config->deviceId, sizeof(config->deviceId), data, length);
+		break;
+	case CONFIG_KEY_CONNECTION_STRING:
+		GetString(config->connectionString, sizeof(config->connectionString), data, length);
+		break;
+	case CONFIG_KEY_UPDATE_BEGIN:
+		if (length == 8)
+		{
+			config->updateBegin = (int64_t)GetLittleEndian(data, 8);
+		}
+		break;
+	case CONFIG_KEY_REBOOT_BEGIN:
+		if (length == 8)
+		{
+			config->rebootBegin = (int64_t)GetLittleEndian(data, 8);
+		}
+		break;
+	case CONFIG_KEY_TEMPERATURE_OFFSET:
+		if (length == 4)
+		{
+			config->temperatureOffsetC = BitsFloat((uint32_t)GetLittleEndian(data, 4));
+		}
+		break;
+	case CONFIG_KEY_PRESSURE_OFFSET:
+		if (length == 4)
+		{
+			config->pressureOffsetPa = BitsFloat((uint32_t)GetLittleEndian(data, 4));
+		}
+		break;
+	case CONFIG_KEY_HUMIDITY_OFFSET:
+		if (length == 4)
+		{
+			config->humidityOffsetPct = BitsFloat((uint32_t)GetLittleEndian(data, 4));
+		}
+		break;
+	case CONFIG_KEY_TELEMETRY_INTERVAL_S:
+		if (length == 4)
+		{
+			config->telemetryIntervalS = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_TELEMETRY_INTERVAL_MS:
+		if (length == 4)
+		{
+			config->telemetryIntervalMs = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_TELEMETRY_INTERVAL_MIN_MS:
+		if (length == 4)
+		{
+			config->telemetryIntervalMinMs = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_TELEMETRY_INTERVAL_MAX_MS:
+		if (length == 4)
+		{
+			config->telemetryIntervalMaxMs = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_AGGREGATION_WINDOW:
+		if (length == 4)
+		{
+			config->aggregationWindowS = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_AGGREGATION_HOP:
+		if (length == 4)
+		{
+			config->aggregationHopS = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_ANOMALY_Z_THRESHOLD:
+		if (length == 4)
+		{
+			config->anomalyZThreshold = BitsFloat((uint32_t)GetLittleEndian(data, 4));
+		}
+		break;
+	case CONFIG_KEY_ANOMALY_RATE:
+		if (length == 4)
+		{
+			config->anomalyRatePerMinute = BitsFloat((uint32_t)GetLittleEndian(data, 4));
+		}
+		break;
+	case CONFIG_KEY_ANOMALY_SAMPLE_MS:
+		if (length == 4)
+		{
+			config->anomalySampleMs = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_SAS_TOKEN_LIFETIME:
+		if (length == 4)
+		{
+			config->sasTokenLifetimeS = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_RETRY_TIMEOUT:
+		if (length == 4)
+		{
+			config->retryTimeoutS = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_COMPRESS_THRESHOLD:
+		if (length == 4)
+		{
+			config->compressThresholdBytes = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_SAMPLE_BLOCK_SAMPLES:
+		if (length == 4)
+		{
+			config->sampleBlockSamples = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_SAMPLE_BLOCK_RAW:
+		if (length == 4)
+		{
+			config->sampleBlockRaw = (uint32_t)GetLittleEndian(data, 4);
+		}
+		break;
+	case CONFIG_KEY_TRANSPORT:
+		GetString(config->transport, sizeof(config->transport), data, length);
+		break;
+	case CONFIG_KEY_METRICS_PORT:
+		if (length == 2)
+		{
+			config->metricsPort = (uint16_t)GetLittleEndian(data, 2);
+		}
+		break;
+	default:
+		/* written by a newer build */
+		break;
+	}
+}
+
+static CONFIG_STORE_RESULT ParseImage(const uint8_t* image, size_t size, CONFIG_STORE* config)
+{
+	CONFIG_STORE_RESULT result;
+	size_t payloadLength;
+
+	if (size < CONFIG_STORE_HEADER_SIZE || memcmp(image, CONFIG_STORE_MAGIC, 8) != 0)
+	{
+		result = CONFIG_STORE_CORRUPT;
+	}
+	else if (GetLittleEndian(image + 8, 2) != CONFIG_STORE_VERSION || GetLittleEndian(image + 10, 2) != CONFIG_STORE_HEADER_SIZE)
+	{
+		printf("Config store version %u is not supported\r\n", (unsigned int)GetLittleEndian(image + 8, 2));
+		result = CONFIG_STORE_CORRUPT;
+	}
+	else if ((payloadLength = (size_t)GetLittleEndian(image + 12, 4)) > size - CONFIG_STORE_HEADER_SIZE ||
+		Crc32(image + CONFIG_STORE_HEADER_SIZE, payloadLength) != (uint32_t)GetLittleEndian(image + 16, 4))
+	{
+		result = CONFIG_STORE_CORRUPT;
+	}
+	else
+	{
+		const uint8_t* record = image + CONFIG_STORE_HEADER_SIZE;
+		const uint8_t* end = record + payloadLength;
+
+		config_store_defaults(config);
+		config->generation = (uint32_t)GetLittleEndian(image + 20, 4);
+		result = CONFIG_STORE_OK;
+
+		while (result == CONFIG_STORE_OK && record < end)
+		{
+			size_t length;
+
+			if (end - record < CONFIG_STORE_RECORD_HEADER_SIZE ||
+				(length = (size_t)GetLittleEndian(record + 2, 2)) > (size_t)(end - record) - CONFIG_STORE_RECORD_HEADER_SIZE)
+			{
+				result = CONFIG_STORE_CORRUPT;
+			}
+			else
+			{
+				ParseRecord(config, (CONFIG_STORE_KEY)GetLittleEndian(record, 2), record + CONFIG_STORE_RECORD_HEADER_SIZE, length);
+				record += CONFIG_STORE_RECORD_HEADER_SIZE + length;
+			}
+		}
+	}
+
+	return result;
+}
+
+const char* config_store_path(const char* explicitPath)
+{
+	const char* path = explicitPath;
+
+	if (path == NULL || path[0] == '\0')
+	{
+		path = getenv(CONFIG_STORE_ENV);
+	}
+	if (path == NULL || path[0] == '\0')
+	{
+		path = CONFIG_STORE_DEFAULT_PATH;
+	}
+
+	return path;
+}
+
+void config_store_defaults(CONFIG_STORE* config)
+{
+	memset(config, 0, sizeof(CONFIG_STORE));
+}
+
+CONFIG_STORE_RESULT config_store_load(const char* path, CONFIG_STORE* config)
+{
+	CONFIG_STORE_RESULT result;
+	struct stat status;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+	{
+		result = (errno == ENOENT) ? CONFIG_STORE_MISSING : CONFIG_STORE_ERROR;
+		if (result == CONFIG_STORE_ERROR)
+		{
+			printf("Failed to open config store %s: %s\r\n", path, strerror(errno));
+		}
+	}
+	else
+	{
+		if (fstat(fd, &status) != 0)
+		{
+			result = CONFIG_STORE_ERROR;
+		}
+		else if (status.st_size < CONFIG_STORE_HEADER_SIZE || status.st_size > CONFIG_STORE_HEADER_SIZE + CONFIG_STORE_PAYLOAD_MAX)
+		{
+			result = CONFIG_STORE_CORRUPT;
+		}
+		else
+		{
+			void* image = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (image == MAP_FAILED)
+			{
+				printf("Failed to map config store %s: %s\r\n", path, strerror(errno));
+				result = CONFIG_STORE_ERROR;
+			}
+			else
+			{
+				result = ParseImage(image, (size_t)status.st_size, config);
+				munmap(image, (size_t)status.st_size);
+			}
+		}
+		close(fd);
+
+		if (result == CONFIG_STORE_CORRUPT)
+		{
+			printf("Config store %s is damaged, ignoring it\r\n", path);
+		}
+	}
+
+	return result;
+}
+
+static int WriteAll(int fd, const uint8_t* data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t written = write(fd, data, length);
+		if (written < 0)
+		{
+			if (errno != EINTR)
+			{
+				return __LINE__;
+			}
+		}
+		else
+		{
+			data += written;
+			length -= (size_t)written;
+		}
+	}
+
+	return 0;
+}
+
+/* Makes the rename itself durable */
+static void SyncDirectory(const char* path)
+{
+	char directory[CONFIG_STORE_PATH_MAX];
+	int fd;
+
+	snprintf(directory, sizeof(directory), "%s", path);
+	if ((fd = open(dirname(directory), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0)
+	{
+		(void)fsync(fd);
+		close(fd);
+	}
+}
+
+CONFIG_STORE_RESULT config_store_save(const char* path, CONFIG_STORE* config)
+{
+	CONFIG_STORE_RESULT result;
+	static CONFIG_STORE_WRITER writer;
+	char temporaryPath[CONFIG_STORE_PATH_MAX + 8];
+	int fd;
+
+	pthread_mutex_lock(&Save_lock);
+
+	memset(&writer, 0, sizeof(writer));
+	writer.length = CONFIG_STORE_HEADER_SIZE;
+	PutRecord(&writer, CONFIG_KEY_DEVICE_ID, config->deviceId, strlen(config->deviceId));
+	PutRecord(&writer, CONFIG_KEY_CONNECTION_STRING, config->connectionString, strlen(config->connectionString));
+	PutInteger(&writer, CONFIG_KEY_UPDATE_BEGIN, (uint64_t)config->updateBegin, 8);
+	PutInteger(&writer, CONFIG_KEY_REBOOT_BEGIN, (uint64_t)config->rebootBegin, 8);
+	PutInteger(&writer, CONFIG_KEY_TEMPERATURE_OFFSET, FloatBits(config->temperatureOffsetC), 4);
+	PutInteger(&writer, CONFIG_KEY_PRESSURE_OFFSET, FloatBits(config->pressureOffsetPa), 4);
+	PutInteger(&writer, CONFIG_KEY_HUMIDITY_OFFSET, FloatBits(config->humidityOffsetPct), 4);
+	PutInteger(&writer, CONFIG_KEY_TELEMETRY_INTERVAL_S, config->telemetryIntervalS, 4);
+	PutInteger(&writer, CONFIG_KEY_TELEMETRY_INTERVAL_MS, config->telemetryIntervalMs, 4);
+	PutInteger(&writer, CONFIG_KEY_TELEMETRY_INTERVAL_MIN_MS, config->telemetryIntervalMinMs, 4);
+	PutInteger(&writer, CONFIG_KEY_TELEMETRY_INTERVAL_MAX_MS, config->telemetryIntervalMaxMs, 4);
+	PutInteger(&writer, CONFIG_KEY_AGGREGATION_WINDOW, config->aggregationWindowS, 4);
+	PutInteger(&writer, CONFIG_KEY_AGGREGATION_HOP, config->aggregationHopS, 4);
+	PutInteger(&writer, CONFIG_KEY_ANOMALY_Z_THRESHOLD, FloatBits(config->anomalyZThreshold), 4);
+	PutInteger(&writer, CONFIG_KEY_ANOMALY_RATE, FloatBits(config->anomalyRatePerMinute), 4);
+	PutInteger(&writer, CONFIG_KEY_ANOMALY_SAMPLE_MS, config->anomalySampleMs, 4);
+	PutInteger(&writer, CONFIG_KEY_SAS_TOKEN_LIFETIME, config->sasTokenLifetimeS, 4);
+	PutInteger(&writer, CONFIG_KEY_RETRY_TIMEOUT, config->retryTimeoutS, 4);
+	PutInteger(&writer, CONFIG_KEY_COMPRESS_THRESHOLD, config->compressThresholdBytes, 4);
+	PutInteger(&writer, CONFIG_KEY_SAMPLE_BLOCK_SAMPLES, config->sampleBlockSamples, 4);
+	PutInteger(&writer, CONFIG_KEY_SAMPLE_BLOCK_RAW, config->sampleBlockRaw, 4);
+	PutRecord(&writer, CONFIG_KEY_TRANSPORT, config->transport, strlen(config->transport));
+	PutInteger(&writer, CONFIG_KEY_METRICS_PORT, config->metricsPort, 2);
+
+	memcpy(writer.buffer, CONFIG_STORE_MAGIC, 8);
+	PutLittleEndian(writer.buffer + 8, CONFIG_STORE_VERSION, 2);
+	PutLittleEndian(writer.buffer + 10, CONFIG_STORE_HEADER_SIZE, 2);
+	PutLittleEndian(writer.buffer + 12, writer.length - CONFIG_STORE_HEADER_SIZE, 4);
+	PutLittleEndian(writer.buffer + 16, Crc32(writer.buffer + CONFIG_STORE_HEADER_SIZE, writer.length - CONFIG_STORE_HEADER_SIZE), 4);
+	PutLittleEndian(writer.buffer + 20, config->generation + 1, 4);
+
+	snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+
+	if (writer.overflow || strlen(path) >= CONFIG_STORE_PATH_MAX)
+	{
+		printf("Config store %s: contents too large\r\n", path);
+		result = CONFIG_STORE_ERROR;
+	}
+	/* the connection string holds the device key */
+	else if ((fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) < 0)
+	{
+		printf("Failed to create %s: %s\r\n", temporaryPath, strerror(errno));
+		result = CONFIG_STORE_ERROR;
+	}
+	else
+	{
+		if (WriteAll(fd, writer.buffer, writer.length) != 0 || fsync(fd) != 0)
+		{
+			printf("Failed to write %s: %s\r\n", temporaryPath, strerror(errno));
+			result = CONFIG_STORE_ERROR;
+		}
+		else
+		{
+			result = CONFIG_STORE_OK;
+		}
+
+		if (close(fd) != 0 && result == CONFIG_STORE_OK)
+		{
+			result = CONFIG_STORE_ERROR;
+		}
+
+		if (result != CONFIG_STORE_OK)
+		{
+			(void)unlink(temporaryPath);
+		}
+		else if (rename(temporaryPath, path) != 0)
+		{
+			printf("Failed to replace config store %s: %s\r\n", path, strerror(errno));
+			(void)unlink(temporaryPath);
+			result = CONFIG_STORE_ERROR;
+		}
+		else
+		{
+			SyncDirectory(path);
+			config->generation++;
+		}
+	}
+
+	pthread_mutex_unlock(&Save_lock);
+
+	return result;
+}
+
+static FILE* OpenSibling(const char* path, const char* name)
+{
+	char directory[CONFIG_STORE_PATH_MAX];
+	char siblingPath[CONFIG_STORE_PATH_MAX * 2];
+
+	snprintf(directory, sizeof(directory), "%s", path);
+	snprintf(siblingPath, sizeof(siblingPath), "%s/%s", dirname(directory), name);
+
+	return fopen(siblingPath, "r");
+}
+
+static void TrimLine(char* line)
+{
+	line[strcspn(line, "\r\n")] = '\0';
+}
+
+static int64_t ParseLegacyTime(const char* text)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	/* the old files hold UTC times as written by FormatTime */
+	return (strptime(text, "%Y-%m-%d %H:%M:%S", &tm) != NULL) ? (int64_t)timegm(&tm) : 0;
+}
+
+CONFIG_STORE_RESULT config_store_import_legacy(const char* path, CONFIG_STORE* config)
+{
+	CONFIG_STORE_RESULT result = CONFIG_STORE_MISSING;
+	char line[CONFIG_STORE_CONNECTION_STRING_SIZE];
+	FILE* fp;
+
+	if ((fp = OpenSibling(path, "deviceinfo")) != NULL)
+	{
+		if (fgets(line, sizeof(line), fp) != NULL)
+		{
+			TrimLine(line);
+			GetString(config->deviceId, sizeof(config->deviceId), (const uint8_t*)line, strlen(line));
+			result = CONFIG_STORE_OK;
+		}
+		if (fgets(line, sizeof(line), fp) != NULL)
+		{
+			TrimLine(line);
+			GetString(config->connectionString, sizeof(config->connectionString), (const uint8_t*)line, strlen(line));
+		}
+		fclose(fp);
+	}
+
+	if ((fp = OpenSibling(path, "lastupdate")) != NULL)
+	{
+		if (fgets(line, sizeof(line), fp) != NULL)
+		{
+			config->updateBegin = ParseLegacyTime(line);
+			if (fgets(line, sizeof(line), fp) != NULL)
+			{
+				config->rebootBegin = ParseLegacyTime(line);
+			}
+		}
+		fclose(fp);
+	}
+
+	return result;
+}
@@ -0,0 +1,184 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "azure_c_shared_utility/platform.h"
+#include "connection.h"
+#include "logger.h"
+#include "metrics.h"
+
+static const char* ReasonName(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason)
+{
+	switch (reason)
+	{
+	case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+		return "expired SAS token";
+	case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
+		return "device disabled";
+	case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+		return "bad credential";
+	case IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED:
+		return "retry expired";
+	case IOTHUB_CLIENT_CONNECTION_NO_NETWORK:
+		return "no network";
+	case IOTHUB_CLIENT_CONNECTION_COMMUNICATION_ERROR:
+		return "communication error";
+	default:
+		return "ok";
+	}
+}
+
+/* Runs on the SDK worker thread */
+static void ConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS status, IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason, void* userContextCallback)
+{
+	CONNECTION* connection = userContextCallback;
+	uint64_t now = metrics_now_us();
+
+	if (status == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED)
+	{
+		if (!connection->connected)
+		{
+			connection->connected = 1;
+			metrics_gauge_add(METRIC_HUB_CONNECTED, 1);
+		}
+		if (connection->startUs != 0)
+		{
+			metrics_histogram_observe(METRIC_CONNECT_LATENCY, now - connection->startUs);
+			LOGGER_INFO("Connected to IoT Hub after %llu ms\r\n", (unsigned long long)((now - connection->startUs) / 1000));
+			connection->startUs = 0;
+		}
+		else if (connection->lostUs != 0)
+		{
+			metrics_counter_add(METRIC_RECONNECTS, 1);
+			metrics_histogram_observe(METRIC_RECONNECT_LATENCY, now - connection->lostUs);
+			LOGGER_INFO("Reconnected to IoT Hub after %llu ms\r\n", (unsigned long long)((now - connection->lostUs) / 1000));
+		}
+		connection->lostUs = 0;
+	}
+	else
+	{
+		if (connection->connected)
+		{
+			connection->connected = 0;
+			connection->lostUs = now;
+			metrics_gauge_add(METRIC_HUB_CONNECTED, -1);
+		}
+		LOGGER_WARN("IoT Hub connection lost: %s\r\n", ReasonName(reason));
+	}
+}
+
+int connection_configure(CONNECTION* connection, IOTHUB_CLIENT_HANDLE clientHandle, const CONNECTION_OPTIONS* options)
+{
+	int result;
+	size_t sasTokenLifetimeS = options->sasTokenLifetimeS;
+
+	if (connection->startUs == 0)
+	{
+		connection->startUs = metrics_now_us();
+	}
+
+	if (IoTHubClient_SetOption(clientHandle, "sas_token_lifetime", &sasTokenLifetimeS) != IOTHUB_CLIENT_OK)
+	{
+		printf("Failed to set the SAS token lifetime\r\n");
+		result = __LINE__;
+	}
+	else if (IoTHubClient_SetRetryPolicy(clientHandle, IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER, options->retryTimeoutS) != IOTHUB_CLIENT_OK)
+	{
+		printf("Failed to set the retry policy\r\n");
+		result = __LINE__;
+	}
+	/* last, registering the callback starts the SDK worker and with it the connect */
+	else if (IoTHubClient_SetConnectionStatusCallback(clientHandle, ConnectionStatusCallback, connection) != IOTHUB_CLIENT_OK)
+	{
+		printf("Failed to set the connection status callback\r\n");
+		result = __LINE__;
+	}
+	else
+	{
+		result = 0;
+	}
+
+	return result;
+}
+
+static void* ConnectThread(void* arg)
+{
+	CONNECTION* connection = arg;
+
+	connection->startUs = metrics_now_us();
+	if (platform_init() != 0)
+	{
+		printf("Failed to initialize the platform.\n");
+	}
+	else
+	{
+		connection->platformReady = 1;
+		if ((connection->clientHandle = IoTHubClient_CreateFromConnectionString(connection->connectionString, connection->protocol)) == NULL)
+		{
+			printf("Failure in IoTHubClient_CreateFromConnectionString\n");
+		}
+		else if (connection_configure(connection, connection->clientHandle, &connection->options) != 0)
+		{
+			/* the sample still works with the SDK defaults */
+			printf("Continuing with the default connection settings\n");
+		}
+	}
+
+	return NULL;
+}
+
+int connection_start(CONNECTION* connection, const char* connectionString, IOTHUB_CLIENT_TRANSPORT_PROVIDER protocol, const CONNECTION_OPTIONS* options)
+{
+	int result;
+
+	memset(connection, 0, sizeof(CONNECTION));
+	connection->connectionString = connectionString;
+	connection->protocol = protocol;
+	connection->options = *options;
+
+	if (pthread_create(&connection->thread, NULL, ConnectThread, connection) != 0)
+	{
+		printf("Failed to start the connection thread\r\n");
+		result = __LINE__;
+	}
+	else
+	{
+		connection->threadStarted = 1;
+		result = 0;
+	}
+
+	return result;
+}
+
+IOTHUB_CLIENT_HANDLE connection_wait(CONNECTION* connection)
+{
+	if (connection->threadStarted)
+	{
+		(void)pthread_join(connection->thread, NULL);
+		connection->threadStarted = 0;
+	}
+
+	return connection->clientHandle;
+}
+
+void connection_stop(CONNECTION* connection)
+{
+	(void)connection_wait(connection);
+	if (connection->clientHandle != NULL)
+	{
+		IoTHubClient_Destroy(connection->clientHandle);
+		connection->clientHandle = NULL;
+	}
+	if (connection->connected)
+	{
+		connection->connected = 0;
+		metrics_gauge_add(METRIC_HUB_CONNECTED, -1);
+	}
+	if (connection->platformReady)
+	{
+		platform_deinit();
+		connection->platformReady = 0;
+	}
+}
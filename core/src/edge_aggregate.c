@@ -0,0 +1,294 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "edge_aggregate.h"
+
+#define SLOT(sequence) ((sequence) % EDGE_AGGREGATE_MAX_SAMPLES)
+
+static void P2Init(EDGE_P2_QUANTILE* estimator, double quantile)
+{
+	memset(estimator, 0, sizeof(EDGE_P2_QUANTILE));
+	estimator->quantile = quantile;
+	estimator->desired[0] = 1;
+	estimator->desired[1] = 1 + 2 * quantile;
+	estimator->desired[2] = 1 + 4 * quantile;
+	estimator->desired[3] = 3 + 2 * quantile;
+	estimator->desired[4] = 5;
+	estimator->increment[1] = quantile / 2;
+	estimator->increment[2] = quantile;
+	estimator->increment[3] = (1 + quantile) / 2;
+	estimator->increment[4] = 1;
+}
+
+static int CompareDouble(const void* left, const void* right)
+{
+	double a = *(const double*)left;
+	double b = *(const double*)right;
+	return (a > b) - (a < b);
+}
+
+static void P2Add(EDGE_P2_QUANTILE* estimator, double value)
+{
+	double* h = estimator->height;
+	double* n = estimator->position;
+	int k;
+
+	if (estimator->count < 5)
+	{
+		h[estimator->count++] = value;
+		if (estimator->count == 5)
+		{
+			qsort(h, 5, sizeof(double), CompareDouble);
+			for (int i = 0; i < 5; i++)
+			{
+				n[i] = i + 1;
+			}
+		}
+		return;
+	}
+
+	if (value < h[0])
+	{
+		h[0] = value;
+		k = 0;
+	}
+	else if (value >= h[4])
+	{
+		h[4] = value;
+		k = 3;
+	}
+	else
+	{
+		for (k = 0; k < 3 && value >= h[k + 1]; k++)
+		{
+		}
+	}
+
+	for (int i = k + 1; i < 5; i++)
+	{
+		n[i] += 1;
+	}
+	for (int i = 0; i < 5; i++)
+	{
+		estimator->desired[i] += estimator->increment[i];
+	}
+
+	/* move the middle markers towards their desired positions */
+	for (int i = 1; i < 4; i++)
+	{
+		double d = estimator->desired[i] - n[i];
+
+		if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1))
+		{
+			int step = (d > 0) ? 1 : -1;
+			double parabolic = h[i] + step / (n[i + 1] - n[i - 1]) *
+				((n[i] - n[i - 1] + step) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+				(n[i + 1] - n[i] - step) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+
+			if (h[i - 1] < parabolic && parabolic < h[i + 1])
+			{
+				h[i] = parabolic;
+			}
+			else
+			{
+				h[i] += step * (h[i + step] - h[i]) / (n[i + step] - n[i]);
+			}
+			n[i] += step;
+		}
+	}
+	estimator->count++;
+}
+
+static double P2Value(const EDGE_P2_QUANTILE* estimator)
+{
+	double result;
+
+	if (estimator->count >= 5)
+	{
+		result = estimator->height[2];
+	}
+	else if (estimator->count == 0)
+	{
+		result = 0;
+	}
+	else
+	{
+		double sorted[5];
+
+		memcpy(sorted, estimator->height, estimator->count * sizeof(double));
+		qsort(sorted, (size_t)estimator->count, sizeof(double), CompareDouble);
+		result = sorted[(int)(estimator->quantile * (estimator->count - 1) + 0.5)];
+	}
+
+	return result;
+}
+
+static void DequePush(EDGE_DEQUE* deque, const EDGE_AGGREGATE* aggregate, int channel, uint64_t sequence, int keepMinimum)
+{
+	double value = aggregate->values[SLOT(sequence)][channel];
+
+	while (deque->back > deque->front)
+	{
+		double last = aggregate->values[SLOT(deque->items[SLOT(deque->back - 1)])][channel];
+		if (keepMinimum ? (last < value) : (last > value))
+		{
+			break;
+		}
+		deque->back--;
+	}
+	deque->items[SLOT(deque->back)] = sequence;
+	deque->back++;
+}
+
+static void DequeEvict(EDGE_DEQUE* deque, uint64_t sequence)
+{
+	if (deque->back > deque->front && deque->items[SLOT(deque->front)] == sequence)
+	{
+		deque->front++;
+	}
+}
+
+static double DequeFront(const EDGE_DEQUE* deque, const EDGE_AGGREGATE* aggregate, int channel)
+{
+	return aggregate->values[SLOT(deque->items[SLOT(deque->front)])][channel];
+}
+
+static void ResetWindow(EDGE_AGGREGATE* aggregate)
+{
+	aggregate->oldest = aggregate->added;
+	for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+	{
+		EDGE_CHANNEL_STATE* state = &aggregate->channels[channel];
+
+		state->mean = 0;
+		state->m2 = 0;
+		state->minimum.front = state->minimum.back = 0;
+		state->maximum.front = state->maximum.back = 0;
+	}
+}
+
+/* Drops the oldest sample from the running statistics */
+static void EvictOldest(EDGE_AGGREGATE* aggregate)
+{
+	uint64_t sequence = aggregate->oldest++;
+	uint64_t remaining = aggregate->added - aggregate->oldest;
+
+	for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+	{
+		EDGE_CHANNEL_STATE* state = &aggregate->channels[channel];
+		double value = aggregate->values[SLOT(sequence)][channel];
+
+		if (remaining == 0)
+		{
+			state->mean = 0;
+			state->m2 = 0;
+		}
+		else
+		{
+			double oldMean = state->mean;
+			state->mean = oldMean + (oldMean - value) / (double)remaining;
+			state->m2 -= (value - oldMean) * (value - state->mean);
+			if (state->m2 < 0)
+			{
+				state->m2 = 0;
+			}
+		}
+		DequeEvict(&state->minimum, sequence);
+		DequeEvict(&state->maximum, sequence);
+	}
+}
+
+void edge_aggregate_init(EDGE_AGGREGATE* aggregate, unsigned int windowMs, unsigned int hopMs)
+{
+	memset(aggregate, 0, sizeof(EDGE_AGGREGATE));
+	aggregate->windowUs = (uint64_t)windowMs * 1000;
+	aggregate->hopUs = (hopMs == 0 || hopMs > windowMs) ? aggregate->windowUs : (uint64_t)hopMs * 1000;
+	for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+	{
+		P2Init(&aggregate->channels[channel].p50, 0.5);
+		P2Init(&aggregate->channels[channel].p95, 0.95);
+	}
+}
+
+int edge_aggregate_add(EDGE_AGGREGATE* aggregate, const SAMPLE_STAMP* stamp, const double values[EDGE_CHANNEL_COUNT], EDGE_SUMMARY* summary)
+{
+	uint64_t nowUs = stamp->monotonicUs;
+	int result = 0;
+	int tumbling = (aggregate->hopUs == aggregate->windowUs);
+	uint64_t sequence;
+	uint64_t count;
+
+	if (aggregate->added - aggregate->oldest == EDGE_AGGREGATE_MAX_SAMPLES)
+	{
+		EvictOldest(aggregate);
+	}
+
+	sequence = aggregate->added++;
+	count = aggregate->added - aggregate->oldest;
+	aggregate->stamps[SLOT(sequence)] = *stamp;
+	for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+	{
+		EDGE_CHANNEL_STATE* state = &aggregate->channels[channel];
+		double delta = values[channel] - state->mean;
+
+		aggregate->values[SLOT(sequence)][channel] = values[channel];
+		state->mean += delta / (double)count;
+		state->m2 += delta * (values[channel] - state->mean);
+		DequePush(&state->minimum, aggregate, channel, sequence, 1);
+		DequePush(&state->maximum, aggregate, channel, sequence, 0);
+		P2Add(&state->p50, values[channel]);
+		P2Add(&state->p95, values[channel]);
+	}
+
+	if (!tumbling)
+	{
+		while (aggregate->oldest < sequence && aggregate->stamps[SLOT(aggregate->oldest)].monotonicUs + aggregate->windowUs <= nowUs)
+		{
+			EvictOldest(aggregate);
+		}
+	}
+
+	if (aggregate->nextSummaryUs == 0)
+	{
+		aggregate->nextSummaryUs = nowUs + aggregate->windowUs;
+	}
+	else if (nowUs >= aggregate->nextSummaryUs)
+	{
+		count = aggregate->added - aggregate->oldest;
+		summary->first = aggregate->stamps[SLOT(aggregate->oldest)];
+		summary->last = *stamp;
+		summary->count = (size_t)count;
+		for (int channel = 0; channel < EDGE_CHANNEL_COUNT; channel++)
+		{
+			EDGE_CHANNEL_STATE* state = &aggregate->channels[channel];
+			EDGE_CHANNEL_SUMMARY* channelSummary = &summary->channels[channel];
+
+			channelSummary->mean = state->mean;
+			channelSummary->stddev = (count > 1) ? sqrt(state->m2 / (double)(count - 1)) : 0;
+			channelSummary->min = DequeFront(&state->minimum, aggregate, channel);
+			channelSummary->max = DequeFront(&state->maximum, aggregate, channel);
+			channelSummary->p50 = P2Value(&state->p50);
+			channelSummary->p95 = P2Value(&state->p95);
+			P2Init(&state->p50, 0.5);
+			P2Init(&state->p95, 0.95);
+		}
+
+		if (tumbling)
+		{
+			ResetWindow(aggregate);
+		}
+		aggregate->nextSummaryUs += aggregate->hopUs;
+		if (aggregate->nextSummaryUs <= nowUs)
+		{
+			/* after a stall, summarize a hop from now instead of catching up */
+			aggregate->nextSummaryUs = nowUs + aggregate->hopUs;
+		}
+		result = 1;
+	}
+
+	return result;
+}
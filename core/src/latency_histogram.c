@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "latency_histogram.h"
+
+#include <string.h>
+
+static unsigned int BucketIndex(uint64_t value_us)
+{
+	unsigned int result;
+
+	if (value_us < LATENCY_HISTOGRAM_LINEAR_BUCKETS)
+	{
+		result = (unsigned int)value_us;
+	}
+	else
+	{
+		unsigned int exponent = 63 - (unsigned int)__builtin_clzll(value_us);
+		result = LATENCY_HISTOGRAM_LINEAR_BUCKETS + (exponent - 4) * LATENCY_HISTOGRAM_SUB_BUCKETS
+			+ (unsigned int)((value_us >> (exponent - 3)) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1));
+		if (result >= LATENCY_HISTOGRAM_BUCKETS)
+		{
+			result = LATENCY_HISTOGRAM_BUCKETS - 1;
+		}
+	}
+
+	return result;
+}
+
+static uint64_t BucketUpperBound(unsigned int index)
+{
+	uint64_t result;
+
+	if (index < LATENCY_HISTOGRAM_LINEAR_BUCKETS)
+	{
+		result = index;
+	}
+	else
+	{
+		unsigned int exponent = (index - LATENCY_HISTOGRAM_LINEAR_BUCKETS) / LATENCY_HISTOGRAM_SUB_BUCKETS + 4;
+		uint64_t subBucket = (index - LATENCY_HISTOGRAM_LINEAR_BUCKETS) % LATENCY_HISTOGRAM_SUB_BUCKETS;
+		result = ((LATENCY_HISTOGRAM_SUB_BUCKETS + subBucket + 1) << (exponent - 3)) - 1;
+	}
+
+	return result;
+}
+
+void latency_histogram_reset(LATENCY_HISTOGRAM* histogram)
+{
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void latency_histogram_record(LATENCY_HISTOGRAM* histogram, uint64_t value_us)
+{
+	histogram->counts[BucketIndex(value_us)]++;
+	histogram->count++;
+	histogram->sum_us += value_us;
+	if (value_us > histogram->max_us)
+	{
+		histogram->max_us = value_us;
+	}
+}
+
+void latency_histogram_merge(LATENCY_HISTOGRAM* destination, const LATENCY_HISTOGRAM* source)
+{
+	for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+	{
+		destination->counts[i] += source->counts[i];
+	}
+	destination->count += source->count;
+	destination->sum_us += source->sum_us;
+	if (source->max_us > destination->max_us)
+	{
+		destination->max_us = source->max_us;
+	}
+}
+
+uint64_t latency_histogram_percentile(const LATENCY_HISTOGRAM* histogram, double percentile)
+{
+	uint64_t result = 0;
+
+	if (histogram->count > 0)
+	{
+		uint64_t rank = (uint64_t)((percentile / 100.0) * (double)histogram->count + 0.5);
+		uint64_t seen = 0;
+
+		if (rank == 0)
+		{
+			rank = 1;
+		}
+
+		for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++)
+		{
+			seen += histogram->counts[i];
+			if (seen >= rank)
+			{
+				result = BucketUpperBound(i);
+				break;
+			}
+		}
+
+		/* never report more than was actually observed */
+		if (result > histogram->max_us)
+		{
+			result = histogram->max_us;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,704 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "logger.h"
+
+/* must be a power of two */
+#define LOGGER_RING_SLOTS 256
+#define LOGGER_RECORD_BYTES 200
+#define LOGGER_DRAIN_INTERVAL_MS 20
+#define LOGGER_OUTPUT_BUFFER 4096
+#define LOGGER_LINE_MAX 512
+
+typedef struct LOGGER_RECORD_TAG
+{
+	size_t sequence;
+	uint64_t timestampUs;
+	const LOGGER_SITE* site;
+	/* set for deferred records, data then holds the encoded arguments */
+	const char* format;
+	uint32_t suppressed;
+	char data[LOGGER_RECORD_BYTES];
+} LOGGER_RECORD;
+
+typedef enum ARGUMENT_KIND_TAG
+{
+	ARGUMENT_NONE,
+	ARGUMENT_SIGNED,
+	ARGUMENT_UNSIGNED,
+	ARGUMENT_DOUBLE,
+	ARGUMENT_STRING,
+	ARGUMENT_POINTER,
+	ARGUMENT_UNSUPPORTED
+} ARGUMENT_KIND;
+
+/* One printf conversion, parsed the same way when encoding and decoding */
+typedef struct CONVERSION_TAG
+{
+	const char* start;
+	const char* end;
+	int widthStar;
+	int precisionStar;
+	/* 'H' hh, 'h', 'l', 'L' ll or long double, 'z', 'j', 't', 0 none */
+	char length;
+	char conversion;
+} CONVERSION;
+
+static const char* const Level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+int logger_level = LOGGER_LEVEL_INFO;
+
+static LOGGER_RECORD Ring[LOGGER_RING_SLOTS];
+static size_t Enqueue_position;
+static size_t Dequeue_position;
+static uint64_t Dropped;
+
+static LOGGER_FORMAT_MODE Format_mode = LOGGER_FORMAT_EAGER;
+static unsigned int Rate_limit = LOGGER_DEFAULT_RATE_LIMIT;
+static int Running = 0;
+static volatile int Writer_stop = 0;
+static pthread_t Writer_thread;
+
+static uint64_t NowUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+static const char* ParseConversion(const char* cursor, CONVERSION* conversion)
+{
+	memset(conversion, 0, sizeof(*conversion));
+	conversion->start = cursor++;
+
+	while (*cursor != '\0' && strchr("-+ #0", *cursor) != NULL)
+	{
+		cursor++;
+	}
+	if (*cursor == '*')
+	{
+		conversion->widthStar = 1;
+		cursor++;
+	}
+	while (*cursor >= '0' && *cursor <= '9')
+	{
+		cursor++;
+	}
+	if (*cursor == '.')
+	{
+		cursor++;
+		if (*cursor == '*')
+		{
+			conversion->precisionStar = 1;
+			cursor++;
+		}
+		while (*cursor >= '0' && *cursor <= '9')
+		{
+			cursor++;
+		}
+	}
+	if (*cursor == 'h' || *cursor == 'l')
+	{
+		conversion->length = *cursor++;
+		if (*cursor == conversion->length)
+		{
+			conversion->length = (conversion->length == 'h') ? 'H' : 'L';
+			cursor++;
+		}
+	}
+	else if (*cursor == 'L' || *cursor == 'z' || *cursor == 'j' || *cursor == 't')
+	{
+		conversion->length = *cursor++;
+	}
+
+	conversion->conversion = *cursor;
+	if (*cursor != '\0')
+	{
+		cursor++;
+	}
+	conversion->end = cursor;
+
+	return cursor;
+}
+
+static ARGUMENT_KIND ArgumentKind(const CONVERSION* conversion)
+{
+	ARGUMENT_KIND result;
+
+	switch (conversion->conversion)
+	{
+	case 'd': case 'i': case 'c':
+		result = ARGUMENT_SIGNED;
+		break;
+	case 'u': case 'o': case 'x': case 'X':
+		result = ARGUMENT_UNSIGNED;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		result = ARGUMENT_DOUBLE;
+		break;
+	case 's':
+		result = (conversion->length == 0) ? ARGUMENT_STRING : ARGUMENT_UNSUPPORTED;
+		break;
+	case 'p':
+		result = ARGUMENT_POINTER;
+		break;
+	case '%':
+		result = ARGUMENT_NONE;
+		break;
+	default:
+		result = ARGUMENT_UNSUPPORTED;
+		break;
+	}
+
+	return result;
+}
+
+static int64_t ReadSigned(char length, va_list* args)
+{
+	int64_t result;
+
+	switch (length)
+	{
+	case 'H': result = (signed char)va_arg(*args, int); break;
+	case 'h': result = (short)va_arg(*args, int); break;
+	case 'l': result = va_arg(*args, long); break;
+	case 'L': result = va_arg(*args, long long); break;
+	case 'z': result = (ptrdiff_t)va_arg(*args, size_t); break;
+	case 'j': result = va_arg(*args, intmax_t); break;
+	case 't': result = va_arg(*args, ptrdiff_t); break;
+	default: result = va_arg(*args, int); break;
+	}
+
+	return result;
+}
+
+static uint64_t ReadUnsigned(char length, va_list* args)
+{
+	uint64_t result;
+
+	switch (length)
+	{
+	case 'H': result = (unsigned char)va_arg(*args, unsigned int); break;
+	case 'h': result = (unsigned short)va_arg(*args, unsigned int); break;
+	case 'l': result = va_arg(*args, unsigned long); break;
+	case 'L': result = va_arg(*args, unsigned long long); break;
+	case 'z': result = va_arg(*args, size_t); break;
+	case 'j': result = va_arg(*args, uintmax_t); break;
+	case 't': result = (uint64_t)va_arg(*args, ptrdiff_t); break;
+	default: result = va_arg(*args, unsigned int); break;
+	}
+
+	return result;
+}
+
+static int Store(char* data, size_t* used, const void* value, size_t size)
+{
+	int result;
+
+	if (*used + size > LOGGER_RECORD_BYTES)
+	{
+		result = __LINE__;
+	}
+	else
+	{
+		memcpy(data + *used, value, size);
+		*used += size;
+		result = 0;
+	}
+
+	return result;
+}
+
+/* Copies the arguments the format refers to, fails when they do not fit or cannot be deferred */
+static int EncodeArguments(char* data, const char* format, va_list args)
+{
+	int result = 0;
+	size_t used = 0;
+	const char* cursor = format;
+	va_list copy;
+
+	va_copy(copy, args);
+	while (result == 0 && (cursor = strchr(cursor, '%')) != NULL)
+	{
+		CONVERSION conversion;
+		cursor = ParseConversion(cursor, &conversion);
+
+		if (conversion.widthStar)
+		{
+			int64_t width = va_arg(copy, int);
+			result = Store(data, &used, &width, sizeof(width));
+		}
+		if (result == 0 && conversion.precisionStar)
+		{
+			int64_t precision = va_arg(copy, int);
+			result = Store(data, &used, &precision, sizeof(precision));
+		}
+		if (result == 0)
+		{
+			switch (ArgumentKind(&conversion))
+			{
+			case ARGUMENT_NONE:
+				break;
+			case ARGUMENT_SIGNED:
+			{
+				int64_t value = ReadSigned(conversion.length, &copy);
+				result = Store(data, &used, &value, sizeof(value));
+				break;
+			}
+			case ARGUMENT_UNSIGNED:
+			{
+				uint64_t value = ReadUnsigned(conversion.length, &copy);
+				result = Store(data, &used, &value, sizeof(value));
+				break;
+			}
+			case ARGUMENT_DOUBLE:
+			{
+				double value = (conversion.length == 'L') ? (double)va_arg(copy, long double) : va_arg(copy, double);
+				result = Store(data, &used, &value, sizeof(value));
+				break;
+			}
+			case ARGUMENT_STRING:
+			{
+				const char* value = va_arg(copy, const char*);
+				if (value == NULL)
+				{
+					value = "(null)";
+				}
+				result = Store(data, &used, value, strlen(value) + 1);
+				break;
+			}
+			case ARGUMENT_POINTER:
+			{
+				uint64_t value = (uint64_t)(uintptr_t)va_arg(copy, void*);
+				result = Store(data, &used, &value, sizeof(value));
+				break;
+			}
+			default:
+				result = __LINE__;
+				break;
+			}
+		}
+	}
+	va_end(copy);
+
+	return result;
+}
+
+static size_t DecodeArguments(char* line, size_t size, const char* format, const char* data)
+{
+	size_t length = 0;
+	size_t used = 0;
+	const char* cursor = format;
+
+	while (*cursor != '\0' && length + 1 < size)
+	{
+		if (*cursor != '%')
+		{
+			line[length++] = *cursor++;
+		}
+		else
+		{
+			CONVERSION conversion;
+			char specification[64];
+			size_t specificationLength = 0;
+			int64_t star[2];
+			int starCount = 0;
+			int written = 0;
+			ARGUMENT_KIND kind;
+			const char* part;
+
+			cursor = ParseConversion(cursor, &conversion);
+			kind = ArgumentKind(&conversion);
+
+			if (conversion.widthStar)
+			{
+				memcpy(&star[starCount++], data + used, sizeof(int64_t));
+				used += sizeof(int64_t);
+			}
+			if (conversion.precisionStar)
+			{
+				memcpy(&star[starCount++], data + used, sizeof(int64_t));
+				used += sizeof(int64_t);
+			}
+
+			/* rebuild the conversion for the stored 64 bit value */
+			for (part = conversion.start; part < conversion.end - 1 && specificationLength < sizeof(specification) - 8; part++)
+			{
+				if (strchr("hlLzjt", *part) == NULL)
+				{
+					specification[specificationLength++] = *part;
+				}
+			}
+			if ((kind == ARGUMENT_SIGNED && conversion.conversion != 'c') || kind == ARGUMENT_UNSIGNED)
+			{
+				specification[specificationLength++] = 'l';
+				specification[specificationLength++] = 'l';
+			}
+			specification[specificationLength++] = conversion.conversion;
+			specification[specificationLength] = '\0';
+
+#define FORMAT_STARRED(value) \
+	(starCount == 2) ? snprintf(line + length, size - length, specification, (int)star[0], (int)star[1], value) : \
+	(starCount == 1) ? snprintf(line + length, size - length, specification, (int)star[0], value) : \
+	snprintf(line + length, size - length, specification, value)
+
+			switch (kind)
+			{
+			case ARGUMENT_NONE:
+				written = snprintf(line + length, size - length, "%%");
+				break;
+			case ARGUMENT_SIGNED:
+			{
+				int64_t value;
+				memcpy(&value, data + used, sizeof(value));
+				used += sizeof(value);
+				if (conversion.conversion == 'c')
+				{
+					written = FORMAT_STARRED((int)value);
+				}
+				else
+				{
+					written = FORMAT_STARRED((long long)value);
+				}
+				break;
+			}
+			case ARGUMENT_UNSIGNED:
+			{
+				uint64_t value;
+				memcpy(&value, data + used, sizeof(value));
+				used += sizeof(value);
+				written = FORMAT_STARRED((unsigned long long)value);
+				break;
+			}
+			case ARGUMENT_DOUBLE:
+			{
+				double value;
+				memcpy(&value, data + used, sizeof(value));
+				used += sizeof(value);
+				written = FORMAT_STARRED(value);
+				break;
+			}
+			case ARGUMENT_STRING:
+			{
+				const char* value = data + used;
+				used += strlen(value) + 1;
+				written = FORMAT_STARRED(value);
+				break;
+			}
+			default:
+			{
+				uint64_t value;
+				memcpy(&value, data + used, sizeof(value));
+				used += sizeof(value);
+				written = FORMAT_STARRED((void*)(uintptr_t)value);
+				break;
+			}
+			}
+#undef FORMAT_STARRED
+
+			if (written > 0)
+			{
+				length += ((size_t)written < size - length) ? (size_t)written : size - length - 1;
+			}
+		}
+	}
+	line[length] = '\0';
+
+	return length;
+}
+
+/* Renders one record as "<UTC time> <LEVEL> <message>\n", dropping the message's own line ending */
+static size_t FormatRecord(char* line, size_t size, const LOGGER_RECORD* record)
+{
+	char message[LOGGER_LINE_MAX];
+	size_t messageLength;
+	size_t length;
+	time_t seconds = (time_t)(record->timestampUs / 1000000ULL);
+	struct tm utc;
+	int written;
+
+	if (record->format != NULL)
+	{
+		messageLength = DecodeArguments(message, sizeof(message), record->format, record->data);
+	}
+	else
+	{
+		messageLength = strlen(record->data);
+		memcpy(message, record->data, messageLength + 1);
+	}
+	while (messageLength > 0 && (message[messageLength - 1] == '\n' || message[messageLength - 1] == '\r'))
+	{
+		message[--messageLength] = '\0';
+	}
+
+	gmtime_r(&seconds, &utc);
+	length = strftime(line, size, "%Y-%m-%d %H:%M:%S", &utc);
+	written = (record->suppressed > 0) ?
+		snprintf(line + length, size - length, ".%06u %-5s %s (%u similar suppressed)\n",
+			(unsigned int)(record->timestampUs % 1000000ULL), Level_names[record->site->level], message, (unsigned int)record->suppressed) :
+		snprintf(line + length, size - length, ".%06u %-5s %s\n",
+			(unsigned int)(record->timestampUs % 1000000ULL), Level_names[record->site->level], message);
+
+	if (written > 0)
+	{
+		length += ((size_t)written < size - length) ? (size_t)written : size - length - 1;
+	}
+
+	return length;
+}
+
+static void FillRecord(LOGGER_RECORD* record, LOGGER_SITE* site, uint64_t timestampUs, uint32_t suppressed,
+	LOGGER_FORMAT_MODE mode, const char* format, va_list args)
+{
+	record->timestampUs = timestampUs;
+	record->site = site;
+	record->suppressed = suppressed;
+	record->format = NULL;
+
+	if (mode == LOGGER_FORMAT_DEFERRED && EncodeArguments(record->data, format, args) == 0)
+	{
+		record->format = format;
+	}
+	else
+	{
+		va_list copy;
+		va_copy(copy, args);
+		(void)vsnprintf(record->data, sizeof(record->data), format, copy);
+		va_end(copy);
+	}
+}
+
+static LOGGER_RECORD* ReserveSlot(size_t* position)
+{
+	LOGGER_RECORD* result = NULL;
+	size_t current = __atomic_load_n(&Enqueue_position, __ATOMIC_RELAXED);
+
+	for (;;)
+	{
+		LOGGER_RECORD* slot = &Ring[current & (LOGGER_RING_SLOTS - 1)];
+		size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)current;
+
+		if (difference == 0)
+		{
+			if (__atomic_compare_exchange_n(&Enqueue_position, &current, current + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				result = slot;
+				*position = current;
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			/* full, the writer is behind */
+			break;
+		}
+		else
+		{
+			current = __atomic_load_n(&Enqueue_position, __ATOMIC_RELAXED);
+		}
+	}
+
+	return result;
+}
+
+/* Returns the number of records suppressed since the last one let through, or -1 to suppress this one */
+static int64_t RateLimit(LOGGER_SITE* site, uint64_t timestampUs)
+{
+	int64_t result;
+	uint64_t window = timestampUs / 1000000ULL;
+
+	if (__atomic_exchange_n(&site->window, window, __ATOMIC_RELAXED) != window)
+	{
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+	}
+
+	if (Rate_limit != 0 && __atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) > Rate_limit)
+	{
+		__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+		result = -1;
+	}
+	else
+	{
+		result = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+	}
+
+	return result;
+}
+
+void logger_write(LOGGER_SITE* site, const char* format, ...)
+{
+	uint64_t timestampUs = NowUs();
+	int64_t suppressed = RateLimit(site, timestampUs);
+
+	if (suppressed >= 0)
+	{
+		va_list args;
+		va_start(args, format);
+
+		if (!__atomic_load_n(&Running, __ATOMIC_ACQUIRE))
+		{
+			LOGGER_RECORD record;
+			char line[LOGGER_LINE_MAX];
+
+			FillRecord(&record, site, timestampUs, (uint32_t)suppressed, LOGGER_FORMAT_EAGER, format, args);
+			(void)fwrite(line, 1, FormatRecord(line, sizeof(line), &record), stdout);
+		}
+		else
+		{
+			size_t position;
+			LOGGER_RECORD* slot = ReserveSlot(&position);
+
+			if (slot == NULL)
+			{
+				__atomic_add_fetch(&Dropped, 1, __ATOMIC_RELAXED);
+			}
+			else
+			{
+				FillRecord(slot, site, timestampUs, (uint32_t)suppressed, Format_mode, format, args);
+				__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+			}
+		}
+
+		va_end(args);
+	}
+}
+
+/* Writes every published record, returns how many there were */
+static size_t Drain(void)
+{
+	static char output[LOGGER_OUTPUT_BUFFER];
+	size_t outputLength = 0;
+	size_t drained = 0;
+	uint64_t dropped;
+
+	for (;;)
+	{
+		LOGGER_RECORD* slot = &Ring[Dequeue_position & (LOGGER_RING_SLOTS - 1)];
+		char line[LOGGER_LINE_MAX];
+		size_t lineLength;
+
+		if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != Dequeue_position + 1)
+		{
+			break;
+		}
+
+		lineLength = FormatRecord(line, sizeof(line), slot);
+		__atomic_store_n(&slot->sequence, Dequeue_position + LOGGER_RING_SLOTS, __ATOMIC_RELEASE);
+		Dequeue_position++;
+		drained++;
+
+		if (outputLength + lineLength > sizeof(output))
+		{
+			(void)fwrite(output, 1, outputLength, stdout);
+			outputLength = 0;
+		}
+		memcpy(output + outputLength, line, lineLength);
+		outputLength += lineLength;
+	}
+
+	if ((dropped = __atomic_exchange_n(&Dropped, 0, __ATOMIC_RELAXED)) > 0)
+	{
+		int written = snprintf(output + outputLength, sizeof(output) - outputLength,
+			"logger: ring full, dropped %llu records\n", (unsigned long long)dropped);
+		if (written > 0 && (size_t)written < sizeof(output) - outputLength)
+		{
+			outputLength += (size_t)written;
+		}
+	}
+
+	if (outputLength > 0)
+	{
+		(void)fwrite(output, 1, outputLength, stdout);
+		(void)fflush(stdout);
+	}
+
+	return drained;
+}
+
+static void* WriterThread(void* arg)
+{
+	(void)arg;
+
+	while (!Writer_stop)
+	{
+		if (Drain() == 0)
+		{
+			struct timespec interval = { 0, LOGGER_DRAIN_INTERVAL_MS * 1000000L };
+			(void)nanosleep(&interval, NULL);
+		}
+	}
+	(void)Drain();
+
+	return NULL;
+}
+
+int logger_start(LOGGER_FORMAT_MODE mode, unsigned int rateLimitPerSecond)
+{
+	int result;
+
+	if (Running)
+	{
+		result = 0;
+	}
+	else
+	{
+		Format_mode = mode;
+		Rate_limit = rateLimitPerSecond;
+		for (size_t i = 0; i < LOGGER_RING_SLOTS; i++)
+		{
+			Ring[i].sequence = i;
+		}
+		Enqueue_position = 0;
+		Dequeue_position = 0;
+		Writer_stop = 0;
+
+		if (pthread_create(&Writer_thread, NULL, WriterThread, NULL) != 0)
+		{
+			printf("Failed to start the logger thread, logging synchronously\n");
+			result = __LINE__;
+		}
+		else
+		{
+			__atomic_store_n(&Running, 1, __ATOMIC_RELEASE);
+			result = 0;
+		}
+	}
+
+	return result;
+}
+
+void logger_stop(void)
+{
+	if (Running)
+	{
+		/* later records are written synchronously, the writer drains what is left */
+		__atomic_store_n(&Running, 0, __ATOMIC_RELEASE);
+		Writer_stop = 1;
+		pthread_join(Writer_thread, NULL);
+	}
+}
+
+int logger_parse_level(const char* name)
+{
+	int result = -1;
+
+	for (int i = 0; i < (int)(sizeof(Level_names) / sizeof(Level_names[0])); i++)
+	{
+		if (strcasecmp(name, Level_names[i]) == 0)
+		{
+			result = i;
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "mem_pool.h"
+#include "metrics.h"
+
+typedef struct FREE_BLOCK_TAG
+{
+	struct FREE_BLOCK_TAG* next;
+} FREE_BLOCK;
+
+typedef struct POOL_TAG
+{
+	MEM_POOL_STATS stats;
+	unsigned char* start;
+	unsigned char* end;
+	/* blocks from here to end were never handed out, their pages may not be mapped yet */
+	unsigned char* fresh;
+	FREE_BLOCK* free;
+} POOL;
+
+static pthread_mutex_t Pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static POOL Pools[MEM_POOL_MAX_CLASSES];
+static size_t Pool_count;
+static unsigned char* Arena;
+
+int mem_pool_init(const MEM_POOL_CLASS* classes, size_t count)
+{
+	size_t arenaSize = 0;
+	int result = 0;
+
+	(void)pthread_mutex_lock(&Pool_lock);
+	if (Arena != NULL || count > MEM_POOL_MAX_CLASSES)
+	{
+		result = __LINE__;
+	}
+	else
+	{
+		Pool_count = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			size_t blockSize = (classes[i].blockSize + MEM_POOL_ALIGNMENT - 1) & ~(size_t)(MEM_POOL_ALIGNMENT - 1);
+
+			if (classes[i].blocks > 0 && blockSize > 0)
+			{
+				memset(&Pools[Pool_count], 0, sizeof(POOL));
+				Pools[Pool_count].stats.blockSize = blockSize;
+				Pools[Pool_count].stats.blocks = classes[i].blocks;
+				arenaSize += blockSize * classes[i].blocks;
+				Pool_count++;
+			}
+		}
+
+		/* not zeroed, the pages of blocks never used are never mapped */
+		if (arenaSize > 0 && (Arena = malloc(arenaSize)) == NULL)
+		{
+			Pool_count = 0;
+			result = __LINE__;
+		}
+		else
+		{
+			unsigned char* next = Arena;
+
+			for (size_t i = 0; i < Pool_count; i++)
+			{
+				POOL* pool = &Pools[i];
+
+				pool->start = next;
+				pool->fresh = next;
+				pool->end = next + pool->stats.blockSize * pool->stats.blocks;
+				next = pool->end;
+			}
+		}
+	}
+	(void)pthread_mutex_unlock(&Pool_lock);
+
+	return result;
+}
+
+void mem_pool_deinit(void)
+{
+	(void)pthread_mutex_lock(&Pool_lock);
+	free(Arena);
+	Arena = NULL;
+	Pool_count = 0;
+	(void)pthread_mutex_unlock(&Pool_lock);
+}
+
+void* mem_pool_alloc(size_t size)
+{
+	void* result = NULL;
+	POOL* full = NULL;
+	int fallback = 0;
+
+	(void)pthread_mutex_lock(&Pool_lock);
+	if (Pool_count > 0)
+	{
+		size_t i = 0;
+
+		while (i < Pool_count && Pools[i].stats.blockSize < size)
+		{
+			i++;
+		}
+		fallback = 1;
+		if (i < Pool_count)
+		{
+			POOL* pool = &Pools[i];
+
+			if (pool->free != NULL || pool->fresh < pool->end)
+			{
+				if (pool->free != NULL)
+				{
+					result = pool->free;
+					pool->free = pool->free->next;
+				}
+				else
+				{
+					result = pool->fresh;
+					pool->fresh += pool->stats.blockSize;
+				}
+				if (++pool->stats.inUse > pool->stats.peak)
+				{
+					pool->stats.peak = pool->stats.inUse;
+				}
+				fallback = 0;
+			}
+			else if (pool->stats.fallbacks++ == 0)
+			{
+				full = pool;
+			}
+		}
+	}
+	(void)pthread_mutex_unlock(&Pool_lock);
+
+	if (result != NULL)
+	{
+		metrics_gauge_add(METRIC_POOL_BLOCKS_IN_USE, 1);
+	}
+	else
+	{
+		if (fallback)
+		{
+			metrics_counter_add(METRIC_POOL_FALLBACKS, 1);
+		}
+		if (full != NULL)
+		{
+			LOGGER_WARN("All %zu blocks of %zu bytes are in use, allocating from the heap\r\n", full->stats.blocks, full->stats.blockSize);
+		}
+		result = malloc(size);
+	}
+
+	return result;
+}
+
+void mem_pool_free(void* block)
+{
+	unsigned char* address = block;
+	int pooled = 0;
+
+	if (block != NULL)
+	{
+		(void)pthread_mutex_lock(&Pool_lock);
+		for (size_t i = 0; i < Pool_count && !pooled; i++)
+		{
+			POOL* pool = &Pools[i];
+
+			if (address >= pool->start && address < pool->end)
+			{
+				((FREE_BLOCK*)block)->next = pool->free;
+				pool->free = (FREE_BLOCK*)block;
+				pool->stats.inUse--;
+				pooled = 1;
+			}
+		}
+		(void)pthread_mutex_unlock(&Pool_lock);
+
+		if (pooled)
+		{
+			metrics_gauge_add(METRIC_POOL_BLOCKS_IN_USE, -1);
+		}
+		else
+		{
+			free(block);
+		}
+	}
+}
+
+size_t mem_pool_stats(MEM_POOL_STATS* stats, size_t count)
+{
+	size_t result;
+
+	(void)pthread_mutex_lock(&Pool_lock);
+	result = Pool_count;
+	for (size_t i = 0; i < Pool_count && i < count; i++)
+	{
+		stats[i] = Pools[i].stats;
+	}
+	(void)pthread_mutex_unlock(&Pool_lock);
+
+	return result;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+
+#include "mem_pool.h"
+#include "message_format.h"
+
+/* every reading carries the time of its read, its sequence number and the epoch of the run, see sample_clock.h */
+static const char* Telemetry_format = "{"
+"\"DeviceID\": \"%s\","
+"\"Temperature\" : %f,"
+"\"Humidity\" : %f,"
+"\"SampleTime\" : \"%s\","
+"\"Sequence\" : %u,"
+"\"Epoch\" : %u } ";
+
+size_t message_format_telemetry(char* buffer, size_t size, const char* deviceId, const SAMPLE_STAMP* stamp, float tempC, float humidityPct)
+{
+	char sampleTime[SAMPLE_CLOCK_TEXT_SIZE];
+	size_t result = 0;
+
+	if (sample_clock_format(stamp->unixUs, sampleTime, sizeof(sampleTime)) > 0)
+	{
+		int length = snprintf(buffer, size, Telemetry_format, deviceId, tempC, humidityPct, sampleTime,
+			(unsigned int)stamp->sequence, (unsigned int)stamp->epoch);
+
+		if (length > 0 && (size_t)length < size)
+		{
+			result = (size_t)length;
+		}
+	}
+
+	return result;
+}
+
+unsigned char* message_format_alloc(size_t* length, const char* format, ...)
+{
+	unsigned char* result;
+	va_list args;
+
+	va_start(args, format);
+	result = message_format_valloc(length, format, args);
+	va_end(args);
+
+	return result;
+}
+
+unsigned char* message_format_valloc(size_t* length, const char* format, va_list args)
+{
+	unsigned char* result = NULL;
+	va_list measure;
+	int size;
+
+	/* formatting spends a va_list, the length is measured on a copy */
+	va_copy(measure, args);
+	size = vsnprintf(NULL, 0, format, measure);
+	va_end(measure);
+
+	if (size >= 0 && (result = mem_pool_alloc((size_t)size + 1)) != NULL)
+	{
+		(void)vsnprintf((char*)result, (size_t)size + 1, format, args);
+		*length = (size_t)size;
+	}
+
+	return result;
+}
@@ -0,0 +1,363 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define METRICS_PREFIX "remote_monitoring_"
+#define METRICS_RESPONSE_MAX 16384
+
+typedef struct METRIC_DESCRIPTION_TAG
+{
+	const char* name;
+	const char* help;
+} METRIC_DESCRIPTION;
+
+static const METRIC_DESCRIPTION Counter_descriptions[METRIC_COUNTER_COUNT] =
+{
+	{ "spi_transactions_total", "SPI transfers issued to the BME280" },
+	{ "spi_errors_total", "SPI transfers that failed or returned short" },
+	{ "sensor_read_failures_total", "Sensor reads that gave up after all retries" },
+	{ "messages_sent_total", "Telemetry messages handed to the IoT Hub client" },
+	{ "messages_confirmed_total", "Telemetry messages confirmed by IoT Hub" },
+	{ "messages_dropped_total", "Telemetry messages that could not be created, queued or delivered" },
+	{ "twin_reports_total", "Reported property updates sent" },
+	{ "twin_report_failures_total", "Reported property updates rejected or not sent" },
+	{ "anomaly_alerts_total", "Alert messages sent for sensor anomalies" },
+	{ "reconnects_total", "IoT Hub connections restored after a loss" },
+	{ "messages_compressed_total", "Messages sent with a deflated body" },
+	{ "compression_saved_bytes_total", "Message body bytes saved by compression" },
+	{ "messages_retried_total", "At-least-once messages sent again after the hub did not confirm them" },
+	{ "messages_expired_total", "Best-effort messages dropped after waiting longer than their lane's timeout" },
+	{ "clock_steps_total", "Steps of the realtime clock seen between two sample stamps" },
+	{ "pool_fallbacks_total", "Allocations the memory pools could not serve, made on the heap instead" },
+	{ "messages_abandoned_total", "At-least-once messages given up after their lane's maximum send attempts" }
+};
+
+static const METRIC_DESCRIPTION Gauge_descriptions[METRIC_GAUGE_COUNT] =
+{
+	{ "send_queue_depth", "Messages handed to the IoT Hub client and not yet confirmed" },
+	{ "hub_connected", "IoT Hub clients currently authenticated" },
+	{ "send_lane_backlog", "Messages waiting in the send lanes for the IoT Hub client" },
+	{ "pool_blocks_in_use", "Blocks of the startup memory pools in use" }
+};
+
+static const METRIC_DESCRIPTION Histogram_descriptions[METRIC_HISTOGRAM_COUNT] =
+{
+	{ "sensor_read_seconds", "Time to read and compensate one BME280 sample" },
+	{ "serialize_seconds", "Time to format one telemetry message" },
+	{ "send_confirm_seconds", "Time from queuing a message to its delivery confirmation" },
+	{ "twin_roundtrip_seconds", "Time from sending reported properties to the hub's answer" },
+	{ "alert_latency_seconds", "Time from reading an anomalous sample to queuing its alert" },
+	{ "connect_seconds", "Time from starting the client to its first authenticated connection" },
+	{ "reconnect_seconds", "Time from losing the IoT Hub connection to restoring it" },
+	{ "alert_lane_wait_seconds", "Time an alert waits in its send lane before it is handed to the IoT Hub client" },
+	{ "sample_wake_seconds", "How late the sampling loop woke up for its next sensor read" }
+};
+
+/* the last bound is +Inf */
+static const uint64_t Bucket_bounds_us[METRICS_HISTOGRAM_BUCKETS - 1] =
+{
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+typedef struct HISTOGRAM_SLOTS_TAG
+{
+	uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum_us;
+} HISTOGRAM_SLOTS;
+
+static uint64_t Counters[METRIC_COUNTER_COUNT];
+static int64_t Gauges[METRIC_GAUGE_COUNT];
+static HISTOGRAM_SLOTS Histograms[METRIC_HISTOGRAM_COUNT];
+
+static int Server_fd = -1;
+static volatile int Server_stop = 0;
+static pthread_t Server_thread;
+
+uint64_t metrics_now_us(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+void metrics_counter_add(METRIC_COUNTER counter, uint64_t value)
+{
+	__atomic_fetch_add(&Counters[counter], value, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_add(METRIC_GAUGE gauge, int64_t delta)
+{
+	__atomic_fetch_add(&Gauges[gauge], delta, __ATOMIC_RELAXED);
+}
+
+void metrics_histogram_observe(METRIC_HISTOGRAM histogram, uint64_t value_us)
+{
+	HISTOGRAM_SLOTS* slots = &Histograms[histogram];
+	unsigned int bucket = 0;
+
+	while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && value_us > Bucket_bounds_us[bucket])
+	{
+		bucket++;
+	}
+
+	__atomic_fetch_add(&slots->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slots->sum_us, value_us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&slots->count, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_counter_get(METRIC_COUNTER counter)
+{
+	return __atomic_load_n(&Counters[counter], __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_histogram_percentile(METRIC_HISTOGRAM histogram, double percentile)
+{
+	uint64_t result = 0;
+	uint64_t counts[METRICS_HISTOGRAM_BUCKETS];
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+	{
+		counts[i] = __atomic_load_n(&Histograms[histogram].buckets[i], __ATOMIC_RELAXED);
+		total += counts[i];
+	}
+
+	if (total > 0)
+	{
+		uint64_t rank = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+		uint64_t seen = 0;
+		unsigned int bucket = 0;
+
+		if (rank == 0)
+		{
+			rank = 1;
+		}
+		while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && (seen += counts[bucket]) < rank)
+		{
+			bucket++;
+		}
+		/* values beyond the last bound are reported as that bound */
+		result = Bucket_bounds_us[(bucket < METRICS_HISTOGRAM_BUCKETS - 1) ? bucket : METRICS_HISTOGRAM_BUCKETS - 2];
+	}
+
+	return result;
+}
+
+/* snprintf that keeps appending to buffer and remembers when it ran out of room */
+static void Append(char* buffer, size_t size, size_t* length, int* overflow, const char* format, ...)
+{
+	if (!*overflow)
+	{
+		va_list args;
+		int written;
+
+		va_start(args, format);
+		written = vsnprintf(buffer + *length, size - *length, format, args);
+		va_end(args);
+
+		if (written < 0 || (size_t)written >= size - *length)
+		{
+			*overflow = 1;
+		}
+		else
+		{
+			*length += (size_t)written;
+		}
+	}
+}
+
+size_t metrics_format_prometheus(char* buffer, size_t size)
+{
+	size_t length = 0;
+	int overflow = (size == 0);
+
+	for (unsigned int i = 0; i < METRIC_COUNTER_COUNT; i++)
+	{
+		const METRIC_DESCRIPTION* description = &Counter_descriptions[i];
+		Append(buffer, size, &length, &overflow, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s counter\n" METRICS_PREFIX "%s %llu\n",
+			description->name, description->help, description->name, description->name,
+			(unsigned long long)__atomic_load_n(&Counters[i], __ATOMIC_RELAXED));
+	}
+
+	for (unsigned int i = 0; i < METRIC_GAUGE_COUNT; i++)
+	{
+		const METRIC_DESCRIPTION* description = &Gauge_descriptions[i];
+		Append(buffer, size, &length, &overflow, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s gauge\n" METRICS_PREFIX "%s %lld\n",
+			description->name, description->help, description->name, description->name,
+			(long long)__atomic_load_n(&Gauges[i], __ATOMIC_RELAXED));
+	}
+
+	for (unsigned int i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+	{
+		const METRIC_DESCRIPTION* description = &Histogram_descriptions[i];
+		uint64_t cumulative = 0;
+
+		Append(buffer, size, &length, &overflow, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s histogram\n",
+			description->name, description->help, description->name);
+		for (unsigned int bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++)
+		{
+			cumulative += __atomic_load_n(&Histograms[i].buckets[bucket], __ATOMIC_RELAXED);
+			if (bucket < METRICS_HISTOGRAM_BUCKETS - 1)
+			{
+				Append(buffer, size, &length, &overflow, METRICS_PREFIX "%s_bucket{le=\"%g\"} %llu\n",
+					description->name, Bucket_bounds_us[bucket] / 1000000.0, (unsigned long long)cumulative);
+			}
+			else
+			{
+				Append(buffer, size, &length, &overflow, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n",
+					description->name, (unsigned long long)cumulative);
+			}
+		}
+		Append(buffer, size, &length, &overflow, METRICS_PREFIX "%s_sum %.6f\n" METRICS_PREFIX "%s_count %llu\n",
+			description->name, __atomic_load_n(&Histograms[i].sum_us, __ATOMIC_RELAXED) / 1000000.0,
+			description->name, (unsigned long long)__atomic_load_n(&Histograms[i].count, __ATOMIC_RELAXED));
+	}
+
+	return overflow ? 0 : length;
+}
+
+size_t metrics_format_reported(char* buffer, size_t size)
+{
+	size_t length = 0;
+	int overflow = (size == 0);
+
+	Append(buffer, size, &length, &overflow,
+		"{\"Metrics\":{\"spi\":%llu,\"spiErr\":%llu,\"readErr\":%llu,\"sent\":%llu,\"confirmed\":%llu,\"dropped\":%llu,\"queue\":%lld,\"clockSteps\":%llu,\"poolFallbacks\":%llu,"
+		"\"readP99us\":%llu,\"wakeP99us\":%llu,\"serializeP99us\":%llu,\"confirmP50us\":%llu,\"confirmP99us\":%llu,\"twinP99us\":%llu}}",
+		(unsigned long long)metrics_counter_get(METRIC_SPI_TRANSACTIONS),
+		(unsigned long long)metrics_counter_get(METRIC_SPI_ERRORS),
+		(unsigned long long)metrics_counter_get(METRIC_SENSOR_READ_FAILURES),
+		(unsigned long long)metrics_counter_get(METRIC_MESSAGES_SENT),
+		(unsigned long long)metrics_counter_get(METRIC_MESSAGES_CONFIRMED),
+		(unsigned long long)metrics_counter_get(METRIC_MESSAGES_DROPPED),
+		(long long)__atomic_load_n(&Gauges[METRIC_SEND_QUEUE_DEPTH], __ATOMIC_RELAXED),
+		(unsigned long long)metrics_counter_get(METRIC_CLOCK_STEPS),
+		(unsigned long long)metrics_counter_get(METRIC_POOL_FALLBACKS),
+		(unsigned long long)metrics_histogram_percentile(METRIC_SENSOR_READ_LATENCY, 99),
+		(unsigned long long)metrics_histogram_percentile(METRIC_SAMPLE_WAKE_LATENCY, 99),
+		(unsigned long long)metrics_histogram_percentile(METRIC_SERIALIZE_LATENCY, 99),
+		(unsigned long long)metrics_histogram_percentile(METRIC_SEND_CONFIRM_LATENCY, 50),
+		(unsigned long long)metrics_histogram_percentile(METRIC_SEND_CONFIRM_LATENCY, 99),
+		(unsigned long long)metrics_histogram_percentile(METRIC_TWIN_ROUNDTRIP_LATENCY, 99));
+
+	return overflow ? 0 : length;
+}
+
+static void ServeClient(int clientFd)
+{
+	static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+	char body[METRICS_RESPONSE_MAX];
+	char request[1024];
+	size_t length;
+
+	/* every request gets the metrics, the request itself is not interpreted */
+	(void)recv(clientFd, request, sizeof(request), 0);
+
+	length = metrics_format_prometheus(body, sizeof(body));
+	if (send(clientFd, header, sizeof(header) - 1, MSG_NOSIGNAL) == (ssize_t)(sizeof(header) - 1) && length > 0)
+	{
+		(void)send(clientFd, body, length, MSG_NOSIGNAL);
+	}
+}
+
+static void* ServerThread(void* arg)
+{
+	(void)arg;
+
+	while (!Server_stop)
+	{
+		struct pollfd pollFd;
+		pollFd.fd = Server_fd;
+		pollFd.events = POLLIN;
+		pollFd.revents = 0;
+
+		if (poll(&pollFd, 1, 500) > 0)
+		{
+			int clientFd = accept(Server_fd, NULL, NULL);
+			if (clientFd >= 0)
+			{
+				struct timeval timeout = { 1, 0 };
+				(void)setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				ServeClient(clientFd);
+				close(clientFd);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+int metrics_server_start(unsigned short port)
+{
+	int result;
+	struct sockaddr_in endpoint;
+	int reuse = 1;
+
+	memset(&endpoint, 0, sizeof(endpoint));
+	endpoint.sin_family = AF_INET;
+	endpoint.sin_port = htons(port);
+	endpoint.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (Server_fd >= 0)
+	{
+		result = 0;
+	}
+	else if ((Server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		perror("Failed to create metrics socket");
+		result = __LINE__;
+	}
+	else if (setsockopt(Server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+		bind(Server_fd, (struct sockaddr*)&endpoint, sizeof(endpoint)) != 0 ||
+		listen(Server_fd, 4) != 0)
+	{
+		perror("Failed to listen for metrics requests");
+		close(Server_fd);
+		Server_fd = -1;
+		result = __LINE__;
+	}
+	else
+	{
+		Server_stop = 0;
+		if (pthread_create(&Server_thread, NULL, ServerThread, NULL) != 0)
+		{
+			printf("Failed to start the metrics thread\n");
+			close(Server_fd);
+			Server_fd = -1;
+			result = __LINE__;
+		}
+		else
+		{
+			printf("Serving metrics on http://127.0.0.1:%u/metrics\n", port);
+			result = 0;
+		}
+	}
+
+	return result;
+}
+
+void metrics_server_stop(void)
+{
+	if (Server_fd >= 0)
+	{
+		Server_stop = 1;
+		pthread_join(Server_thread, NULL);
+		close(Server_fd);
+		Server_fd = -1;
+	}
+}
@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "payload_compress.h"
+
+/*
+ * A 4 KiB window covers the dictionary and any message we send; with memLevel
+ * 5 the deflate state is about 25 KiB instead of the 256 KiB of the zlib
+ * defaults. The stream is set up once and reset per message.
+ */
+#define PAYLOAD_COMPRESS_WINDOW_BITS 12
+#define PAYLOAD_COMPRESS_MEM_LEVEL 5
+
+/*
+ * Keys and constants of the device info, telemetry, summary and alert formats
+ * in remote_monitoring.c. Deflate finds matches nearer the end at a lower
+ * cost, so the telemetry keys every message starts with come last.
+ */
+static const char Dictionary[] =
+"{ \"ObjectType\": \"DeviceInfo\",\"IsSimulatedDevice\": 0,\"Version\" : '1.0',\"DeviceProperties\" :"
+"{\"DeviceID\": \"\", \"TelemetryInterval\" : 1, \"HubEnabledState\" : true},\"Telemetry\" : ["
+"{\"Name\": \"Temperature\", \"DisplayName\" : \"Temperature\", \"Type\" : \"double\"},"
+"{ \"Name\": \"Humidity\", \"DisplayName\" : \"Humidity\", \"Type\" : \"double\" }] }"
+"\"Alert\" : \"RateOfChange\",\"Alert\" : \"ZScore\",\"Sensor\" : \"Temperature\",\"Sensor\" : \"Humidity\","
+"\"Value\" : ,\"Mean\" : ,\"ZScore\" : ,\"RatePerMinute\" : 0.000000,\"SampleTime\" : \"\","
+"\"Series\" : \"Watch\",\"Series\" : \"Telemetry\",\"Sequence\" : ,\"Epoch\" :  } "
+"\"WindowStart\" : \"\",\"WindowEnd\" : \"\",\"FirstSequence\" : ,\"LastSequence\" : ,\"Epoch\" : ,"
+"\"WindowSeconds\" : ,\"Samples\" : ,"
+"\"TemperatureStats\" : { \"Min\" : , \"Max\" : , \"StdDev\" : , \"P50\" : , \"P95\" :  },"
+"\"HumidityStats\" : { \"Min\" : , \"Max\" : , \"StdDev\" : , \"P50\" : , \"P95\" :  } }"
+"[{\"DeviceID\": \"\",\"Temperature\" : 2.000000,\"Humidity\" : 4.000000,\"SampleTime\" : \"2026-10-18T\",\"Sequence\" : 1,\"Epoch\" : 1 } ,"
+"{\"DeviceID\": \"\",\"Temperature\" : 0.000000,\"Humidity\" : 0.000000,\"SampleTime\" : \"202";
+
+static pthread_mutex_t Stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static z_stream Stream;
+static int Initialized;
+
+int payload_compress_init(int level)
+{
+	int result;
+
+	pthread_mutex_lock(&Stream_lock);
+	if (Initialized)
+	{
+		result = (deflateParams(&Stream, level, Z_DEFAULT_STRATEGY) == Z_OK) ? 0 : -1;
+	}
+	else
+	{
+		memset(&Stream, 0, sizeof(Stream));
+		if (deflateInit2(&Stream, level, Z_DEFLATED, PAYLOAD_COMPRESS_WINDOW_BITS, PAYLOAD_COMPRESS_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			printf("Failed to set up deflate: %s\r\n", (Stream.msg != NULL) ? Stream.msg : "out of memory");
+			result = -1;
+		}
+		else
+		{
+			Initialized = 1;
+			result = 0;
+		}
+	}
+	pthread_mutex_unlock(&Stream_lock);
+
+	return result;
+}
+
+void payload_compress_deinit(void)
+{
+	pthread_mutex_lock(&Stream_lock);
+	if (Initialized)
+	{
+		(void)deflateEnd(&Stream);
+		Initialized = 0;
+	}
+	pthread_mutex_unlock(&Stream_lock);
+}
+
+size_t payload_compress(const unsigned char* body, size_t size, unsigned char* out, size_t outSize)
+{
+	size_t result = 0;
+
+	pthread_mutex_lock(&Stream_lock);
+	if (Initialized && size > 0)
+	{
+		/* nothing smaller than the body is worth sending, so deflate stops once the body size is reached */
+		size_t limit = (outSize < size - 1) ? outSize : size - 1;
+
+		Stream.next_in = (Bytef*)body;
+		Stream.avail_in = (uInt)size;
+		Stream.next_out = out;
+		Stream.avail_out = (uInt)limit;
+		if (deflateSetDictionary(&Stream, (const Bytef*)Dictionary, (uInt)(sizeof(Dictionary) - 1)) == Z_OK &&
+			deflate(&Stream, Z_FINISH) == Z_STREAM_END)
+		{
+			result = (size_t)Stream.total_out;
+		}
+		(void)deflateReset(&Stream);
+	}
+	pthread_mutex_unlock(&Stream_lock);
+
+	return result;
+}
+
+const unsigned char* payload_compress_dictionary(size_t* size)
+{
+	*size = sizeof(Dictionary) - 1;
+	return (const unsigned char*)Dictionary;
+}
+
+unsigned long payload_compress_dictionary_id(void)
+{
+	return adler32(adler32(0L, Z_NULL, 0), (const Bytef*)Dictionary, (uInt)(sizeof(Dictionary) - 1));
+}
@@ -0,0 +1,199 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "reading_shm.h"
+
+/* a reader gives up after this many torn reads, only a writer that died mid-publish gets there */
+#define READING_SHM_READ_ATTEMPTS 10000
+
+READING_SHM* reading_shm_create(const char* name)
+{
+	READING_SHM* result = NULL;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+	{
+		printf("Failed to create shared memory %s: %s\r\n", name, strerror(errno));
+	}
+	else
+	{
+		void* segment;
+
+		/* readable by local consumers whatever the umask */
+		if (fchmod(fd, 0644) != 0 || ftruncate(fd, sizeof(READING_SHM)) != 0)
+		{
+			printf("Failed to size shared memory %s: %s\r\n", name, strerror(errno));
+		}
+		else if ((segment = mmap(NULL, sizeof(READING_SHM), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		{
+			printf("Failed to map shared memory %s: %s\r\n", name, strerror(errno));
+		}
+		else
+		{
+			/* a segment left by an earlier run is taken over, readers retry while the header is rewritten */
+			uint32_t sequence = __atomic_load_n(&((READING_SHM*)segment)->sequence, __ATOMIC_RELAXED) | 1;
+
+			result = segment;
+			__atomic_store_n(&result->sequence, sequence, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+			memcpy(result->magic, READING_SHM_MAGIC, sizeof(result->magic));
+			result->version = READING_SHM_VERSION;
+			result->historySize = READING_SHM_HISTORY;
+			result->sampleSize = sizeof(READING_SAMPLE);
+			result->writerPid = (int32_t)getpid();
+			result->published = 0;
+			memset(result->history, 0, sizeof(result->history));
+			__atomic_store_n(&result->sequence, sequence + 1, __ATOMIC_RELEASE);
+		}
+		close(fd);
+	}
+
+	return result;
+}
+
+void reading_shm_publish(READING_SHM* shm, const SAMPLE_STAMP* stamp, float temperatureC, float pressurePa, float humidityPct)
+{
+	if (shm != NULL)
+	{
+		uint32_t sequence = __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED);
+		READING_SAMPLE* slot = &shm->history[shm->published % READING_SHM_HISTORY];
+
+		__atomic_store_n(&shm->sequence, sequence + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		slot->monotonicUs = stamp->monotonicUs;
+		slot->unixUs = stamp->unixUs;
+		slot->temperatureC = temperatureC;
+		slot->pressurePa = pressurePa;
+		slot->humidityPct = humidityPct;
+		slot->sequence = stamp->sequence;
+		shm->published++;
+		__atomic_store_n(&shm->sequence, sequence + 2, __ATOMIC_RELEASE);
+	}
+}
+
+void reading_shm_destroy(READING_SHM* shm, const char* name)
+{
+	if (shm != NULL)
+	{
+		shm->writerPid = 0;
+		munmap(shm, sizeof(READING_SHM));
+		(void)shm_unlink(name);
+	}
+}
+
+const READING_SHM* reading_shm_open(const char* name)
+{
+	const READING_SHM* result = NULL;
+	struct stat status;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0)) >= 0)
+	{
+		void* segment;
+
+		if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(READING_SHM) &&
+			(segment = mmap(NULL, sizeof(READING_SHM), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+		{
+			result = segment;
+			if (memcmp(result->magic, READING_SHM_MAGIC, sizeof(result->magic)) != 0 ||
+				result->version != READING_SHM_VERSION ||
+				result->historySize != READING_SHM_HISTORY ||
+				result->sampleSize != sizeof(READING_SAMPLE))
+			{
+				printf("Shared memory %s has another layout (version %u)\r\n", name, (unsigned int)result->version);
+				munmap(segment, sizeof(READING_SHM));
+				result = NULL;
+			}
+		}
+		close(fd);
+	}
+
+	return result;
+}
+
+void reading_shm_close(const READING_SHM* shm)
+{
+	if (shm != NULL)
+	{
+		munmap((void*)shm, sizeof(READING_SHM));
+	}
+}
+
+uint32_t reading_shm_read_begin(const READING_SHM* shm)
+{
+	return __atomic_load_n(&shm->sequence, __ATOMIC_ACQUIRE);
+}
+
+int reading_shm_read_retry(const READING_SHM* shm, uint32_t sequence)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (sequence & 1) || __atomic_load_n(&shm->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+const READING_SAMPLE* reading_shm_latest_slot(const READING_SHM* shm)
+{
+	return &shm->history[(shm->published + READING_SHM_HISTORY - 1) % READING_SHM_HISTORY];
+}
+
+int reading_shm_latest(const READING_SHM* shm, READING_SAMPLE* sample)
+{
+	int result = -1;
+
+	for (int attempt = 0; attempt < READING_SHM_READ_ATTEMPTS; attempt++)
+	{
+		uint32_t sequence = reading_shm_read_begin(shm);
+		uint64_t published = shm->published;
+
+		*sample = *reading_shm_latest_slot(shm);
+		if (!reading_shm_read_retry(shm, sequence))
+		{
+			result = (published > 0) ? 0 : -1;
+			break;
+		}
+	}
+
+	return result;
+}
+
+size_t reading_shm_history(const READING_SHM* shm, READING_SAMPLE* samples, size_t count)
+{
+	size_t result = 0;
+
+	for (int attempt = 0; attempt < READING_SHM_READ_ATTEMPTS; attempt++)
+	{
+		uint32_t sequence = reading_shm_read_begin(shm);
+		uint64_t published = shm->published;
+		size_t available = (published < READING_SHM_HISTORY) ? (size_t)published : READING_SHM_HISTORY;
+
+		result = (count < available) ? count : available;
+		for (size_t i = 0; i < result; i++)
+		{
+			samples[i] = shm->history[(published - 1 - i) % READING_SHM_HISTORY];
+		}
+		if (!reading_shm_read_retry(shm, sequence))
+		{
+			break;
+		}
+		result = 0;
+	}
+
+	return result;
+}
+
+int reading_shm_writer_alive(const READING_SHM* shm)
+{
+	pid_t pid = (pid_t)shm->writerPid;
+
+	/* EPERM: the writer runs as another user, but it runs */
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
@@ -0,0 +1,99 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "realtime.h"
+
+void realtime_defaults(REALTIME_OPTIONS* options)
+{
+	options->cpu = -1;
+	options->priority = 0;
+	options->lockMemory = 0;
+}
+
+/* Touches a page at a time below the caller's frame, the stack the caller's calls will use */
+static __attribute__((noinline)) void PrefaultStack(void)
+{
+	volatile unsigned char stack[REALTIME_PREFAULT_STACK_BYTES];
+	long pageSize = sysconf(_SC_PAGESIZE);
+
+	for (size_t i = 0; i < sizeof(stack); i += (pageSize > 0) ? (size_t)pageSize : 4096)
+	{
+		stack[i] = 0;
+	}
+}
+
+int realtime_apply(const REALTIME_OPTIONS* options)
+{
+	int result = 0;
+	int error;
+
+	if (options->cpu >= 0)
+	{
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		if (options->cpu >= CPU_SETSIZE)
+		{
+			LOGGER_WARN("There is no core %d to pin the sampler to\r\n", options->cpu);
+			result = __LINE__;
+		}
+		else
+		{
+			CPU_SET(options->cpu, &cpus);
+			if ((error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0)
+			{
+				LOGGER_WARN("Failed to pin the sampler to core %d: %s\r\n", options->cpu, strerror(error));
+				result = __LINE__;
+			}
+		}
+	}
+
+	if (options->priority > 0)
+	{
+		struct sched_param parameters;
+
+		memset(&parameters, 0, sizeof(parameters));
+		parameters.sched_priority = options->priority;
+		if ((error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters)) != 0)
+		{
+			LOGGER_WARN("Failed to run the sampler under SCHED_FIFO at priority %d: %s\r\n", options->priority, strerror(error));
+			result = __LINE__;
+		}
+	}
+
+	if (options->lockMemory)
+	{
+		int flags = MCL_CURRENT | MCL_FUTURE;
+
+#ifdef MCL_ONFAULT
+		/* pages are locked as they are first touched, not all at once: the 8 MB stack of every thread and the unused memory pool blocks stay unmapped */
+		flags |= MCL_ONFAULT;
+#endif
+		if (mlockall(flags) != 0)
+		{
+			LOGGER_WARN("Failed to lock the process in memory: %s\r\n", strerror(errno));
+			result = __LINE__;
+		}
+		else
+		{
+			PrefaultStack();
+		}
+	}
+
+	if (result == 0 && (options->cpu >= 0 || options->priority > 0 || options->lockMemory))
+	{
+		LOGGER_INFO("Sampler on core %d (-1 is any), SCHED_FIFO priority %d (0 is the normal scheduler), memory %s\r\n",
+			options->cpu, options->priority, options->lockMemory ? "locked" : "not locked");
+	}
+
+	return result;
+}
@@ -0,0 +1,399 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <string.h>
+
+#include "sample_block.h"
+
+/* 0.01 C and 0.01 %RH */
+#define SAMPLE_BLOCK_SCALE 100.0
+
+typedef struct SAMPLE_BLOCK_BUCKET_TAG
+{
+	unsigned int prefix;
+	unsigned int prefixBits;
+	unsigned int valueBits;
+} SAMPLE_BLOCK_BUCKET;
+
+/* the first bucket, 0 without a value, is handled on its own */
+static const SAMPLE_BLOCK_BUCKET Buckets[] =
+{
+	{ 0x2, 2, 4 },
+	{ 0x6, 3, 7 },
+	{ 0xE, 4, 12 },
+	{ 0xF, 4, 32 }
+};
+
+#define BUCKET_COUNT (sizeof(Buckets) / sizeof(Buckets[0]))
+
+static void PutLittleEndian(unsigned char* data, uint64_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		data[i] = (unsigned char)(value >> (8 * i));
+	}
+}
+
+static uint64_t GetLittleEndian(const unsigned char* data, int size)
+{
+	uint64_t value = 0;
+
+	for (int i = size - 1; i >= 0; i--)
+	{
+		value = (value << 8) | data[i];
+	}
+	return value;
+}
+
+static void WriteBits(SAMPLE_BLOCK_ENCODER* encoder, uint32_t value, unsigned int count)
+{
+	while (count > 0)
+	{
+		unsigned char* byte = &encoder->buffer[SAMPLE_BLOCK_HEADER_SIZE + encoder->bits / 8];
+		unsigned int room = 8 - (unsigned int)(encoder->bits % 8);
+		unsigned int take = (count < room) ? count : room;
+		unsigned int chunk = (unsigned int)(value >> (count - take)) & ((1U << take) - 1);
+
+		if (room == 8)
+		{
+			*byte = 0;
+		}
+		*byte |= (unsigned char)(chunk << (room - take));
+		encoder->bits += take;
+		count -= take;
+	}
+}
+
+static void WriteNumber(SAMPLE_BLOCK_ENCODER* encoder, int32_t number)
+{
+	if (number == 0)
+	{
+		WriteBits(encoder, 0, 1);
+	}
+	else
+	{
+		size_t i = 0;
+
+		/* the last bucket takes any 32-bit number */
+		while (i + 1 < BUCKET_COUNT &&
+			(number < -(1 << (Buckets[i].valueBits - 1)) || number >= (1 << (Buckets[i].valueBits - 1))))
+		{
+			i++;
+		}
+		WriteBits(encoder, Buckets[i].prefix, Buckets[i].prefixBits);
+		WriteBits(encoder, (uint32_t)number, Buckets[i].valueBits);
+	}
+}
+
+static int ReadBits(SAMPLE_BLOCK_DECODER* decoder, unsigned int count, uint32_t* value)
+{
+	int result = 0;
+
+	if (decoder->bit + count > (decoder->size - SAMPLE_BLOCK_HEADER_SIZE) * 8)
+	{
+		result = -1;
+	}
+	else
+	{
+		*value = 0;
+		for (unsigned int i = 0; i < count; i++, decoder->bit++)
+		{
+			unsigned char byte = decoder->block[SAMPLE_BLOCK_HEADER_SIZE + decoder->bit / 8];
+			*value = (*value << 1) | ((byte >> (7 - decoder->bit % 8)) & 1);
+		}
+	}
+	return result;
+}
+
+static int ReadNumber(SAMPLE_BLOCK_DECODER* decoder, int32_t* number)
+{
+	uint32_t bit;
+	int result = ReadBits(decoder, 1, &bit);
+
+	if (result == 0 && bit == 0)
+	{
+		*number = 0;
+	}
+	else if (result == 0)
+	{
+		size_t i = 0;
+		uint32_t value;
+
+		/* count the ones after the first, a 0 ends the prefix except in the last bucket */
+		while (result == 0 && i + 1 < BUCKET_COUNT && (result = ReadBits(decoder, 1, &bit)) == 0 && bit == 1)
+		{
+			i++;
+		}
+		if (result == 0 && (result = ReadBits(decoder, Buckets[i].valueBits, &value)) == 0)
+		{
+			/* sign extension */
+			unsigned int shift = 32 - Buckets[i].valueBits;
+			*number = (int32_t)(value << shift) >> shift;
+		}
+	}
+	return result;
+}
+
+static int32_t ToFixedPoint(float value)
+{
+	double scaled = nearbyint(value * SAMPLE_BLOCK_SCALE);
+
+	/* NaN goes to 0 */
+	return (scaled != scaled) ? 0 : (scaled > INT32_MAX) ? INT32_MAX : (scaled < INT32_MIN) ? INT32_MIN : (int32_t)scaled;
+}
+
+/*
+ * Checks that a sample fits and writes its stamp: the first sample's time and
+ * epoch are the block's, the epoch and its sequence number take 32 bits each,
+ * a later sample writes the delta of the tick delta and the delta of the
+ * sequence delta. 0 when the sample can follow, -1 when it needs a block of
+ * its own.
+ */
+static int WriteStamp(SAMPLE_BLOCK_ENCODER* encoder, uint64_t unixMs, uint32_t epoch, uint32_t sequence)
+{
+	int result = 0;
+
+	if (encoder->count == SAMPLE_BLOCK_MAX_SAMPLES ||
+		SAMPLE_BLOCK_HEADER_SIZE + (encoder->bits + SAMPLE_BLOCK_MAX_SAMPLE_BITS + 7) / 8 > encoder->capacity)
+	{
+		result = -1;
+	}
+	else if (encoder->count == 0)
+	{
+		encoder->firstUnixMs = unixMs;
+		encoder->epoch = epoch;
+		WriteBits(encoder, epoch, 32);
+		WriteBits(encoder, sequence, 32);
+	}
+	else if (unixMs < encoder->firstUnixMs || epoch != encoder->epoch)
+	{
+		result = -1;
+	}
+	else
+	{
+		/* rounded to the nearest tick, the jitter of the sampling loop mostly disappears */
+		int64_t tick = (int64_t)((unixMs - encoder->firstUnixMs + encoder->tickMs / 2) / encoder->tickMs);
+		int64_t tickDelta = tick - encoder->lastTick;
+		int64_t deltaOfDelta = tickDelta - encoder->lastTickDelta;
+		/* the sequence numbers wrap, their delta is signed 32 bits */
+		int64_t sequenceDelta = (int32_t)(sequence - encoder->lastSequence);
+		int64_t sequenceDeltaOfDelta = sequenceDelta - encoder->lastSequenceDelta;
+
+		if (tickDelta < 0 || deltaOfDelta < INT32_MIN || deltaOfDelta > INT32_MAX ||
+			sequenceDeltaOfDelta < INT32_MIN || sequenceDeltaOfDelta > INT32_MAX)
+		{
+			result = -1;
+		}
+		else
+		{
+			WriteNumber(encoder, (int32_t)deltaOfDelta);
+			WriteNumber(encoder, (int32_t)sequenceDeltaOfDelta);
+			encoder->lastTick = tick;
+			encoder->lastTickDelta = tickDelta;
+			encoder->lastSequenceDelta = sequenceDelta;
+		}
+	}
+	if (result == 0)
+	{
+		encoder->lastSequence = sequence;
+	}
+	return result;
+}
+
+/* Reads the stamp of the next sample, 0 on success; blocks without sequence numbers give 0 */
+static int ReadStamp(SAMPLE_BLOCK_DECODER* decoder, uint64_t* unixMs, uint32_t* sequence)
+{
+	int32_t deltaOfDelta = 0;
+	int32_t sequenceDeltaOfDelta = 0;
+	uint32_t first = 0;
+	int result;
+
+	if (decoder->decoded == 0)
+	{
+		result = decoder->sequenced ? ReadBits(decoder, 32, &first) : 0;
+		decoder->lastSequence = first;
+	}
+	else
+	{
+		result = ReadNumber(decoder, &deltaOfDelta);
+		if (result == 0 && decoder->sequenced)
+		{
+			result = ReadNumber(decoder, &sequenceDeltaOfDelta);
+		}
+		decoder->lastSequenceDelta += sequenceDeltaOfDelta;
+		decoder->lastSequence += (uint32_t)decoder->lastSequenceDelta;
+	}
+
+	if (result == 0)
+	{
+		decoder->lastTickDelta += deltaOfDelta;
+		decoder->lastTick += decoder->lastTickDelta;
+		*unixMs = decoder->firstUnixMs + (uint64_t)decoder->lastTick * decoder->tickMs;
+		*sequence = decoder->sequenced ? decoder->lastSequence : 0;
+	}
+	return result;
+}
+
+static void Begin(SAMPLE_BLOCK_ENCODER* encoder, uint8_t format, unsigned char* buffer, size_t capacity, unsigned int tickMs)
+{
+	memset(encoder, 0, sizeof(*encoder));
+	encoder->buffer = buffer;
+	encoder->capacity = capacity;
+	encoder->format = format;
+	/* consecutive sequence numbers cost a bit each */
+	encoder->lastSequenceDelta = 1;
+	encoder->tickMs = (uint16_t)((tickMs != 0 && tickMs <= UINT16_MAX) ? tickMs : SAMPLE_BLOCK_DEFAULT_TICK_MS);
+}
+
+void sample_block_begin(SAMPLE_BLOCK_ENCODER* encoder, unsigned char* buffer, size_t capacity, unsigned int tickMs)
+{
+	Begin(encoder, SAMPLE_BLOCK_FORMAT_READINGS, buffer, capacity, tickMs);
+}
+
+void sample_block_begin_raw(SAMPLE_BLOCK_ENCODER* encoder, unsigned char* buffer, size_t capacity, unsigned int tickMs)
+{
+	Begin(encoder, SAMPLE_BLOCK_FORMAT_RAW, buffer, capacity, tickMs);
+}
+
+int sample_block_add(SAMPLE_BLOCK_ENCODER* encoder, uint64_t unixMs, uint32_t epoch, uint32_t sequence, float temperatureC, float humidityPct)
+{
+	int result = -1;
+	int32_t temperature = ToFixedPoint(temperatureC);
+	int32_t humidity = ToFixedPoint(humidityPct);
+
+	if (encoder->format == SAMPLE_BLOCK_FORMAT_READINGS && WriteStamp(encoder, unixMs, epoch, sequence) == 0)
+	{
+		/* wraps like the decoder's sum, the difference of two int32 always fits in 32 bits */
+		WriteNumber(encoder, (int32_t)((uint32_t)temperature - (uint32_t)encoder->lastTemperature));
+		WriteNumber(encoder, (int32_t)((uint32_t)humidity - (uint32_t)encoder->lastHumidity));
+		encoder->lastTemperature = temperature;
+		encoder->lastHumidity = humidity;
+		encoder->count++;
+		result = 0;
+	}
+	return result;
+}
+
+int sample_block_add_raw(SAMPLE_BLOCK_ENCODER* encoder, uint64_t unixMs, uint32_t epoch, uint32_t sequence, int32_t adcT, int32_t adcP, int32_t adcH)
+{
+	int result = -1;
+
+	if (encoder->format == SAMPLE_BLOCK_FORMAT_RAW && WriteStamp(encoder, unixMs, epoch, sequence) == 0)
+	{
+		WriteBits(encoder, (uint32_t)adcT & 0xFFFFF, 20);
+		WriteBits(encoder, (uint32_t)adcP & 0xFFFFF, 20);
+		WriteBits(encoder, (uint32_t)adcH & 0xFFFF, 16);
+		encoder->count++;
+		result = 0;
+	}
+	return result;
+}
+
+size_t sample_block_finish(SAMPLE_BLOCK_ENCODER* encoder)
+{
+	size_t result = 0;
+
+	if (encoder->count > 0)
+	{
+		encoder->buffer[0] = encoder->format | SAMPLE_BLOCK_FLAG_SEQUENCED | SAMPLE_BLOCK_FLAG_EPOCH;
+		PutLittleEndian(&encoder->buffer[1], encoder->count, 2);
+		PutLittleEndian(&encoder->buffer[3], encoder->tickMs, 2);
+		PutLittleEndian(&encoder->buffer[5], encoder->firstUnixMs, 8);
+		result = SAMPLE_BLOCK_HEADER_SIZE + (encoder->bits + 7) / 8;
+	}
+	return result;
+}
+
+int sample_block_decode_begin(SAMPLE_BLOCK_DECODER* decoder, const unsigned char* block, size_t size)
+{
+	int result = 0;
+	uint8_t format = (size > 0) ? (uint8_t)(block[0] & ~(SAMPLE_BLOCK_FLAG_SEQUENCED | SAMPLE_BLOCK_FLAG_EPOCH)) : 0;
+
+	memset(decoder, 0, sizeof(*decoder));
+	if (size < SAMPLE_BLOCK_HEADER_SIZE || (format != SAMPLE_BLOCK_FORMAT_READINGS && format != SAMPLE_BLOCK_FORMAT_RAW))
+	{
+		result = -1;
+	}
+	else
+	{
+		decoder->block = block;
+		decoder->size = size;
+		decoder->format = format;
+		decoder->sequenced = (block[0] & SAMPLE_BLOCK_FLAG_SEQUENCED) != 0;
+		decoder->lastSequenceDelta = 1;
+		decoder->count = (uint16_t)GetLittleEndian(&block[1], 2);
+		decoder->tickMs = (uint16_t)GetLittleEndian(&block[3], 2);
+		decoder->firstUnixMs = GetLittleEndian(&block[5], 8);
+		/* the epoch leads the stream, an empty block has none */
+		if ((block[0] & SAMPLE_BLOCK_FLAG_EPOCH) != 0 && decoder->count > 0)
+		{
+			result = ReadBits(decoder, 32, &decoder->epoch);
+		}
+	}
+	return result;
+}
+
+int sample_block_decode_next(SAMPLE_BLOCK_DECODER* decoder, SAMPLE_BLOCK_SAMPLE* sample)
+{
+	int result = 1;
+	int32_t temperatureChange;
+	int32_t humidityChange;
+
+	if (decoder->format != SAMPLE_BLOCK_FORMAT_READINGS)
+	{
+		result = -1;
+	}
+	else if (decoder->decoded == decoder->count)
+	{
+		result = 0;
+	}
+	else if (ReadStamp(decoder, &sample->unixMs, &sample->sequence) != 0 ||
+		ReadNumber(decoder, &temperatureChange) != 0 ||
+		ReadNumber(decoder, &humidityChange) != 0)
+	{
+		result = -1;
+	}
+	else
+	{
+		decoder->lastTemperature = (int32_t)((uint32_t)decoder->lastTemperature + (uint32_t)temperatureChange);
+		decoder->lastHumidity = (int32_t)((uint32_t)decoder->lastHumidity + (uint32_t)humidityChange);
+		decoder->decoded++;
+
+		sample->temperatureC = (float)(decoder->lastTemperature / SAMPLE_BLOCK_SCALE);
+		sample->humidityPct = (float)(decoder->lastHumidity / SAMPLE_BLOCK_SCALE);
+	}
+	return result;
+}
+
+int sample_block_decode_next_raw(SAMPLE_BLOCK_DECODER* decoder, SAMPLE_BLOCK_RAW_FRAME* frame)
+{
+	int result = 1;
+	uint32_t adcT;
+	uint32_t adcP;
+	uint32_t adcH;
+
+	if (decoder->format != SAMPLE_BLOCK_FORMAT_RAW)
+	{
+		result = -1;
+	}
+	else if (decoder->decoded == decoder->count)
+	{
+		result = 0;
+	}
+	else if (ReadStamp(decoder, &frame->unixMs, &frame->sequence) != 0 ||
+		ReadBits(decoder, 20, &adcT) != 0 ||
+		ReadBits(decoder, 20, &adcP) != 0 ||
+		ReadBits(decoder, 16, &adcH) != 0)
+	{
+		result = -1;
+	}
+	else
+	{
+		decoder->decoded++;
+		frame->adcT = (int32_t)adcT;
+		frame->adcP = (int32_t)adcP;
+		frame->adcH = (int32_t)adcH;
+	}
+	return result;
+}
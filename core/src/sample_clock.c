@@ -0,0 +1,162 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "metrics.h"
+#include "sample_clock.h"
+
+/* the series share the clocks, one offset serves them all */
+static pthread_mutex_t Clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static int Stamped;
+static int64_t Last_offset_us;
+static uint64_t Last_monotonic_us;
+static uint64_t Steps;
+static SAMPLE_CLOCK_STEP Last_step;
+static pthread_once_t Epoch_once = PTHREAD_ONCE_INIT;
+static uint32_t Epoch;
+/* the first stamp from the source anchors its monotonic time */
+static SAMPLE_CLOCK_SOURCE Source;
+static int Source_anchored;
+static uint64_t Source_anchor_us;
+static uint64_t Source_anchor_monotonic_us;
+
+static void DrawEpoch(void)
+{
+	if (getrandom(&Epoch, sizeof(Epoch), GRND_NONBLOCK) != (ssize_t)sizeof(Epoch))
+	{
+		/* early in boot the pool may not be ready, the time and pid still differ from the last run */
+		struct timespec now;
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		Epoch = (uint32_t)now.tv_nsec ^ (uint32_t)now.tv_sec ^ ((uint32_t)getpid() << 16);
+	}
+	/* 0 is left for stamps without an epoch */
+	if (Epoch == 0)
+	{
+		Epoch = 1;
+	}
+}
+
+uint32_t sample_clock_epoch(void)
+{
+	(void)pthread_once(&Epoch_once, DrawEpoch);
+	return Epoch;
+}
+
+void sample_clock_set_source(SAMPLE_CLOCK_SOURCE source)
+{
+	(void)pthread_mutex_lock(&Clock_lock);
+	Source = source;
+	Source_anchored = 0;
+	/* switching between the clocks and a source is not a step */
+	Stamped = 0;
+	(void)pthread_mutex_unlock(&Clock_lock);
+}
+
+void sample_clock_stamp(SAMPLE_CLOCK* clock, SAMPLE_STAMP* stamp)
+{
+	struct timespec now;
+	int64_t offsetUs;
+	int64_t stepUs = 0;
+	uint64_t sourceUs;
+	uint32_t epoch = sample_clock_epoch();
+
+	/* both clocks under the lock, so the stamps of all series are in monotonic order */
+	(void)pthread_mutex_lock(&Clock_lock);
+	if (Source != NULL && (sourceUs = Source()) != 0)
+	{
+		if (!Source_anchored)
+		{
+			Source_anchored = 1;
+			Source_anchor_us = sourceUs;
+			Source_anchor_monotonic_us = metrics_now_us();
+		}
+		stamp->unixUs = sourceUs;
+		stamp->monotonicUs = Source_anchor_monotonic_us + ((sourceUs > Source_anchor_us) ? sourceUs - Source_anchor_us : 0);
+		/* a capture made across a clock step still gives intervals that do not go back */
+		if (Stamped && stamp->monotonicUs < Last_monotonic_us)
+		{
+			stamp->monotonicUs = Last_monotonic_us;
+		}
+	}
+	else
+	{
+		clock_gettime(CLOCK_REALTIME, &now);
+		stamp->unixUs = (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+		stamp->monotonicUs = metrics_now_us();
+	}
+	offsetUs = (int64_t)(stamp->unixUs - stamp->monotonicUs);
+	stamp->sequence = clock->next++;
+	stamp->epoch = epoch;
+	if (Stamped)
+	{
+		uint64_t allowedUs = SAMPLE_CLOCK_STEP_THRESHOLD_US +
+			(stamp->monotonicUs - Last_monotonic_us) / 1000000ULL * SAMPLE_CLOCK_MAX_SLEW_PPM;
+
+		stepUs = offsetUs - Last_offset_us;
+		if ((uint64_t)((stepUs < 0) ? -stepUs : stepUs) > allowedUs)
+		{
+			Steps++;
+			Last_step.unixUs = stamp->unixUs;
+			Last_step.stepUs = stepUs;
+		}
+		else
+		{
+			stepUs = 0;
+		}
+	}
+	Stamped = 1;
+	Last_offset_us = offsetUs;
+	Last_monotonic_us = stamp->monotonicUs;
+	(void)pthread_mutex_unlock(&Clock_lock);
+
+	if (stepUs != 0)
+	{
+		metrics_counter_add(METRIC_CLOCK_STEPS, 1);
+		LOGGER_WARN("The realtime clock stepped by %lld ms, samples from sequence %u on follow it\r\n",
+			(long long)(stepUs / 1000), (unsigned int)stamp->sequence);
+	}
+}
+
+uint64_t sample_clock_last_step(SAMPLE_CLOCK_STEP* last)
+{
+	uint64_t result;
+
+	(void)pthread_mutex_lock(&Clock_lock);
+	result = Steps;
+	if (Steps > 0)
+	{
+		*last = Last_step;
+	}
+	(void)pthread_mutex_unlock(&Clock_lock);
+
+	return result;
+}
+
+size_t sample_clock_format(uint64_t unixUs, char* text, size_t size)
+{
+	time_t seconds = (time_t)(unixUs / 1000000ULL);
+	struct tm utc;
+	size_t result = 0;
+
+	if (gmtime_r(&seconds, &utc) != NULL)
+	{
+		int length = snprintf(text, size, "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ",
+			utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+			(unsigned int)(unixUs % 1000000ULL));
+
+		if (length > 0 && (size_t)length < size)
+		{
+			result = (size_t)length;
+		}
+	}
+
+	return result;
+}
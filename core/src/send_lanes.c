@@ -0,0 +1,339 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "send_lanes.h"
+
+static const char* Lane_names[SEND_LANE_COUNT] = { "alert", "telemetry", "bulk", "diagnostics" };
+
+static const SEND_LANE_CONFIG Default_configs[SEND_LANE_COUNT] =
+{
+	/* weight, in flight, queued, timeout, delivery, attempts */
+	{ 8, 4, 64, 30000, SEND_DELIVERY_AT_LEAST_ONCE, 10 },
+	{ 4, 8, 512, 60000, SEND_DELIVERY_AT_LEAST_ONCE, 5 },
+	{ 1, 2, 256, 300000, SEND_DELIVERY_AT_LEAST_ONCE, 5 },
+	{ 1, 1, 16, 30000, SEND_DELIVERY_BEST_EFFORT, 1 }
+};
+
+void send_lanes_defaults(SEND_LANE_CONFIG configs[SEND_LANE_COUNT])
+{
+	memcpy(configs, Default_configs, sizeof(Default_configs));
+}
+
+const char* send_lanes_name(SEND_LANE lane)
+{
+	return ((unsigned int)lane < SEND_LANE_COUNT) ? Lane_names[lane] : "unknown";
+}
+
+int send_lanes_parse(const char* text, SEND_LANE_CONFIG configs[SEND_LANE_COUNT])
+{
+	char name[16];
+	char delivery[16];
+	SEND_LANE_CONFIG config;
+	int fields;
+	int result = -1;
+
+	config.maxAttempts = 0;
+	if ((fields = sscanf(text, "%15[^,],%u,%u,%u,%u,%15[^,],%u", name, &config.weight, &config.maxInFlight, &config.maxQueued,
+		&config.timeoutMs, delivery, &config.maxAttempts)) >= 6 && config.weight > 0 && config.maxInFlight > 0 && config.maxQueued > 0 &&
+		(fields == 6 || config.maxAttempts > 0) &&
+		(strcmp(delivery, "at-least-once") == 0 || strcmp(delivery, "best-effort") == 0))
+	{
+		config.delivery = (strcmp(delivery, "best-effort") == 0) ? SEND_DELIVERY_BEST_EFFORT : SEND_DELIVERY_AT_LEAST_ONCE;
+		for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+		{
+			if (strcmp(name, Lane_names[lane]) == 0)
+			{
+				if (fields == 6)
+				{
+					config.maxAttempts = configs[lane].maxAttempts;
+				}
+				configs[lane] = config;
+				result = 0;
+			}
+		}
+	}
+
+	return result;
+}
+
+int send_lanes_init(SEND_LANES* lanes, const SEND_LANE_CONFIG configs[SEND_LANE_COUNT])
+{
+	pthread_condattr_t attributes;
+	int result = 0;
+
+	memset(lanes, 0, sizeof(*lanes));
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		lanes->lanes[lane].config = configs[lane];
+	}
+
+	/* send_lanes_wait measures against the monotonic clock, a clock step neither stalls nor spins it */
+	if (pthread_mutex_init(&lanes->lock, NULL) != 0 ||
+		pthread_condattr_init(&attributes) != 0)
+	{
+		result = -1;
+	}
+	else
+	{
+		if (pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC) != 0 ||
+			pthread_cond_init(&lanes->changed, &attributes) != 0)
+		{
+			(void)pthread_mutex_destroy(&lanes->lock);
+			result = -1;
+		}
+		(void)pthread_condattr_destroy(&attributes);
+	}
+
+	return result;
+}
+
+void send_lanes_deinit(SEND_LANES* lanes)
+{
+	(void)pthread_cond_destroy(&lanes->changed);
+	(void)pthread_mutex_destroy(&lanes->lock);
+}
+
+const SEND_LANE_CONFIG* send_lanes_config(const SEND_LANES* lanes, SEND_LANE lane)
+{
+	return &lanes->lanes[lane].config;
+}
+
+static SEND_LANE_ITEM* RemoveHead(SEND_LANE_STATE* state)
+{
+	SEND_LANE_ITEM* item = state->head;
+
+	state->head = item->next;
+	if (state->head == NULL)
+	{
+		state->tail = NULL;
+	}
+	state->queued--;
+	item->next = NULL;
+	return item;
+}
+
+SEND_LANE_ITEM* send_lanes_push(SEND_LANES* lanes, SEND_LANE_ITEM* item, SEND_LANE lane, uint64_t nowUs)
+{
+	SEND_LANE_STATE* state = &lanes->lanes[lane];
+	SEND_LANE_ITEM* dropped = NULL;
+
+	item->next = NULL;
+	item->lane = lane;
+	item->queuedUs = nowUs;
+	item->attempts = 0;
+	item->notBeforeUs = 0;
+
+	(void)pthread_mutex_lock(&lanes->lock);
+	if (state->queued >= state->config.maxQueued)
+	{
+		dropped = RemoveHead(state);
+	}
+	if (state->tail != NULL)
+	{
+		state->tail->next = item;
+	}
+	else
+	{
+		state->head = item;
+	}
+	state->tail = item;
+	state->queued++;
+	lanes->changes++;
+	(void)pthread_cond_broadcast(&lanes->changed);
+	(void)pthread_mutex_unlock(&lanes->lock);
+
+	return dropped;
+}
+
+SEND_LANE_ITEM* send_lanes_pop(SEND_LANES* lanes, uint64_t nowUs, SEND_LANE_ITEM** expired)
+{
+	SEND_LANE_STATE* chosen = NULL;
+	SEND_LANE_ITEM* item = NULL;
+	long totalWeight = 0;
+
+	*expired = NULL;
+	(void)pthread_mutex_lock(&lanes->lock);
+	lanes->changesSeen = lanes->changes;
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		SEND_LANE_STATE* state = &lanes->lanes[lane];
+
+		/* a lane is in time order, what waited too long is at its head */
+		while (state->config.delivery == SEND_DELIVERY_BEST_EFFORT && state->head != NULL &&
+			nowUs - state->head->queuedUs > state->config.timeoutMs * 1000ULL)
+		{
+			SEND_LANE_ITEM* stale = RemoveHead(state);
+			stale->next = *expired;
+			*expired = stale;
+		}
+
+		if (state->head != NULL && state->inFlight < state->config.maxInFlight && state->head->notBeforeUs <= nowUs)
+		{
+			state->current += (long)state->config.weight;
+			totalWeight += (long)state->config.weight;
+			if (chosen == NULL || state->current > chosen->current)
+			{
+				chosen = state;
+			}
+		}
+	}
+
+	if (chosen != NULL)
+	{
+		chosen->current -= totalWeight;
+		chosen->inFlight++;
+		item = RemoveHead(chosen);
+		item->attempts++;
+	}
+	(void)pthread_mutex_unlock(&lanes->lock);
+
+	return item;
+}
+
+/* The newest message of a lane, for a retry that goes back into a full one */
+static SEND_LANE_ITEM* RemoveTail(SEND_LANE_STATE* state)
+{
+	SEND_LANE_ITEM* item = state->tail;
+
+	if (state->head == item)
+	{
+		state->head = NULL;
+		state->tail = NULL;
+	}
+	else
+	{
+		SEND_LANE_ITEM* previous = state->head;
+		while (previous->next != item)
+		{
+			previous = previous->next;
+		}
+		previous->next = NULL;
+		state->tail = previous;
+	}
+	state->queued--;
+	return item;
+}
+
+SEND_LANE_OUTCOME send_lanes_complete(SEND_LANES* lanes, SEND_LANE_ITEM* item, int delivered, uint64_t nowUs, SEND_LANE_ITEM** dropped)
+{
+	SEND_LANE_STATE* state = &lanes->lanes[item->lane];
+	SEND_LANE_OUTCOME result = SEND_LANE_DONE;
+
+	*dropped = NULL;
+	(void)pthread_mutex_lock(&lanes->lock);
+	state->inFlight--;
+	if (!delivered && state->config.delivery == SEND_DELIVERY_AT_LEAST_ONCE && item->attempts >= state->config.maxAttempts)
+	{
+		result = SEND_LANE_ABANDONED;
+	}
+	else if (!delivered && state->config.delivery == SEND_DELIVERY_AT_LEAST_ONCE)
+	{
+		/* 1 s, 2 s, 4 s and so on, capped; a hub that is down is not asked again right away */
+		unsigned int shift = (item->attempts > 0 && item->attempts <= 16) ? item->attempts - 1 : 16;
+		uint64_t backoffMs = (uint64_t)SEND_LANES_RETRY_BACKOFF_MS << shift;
+
+		if (backoffMs > SEND_LANES_RETRY_BACKOFF_MAX_MS)
+		{
+			backoffMs = SEND_LANES_RETRY_BACKOFF_MAX_MS;
+		}
+		if (state->queued >= state->config.maxQueued)
+		{
+			*dropped = RemoveTail(state);
+		}
+		/* back to the head, the lane keeps its order */
+		item->notBeforeUs = nowUs + backoffMs * 1000ULL;
+		item->next = state->head;
+		state->head = item;
+		if (state->tail == NULL)
+		{
+			state->tail = item;
+		}
+		state->queued++;
+		result = SEND_LANE_REQUEUED;
+	}
+	lanes->changes++;
+	(void)pthread_cond_broadcast(&lanes->changed);
+	(void)pthread_mutex_unlock(&lanes->lock);
+
+	return result;
+}
+
+void send_lanes_wait(SEND_LANES* lanes, unsigned int timeoutMs)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	(void)pthread_mutex_lock(&lanes->lock);
+	if (lanes->changes == lanes->changesSeen)
+	{
+		(void)pthread_cond_timedwait(&lanes->changed, &lanes->lock, &deadline);
+	}
+	(void)pthread_mutex_unlock(&lanes->lock);
+}
+
+void send_lanes_wake(SEND_LANES* lanes)
+{
+	(void)pthread_mutex_lock(&lanes->lock);
+	lanes->changes++;
+	(void)pthread_cond_broadcast(&lanes->changed);
+	(void)pthread_mutex_unlock(&lanes->lock);
+}
+
+size_t send_lanes_pending(SEND_LANES* lanes)
+{
+	size_t result = 0;
+
+	(void)pthread_mutex_lock(&lanes->lock);
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		result += lanes->lanes[lane].queued + lanes->lanes[lane].inFlight;
+	}
+	(void)pthread_mutex_unlock(&lanes->lock);
+
+	return result;
+}
+
+SEND_LANE_ITEM* send_lanes_take_queued(SEND_LANES* lanes)
+{
+	SEND_LANE_ITEM* result = NULL;
+	SEND_LANE_ITEM* last = NULL;
+
+	(void)pthread_mutex_lock(&lanes->lock);
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		SEND_LANE_STATE* state = &lanes->lanes[lane];
+
+		if (state->head != NULL)
+		{
+			if (last != NULL)
+			{
+				last->next = state->head;
+			}
+			else
+			{
+				result = state->head;
+			}
+			last = state->tail;
+			state->head = NULL;
+			state->tail = NULL;
+			state->queued = 0;
+		}
+	}
+	(void)pthread_mutex_unlock(&lanes->lock);
+
+	return result;
+}
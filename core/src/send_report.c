@@ -0,0 +1,179 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+/* the glibc copy of tcp_info stops before the byte counters */
+#include <linux/tcp.h>
+
+#include "metrics.h"
+#include "send_report.h"
+
+#define SEND_REPORT_POLL_MS 10
+
+int send_report_init(SEND_REPORT* report)
+{
+	memset(report, 0, sizeof(SEND_REPORT));
+	return (pthread_mutex_init(&report->lock, NULL) == 0) ? 0 : __LINE__;
+}
+
+void send_report_deinit(SEND_REPORT* report)
+{
+	(void)pthread_mutex_destroy(&report->lock);
+}
+
+void* send_report_sent(SEND_REPORT* report)
+{
+	uint64_t* sentAtUs = malloc(sizeof(uint64_t));
+
+	if (sentAtUs != NULL)
+	{
+		*sentAtUs = metrics_now_us();
+		(void)pthread_mutex_lock(&report->lock);
+		if (report->sent++ == 0)
+		{
+			report->firstSentUs = *sentAtUs;
+		}
+		(void)pthread_mutex_unlock(&report->lock);
+	}
+
+	return sentAtUs;
+}
+
+void send_report_unsent(SEND_REPORT* report, void* context)
+{
+	(void)pthread_mutex_lock(&report->lock);
+	report->sent--;
+	(void)pthread_mutex_unlock(&report->lock);
+	free(context);
+}
+
+uint64_t send_report_confirmed(SEND_REPORT* report, void* context, int delivered)
+{
+	uint64_t* sentAtUs = context;
+	uint64_t now = metrics_now_us();
+	uint64_t result = now - *sentAtUs;
+
+	(void)pthread_mutex_lock(&report->lock);
+	if (delivered)
+	{
+		report->confirmed++;
+		report->lastConfirmedUs = now;
+		latency_histogram_record(&report->latency, result);
+	}
+	else
+	{
+		report->failed++;
+	}
+	(void)pthread_mutex_unlock(&report->lock);
+	free(sentAtUs);
+
+	return result;
+}
+
+size_t send_report_wait(SEND_REPORT* report, unsigned int timeoutMs)
+{
+	const struct timespec poll = { 0, SEND_REPORT_POLL_MS * 1000000L };
+	unsigned int waitedMs = 0;
+	size_t outstanding;
+
+	for (;;)
+	{
+		(void)pthread_mutex_lock(&report->lock);
+		outstanding = report->sent - report->confirmed - report->failed;
+		(void)pthread_mutex_unlock(&report->lock);
+		if (outstanding == 0 || waitedMs >= timeoutMs)
+		{
+			break;
+		}
+		(void)nanosleep(&poll, NULL);
+		waitedMs += SEND_REPORT_POLL_MS;
+	}
+
+	return outstanding;
+}
+
+size_t send_report_print(SEND_REPORT* report, const char* transportName)
+{
+	double elapsedSeconds;
+	size_t result;
+
+	(void)pthread_mutex_lock(&report->lock);
+	elapsedSeconds = (report->lastConfirmedUs > report->firstSentUs) ?
+		(report->lastConfirmedUs - report->firstSentUs) / 1000000.0 : 0.0;
+	printf("==== send report ====\r\n");
+	if (transportName != NULL)
+	{
+		printf("transport: %s\r\n", transportName);
+	}
+	printf("messages: %zu sent, %zu confirmed, %zu failed\r\n", report->sent, report->confirmed, report->failed);
+	printf("throughput: %.1f msg/s\r\n", (elapsedSeconds > 0) ? report->confirmed / elapsedSeconds : 0.0);
+	printf("send->confirm latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\r\n",
+		latency_histogram_percentile(&report->latency, 50) / 1000.0,
+		latency_histogram_percentile(&report->latency, 99) / 1000.0,
+		report->latency.max_us / 1000.0);
+	result = report->confirmed;
+	(void)pthread_mutex_unlock(&report->lock);
+
+	return result;
+}
+
+static uint64_t TcpBytesOnOpenSockets(void)
+{
+	uint64_t total = 0;
+	DIR* fds = opendir("/proc/self/fd");
+
+	if (fds != NULL)
+	{
+		struct dirent* entry;
+		while ((entry = readdir(fds)) != NULL)
+		{
+			struct tcp_info info;
+			socklen_t length = sizeof(info);
+
+			/* anything that is not a TCP socket fails getsockopt */
+			if (isdigit((unsigned char)entry->d_name[0]) &&
+				getsockopt(atoi(entry->d_name), IPPROTO_TCP, TCP_INFO, &info, &length) == 0 &&
+				length >= offsetof(struct tcp_info, tcpi_bytes_received) + sizeof(info.tcpi_bytes_received))
+			{
+				total += info.tcpi_bytes_acked + info.tcpi_bytes_received;
+			}
+		}
+		(void)closedir(fds);
+	}
+
+	return total;
+}
+
+void send_report_print_costs(size_t confirmed)
+{
+	uint64_t wireBytes = TcpBytesOnOpenSockets();
+	struct rusage usage;
+	double userSeconds;
+	double systemSeconds;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+	{
+		memset(&usage, 0, sizeof(usage));
+	}
+	userSeconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+	systemSeconds = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+
+	if (confirmed == 0)
+	{
+		confirmed = 1;
+	}
+	printf("wire bytes: %llu, %.1f per confirmed message\r\n",
+		(unsigned long long)wireBytes, (double)wireBytes / confirmed);
+	printf("cpu: %.3f s user, %.3f s system, %.3f ms per confirmed message\r\n",
+		userSeconds, systemSeconds, (userSeconds + systemSeconds) * 1000.0 / confirmed);
+	printf("max rss: %ld KiB\r\n", usage.ru_maxrss);
+}
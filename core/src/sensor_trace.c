@@ -0,0 +1,403 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include "sample_clock.h"
+#include "sensor_trace.h"
+
+#ifdef ENABLE_SENSOR_TRACE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SENSOR_TRACE_MAGIC "BMETRACE"
+#define SENSOR_TRACE_HEADER_SIZE 24
+#define SENSOR_TRACE_CHIPS 2
+/* first measurement register, a read of it starts a new burst */
+#define SENSOR_TRACE_DATA_REGISTER 0xF7
+/* polled until the sensor is idle, never recorded and always idle on replay */
+#define SENSOR_TRACE_STATUS_REGISTER 0xF3
+
+typedef struct SENSOR_TRACE_RECORD_TAG
+{
+	uint8_t chipEnable;
+	uint8_t reg;
+	uint8_t length;
+	uint64_t offsetUs;
+	const uint8_t* data;
+} SENSOR_TRACE_RECORD;
+
+typedef struct SENSOR_TRACE_REPLAY_TAG
+{
+	uint8_t* file;
+	SENSOR_TRACE_RECORD* records;
+	size_t recordCount;
+	uint64_t startUs;
+	SENSOR_REPLAY_PACE pace;
+	uint64_t wallStartUs;
+	/* per chip enable: next record and the register file it has built up */
+	size_t cursor[SENSOR_TRACE_CHIPS];
+	uint8_t registers[SENSOR_TRACE_CHIPS][256];
+	uint64_t lastBurstUs;
+	int finished;
+	int chipPresent[SENSOR_TRACE_CHIPS];
+} SENSOR_TRACE_REPLAY;
+
+static FILE* Capture_fp = NULL;
+static uint64_t Capture_last_us;
+static pthread_mutex_t Capture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static SENSOR_TRACE_REPLAY* Replay = NULL;
+
+static uint64_t WallUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+static void PutLittleEndian(uint8_t* buffer, uint64_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		buffer[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static uint64_t GetLittleEndian(const uint8_t* buffer, int size)
+{
+	uint64_t value = 0;
+
+	for (int i = 0; i < size; i++)
+	{
+		value |= (uint64_t)buffer[i] << (8 * i);
+	}
+
+	return value;
+}
+
+int sensor_trace_capture_start(const char* path)
+{
+	int result;
+	uint8_t header[SENSOR_TRACE_HEADER_SIZE];
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, SENSOR_TRACE_MAGIC, 8);
+	PutLittleEndian(header + 8, SENSOR_TRACE_VERSION, 2);
+	Capture_last_us = WallUs();
+	PutLittleEndian(header + 16, Capture_last_us, 8);
+
+	if ((Capture_fp = fopen(path, "wb")) == NULL)
+	{
+		printf("Failed to create sensor capture %s: %s\r\n", path, strerror(errno));
+		result = __LINE__;
+	}
+	else if (fwrite(header, 1, sizeof(header), Capture_fp) != sizeof(header))
+	{
+		printf("Failed to write sensor capture header\r\n");
+		fclose(Capture_fp);
+		Capture_fp = NULL;
+		result = __LINE__;
+	}
+	else
+	{
+		printf("Capturing sensor reads to %s\r\n", path);
+		result = 0;
+	}
+
+	return result;
+}
+
+void sensor_trace_capture_stop(void)
+{
+	pthread_mutex_lock(&Capture_lock);
+	if (Capture_fp != NULL)
+	{
+		fclose(Capture_fp);
+		Capture_fp = NULL;
+	}
+	pthread_mutex_unlock(&Capture_lock);
+}
+
+void sensor_trace_capture_read(int chipEnable, uint8_t reg, const uint8_t* data, int length)
+{
+	if (Capture_fp != NULL && reg != SENSOR_TRACE_STATUS_REGISTER && length > 0 && length <= 255 &&
+		chipEnable >= 0 && chipEnable < SENSOR_TRACE_CHIPS)
+	{
+		uint8_t record[3 + 10];
+		size_t recordLength = 3;
+		uint64_t now = WallUs();
+
+		pthread_mutex_lock(&Capture_lock);
+		if (Capture_fp != NULL)
+		{
+			uint64_t deltaUs = (now > Capture_last_us) ? now - Capture_last_us : 0;
+			Capture_last_us = now;
+
+			record[0] = (uint8_t)chipEnable;
+			record[1] = reg;
+			record[2] = (uint8_t)length;
+			do
+			{
+				record[recordLength++] = (uint8_t)((deltaUs & 0x7F) | ((deltaUs > 0x7F) ? 0x80 : 0));
+				deltaUs >>= 7;
+			} while (deltaUs != 0);
+
+			if (fwrite(record, 1, recordLength, Capture_fp) != recordLength ||
+				fwrite(data, 1, (size_t)length, Capture_fp) != (size_t)length)
+			{
+				printf("Sensor capture write failed, stopping the capture\r\n");
+				fclose(Capture_fp);
+				Capture_fp = NULL;
+			}
+			else if (reg == SENSOR_TRACE_DATA_REGISTER)
+			{
+				/* a burst ends every cycle, keep the file usable after a power cut */
+				(void)fflush(Capture_fp);
+			}
+		}
+		pthread_mutex_unlock(&Capture_lock);
+	}
+}
+
+static int ParseRecords(SENSOR_TRACE_REPLAY* replay, size_t size)
+{
+	int result = 0;
+	size_t position = SENSOR_TRACE_HEADER_SIZE;
+	size_t capacity = 0;
+	uint64_t offsetUs = 0;
+
+	while (result == 0 && position < size)
+	{
+		SENSOR_TRACE_RECORD record;
+		uint64_t deltaUs = 0;
+		int shift = 0;
+
+		if (position + 3 > size)
+		{
+			/* a torn final record from a capture that was cut off */
+			break;
+		}
+		record.chipEnable = replay->file[position];
+		record.reg = replay->file[position + 1];
+		record.length = replay->file[position + 2];
+		position += 3;
+
+		while (position < size && shift < 64)
+		{
+			uint8_t byte = replay->file[position++];
+			deltaUs |= (uint64_t)(byte & 0x7F) << shift;
+			shift += 7;
+			if ((byte & 0x80) == 0)
+			{
+				break;
+			}
+		}
+		if (position + record.length > size)
+		{
+			break;
+		}
+		offsetUs += deltaUs;
+		record.offsetUs = offsetUs;
+		record.data = replay->file + position;
+		position += record.length;
+
+		if (record.chipEnable >= SENSOR_TRACE_CHIPS)
+		{
+			printf("Sensor trace record for chip enable %u, ignoring the rest\r\n", record.chipEnable);
+			break;
+		}
+
+		if (replay->recordCount == capacity)
+		{
+			size_t newCapacity = (capacity == 0) ? 1024 : capacity * 2;
+			SENSOR_TRACE_RECORD* records = realloc(replay->records, newCapacity * sizeof(SENSOR_TRACE_RECORD));
+			if (records == NULL)
+			{
+				result = __LINE__;
+				break;
+			}
+			replay->records = records;
+			capacity = newCapacity;
+		}
+		replay->records[replay->recordCount++] = record;
+		replay->chipPresent[record.chipEnable] = 1;
+	}
+
+	return result;
+}
+
+/* Applies chipEnable's records from its cursor up to the next burst, returns 0 when there is none */
+static int AdvanceToBurst(SENSOR_TRACE_REPLAY* replay, int chipEnable, int stopAtBurst)
+{
+	int result = 0;
+	size_t i;
+
+	for (i = replay->cursor[chipEnable]; i < replay->recordCount; i++)
+	{
+		const SENSOR_TRACE_RECORD* record = &replay->records[i];
+		if (record->chipEnable == chipEnable)
+		{
+			if (record->reg == SENSOR_TRACE_DATA_REGISTER && stopAtBurst)
+			{
+				break;
+			}
+			memcpy(&replay->registers[chipEnable][record->reg], record->data,
+				(record->reg + record->length > 256) ? (size_t)(256 - record->reg) : record->length);
+			if (record->reg == SENSOR_TRACE_DATA_REGISTER)
+			{
+				replay->lastBurstUs = replay->startUs + record->offsetUs;
+				result = 1;
+				i++;
+				break;
+			}
+		}
+	}
+	replay->cursor[chipEnable] = i;
+
+	return result;
+}
+
+int sensor_trace_replay_open(const char* path, SENSOR_REPLAY_PACE pace)
+{
+	int result;
+	FILE* fp;
+	long size = 0;
+	SENSOR_TRACE_REPLAY* replay = calloc(1, sizeof(SENSOR_TRACE_REPLAY));
+
+	if (replay == NULL)
+	{
+		result = __LINE__;
+	}
+	else if ((fp = fopen(path, "rb")) == NULL)
+	{
+		printf("Failed to open sensor trace %s: %s\r\n", path, strerror(errno));
+		free(replay);
+		result = __LINE__;
+	}
+	else
+	{
+		if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < SENSOR_TRACE_HEADER_SIZE || fseek(fp, 0, SEEK_SET) != 0 ||
+			(replay->file = malloc((size_t)size)) == NULL ||
+			fread(replay->file, 1, (size_t)size, fp) != (size_t)size)
+		{
+			printf("Failed to read sensor trace %s\r\n", path);
+			result = __LINE__;
+		}
+		else if (memcmp(replay->file, SENSOR_TRACE_MAGIC, 8) != 0 ||
+			GetLittleEndian(replay->file + 8, 2) != SENSOR_TRACE_VERSION)
+		{
+			printf("%s is not a version %d sensor trace\r\n", path, SENSOR_TRACE_VERSION);
+			result = __LINE__;
+		}
+		else
+		{
+			replay->startUs = GetLittleEndian(replay->file + 16, 8);
+			replay->pace = pace;
+			result = ParseRecords(replay, (size_t)size);
+		}
+		fclose(fp);
+
+		if (result != 0)
+		{
+			free(replay->records);
+			free(replay->file);
+			free(replay);
+		}
+		else
+		{
+			/* calibration and chip id reads come before the first burst */
+			for (int chip = 0; chip < SENSOR_TRACE_CHIPS; chip++)
+			{
+				(void)AdvanceToBurst(replay, chip, 1);
+			}
+			Replay = replay;
+			/* the samples carry the capture time, not the time of the replay */
+			sample_clock_set_source(sensor_trace_replay_timestamp_us);
+			printf("Replaying %zu sensor reads from %s\r\n", replay->recordCount, path);
+		}
+	}
+
+	return result;
+}
+
+void sensor_trace_replay_close(void)
+{
+	if (Replay != NULL)
+	{
+		sample_clock_set_source(NULL);
+		free(Replay->records);
+		free(Replay->file);
+		free(Replay);
+		Replay = NULL;
+	}
+}
+
+int sensor_trace_replaying(void)
+{
+	return Replay != NULL;
+}
+
+int sensor_trace_replay_read(int chipEnable, uint8_t reg, uint8_t* data, int length)
+{
+	int result;
+
+	if (Replay == NULL || chipEnable < 0 || chipEnable >= SENSOR_TRACE_CHIPS || length <= 0 || reg + length > 256)
+	{
+		result = 0;
+	}
+	else if (reg == SENSOR_TRACE_DATA_REGISTER && !AdvanceToBurst(Replay, chipEnable, 0))
+	{
+		Replay->finished = 1;
+		result = 0;
+	}
+	else
+	{
+		if (reg == SENSOR_TRACE_DATA_REGISTER && Replay->pace == SENSOR_REPLAY_REALTIME)
+		{
+			uint64_t now = WallUs();
+			uint64_t due;
+
+			if (Replay->wallStartUs == 0)
+			{
+				Replay->wallStartUs = now - (Replay->lastBurstUs - Replay->startUs);
+			}
+			due = Replay->wallStartUs + (Replay->lastBurstUs - Replay->startUs);
+			if (due > now)
+			{
+				struct timespec wait = { (time_t)((due - now) / 1000000ULL), (long)((due - now) % 1000000ULL) * 1000L };
+				(void)nanosleep(&wait, NULL);
+			}
+		}
+
+		memcpy(data, &Replay->registers[chipEnable][reg], (size_t)length);
+		if (reg == SENSOR_TRACE_STATUS_REGISTER)
+		{
+			data[0] = 0;
+		}
+		result = length;
+	}
+
+	return result;
+}
+
+int sensor_trace_replay_has_chip(int chipEnable)
+{
+	return Replay != NULL && chipEnable >= 0 && chipEnable < SENSOR_TRACE_CHIPS && Replay->chipPresent[chipEnable];
+}
+
+int sensor_trace_replay_finished(void)
+{
+	return Replay != NULL && Replay->finished;
+}
+
+uint64_t sensor_trace_replay_timestamp_us(void)
+{
+	return (Replay != NULL) ? Replay->lastBurstUs : 0;
+}
+
+#endif /* ENABLE_SENSOR_TRACE */
@@ -0,0 +1,35 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "text_file.h"
+
+char* text_file_read(const char* path)
+{
+	char* result = NULL;
+	FILE* fp;
+
+	if (NULL == (fp = fopen(path, "r")))
+	{
+		printf("Failed to open %s\r\n", path);
+	}
+	else
+	{
+		long size;
+		if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+			(result = malloc((size_t)size + 1)) == NULL)
+		{
+			printf("Failed to read %s\r\n", path);
+		}
+		else
+		{
+			size_t length = fread(result, 1, (size_t)size, fp);
+			result[length] = '\0';
+		}
+		fclose(fp);
+	}
+
+	return result;
+}
@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include "trace.h"
+
+#ifdef ENABLE_TRACING
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* spans kept per thread, must be a power of two */
+#define TRACE_EVENTS_PER_THREAD 4096
+#define TRACE_PATH_MAX 256
+
+typedef struct TRACE_EVENT_TAG
+{
+	const char* name;
+	uint64_t start_ns;
+	uint64_t duration_ns;
+} TRACE_EVENT;
+
+typedef struct TRACE_BUFFER_TAG
+{
+	struct TRACE_BUFFER_TAG* next;
+	long tid;
+	/* total spans recorded, only the owning thread writes */
+	uint64_t head;
+	TRACE_EVENT events[TRACE_EVENTS_PER_THREAD];
+} TRACE_BUFFER;
+
+static __thread TRACE_BUFFER* Thread_buffer;
+static TRACE_BUFFER* Buffers;
+
+static char Path_prefix[TRACE_PATH_MAX] = TRACE_DEFAULT_PATH_PREFIX;
+static unsigned int Dump_count;
+static int Signal_pipe[2] = { -1, -1 };
+static pthread_t Dump_thread;
+static pthread_mutex_t Dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction Previous_action;
+
+uint64_t trace_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static TRACE_BUFFER* RegisterThread(void)
+{
+	TRACE_BUFFER* buffer = calloc(1, sizeof(TRACE_BUFFER));
+
+	if (buffer != NULL)
+	{
+		buffer->tid = (long)syscall(SYS_gettid);
+		/* buffers are never freed, a dump can walk the list at any time */
+		buffer->next = __atomic_load_n(&Buffers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&Buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		{
+		}
+		Thread_buffer = buffer;
+	}
+
+	return buffer;
+}
+
+void trace_record(const TRACE_SPAN* span)
+{
+	uint64_t end_ns = trace_now_ns();
+	TRACE_BUFFER* buffer = (Thread_buffer != NULL) ? Thread_buffer : RegisterThread();
+
+	if (buffer != NULL)
+	{
+		uint64_t head = buffer->head;
+		TRACE_EVENT* event = &buffer->events[head & (TRACE_EVENTS_PER_THREAD - 1)];
+
+		event->name = span->name;
+		event->start_ns = span->start_ns;
+		event->duration_ns = end_ns - span->start_ns;
+		__atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+	}
+}
+
+/* Copies a thread's spans and drops the ones the thread may have overwritten meanwhile */
+static size_t SnapshotBuffer(const TRACE_BUFFER* buffer, TRACE_EVENT* events, uint64_t* first)
+{
+	uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	uint64_t start = (head > TRACE_EVENTS_PER_THREAD) ? head - TRACE_EVENTS_PER_THREAD : 0;
+	uint64_t headAfter;
+	size_t count = 0;
+
+	for (uint64_t i = start; i < head; i++)
+	{
+		events[count++] = buffer->events[i & (TRACE_EVENTS_PER_THREAD - 1)];
+	}
+
+	headAfter = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	*first = (headAfter > TRACE_EVENTS_PER_THREAD && headAfter - TRACE_EVENTS_PER_THREAD > start) ?
+		headAfter - TRACE_EVENTS_PER_THREAD - start : 0;
+
+	return count;
+}
+
+void trace_dump(void)
+{
+	static TRACE_EVENT events[TRACE_EVENTS_PER_THREAD];
+	char path[TRACE_PATH_MAX + 32];
+	FILE* fp;
+	long pid = (long)getpid();
+
+	pthread_mutex_lock(&Dump_lock);
+	snprintf(path, sizeof(path), "%s-%ld-%u.json", Path_prefix, pid, Dump_count++);
+	if ((fp = fopen(path, "w")) == NULL)
+	{
+		printf("Failed to open trace dump %s: %s\r\n", path, strerror(errno));
+	}
+	else
+	{
+		const char* separator = "";
+
+		fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		for (TRACE_BUFFER* buffer = __atomic_load_n(&Buffers, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next)
+		{
+			uint64_t first;
+			size_t count = SnapshotBuffer(buffer, events, &first);
+
+			for (size_t i = (size_t)first; i < count; i++)
+			{
+				fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+					separator, events[i].name, pid, buffer->tid,
+					events[i].start_ns / 1000.0, events[i].duration_ns / 1000.0);
+				separator = ",";
+			}
+		}
+		fprintf(fp, "\n]}\n");
+		fclose(fp);
+		printf("Wrote trace %s\r\n", path);
+	}
+	pthread_mutex_unlock(&Dump_lock);
+}
+
+static void OnDumpSignal(int signalNumber)
+{
+	int savedErrno = errno;
+	char byte = 0;
+
+	(void)signalNumber;
+	/* only async-signal-safe work here, the dump thread does the rest */
+	(void)write(Signal_pipe[1], &byte, 1);
+	errno = savedErrno;
+}
+
+static void* DumpThread(void* arg)
+{
+	char byte;
+	ssize_t received;
+
+	(void)arg;
+	while ((received = read(Signal_pipe[0], &byte, 1)) != 0)
+	{
+		if (received < 0 && errno != EINTR)
+		{
+			break;
+		}
+		if (received == 1)
+		{
+			if (byte != 0)
+			{
+				/* written by trace_deinit */
+				break;
+			}
+			trace_dump();
+		}
+	}
+
+	return NULL;
+}
+
+int trace_init(const char* pathPrefix)
+{
+	int result;
+	struct sigaction action;
+
+	if (pathPrefix != NULL)
+	{
+		snprintf(Path_prefix, sizeof(Path_prefix), "%s", pathPrefix);
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = OnDumpSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	if (Signal_pipe[0] >= 0)
+	{
+		result = 0;
+	}
+	else if (pipe(Signal_pipe) != 0)
+	{
+		perror("Failed to create the trace signal pipe");
+		result = __LINE__;
+	}
+	else if (fcntl(Signal_pipe[1], F_SETFL, fcntl(Signal_pipe[1], F_GETFL, 0) | O_NONBLOCK) != 0 ||
+		pthread_create(&Dump_thread, NULL, DumpThread, NULL) != 0)
+	{
+		printf("Failed to start the trace dump thread\r\n");
+		close(Signal_pipe[0]);
+		close(Signal_pipe[1]);
+		Signal_pipe[0] = Signal_pipe[1] = -1;
+		result = __LINE__;
+	}
+	else if (sigaction(SIGUSR1, &action, &Previous_action) != 0)
+	{
+		perror("Failed to install the SIGUSR1 handler");
+		result = __LINE__;
+	}
+	else
+	{
+		printf("Tracing enabled, kill -USR1 %ld writes %s-%ld-<n>.json\r\n", (long)getpid(), Path_prefix, (long)getpid());
+		result = 0;
+	}
+
+	return result;
+}
+
+void trace_deinit(void)
+{
+	if (Signal_pipe[0] >= 0)
+	{
+		char stop = 1;
+
+		(void)sigaction(SIGUSR1, &Previous_action, NULL);
+		(void)write(Signal_pipe[1], &stop, 1);
+		pthread_join(Dump_thread, NULL);
+		close(Signal_pipe[0]);
+		close(Signal_pipe[1]);
+		Signal_pipe[0] = Signal_pipe[1] = -1;
+	}
+}
+
+#endif /* ENABLE_TRACING */
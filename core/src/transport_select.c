@@ -0,0 +1,63 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <string.h>
+
+#include "iothubtransportmqtt.h"
+#include "iothubtransportmqtt_websockets.h"
+#ifdef USE_AMQP
+#include "iothubtransportamqp.h"
+#include "iothubtransportamqp_websockets.h"
+#endif
+#ifdef USE_HTTP
+#include "iothubtransporthttp.h"
+#endif
+#include "transport_select.h"
+
+static const TRANSPORT Transports[] =
+{
+	{ "mqtt", MQTT_Protocol, true, false },
+	{ "mqtt-ws", MQTT_WebSocket_Protocol, true, false },
+#ifdef USE_AMQP
+	{ "amqp", AMQP_Protocol, true, false },
+	{ "amqp-ws", AMQP_Protocol_over_WebSocketsTls, true, false },
+#endif
+#ifdef USE_HTTP
+	{ "http", HTTP_Protocol, false, false },
+	{ "http-batch", HTTP_Protocol, false, true },
+#endif
+};
+
+const TRANSPORT* transport_find(const char* name)
+{
+	const TRANSPORT* result = NULL;
+
+	for (size_t i = 0; i < sizeof(Transports) / sizeof(Transports[0]) && result == NULL; i++)
+	{
+		if (strcmp(name, Transports[i].name) == 0)
+		{
+			result = &Transports[i];
+		}
+	}
+	return result;
+}
+
+const TRANSPORT* transport_default(void)
+{
+	return &Transports[0];
+}
+
+int transport_configure(IOTHUB_CLIENT_HANDLE clientHandle, const TRANSPORT* transport)
+{
+	int result = 0;
+
+	if (transport->batching)
+	{
+		bool batching = true;
+		if (IoTHubClient_SetOption(clientHandle, "Batching", &batching) != IOTHUB_CLIENT_OK)
+		{
+			result = __LINE__;
+		}
+	}
+	return result;
+}
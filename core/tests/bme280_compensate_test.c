@@ -0,0 +1,114 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bme280.h"
+#include "check.h"
+
+/*
+ * Checks the compensation against the datasheet's example. With --print it
+ * also prints every calibration ("calibration" and its 18 words) and the
+ * frames compensated with it ("frame adc_T adc_P adc_H T P H", T in 0.01 C,
+ * P in Q24.8 Pa, H in Q22.10 %RH), for bme280_compensate_test.py to check
+ * core/tools/bme280_compensate.py against.
+ */
+
+static const bme280_calib_data_t Calibrations[] =
+{
+	/* the datasheet's example, which fake_spi.c reports as well */
+	{ 27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000, 75, 362, 0, 324, 50, 30 },
+	/* other words, with signs the example does not have, so that every term of the formulas counts */
+	{ 28960, 26854, 50, 38173, -10651, 3024, 8366, -205, -7, 9900, -10230, 4285, 75, 345, 12, 366, -16, 30 }
+};
+
+/* the datasheet's frame and frames near it, as consecutive reads of a module at rest vary */
+static const int32_t Frames[][3] =
+{
+	{ 519888, 415148, 0x6A00 },
+	{ 519904, 415132, 0x6A07 },
+	{ 519872, 415161, 0x69F8 },
+	{ 520112, 415040, 0x6B20 },
+	{ 519520, 415390, 0x6880 }
+};
+
+static void PrintCalibration(const bme280_calib_data_t* c)
+{
+	printf("calibration %u %d %d %u %d %d %d %d %d %d %d %d %u %d %u %d %d %d\n",
+		(unsigned int)c->dig_T1, (int)c->dig_T2, (int)c->dig_T3,
+		(unsigned int)c->dig_P1, (int)c->dig_P2, (int)c->dig_P3, (int)c->dig_P4, (int)c->dig_P5, (int)c->dig_P6, (int)c->dig_P7, (int)c->dig_P8, (int)c->dig_P9,
+		(unsigned int)c->dig_H1, (int)c->dig_H2, (unsigned int)c->dig_H3, (int)c->dig_H4, (int)c->dig_H5, (int)c->dig_H6);
+}
+
+static void Compensate(const bme280_calib_data_t* calibration, int32_t adcT, int32_t adcP, int32_t adcH, int print)
+{
+	int32_t tFine;
+	int32_t temperature = bme280_compensate_T_int32(calibration, adcT, &tFine);
+	uint32_t pressure = bme280_compensate_P_int64(calibration, adcP, tFine);
+	uint32_t humidity = bme280_compensate_H_int32(calibration, adcH, tFine);
+
+	/* the humidity is clamped to 0-100 %RH */
+	CHECK(humidity <= 100 * 1024);
+	if (print)
+	{
+		printf("frame %d %d %d %d %u %u\n", adcT, adcP, adcH, temperature, pressure, humidity);
+	}
+}
+
+static void TestDatasheet(void)
+{
+	int32_t tFine;
+
+	/* 25.08 C and the datasheet's 100653.27 Pa to within the integer code's rounding */
+	CHECK(bme280_compensate_T_int32(&Calibrations[0], 519888, &tFine) == 2508);
+	CHECK(tFine == 128422);
+	CHECK(bme280_compensate_P_int64(&Calibrations[0], 415148, tFine) / 256.0 > 100653.2);
+	CHECK(bme280_compensate_P_int64(&Calibrations[0], 415148, tFine) / 256.0 < 100653.3);
+	/* a calibration without dig_P1 gives no pressure instead of dividing by 0 */
+	{
+		bme280_calib_data_t calibration = Calibrations[0];
+
+		calibration.dig_P1 = 0;
+		CHECK(bme280_compensate_P_int64(&calibration, 415148, tFine) == 0);
+	}
+}
+
+/* the frames, then a sweep over the ADC ranges a module reports, humidity clamps included */
+static void TestFrames(int print)
+{
+	static const int32_t Humidities[] = { 0, 0x3000, 0x6A00, 0x9000, 0xFFFF };
+
+	for (size_t c = 0; c < sizeof(Calibrations) / sizeof(Calibrations[0]); c++)
+	{
+		if (print)
+		{
+			PrintCalibration(&Calibrations[c]);
+		}
+		for (size_t f = 0; f < sizeof(Frames) / sizeof(Frames[0]); f++)
+		{
+			Compensate(&Calibrations[c], Frames[f][0], Frames[f][1], Frames[f][2], print);
+		}
+		for (int32_t adcT = 0x50000; adcT <= 0xA0000; adcT += 0x3000)
+		{
+			for (int32_t adcP = 0x20000; adcP <= 0x80000; adcP += 0x10000)
+			{
+				for (size_t h = 0; h < sizeof(Humidities) / sizeof(Humidities[0]); h++)
+				{
+					Compensate(&Calibrations[c], adcT, adcP, Humidities[h], print);
+				}
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int print = (argc > 1 && strcmp(argv[1], "--print") == 0);
+
+	TestDatasheet();
+	TestFrames(print);
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Checks core/tools/bme280_compensate.py against core/src/bme280_compensate.c.
+
+bme280_compensate_test --print prints the calibrations and frames it
+compensates with the C code; this compensates them again with the port and
+compares the integers bit for bit. Run by ctest with the path of
+bme280_compensate_test.
+"""
+
+import os
+import subprocess
+import sys
+
+# no __pycache__ in the source tree
+sys.dont_write_bytecode = True
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import bme280_compensate  # noqa: E402
+
+CALIBRATION_WORDS = ("dig_T1", "dig_T2", "dig_T3",
+                     "dig_P1", "dig_P2", "dig_P3", "dig_P4", "dig_P5", "dig_P6", "dig_P7", "dig_P8", "dig_P9",
+                     "dig_H1", "dig_H2", "dig_H3", "dig_H4", "dig_H5", "dig_H6")
+
+
+def main():
+    output = subprocess.check_output([sys.argv[1], "--print"], universal_newlines=True)
+    failures = frames = 0
+    calib = None
+    for line in output.splitlines():
+        fields = line.split()
+        if fields[0] == "calibration":
+            calib = dict(zip(CALIBRATION_WORDS, (int(field) for field in fields[1:])))
+        elif fields[0] == "frame":
+            adc_t, adc_p, adc_h, temperature, pressure, humidity = (int(field) for field in fields[1:])
+            got_temperature, t_fine = bme280_compensate.compensate_t(calib, adc_t)
+            got = (got_temperature, bme280_compensate.compensate_p(calib, adc_p, t_fine), bme280_compensate.compensate_h(calib, adc_h, t_fine))
+            frames += 1
+            if got != (temperature, pressure, humidity):
+                print("frame %d %d %d: Python %s, C %s" % (adc_t, adc_p, adc_h, got, (temperature, pressure, humidity)))
+                failures += 1
+    if frames == 0:
+        print("bme280_compensate_test printed no frames")
+        return 1
+    return 0 if failures == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,19 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/*
+ * The core tests are plain executables run by ctest. CHECK prints a condition
+ * that does not hold and counts it, main returns CHECK_RESULT().
+ */
+static int Check_failures;
+
+#define CHECK(condition) \
+	((condition) ? (void)0 : (void)(Check_failures++, printf("%s:%d: CHECK(%s) failed\r\n", __FILE__, __LINE__, #condition)))
+#define CHECK_RESULT() ((Check_failures == 0) ? 0 : 1)
+
+#endif /* CHECK_H */
@@ -0,0 +1,315 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "config_store.h"
+
+/* the layout of config_store.h, written by hand so the parser meets images the store never saves */
+#define HEADER_SIZE 24
+#define KEY_DEVICE_ID 1
+#define KEY_METRICS_PORT 9
+#define KEY_UNKNOWN 999
+
+static char Directory[] = "/tmp/config_store_test.XXXXXX";
+static char Path[sizeof(Directory) + 16];
+
+static uint32_t Crc32(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFFu;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+	}
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+static void PutLittleEndian(uint8_t* buffer, uint32_t value, int size)
+{
+	for (int i = 0; i < size; i++)
+	{
+		buffer[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static size_t PutRecord(uint8_t* buffer, uint16_t key, const void* data, uint16_t length)
+{
+	PutLittleEndian(buffer, key, 2);
+	PutLittleEndian(buffer + 2, length, 2);
+	memcpy(buffer + 4, data, length);
+	return 4u + length;
+}
+
+/* Completes the header in front of payloadLength bytes of records */
+static void PutHeader(uint8_t* image, size_t payloadLength)
+{
+	memcpy(image, "RMSTORE", 8);
+	PutLittleEndian(image + 8, CONFIG_STORE_VERSION, 2);
+	PutLittleEndian(image + 10, HEADER_SIZE, 2);
+	PutLittleEndian(image + 12, (uint32_t)payloadLength, 4);
+	PutLittleEndian(image + 16, Crc32(image + HEADER_SIZE, payloadLength), 4);
+	PutLittleEndian(image + 20, 7, 4);
+}
+
+static void WriteFile(const char* path, const uint8_t* data, size_t length)
+{
+	FILE* fp = fopen(path, "wb");
+
+	CHECK(fp != NULL);
+	if (fp != NULL)
+	{
+		CHECK(fwrite(data, 1, length, fp) == length);
+		fclose(fp);
+	}
+}
+
+static size_t ReadFile(const char* path, uint8_t* data, size_t size)
+{
+	FILE* fp = fopen(path, "rb");
+	size_t result = 0;
+
+	if (fp != NULL)
+	{
+		result = fread(data, 1, size, fp);
+		fclose(fp);
+	}
+
+	return result;
+}
+
+static void FillConfig(CONFIG_STORE* config)
+{
+	config_store_defaults(config);
+	strcpy(config->deviceId, "test-device");
+	strcpy(config->connectionString, "HostName=hub.example.net;DeviceId=test-device;SharedAccessKey=a2V5");
+	config->updateBegin = 1760779812;
+	config->rebootBegin = -1;
+	config->temperatureOffsetC = -1.25f;
+	config->pressureOffsetPa = 12.5f;
+	config->humidityOffsetPct = 3.0f;
+	config->telemetryIntervalS = 5;
+	config->telemetryIntervalMs = 2500;
+	config->telemetryIntervalMinMs = 1000;
+	config->telemetryIntervalMaxMs = 60000;
+	config->aggregationWindowS = 60;
+	config->aggregationHopS = 15;
+	config->anomalyZThreshold = 4.5f;
+	config->anomalyRatePerMinute = -1.0f;
+	config->anomalySampleMs = 500;
+	config->sasTokenLifetimeS = 3600;
+	config->retryTimeoutS = 0;
+	strcpy(config->transport, "mqtt-ws");
+	config->compressThresholdBytes = 256;
+	config->sampleBlockSamples = 600;
+	config->sampleBlockRaw = 1;
+	config->metricsPort = 9100;
+}
+
+static void CheckSameSettings(const CONFIG_STORE* expected, const CONFIG_STORE* actual)
+{
+	CHECK(strcmp(expected->deviceId, actual->deviceId) == 0);
+	CHECK(strcmp(expected->connectionString, actual->connectionString) == 0);
+	CHECK(expected->updateBegin == actual->updateBegin);
+	CHECK(expected->rebootBegin == actual->rebootBegin);
+	CHECK(expected->temperatureOffsetC == actual->temperatureOffsetC);
+	CHECK(expected->pressureOffsetPa == actual->pressureOffsetPa);
+	CHECK(expected->humidityOffsetPct == actual->humidityOffsetPct);
+	CHECK(expected->telemetryIntervalS == actual->telemetryIntervalS);
+	CHECK(expected->telemetryIntervalMs == actual->telemetryIntervalMs);
+	CHECK(expected->telemetryIntervalMinMs == actual->telemetryIntervalMinMs);
+	CHECK(expected->telemetryIntervalMaxMs == actual->telemetryIntervalMaxMs);
+	CHECK(expected->aggregationWindowS == actual->aggregationWindowS);
+	CHECK(expected->aggregationHopS == actual->aggregationHopS);
+	CHECK(expected->anomalyZThreshold == actual->anomalyZThreshold);
+	CHECK(expected->anomalyRatePerMinute == actual->anomalyRatePerMinute);
+	CHECK(expected->anomalySampleMs == actual->anomalySampleMs);
+	CHECK(expected->sasTokenLifetimeS == actual->sasTokenLifetimeS);
+	CHECK(expected->retryTimeoutS == actual->retryTimeoutS);
+	CHECK(strcmp(expected->transport, actual->transport) == 0);
+	CHECK(expected->compressThresholdBytes == actual->compressThresholdBytes);
+	CHECK(expected->sampleBlockSamples == actual->sampleBlockSamples);
+	CHECK(expected->sampleBlockRaw == actual->sampleBlockRaw);
+	CHECK(expected->metricsPort == actual->metricsPort);
+}
+
+static void TestRoundTrip(void)
+{
+	CONFIG_STORE saved;
+	CONFIG_STORE loaded;
+
+	FillConfig(&saved);
+	CHECK(config_store_save(Path, &saved) == CONFIG_STORE_OK);
+	CHECK(saved.generation == 1);
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(loaded.generation == 1);
+	CheckSameSettings(&saved, &loaded);
+
+	/* every save bumps the generation */
+	CHECK(config_store_save(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(loaded.generation == 2);
+}
+
+static void TestMissing(void)
+{
+	char missing[sizeof(Path) + 8];
+	CONFIG_STORE loaded;
+
+	snprintf(missing, sizeof(missing), "%s.none", Path);
+	CHECK(config_store_load(missing, &loaded) == CONFIG_STORE_MISSING);
+}
+
+/* Saves a good store, damages one byte of the file or cuts it short, and expects it rejected */
+static void CheckDamaged(size_t offset, int truncate)
+{
+	uint8_t image[HEADER_SIZE + 4096];
+	CONFIG_STORE config;
+	size_t length;
+
+	FillConfig(&config);
+	CHECK(config_store_save(Path, &config) == CONFIG_STORE_OK);
+	length = ReadFile(Path, image, sizeof(image));
+	CHECK(length > offset);
+	if (truncate)
+	{
+		length = offset;
+	}
+	else
+	{
+		image[offset] ^= 0x01;
+	}
+	WriteFile(Path, image, length);
+	CHECK(config_store_load(Path, &config) == CONFIG_STORE_CORRUPT);
+}
+
+static void TestCorrupt(void)
+{
+	/* magic, version, payload length, the CRC itself and a payload byte */
+	CheckDamaged(0, 0);
+	CheckDamaged(8, 0);
+	CheckDamaged(12, 0);
+	CheckDamaged(16, 0);
+	CheckDamaged(HEADER_SIZE + 5, 0);
+	/* cut inside the header and inside the payload */
+	CheckDamaged(HEADER_SIZE - 1, 1);
+	CheckDamaged(HEADER_SIZE + 10, 1);
+}
+
+/* A power cut during a save leaves a partial temporary file; the store is still the previous one */
+static void TestTruncatedTemporary(void)
+{
+	char temporaryPath[sizeof(Path) + 8];
+	uint8_t image[HEADER_SIZE + 4096];
+	CONFIG_STORE saved;
+	CONFIG_STORE loaded;
+	size_t length;
+
+	FillConfig(&saved);
+	CHECK(config_store_save(Path, &saved) == CONFIG_STORE_OK);
+	length = ReadFile(Path, image, sizeof(image));
+
+	snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", Path);
+	WriteFile(temporaryPath, image, length / 2);
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_OK);
+	CheckSameSettings(&saved, &loaded);
+
+	/* the next save writes over it and renames it into place */
+	loaded.metricsPort = 9200;
+	CHECK(config_store_save(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(access(temporaryPath, F_OK) != 0);
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(loaded.metricsPort == 9200);
+}
+
+static void TestUnknownKeys(void)
+{
+	uint8_t image[256];
+	uint8_t wrongWidth[4] = { 1, 2, 3, 4 };
+	CONFIG_STORE loaded;
+	size_t length = HEADER_SIZE;
+
+	/* a key of a newer build, a known key of the wrong width, then one that applies */
+	length += PutRecord(image + length, KEY_UNKNOWN, "new", 3);
+	length += PutRecord(image + length, KEY_METRICS_PORT, wrongWidth, sizeof(wrongWidth));
+	length += PutRecord(image + length, KEY_DEVICE_ID, "future-device", 13);
+	PutHeader(image, length - HEADER_SIZE);
+	WriteFile(Path, image, length);
+
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_OK);
+	CHECK(loaded.generation == 7);
+	CHECK(strcmp(loaded.deviceId, "future-device") == 0);
+	CHECK(loaded.metricsPort == 0);
+
+	/* a record that claims more than the payload holds */
+	length = HEADER_SIZE + PutRecord(image + HEADER_SIZE, KEY_DEVICE_ID, "abc", 3);
+	PutLittleEndian(image + HEADER_SIZE + 2, 40, 2);
+	PutHeader(image, length - HEADER_SIZE);
+	WriteFile(Path, image, length);
+	CHECK(config_store_load(Path, &loaded) == CONFIG_STORE_CORRUPT);
+}
+
+static void TestImportLegacy(void)
+{
+	char legacyPath[sizeof(Directory) + 16];
+	static const char deviceinfo[] = "legacy-device\nHostName=hub.example.net;DeviceId=legacy-device\n";
+	static const char lastupdate[] = "2026-10-18 09:30:12\n2026-10-18 09:31:00\n";
+	CONFIG_STORE config;
+
+	snprintf(legacyPath, sizeof(legacyPath), "%s/deviceinfo", Directory);
+	WriteFile(legacyPath, (const uint8_t*)deviceinfo, strlen(deviceinfo));
+	snprintf(legacyPath, sizeof(legacyPath), "%s/lastupdate", Directory);
+	WriteFile(legacyPath, (const uint8_t*)lastupdate, strlen(lastupdate));
+
+	config_store_defaults(&config);
+	CHECK(config_store_import_legacy(Path, &config) == CONFIG_STORE_OK);
+	CHECK(strcmp(config.deviceId, "legacy-device") == 0);
+	CHECK(strcmp(config.connectionString, "HostName=hub.example.net;DeviceId=legacy-device") == 0);
+	CHECK(config.updateBegin == 1792315812);
+	CHECK(config.rebootBegin == 1792315860);
+}
+
+static void RemoveDirectory(void)
+{
+	static const char* names[] = { "store", "store.tmp", "deviceinfo", "lastupdate" };
+	char path[sizeof(Directory) + 16];
+
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		snprintf(path, sizeof(path), "%s/%s", Directory, names[i]);
+		(void)unlink(path);
+	}
+	(void)rmdir(Directory);
+}
+
+int main(void)
+{
+	if (mkdtemp(Directory) == NULL)
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(Path, sizeof(Path), "%s/store", Directory);
+
+	TestRoundTrip();
+	TestMissing();
+	TestCorrupt();
+	TestTruncatedTemporary();
+	TestUnknownKeys();
+	TestImportLegacy();
+
+	RemoveDirectory();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,65 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "check.h"
+#include "payload_compress.h"
+
+static const char Telemetry[] =
+"[{\"DeviceID\": \"raspberrypi\",\"Temperature\" : 21.570000,\"Humidity\" : 39.920000,\"SampleTime\" : \"2026-10-18T09:12:01.123456Z\",\"Sequence\" : 118,\"Epoch\" : 1592590337 } ,"
+"{\"DeviceID\": \"raspberrypi\",\"Temperature\" : 21.580000,\"Humidity\" : 39.910000,\"SampleTime\" : \"2026-10-18T09:12:02.123511Z\",\"Sequence\" : 119,\"Epoch\" : 1592590337 } ]";
+
+/* the dictionary changes only together with its id, consumers pick dictionaries by it */
+static void TestDictionaryId(void)
+{
+	size_t size;
+	const unsigned char* dictionary = payload_compress_dictionary(&size);
+
+	CHECK(payload_compress_dictionary_id() == PAYLOAD_COMPRESS_DICTIONARY_ID);
+	CHECK(adler32(adler32(0L, Z_NULL, 0), dictionary, (uInt)size) == PAYLOAD_COMPRESS_DICTIONARY_ID);
+}
+
+/* a body inflates with the dictionary its header names and with no other */
+static void TestRoundTrip(void)
+{
+	unsigned char compressed[sizeof(Telemetry)];
+	unsigned char inflated[sizeof(Telemetry)];
+	size_t dictionarySize;
+	const unsigned char* dictionary = payload_compress_dictionary(&dictionarySize);
+	size_t size;
+	z_stream stream;
+	int status;
+
+	CHECK(payload_compress_init(PAYLOAD_COMPRESS_DEFAULT_LEVEL) == 0);
+	size = payload_compress((const unsigned char*)Telemetry, sizeof(Telemetry) - 1, compressed, sizeof(compressed));
+	CHECK(size > 0 && size < (sizeof(Telemetry) - 1) / 2);
+
+	memset(&stream, 0, sizeof(stream));
+	CHECK(inflateInit(&stream) == Z_OK);
+	stream.next_in = compressed;
+	stream.avail_in = (uInt)size;
+	stream.next_out = inflated;
+	stream.avail_out = sizeof(inflated);
+	status = inflate(&stream, Z_FINISH);
+	CHECK(status == Z_NEED_DICT && stream.adler == PAYLOAD_COMPRESS_DICTIONARY_ID);
+	/* a dictionary of another version is refused */
+	CHECK(inflateSetDictionary(&stream, dictionary, (uInt)dictionarySize - 1) == Z_DATA_ERROR);
+	CHECK(inflateSetDictionary(&stream, dictionary, (uInt)dictionarySize) == Z_OK);
+	CHECK(inflate(&stream, Z_FINISH) == Z_STREAM_END);
+	CHECK(stream.total_out == sizeof(Telemetry) - 1 && memcmp(inflated, Telemetry, sizeof(Telemetry) - 1) == 0);
+	(void)inflateEnd(&stream);
+
+	payload_compress_deinit();
+	CHECK(payload_compress((const unsigned char*)Telemetry, sizeof(Telemetry) - 1, compressed, sizeof(compressed)) == 0);
+}
+
+int main(void)
+{
+	TestDictionaryId();
+	TestRoundTrip();
+
+	return CHECK_RESULT();
+}
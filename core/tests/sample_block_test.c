@@ -0,0 +1,315 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "sample_block.h"
+
+/*
+ * Encodes sample blocks and checks that they decode to what went in. Given a
+ * directory, it also writes every block there as <name>.bin with the values it
+ * holds in <name>.expected, for sample_block_test.py to check the Python
+ * decoder against: a line "<format> <epoch>" (-1 without one), then a line
+ * "<unixMs> <sequence> <values...>" per sample, readings in 0.01 units.
+ */
+
+#define EPOCH 0x5EED0001U
+#define FIRST_MS 1700000000000ULL
+#define JITTER_SAMPLES 500
+
+typedef struct READING_TAG
+{
+	uint64_t unixMs;
+	uint32_t sequence;
+	float temperatureC;
+	float humidityPct;
+	/* what the block holds: the time on its tick, the values in 0.01 units */
+	uint64_t expectedMs;
+	int32_t expectedTemperature;
+	int32_t expectedHumidity;
+} READING;
+
+typedef struct RAW_TAG
+{
+	uint64_t unixMs;
+	uint32_t sequence;
+	int32_t adcT;
+	int32_t adcP;
+	int32_t adcH;
+} RAW;
+
+/* deltas on both sides of every bucket, the 32-bit escape, clamping, NaN and sequence gaps and wrap */
+static const READING Edges[] =
+{
+	{ FIRST_MS, 0xFFFFFFFDU, 21.5f, 40.0f, FIRST_MS, 2150, 4000 },
+	{ FIRST_MS + 10, 0xFFFFFFFEU, 21.57f, 39.92f, FIRST_MS + 10, 2157, 3992 },
+	{ FIRST_MS + 24, 0xFFFFFFFFU, 21.49f, 40.0f, FIRST_MS + 20, 2149, 4000 },
+	{ FIRST_MS + 36, 0U, 21.50f, 39.99f, FIRST_MS + 40, 2150, 3999 },
+	{ FIRST_MS + 40, 4U, 22.13f, 39.36f, FIRST_MS + 40, 2213, 3936 },
+	{ FIRST_MS + 1040, 5U, 21.48f, 40.01f, FIRST_MS + 1040, 2148, 4001 },
+	{ FIRST_MS + 1050, 5U, 42.0f, 19.52f, FIRST_MS + 1050, 4200, 1952 },
+	{ FIRST_MS + 1060, 1U, 21.52f, 40.0f, FIRST_MS + 1060, 2152, 4000 },
+	{ FIRST_MS + 1070, 1000001U, 1e12f, -1e12f, FIRST_MS + 1070, INT32_MAX, INT32_MIN },
+	{ FIRST_MS + 86400000ULL, 1000002U, -1e12f, 1e12f, FIRST_MS + 86400000ULL, INT32_MIN, INT32_MAX },
+	{ FIRST_MS + 86400010ULL, 1000003U, NAN, NAN, FIRST_MS + 86400010ULL, 0, 0 },
+	{ FIRST_MS + 86400020ULL, 1000004U, -40.0f, 100.0f, FIRST_MS + 86400020ULL, -4000, 10000 },
+	{ FIRST_MS + 86400030ULL, 1000005U, 9999.99f, 0.01f, FIRST_MS + 86400030ULL, 999999, 1 }
+};
+
+static const RAW Frames[] =
+{
+	{ FIRST_MS, 7U, 519888, 415148, 27136 },
+	{ FIRST_MS + 10, 8U, 0, 0, 0 },
+	{ FIRST_MS + 20, 9U, 0xFFFFF, 0xFFFFF, 0xFFFF },
+	{ FIRST_MS + 30, 11U, 519890, 415100, 27140 },
+	{ FIRST_MS + 60030, 12U, 1, 0x80000, 0x8000 }
+};
+
+static const char* OutputDirectory = NULL;
+
+static void WriteBlock(const char* name, const unsigned char* block, size_t size, const char* expected)
+{
+	if (OutputDirectory != NULL)
+	{
+		char path[1024];
+		FILE* file;
+
+		snprintf(path, sizeof(path), "%s/%s.bin", OutputDirectory, name);
+		CHECK((file = fopen(path, "wb")) != NULL);
+		if (file != NULL)
+		{
+			CHECK(fwrite(block, 1, size, file) == size);
+			fclose(file);
+		}
+		snprintf(path, sizeof(path), "%s/%s.expected", OutputDirectory, name);
+		CHECK((file = fopen(path, "w")) != NULL);
+		if (file != NULL)
+		{
+			fputs(expected, file);
+			fclose(file);
+		}
+	}
+}
+
+/* appends to the expected text of a block */
+static void Expect(char* expected, size_t size, const char* format, ...)
+{
+	size_t length = strlen(expected);
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(expected + length, size - length, format, args);
+	va_end(args);
+}
+
+/* encodes the readings as one block, checks the C decoder and writes the block */
+static void TestReadings(const char* name, const READING* readings, size_t count, unsigned int tickMs)
+{
+	static unsigned char block[SAMPLE_BLOCK_SIZE(JITTER_SAMPLES)];
+	static char expected[64 * (JITTER_SAMPLES + 1)];
+	SAMPLE_BLOCK_ENCODER encoder;
+	SAMPLE_BLOCK_DECODER decoder;
+	SAMPLE_BLOCK_SAMPLE sample;
+	size_t size;
+	size_t i;
+	int next;
+
+	sample_block_begin(&encoder, block, sizeof(block), tickMs);
+	for (i = 0; i < count; i++)
+	{
+		CHECK(sample_block_add(&encoder, readings[i].unixMs, EPOCH, readings[i].sequence, readings[i].temperatureC, readings[i].humidityPct) == 0);
+	}
+	size = sample_block_finish(&encoder);
+	CHECK(size > SAMPLE_BLOCK_HEADER_SIZE && size <= SAMPLE_BLOCK_SIZE(count));
+
+	snprintf(expected, sizeof(expected), "%d %u\n", SAMPLE_BLOCK_FORMAT_READINGS, EPOCH);
+	CHECK(sample_block_decode_begin(&decoder, block, size) == 0);
+	CHECK(decoder.epoch == EPOCH);
+	for (i = 0; i < count; i++)
+	{
+		const READING* reading = &readings[i];
+
+		CHECK(sample_block_decode_next(&decoder, &sample) == 1);
+		CHECK(sample.unixMs == reading->expectedMs);
+		CHECK(sample.sequence == reading->sequence);
+		/* the decoder's float of the fixed-point value, the extremes only to float precision */
+		CHECK(sample.temperatureC == (float)(reading->expectedTemperature / 100.0));
+		CHECK(sample.humidityPct == (float)(reading->expectedHumidity / 100.0));
+		Expect(expected, sizeof(expected), "%llu %u %d %d\n", (unsigned long long)reading->expectedMs, reading->sequence,
+			reading->expectedTemperature, reading->expectedHumidity);
+	}
+	CHECK(sample_block_decode_next(&decoder, &sample) == 0);
+	/* a truncated block is an error, not fewer samples */
+	CHECK(sample_block_decode_begin(&decoder, block, size - 1) == 0);
+	while ((next = sample_block_decode_next(&decoder, &sample)) == 1)
+	{
+	}
+	CHECK(next == -1);
+
+	WriteBlock(name, block, size, expected);
+}
+
+static void TestEdges(void)
+{
+	TestReadings("edges", Edges, sizeof(Edges) / sizeof(Edges[0]), SAMPLE_BLOCK_DEFAULT_TICK_MS);
+}
+
+/* a sampling loop with jitter around a 1 s period and slowly drifting values */
+static void TestJitter(void)
+{
+	static READING readings[JITTER_SAMPLES];
+	uint32_t random = 12345;
+
+	for (int i = 0; i < JITTER_SAMPLES; i++)
+	{
+		READING* reading = &readings[i];
+		int32_t jitter;
+
+		random = random * 1103515245U + 12345U;
+		jitter = (int32_t)((random >> 16) % 41) - 20;
+		reading->unixMs = FIRST_MS + 1000ULL * (uint64_t)i + (uint64_t)(i == 0 ? 0 : jitter);
+		reading->expectedMs = FIRST_MS + (reading->unixMs - FIRST_MS + 5) / 10 * 10;
+		reading->sequence = (uint32_t)i + ((i >= 250) ? 3U : 0U);
+		reading->expectedTemperature = 2000 + (int32_t)((random >> 8) % 7) - 3 + i / 10;
+		reading->expectedHumidity = 4500 - i / 5;
+		reading->temperatureC = (float)(reading->expectedTemperature / 100.0);
+		reading->humidityPct = (float)(reading->expectedHumidity / 100.0);
+	}
+	TestReadings("jitter", readings, JITTER_SAMPLES, SAMPLE_BLOCK_DEFAULT_TICK_MS);
+}
+
+/* a coarse tick rounds every sample to the nearest second */
+static void TestCoarseTick(void)
+{
+	static const READING readings[] =
+	{
+		{ FIRST_MS, 1U, 20.0f, 50.0f, FIRST_MS, 2000, 5000 },
+		{ FIRST_MS + 1499, 2U, 20.01f, 50.0f, FIRST_MS + 1000, 2001, 5000 },
+		{ FIRST_MS + 1500, 3U, 20.02f, 50.0f, FIRST_MS + 2000, 2002, 5000 },
+		{ FIRST_MS + 65535000ULL, 4U, 20.03f, 50.0f, FIRST_MS + 65535000ULL, 2003, 5000 }
+	};
+
+	TestReadings("coarse", readings, sizeof(readings) / sizeof(readings[0]), 1000);
+}
+
+static void TestRaw(void)
+{
+	static unsigned char block[SAMPLE_BLOCK_SIZE(sizeof(Frames) / sizeof(Frames[0]))];
+	static char expected[64 * (sizeof(Frames) / sizeof(Frames[0]) + 1)];
+	SAMPLE_BLOCK_ENCODER encoder;
+	SAMPLE_BLOCK_DECODER decoder;
+	SAMPLE_BLOCK_SAMPLE sample;
+	SAMPLE_BLOCK_RAW_FRAME frame;
+	size_t count = sizeof(Frames) / sizeof(Frames[0]);
+	size_t size;
+
+	sample_block_begin_raw(&encoder, block, sizeof(block), SAMPLE_BLOCK_DEFAULT_TICK_MS);
+	/* a raw block takes frames only */
+	CHECK(sample_block_add(&encoder, FIRST_MS, EPOCH, 0, 20.0f, 40.0f) == -1);
+	for (size_t i = 0; i < count; i++)
+	{
+		CHECK(sample_block_add_raw(&encoder, Frames[i].unixMs, EPOCH, Frames[i].sequence, Frames[i].adcT, Frames[i].adcP, Frames[i].adcH) == 0);
+	}
+	size = sample_block_finish(&encoder);
+	CHECK(size > SAMPLE_BLOCK_HEADER_SIZE && size <= sizeof(block));
+
+	snprintf(expected, sizeof(expected), "%d %u\n", SAMPLE_BLOCK_FORMAT_RAW, EPOCH);
+	CHECK(sample_block_decode_begin(&decoder, block, size) == 0);
+	CHECK(decoder.epoch == EPOCH);
+	CHECK(sample_block_decode_next(&decoder, &sample) == -1);
+	for (size_t i = 0; i < count; i++)
+	{
+		CHECK(sample_block_decode_next_raw(&decoder, &frame) == 1);
+		CHECK(frame.unixMs == Frames[i].unixMs);
+		CHECK(frame.sequence == Frames[i].sequence);
+		CHECK(frame.adcT == Frames[i].adcT && frame.adcP == Frames[i].adcP && frame.adcH == Frames[i].adcH);
+		Expect(expected, sizeof(expected), "%llu %u %d %d %d\n", (unsigned long long)Frames[i].unixMs, Frames[i].sequence,
+			Frames[i].adcT, Frames[i].adcP, Frames[i].adcH);
+	}
+	CHECK(sample_block_decode_next_raw(&decoder, &frame) == 0);
+
+	WriteBlock("raw", block, size, expected);
+}
+
+/* the encoder sends no empty block, a header without samples still decodes to none */
+static void TestEmpty(void)
+{
+	unsigned char block[SAMPLE_BLOCK_SIZE(1)];
+	SAMPLE_BLOCK_ENCODER encoder;
+	SAMPLE_BLOCK_DECODER decoder;
+	SAMPLE_BLOCK_SAMPLE sample;
+
+	sample_block_begin(&encoder, block, sizeof(block), SAMPLE_BLOCK_DEFAULT_TICK_MS);
+	CHECK(sample_block_finish(&encoder) == 0);
+
+	memset(block, 0, SAMPLE_BLOCK_HEADER_SIZE);
+	block[0] = SAMPLE_BLOCK_FORMAT_READINGS | SAMPLE_BLOCK_FLAG_SEQUENCED | SAMPLE_BLOCK_FLAG_EPOCH;
+	block[3] = SAMPLE_BLOCK_DEFAULT_TICK_MS;
+	CHECK(sample_block_decode_begin(&decoder, block, SAMPLE_BLOCK_HEADER_SIZE) == 0);
+	CHECK(decoder.epoch == 0);
+	CHECK(sample_block_decode_next(&decoder, &sample) == 0);
+	WriteBlock("empty", block, SAMPLE_BLOCK_HEADER_SIZE, "1 -1\n");
+
+	/* shorter than a header or of an unknown format is no block */
+	CHECK(sample_block_decode_begin(&decoder, block, SAMPLE_BLOCK_HEADER_SIZE - 1) == -1);
+	block[0] = 3;
+	CHECK(sample_block_decode_begin(&decoder, block, SAMPLE_BLOCK_HEADER_SIZE) == -1);
+}
+
+/* samples that cannot follow in the block are refused and leave it as it was */
+static void TestRefused(void)
+{
+	unsigned char block[SAMPLE_BLOCK_SIZE(2)];
+	SAMPLE_BLOCK_ENCODER encoder;
+	SAMPLE_BLOCK_DECODER decoder;
+	SAMPLE_BLOCK_SAMPLE sample;
+	uint32_t count = 1;
+	size_t size;
+
+	sample_block_begin(&encoder, block, sizeof(block), SAMPLE_BLOCK_DEFAULT_TICK_MS);
+	CHECK(sample_block_add(&encoder, FIRST_MS, EPOCH, 0, 20.0f, 40.0f) == 0);
+	/* earlier than the first, of another run, a tick delta beyond 32 bits */
+	CHECK(sample_block_add(&encoder, FIRST_MS - 1, EPOCH, 1, 20.0f, 40.0f) == -1);
+	CHECK(sample_block_add(&encoder, FIRST_MS + 10, EPOCH + 1, 1, 20.0f, 40.0f) == -1);
+	CHECK(sample_block_add(&encoder, FIRST_MS + 10ULL * 0x80000000ULL, EPOCH, 1, 20.0f, 40.0f) == -1);
+	/* a block sized for 2 samples of the worst case takes at least 2 and then says it is full */
+	while (sample_block_add(&encoder, FIRST_MS + 10 * count, EPOCH, count, 20.5f, 40.5f) == 0)
+	{
+		count++;
+	}
+	CHECK(count >= 2);
+	size = sample_block_finish(&encoder);
+	CHECK(size <= sizeof(block));
+
+	CHECK(sample_block_decode_begin(&decoder, block, size) == 0);
+	CHECK(sample_block_decode_next(&decoder, &sample) == 1);
+	CHECK(sample.unixMs == FIRST_MS && sample.sequence == 0 && sample.temperatureC == 20.0f && sample.humidityPct == 40.0f);
+	for (uint32_t i = 1; i < count; i++)
+	{
+		CHECK(sample_block_decode_next(&decoder, &sample) == 1);
+		CHECK(sample.unixMs == FIRST_MS + 10 * i && sample.sequence == i && sample.temperatureC == 20.5f && sample.humidityPct == 40.5f);
+	}
+	CHECK(sample_block_decode_next(&decoder, &sample) == 0);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 1)
+	{
+		OutputDirectory = argv[1];
+	}
+
+	TestEdges();
+	TestJitter();
+	TestCoarseTick();
+	TestRaw();
+	TestEmpty();
+	TestRefused();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Checks core/tools/sample_block.py against the C encoder.
+
+sample_block_test writes the blocks it encodes and the values they hold into a
+directory; this decodes every block with the reference decoder and compares.
+Run by ctest with the path of sample_block_test.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+
+# no __pycache__ in the source tree
+sys.dont_write_bytecode = True
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import sample_block  # noqa: E402
+
+
+def expected_block(path):
+    with open(path) as file:
+        lines = [[int(field) for field in line.split()] for line in file if line.strip()]
+    block_format, epoch = lines[0]
+    return block_format, (None if epoch < 0 else epoch), [tuple(line) for line in lines[1:]]
+
+
+def decoded_block(block, block_format):
+    if block_format == sample_block.FORMAT_RAW:
+        return list(sample_block.decode_raw(block))
+    # the reference decoder gives 0.01 units as floats, the test compares them as the encoder's integers
+    return [(unix_ms, sequence, round(temperature * sample_block.SCALE), round(humidity * sample_block.SCALE))
+            for unix_ms, sequence, temperature, humidity in sample_block.decode(block)]
+
+
+def main():
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        subprocess.check_call([sys.argv[1], directory])
+        names = sorted(name[:-len(".bin")] for name in os.listdir(directory) if name.endswith(".bin"))
+        if not names:
+            print("sample_block_test wrote no blocks")
+            return 1
+        for name in names:
+            with open(os.path.join(directory, name + ".bin"), "rb") as file:
+                block = file.read()
+            block_format, epoch, samples = expected_block(os.path.join(directory, name + ".expected"))
+            if sample_block.block_format(block) != block_format:
+                print("%s: format %d, expected %d" % (name, sample_block.block_format(block), block_format))
+                failures += 1
+            if sample_block.block_epoch(block) != epoch:
+                print("%s: epoch %s, expected %s" % (name, sample_block.block_epoch(block), epoch))
+                failures += 1
+            decoded = decoded_block(block, block_format)
+            if len(decoded) != len(samples):
+                print("%s: %d samples, expected %d" % (name, len(decoded), len(samples)))
+                failures += 1
+            for index, (got, want) in enumerate(zip(decoded, samples)):
+                if got != want:
+                    print("%s: sample %d is %s, expected %s" % (name, index, got, want))
+                    failures += 1
+            # a truncated block is an error, not fewer samples
+            if samples:
+                try:
+                    decoded_block(block[:-1], block_format)
+                    print("%s: truncated block decoded" % name)
+                    failures += 1
+                except sample_block.BlockError:
+                    pass
+
+    # shorter than a header is no block
+    try:
+        sample_block.block_format(b"\x01")
+        print("a 1-byte block has a format")
+        failures += 1
+    except sample_block.BlockError:
+        pass
+    return 0 if failures == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,322 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "send_lanes.h"
+
+#define SECOND_US 1000000ULL
+#define MESSAGE_COUNT 600
+
+/* the lanes only link items, a test message is one with a number */
+typedef struct MESSAGE_TAG
+{
+	SEND_LANE_ITEM item;
+	int id;
+} MESSAGE;
+
+static MESSAGE Messages[MESSAGE_COUNT];
+
+static MESSAGE* Message(int id)
+{
+	Messages[id].id = id;
+	return &Messages[id];
+}
+
+static int Id(const SEND_LANE_ITEM* item)
+{
+	return (item != NULL) ? ((const MESSAGE*)item)->id : -1;
+}
+
+static void Configure(SEND_LANE_CONFIG configs[SEND_LANE_COUNT], unsigned int maxInFlight, unsigned int maxQueued, SEND_DELIVERY delivery)
+{
+	send_lanes_defaults(configs);
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		configs[lane].maxInFlight = maxInFlight;
+		configs[lane].maxQueued = maxQueued;
+		configs[lane].delivery = delivery;
+	}
+}
+
+static SEND_LANE_ITEM* Pop(SEND_LANES* lanes, uint64_t nowUs)
+{
+	SEND_LANE_ITEM* expired;
+	SEND_LANE_ITEM* item = send_lanes_pop(lanes, nowUs, &expired);
+
+	CHECK(expired == NULL);
+	return item;
+}
+
+static void TestParse(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+
+	send_lanes_defaults(configs);
+	CHECK(send_lanes_parse("telemetry,3,6,100,10000,best-effort", configs) == 0);
+	CHECK(configs[SEND_LANE_TELEMETRY].weight == 3);
+	CHECK(configs[SEND_LANE_TELEMETRY].maxInFlight == 6);
+	CHECK(configs[SEND_LANE_TELEMETRY].maxQueued == 100);
+	CHECK(configs[SEND_LANE_TELEMETRY].timeoutMs == 10000);
+	CHECK(configs[SEND_LANE_TELEMETRY].delivery == SEND_DELIVERY_BEST_EFFORT);
+	CHECK(configs[SEND_LANE_TELEMETRY].maxAttempts == 5);
+	CHECK(send_lanes_parse("bulk,1,2,256,300000,at-least-once,20", configs) == 0);
+	CHECK(configs[SEND_LANE_BULK].maxAttempts == 20);
+
+	CHECK(send_lanes_parse("bulk,1,2,256,300000,at-least-once,0", configs) != 0);
+	CHECK(send_lanes_parse("bulk,0,2,256,300000,at-least-once", configs) != 0);
+	CHECK(send_lanes_parse("bulk,1,2,256,300000,sometimes", configs) != 0);
+	CHECK(send_lanes_parse("other,1,2,256,300000,best-effort", configs) != 0);
+	CHECK(send_lanes_parse("bulk,1,2", configs) != 0);
+}
+
+/* Smooth weighted round robin gives every lane its weight's share of each round, 8:4:1:1 by default */
+static void TestWeights(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	unsigned int popped[SEND_LANE_COUNT] = { 0 };
+	int id = 0;
+
+	Configure(configs, MESSAGE_COUNT, MESSAGE_COUNT, SEND_DELIVERY_AT_LEAST_ONCE);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	for (int lane = 0; lane < SEND_LANE_COUNT; lane++)
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			CHECK(send_lanes_push(&lanes, &Message(id++)->item, (SEND_LANE)lane, 0) == NULL);
+		}
+	}
+
+	/* ten rounds of 14 */
+	for (int i = 0; i < 140; i++)
+	{
+		SEND_LANE_ITEM* item = Pop(&lanes, 0);
+
+		CHECK(item != NULL);
+		if (item != NULL)
+		{
+			popped[item->lane]++;
+			CHECK(item->attempts == 1);
+		}
+	}
+	CHECK(popped[SEND_LANE_ALERT] == 80);
+	CHECK(popped[SEND_LANE_TELEMETRY] == 40);
+	CHECK(popped[SEND_LANE_BULK] == 10);
+	CHECK(popped[SEND_LANE_DIAGNOSTICS] == 10);
+	CHECK(send_lanes_pending(&lanes) == 400);
+	send_lanes_deinit(&lanes);
+}
+
+/* A lane with all its slots in flight is skipped until one completes */
+static void TestInFlightLimit(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	SEND_LANE_ITEM* first;
+	SEND_LANE_ITEM* dropped;
+
+	Configure(configs, 2, 16, SEND_DELIVERY_AT_LEAST_ONCE);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	for (int id = 0; id < 3; id++)
+	{
+		(void)send_lanes_push(&lanes, &Message(id)->item, SEND_LANE_TELEMETRY, 0);
+	}
+	first = Pop(&lanes, 0);
+	CHECK(Id(first) == 0);
+	CHECK(Id(Pop(&lanes, 0)) == 1);
+	CHECK(Pop(&lanes, 0) == NULL);
+	CHECK(send_lanes_complete(&lanes, first, 1, 0, &dropped) == SEND_LANE_DONE);
+	CHECK(dropped == NULL);
+	CHECK(Id(Pop(&lanes, 0)) == 2);
+	send_lanes_deinit(&lanes);
+}
+
+/* Best-effort messages past the lane's timeout come back in *expired, oldest last */
+static void TestBestEffortExpiry(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	SEND_LANE_ITEM* expired;
+	SEND_LANE_ITEM* item;
+	SEND_LANE_ITEM* dropped;
+	uint64_t timeoutUs;
+
+	send_lanes_defaults(configs);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	timeoutUs = configs[SEND_LANE_DIAGNOSTICS].timeoutMs * 1000ULL;
+	(void)send_lanes_push(&lanes, &Message(0)->item, SEND_LANE_DIAGNOSTICS, 0);
+	(void)send_lanes_push(&lanes, &Message(1)->item, SEND_LANE_DIAGNOSTICS, SECOND_US);
+	(void)send_lanes_push(&lanes, &Message(2)->item, SEND_LANE_DIAGNOSTICS, timeoutUs);
+
+	/* exactly the timeout is still in time */
+	item = send_lanes_pop(&lanes, timeoutUs + SECOND_US, &expired);
+	CHECK(Id(expired) == 0);
+	CHECK(expired != NULL && expired->next == NULL);
+	CHECK(Id(item) == 1);
+
+	/* not confirmed, a best-effort message is not sent again */
+	CHECK(send_lanes_complete(&lanes, item, 0, timeoutUs + SECOND_US, &dropped) == SEND_LANE_DONE);
+	CHECK(dropped == NULL);
+	item = send_lanes_pop(&lanes, 3 * timeoutUs, &expired);
+	CHECK(item == NULL);
+	CHECK(Id(expired) == 2);
+	CHECK(send_lanes_pending(&lanes) == 0);
+
+	/* at-least-once lanes never expire */
+	(void)send_lanes_push(&lanes, &Message(3)->item, SEND_LANE_TELEMETRY, 0);
+	item = send_lanes_pop(&lanes, 100 * timeoutUs, &expired);
+	CHECK(expired == NULL);
+	CHECK(Id(item) == 3);
+	send_lanes_deinit(&lanes);
+}
+
+/* A full lane drops its oldest message for a push */
+static void TestMaxQueuedDrop(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+
+	Configure(configs, 16, 3, SEND_DELIVERY_AT_LEAST_ONCE);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	for (int id = 0; id < 3; id++)
+	{
+		CHECK(send_lanes_push(&lanes, &Message(id)->item, SEND_LANE_BULK, 0) == NULL);
+	}
+	CHECK(Id(send_lanes_push(&lanes, &Message(3)->item, SEND_LANE_BULK, 0)) == 0);
+	CHECK(Id(send_lanes_push(&lanes, &Message(4)->item, SEND_LANE_BULK, 0)) == 1);
+	CHECK(send_lanes_pending(&lanes) == 3);
+	CHECK(Id(Pop(&lanes, 0)) == 2);
+	CHECK(Id(Pop(&lanes, 0)) == 3);
+	CHECK(Id(Pop(&lanes, 0)) == 4);
+	send_lanes_deinit(&lanes);
+}
+
+/* An undelivered at-least-once message goes back to the head after its backoff and keeps the lane's order */
+static void TestRequeue(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	SEND_LANE_ITEM* item;
+	SEND_LANE_ITEM* dropped;
+	uint64_t nowUs = 10 * SECOND_US;
+
+	Configure(configs, 16, 16, SEND_DELIVERY_AT_LEAST_ONCE);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	(void)send_lanes_push(&lanes, &Message(0)->item, SEND_LANE_ALERT, nowUs);
+	(void)send_lanes_push(&lanes, &Message(1)->item, SEND_LANE_ALERT, nowUs);
+	item = Pop(&lanes, nowUs);
+	CHECK(Id(item) == 0);
+	CHECK(send_lanes_complete(&lanes, item, 0, nowUs, &dropped) == SEND_LANE_REQUEUED);
+	CHECK(dropped == NULL);
+	CHECK(send_lanes_pending(&lanes) == 2);
+
+	/* the lane waits for its head, the message behind it does not overtake */
+	CHECK(Pop(&lanes, nowUs + SEND_LANES_RETRY_BACKOFF_MS * 1000ULL - 1) == NULL);
+	item = Pop(&lanes, nowUs + SEND_LANES_RETRY_BACKOFF_MS * 1000ULL);
+	CHECK(Id(item) == 0);
+	CHECK(item != NULL && item->attempts == 2);
+	CHECK(send_lanes_complete(&lanes, item, 1, nowUs, &dropped) == SEND_LANE_DONE);
+	CHECK(Id(Pop(&lanes, nowUs + SEND_LANES_RETRY_BACKOFF_MS * 1000ULL)) == 1);
+	send_lanes_deinit(&lanes);
+}
+
+/* A retry going back into a full lane drops the newest message, the lane stays within maxQueued */
+static void TestRequeueFullLane(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	SEND_LANE_ITEM* item;
+	SEND_LANE_ITEM* dropped;
+
+	Configure(configs, 16, 2, SEND_DELIVERY_AT_LEAST_ONCE);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	(void)send_lanes_push(&lanes, &Message(0)->item, SEND_LANE_TELEMETRY, 0);
+	item = Pop(&lanes, 0);
+	(void)send_lanes_push(&lanes, &Message(1)->item, SEND_LANE_TELEMETRY, 0);
+	(void)send_lanes_push(&lanes, &Message(2)->item, SEND_LANE_TELEMETRY, 0);
+	CHECK(send_lanes_complete(&lanes, item, 0, 0, &dropped) == SEND_LANE_REQUEUED);
+	CHECK(Id(dropped) == 2);
+	CHECK(send_lanes_pending(&lanes) == 2);
+
+	/* the next push drops the oldest, which is the retry again only once it is the oldest */
+	CHECK(Id(send_lanes_push(&lanes, &Message(3)->item, SEND_LANE_TELEMETRY, 0)) == 0);
+	CHECK(Id(Pop(&lanes, 0)) == 1);
+	CHECK(Id(Pop(&lanes, 0)) == 3);
+	send_lanes_deinit(&lanes);
+}
+
+/* The backoff doubles per attempt, after the lane's attempts the message is given up */
+static void TestRetryCap(void)
+{
+	SEND_LANE_CONFIG configs[SEND_LANE_COUNT];
+	SEND_LANES lanes;
+	SEND_LANE_ITEM* item;
+	SEND_LANE_ITEM* dropped;
+	uint64_t nowUs = 0;
+	uint64_t backoffUs = SEND_LANES_RETRY_BACKOFF_MS * 1000ULL;
+
+	Configure(configs, 16, 16, SEND_DELIVERY_AT_LEAST_ONCE);
+	configs[SEND_LANE_BULK].maxAttempts = 4;
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	(void)send_lanes_push(&lanes, &Message(0)->item, SEND_LANE_BULK, nowUs);
+	for (unsigned int attempt = 1; attempt < 4; attempt++)
+	{
+		item = Pop(&lanes, nowUs);
+		CHECK(Id(item) == 0);
+		CHECK(item != NULL && item->attempts == attempt);
+		if (item == NULL)
+		{
+			break;
+		}
+		CHECK(send_lanes_complete(&lanes, item, 0, nowUs, &dropped) == SEND_LANE_REQUEUED);
+		CHECK(Pop(&lanes, nowUs + backoffUs - 1) == NULL);
+		nowUs += backoffUs;
+		backoffUs *= 2;
+	}
+	item = Pop(&lanes, nowUs);
+	CHECK(item != NULL && item->attempts == 4);
+	if (item != NULL)
+	{
+		CHECK(send_lanes_complete(&lanes, item, 0, nowUs, &dropped) == SEND_LANE_ABANDONED);
+		CHECK(dropped == NULL);
+	}
+	CHECK(send_lanes_pending(&lanes) == 0);
+
+	/* the backoff stops growing at its maximum */
+	configs[SEND_LANE_BULK].maxAttempts = 20;
+	send_lanes_deinit(&lanes);
+	CHECK(send_lanes_init(&lanes, configs) == 0);
+	(void)send_lanes_push(&lanes, &Message(1)->item, SEND_LANE_BULK, 0);
+	nowUs = 0;
+	for (unsigned int attempt = 1; attempt < 20; attempt++)
+	{
+		item = Pop(&lanes, nowUs);
+		CHECK(item != NULL);
+		if (item == NULL)
+		{
+			break;
+		}
+		CHECK(send_lanes_complete(&lanes, item, 0, nowUs, &dropped) == SEND_LANE_REQUEUED);
+		CHECK(item->notBeforeUs - nowUs <= SEND_LANES_RETRY_BACKOFF_MAX_MS * 1000ULL);
+		nowUs += SEND_LANES_RETRY_BACKOFF_MAX_MS * 1000ULL;
+	}
+	send_lanes_deinit(&lanes);
+}
+
+int main(void)
+{
+	TestParse();
+	TestWeights();
+	TestInFlightLimit();
+	TestBestEffortExpiry();
+	TestMaxQueuedDrop();
+	TestRequeue();
+	TestRequeueFullLane();
+	TestRetryCap();
+
+	return CHECK_RESULT();
+}
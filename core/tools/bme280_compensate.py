@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Compensation of raw BME280 frames, a port of core/src/bme280_compensate.c.
+
+The integer arithmetic follows the C code step for step, int32 and int64
+included, so a backend gets the very values the device would have sent:
+
+    calibration = json.load(...)["Bme280Calibration"]
+    for unix_ms, sequence, adc_t, adc_p, adc_h in sample_block.decode_raw(body):
+        temperature_c, pressure_pa, humidity_pct = compensate(calibration, adc_t, adc_p, adc_h)
+
+Run as a script it takes the calibration the device reports (a file holding
+the Bme280Calibration object, or the whole reported properties) and raw
+block files, and prints the readings as CSV.
+"""
+
+import argparse
+import json
+import sys
+
+import sample_block
+
+
+def int32(value):
+    return ((value + (1 << 31)) & 0xFFFFFFFF) - (1 << 31)
+
+
+def int64(value):
+    return ((value + (1 << 63)) & 0xFFFFFFFFFFFFFFFF) - (1 << 63)
+
+
+def divide(numerator, denominator):
+    """C division, which truncates toward zero where // floors."""
+    quotient = abs(numerator) // abs(denominator)
+    return quotient if (numerator < 0) == (denominator < 0) else -quotient
+
+
+def compensate_t(calib, adc_t):
+    """Returns (temperature in 0.01 C, t_fine)."""
+    var1 = int32(int32((adc_t >> 3) - (calib["dig_T1"] << 1)) * calib["dig_T2"]) >> 11
+    var2 = int32((adc_t >> 4) - calib["dig_T1"])
+    var2 = int32(int32(int32(var2 * var2) >> 12) * calib["dig_T3"]) >> 14
+    t_fine = int32(var1 + var2)
+    return int32(t_fine * 5 + 128) >> 8, t_fine
+
+
+def compensate_p(calib, adc_p, t_fine):
+    """Returns the pressure in Pa as Q24.8."""
+    var1 = t_fine - 128000
+    var2 = int64(var1 * var1 * calib["dig_P6"])
+    var2 = int64(var2 + int64(int64(var1 * calib["dig_P5"]) << 17))
+    var2 = int64(var2 + (calib["dig_P4"] << 35))
+    var1 = int64((int64(var1 * var1 * calib["dig_P3"]) >> 8) + int64(int64(var1 * calib["dig_P2"]) << 12))
+    var1 = int64(int64((1 << 47) + var1) * calib["dig_P1"]) >> 33
+    if var1 == 0:
+        return 0
+    p = 1048576 - adc_p
+    p = divide(int64(int64(int64(p << 31) - var2) * 3125), var1)
+    var1 = int64(int64(calib["dig_P9"] * (p >> 13)) * (p >> 13)) >> 25
+    var2 = int64(calib["dig_P8"] * p) >> 19
+    p = int64((int64(p + var1 + var2) >> 8) + (calib["dig_P7"] << 4))
+    return p & 0xFFFFFFFF
+
+
+def compensate_h(calib, adc_h, t_fine):
+    """Returns the relative humidity as Q22.10."""
+    x = int32(t_fine - 76800)
+    a = int32(int32(int32(adc_h << 14) - int32(calib["dig_H4"] << 20)) - int32(calib["dig_H5"] * x))
+    a = int32(a + 16384) >> 15
+    b = int32(int32(int32(x * calib["dig_H6"]) >> 10) * int32((int32(x * calib["dig_H3"]) >> 11) + 32768)) >> 10
+    b = int32(int32(int32(b + 2097152) * calib["dig_H2"]) + 8192) >> 14
+    x = int32(a * b)
+    x = int32(x - (int32(int32(int32((x >> 15) * (x >> 15)) >> 7) * calib["dig_H1"]) >> 4))
+    x = min(max(x, 0), 419430400)
+    return x >> 12
+
+
+def compensate(calib, adc_t, adc_p, adc_h):
+    """Returns (temperature_c, pressure_pa, humidity_pct) as bme280_read_device computes them."""
+    temperature, t_fine = compensate_t(calib, adc_t)
+    return temperature / 100.0, compensate_p(calib, adc_p, t_fine) / 256.0, compensate_h(calib, adc_h, t_fine) / 1024.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("calibration", help="JSON file with the Bme280Calibration the device reports")
+    parser.add_argument("blocks", nargs="*", help="files holding one raw block each (default stdin)")
+    args = parser.parse_args()
+
+    with open(args.calibration) as calibration_file:
+        calib = json.load(calibration_file)
+    calib = calib.get("Bme280Calibration", calib)
+    blocks = [open(path, "rb").read() for path in args.blocks] or [sys.stdin.buffer.read()]
+
+    print("unix_ms,sequence,temperature_c,pressure_pa,humidity_pct")
+    for block in blocks:
+        for unix_ms, sequence, adc_t, adc_p, adc_h in sample_block.decode_raw(block):
+            temperature_c, pressure_pa, humidity_pct = compensate(calib, adc_t, adc_p, adc_h)
+            print("%d,%s,%.2f,%.2f,%.2f" % (unix_ms, sample_block.csv_sequence(sequence), temperature_c, pressure_pa, humidity_pct))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+# Copyright (c) Microsoft. All rights reserved.
+# Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+"""Reference decoder for the sample blocks of core/inc/sample_block.h.
+
+Import it in a backend to turn the body of a SampleBlock message into
+readings:
+
+    for unix_ms, sequence, temperature_c, humidity_pct in decode(body):
+        ...
+
+sequence is the number the device gave the sample when it read it, one more
+per read of the telemetry series; a gap is a read that failed or a sample that
+was left out or lost. It is None in blocks from before the device numbered its
+samples. The numbers start over from 0 with every run of the device, so they
+are unique only together with the run's epoch, block_epoch(body), which is
+None in blocks from before the device sent one.
+
+A block of raw frames (remote_monitoring --sample-block-format raw) decodes to the BME280's
+ADC values instead, block_format() tells which one a body is:
+
+    for unix_ms, sequence, adc_t, adc_p, adc_h in decode_raw(body):
+        ...
+
+bme280_compensate.py turns those into readings. Run as a script it prints the
+samples of block files (or stdin) as CSV.
+"""
+
+import argparse
+import struct
+import sys
+
+FORMAT_READINGS = 1
+FORMAT_RAW = 2
+FLAG_SEQUENCED = 0x80
+FLAG_EPOCH = 0x40
+HEADER = struct.Struct("<BHHQ")
+SCALE = 100.0
+# (ones after the first bit, value bits); a 0 ends the prefix except in the last bucket
+BUCKETS = ((0, 4), (1, 7), (2, 12), (3, 32))
+
+
+class BlockError(ValueError):
+    pass
+
+
+class BitReader:
+    def __init__(self, data):
+        self.data = data
+        self.bit = 0
+
+    def read(self, count):
+        if self.bit + count > len(self.data) * 8:
+            raise BlockError("block is truncated")
+        value = 0
+        for _ in range(count):
+            value = (value << 1) | ((self.data[self.bit // 8] >> (7 - self.bit % 8)) & 1)
+            self.bit += 1
+        return value
+
+    def number(self):
+        if self.read(1) == 0:
+            return 0
+        ones = 0
+        while ones < len(BUCKETS) - 1 and self.read(1) == 1:
+            ones += 1
+        bits = BUCKETS[ones][1]
+        value = self.read(bits)
+        return value - (1 << bits) if value & (1 << (bits - 1)) else value
+
+
+def wrap32(value):
+    """The encoder's fixed-point values are int32 and wrap like them."""
+    return ((value + (1 << 31)) & 0xFFFFFFFF) - (1 << 31)
+
+
+def block_format(block):
+    """FORMAT_READINGS or FORMAT_RAW."""
+    if len(block) < HEADER.size:
+        raise BlockError("block is shorter than its header")
+    if block[0] & ~(FLAG_SEQUENCED | FLAG_EPOCH) not in (FORMAT_READINGS, FORMAT_RAW):
+        raise BlockError("unknown block format %d" % block[0])
+    return block[0] & ~(FLAG_SEQUENCED | FLAG_EPOCH)
+
+
+def block_epoch(block):
+    """The epoch of the run that sampled the block, None when it has none."""
+    block_format(block)
+    flags, count = HEADER.unpack_from(block)[:2]
+    if not flags & FLAG_EPOCH or count == 0:
+        return None
+    return BitReader(block[HEADER.size:]).read(32)
+
+
+def samples(block, expected_format):
+    """Yields (unix_ms, sequence, reader) for every sample, the caller reads the values."""
+    if block_format(block) != expected_format:
+        raise BlockError("block is of format %d, not %d" % (block_format(block), expected_format))
+    flags, count, tick_ms, first_unix_ms = HEADER.unpack_from(block)
+    sequenced = bool(flags & FLAG_SEQUENCED)
+
+    reader = BitReader(block[HEADER.size:])
+    if flags & FLAG_EPOCH and count > 0:
+        reader.read(32)
+    tick = tick_delta = 0
+    sequence = None
+    sequence_delta = 1
+    for index in range(count):
+        if index == 0:
+            if sequenced:
+                sequence = reader.read(32)
+        else:
+            tick_delta += reader.number()
+            tick += tick_delta
+            if sequenced:
+                sequence_delta += reader.number()
+                sequence = (sequence + sequence_delta) & 0xFFFFFFFF
+        yield first_unix_ms + tick * tick_ms, sequence, reader
+
+
+def decode(block):
+    """Yields (unix_ms, sequence, temperature_c, humidity_pct) for every sample of the block."""
+    temperature = humidity = 0
+    for unix_ms, sequence, reader in samples(block, FORMAT_READINGS):
+        temperature = wrap32(temperature + reader.number())
+        humidity = wrap32(humidity + reader.number())
+        yield unix_ms, sequence, temperature / SCALE, humidity / SCALE
+
+
+def decode_raw(block):
+    """Yields (unix_ms, sequence, adc_t, adc_p, adc_h) for every frame of a raw block."""
+    for unix_ms, sequence, reader in samples(block, FORMAT_RAW):
+        yield unix_ms, sequence, reader.read(20), reader.read(20), reader.read(16)
+
+
+def csv_sequence(sequence):
+    return "" if sequence is None else str(sequence)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("blocks", nargs="*", help="files holding one block each (default stdin)")
+    args = parser.parse_args()
+
+    blocks = [open(path, "rb").read() for path in args.blocks] or [sys.stdin.buffer.read()]
+    if all(block_format(block) == FORMAT_RAW for block in blocks):
+        print("unix_ms,sequence,adc_t,adc_p,adc_h")
+        for block in blocks:
+            for unix_ms, sequence, adc_t, adc_p, adc_h in decode_raw(block):
+                print("%d,%s,%d,%d,%d" % (unix_ms, csv_sequence(sequence), adc_t, adc_p, adc_h))
+    else:
+        print("unix_ms,sequence,temperature_c,humidity_pct")
+        for block in blocks:
+            for unix_ms, sequence, temperature_c, humidity_pct in decode(block):
+                print("%d,%s,%.2f,%.2f" % (unix_ms, csv_sequence(sequence), temperature_c, humidity_pct))
+
+
+if __name__ == "__main__":
+    main()
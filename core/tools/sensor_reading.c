@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "reading_shm.h"
+
+/*
+ * Prints the readings remote_monitoring publishes in shared memory, without
+ * touching the SPI bus: the latest one, the retained history, or the latest
+ * one each time it changes. One line per reading:
+ *
+ *   <unix time> <temperature C> <pressure Pa> <humidity %> <age ms>
+ */
+static volatile sig_atomic_t stopRequested = 0;
+
+static void OnSignal(int signum)
+{
+	(void)signum;
+	stopRequested = 1;
+}
+
+static uint64_t NowUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000ULL;
+}
+
+static void PrintSample(const READING_SAMPLE* sample)
+{
+	uint64_t now = NowUs();
+
+	printf("%llu.%06llu %.2f %.2f %.2f %.3f %u\n",
+		(unsigned long long)(sample->unixUs / 1000000ULL), (unsigned long long)(sample->unixUs % 1000000ULL),
+		sample->temperatureC, sample->pressurePa, sample->humidityPct,
+		(now > sample->monotonicUs) ? (now - sample->monotonicUs) / 1000.0 : 0.0, (unsigned int)sample->sequence);
+}
+
+static void PrintUsage(const char* program)
+{
+	printf("usage: %s [options]\n"
+		"  --name <segment>    shared memory segment (default " READING_SHM_DEFAULT_NAME ")\n"
+		"  --history           print the retained readings, oldest first\n"
+		"  --follow            print the latest reading whenever it changes, until interrupted\n"
+		"  --poll-us <us>      how often --follow checks for a new reading (default 1000)\n", program);
+}
+
+int main(int argc, char** argv)
+{
+	int result = 0;
+	const char* name = READING_SHM_DEFAULT_NAME;
+	int history = 0;
+	int follow = 0;
+	unsigned long pollUs = 1000;
+	const READING_SHM* shm;
+
+	for (int i = 1; i < argc && result == 0; i++)
+	{
+		if (strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+		{
+			name = argv[++i];
+		}
+		else if (strcmp(argv[i], "--history") == 0)
+		{
+			history = 1;
+		}
+		else if (strcmp(argv[i], "--follow") == 0)
+		{
+			follow = 1;
+		}
+		else if (strcmp(argv[i], "--poll-us") == 0 && i + 1 < argc)
+		{
+			pollUs = strtoul(argv[++i], NULL, 10);
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
+
+	if (result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else if ((shm = reading_shm_open(name)) == NULL)
+	{
+		printf("No readings published in %s, is remote_monitoring running?\n", name);
+		result = EXIT_FAILURE;
+	}
+	else
+	{
+		READING_SAMPLE samples[READING_SHM_HISTORY];
+		size_t count = reading_shm_history(shm, samples, history ? READING_SHM_HISTORY : 1);
+
+		if (!reading_shm_writer_alive(shm))
+		{
+			fprintf(stderr, "The publishing process is gone, the readings are stale\n");
+		}
+		while (count > 0)
+		{
+			PrintSample(&samples[--count]);
+		}
+
+		if (follow)
+		{
+			struct timespec poll = { (time_t)(pollUs / 1000000UL), (long)(pollUs % 1000000UL) * 1000L };
+			uint64_t seen = shm->published;
+
+			signal(SIGINT, OnSignal);
+			signal(SIGTERM, OnSignal);
+			while (!stopRequested && reading_shm_writer_alive(shm))
+			{
+				READING_SAMPLE sample;
+				uint64_t published = __atomic_load_n(&shm->published, __ATOMIC_ACQUIRE);
+
+				if (published != seen && reading_shm_latest(shm, &sample) == 0)
+				{
+					seen = published;
+					PrintSample(&sample);
+					fflush(stdout);
+				}
+				else
+				{
+					nanosleep(&poll, NULL);
+				}
+			}
+		}
+
+		reading_shm_close(shm);
+	}
+
+	return result;
+}
@@ -0,0 +1,705 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#define _GNU_SOURCE
+#include "iothub_client_ll.h"
+#include "iothubtransportmqtt.h"
+#include "iothubtransportamqp.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/platform.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_histogram.h"
+#include "load_generator.h"
+#include "metrics.h"
+
+#define DEVICE_LINE_MAX 1024
+#define DRAIN_TIMEOUT_US (10 * 1000000ULL)
+
+typedef struct WORKER_TAG WORKER;
+
+typedef struct VIRTUAL_DEVICE_TAG
+{
+	IOTHUB_CLIENT_LL_HANDLE clientHandle;
+	WORKER* worker;
+	char* connectionString;
+	char deviceId[129];
+	char deviceKey[128];
+	char hubName[128];
+	char hubSuffix[128];
+	unsigned int intervalMs;
+	unsigned int payloadFields;
+	unsigned int twinIntervalSeconds;
+	uint64_t nextSendUs;
+	uint64_t nextTwinUs;
+	unsigned int sequence;
+	/* rand_r state, only the device's worker touches it */
+	unsigned int randomState;
+	char* payload;
+	size_t payloadSize;
+} VIRTUAL_DEVICE;
+
+typedef struct WORKER_STATS_TAG
+{
+	uint64_t sent;
+	uint64_t confirmed;
+	uint64_t failed;
+	uint64_t late;
+	uint64_t twinSent;
+	uint64_t twinAcked;
+	uint64_t methods;
+	uint64_t bytes;
+	/* the send window the throughput is measured over, 0 until the first send and confirmation */
+	uint64_t firstSentUs;
+	uint64_t lastConfirmedUs;
+	LATENCY_HISTOGRAM sendLatency;
+	LATENCY_HISTOGRAM twinLatency;
+} WORKER_STATS;
+
+struct WORKER_TAG
+{
+	pthread_t thread;
+	const LOAD_GENERATOR_CONFIG* config;
+	VIRTUAL_DEVICE* devices;
+	size_t deviceCount;
+	size_t connectedCount;
+	TRANSPORT_HANDLE sharedTransport;
+	uint64_t inFlight;
+	/* how long the devices took to connect and the in-flight messages to drain */
+	uint64_t connectUs;
+	uint64_t drainUs;
+	WORKER_STATS stats;
+};
+
+typedef struct SEND_CONTEXT_TAG
+{
+	WORKER* worker;
+	uint64_t sentAtUs;
+} SEND_CONTEXT;
+
+static volatile int g_stopRequested = 0;
+
+void load_generator_config_init(LOAD_GENERATOR_CONFIG* config)
+{
+	config->devicesFile = NULL;
+	config->threadCount = 4;
+	config->durationSeconds = 60;
+	config->intervalMs = 1000;
+	config->payloadFields = 0;
+	config->twinIntervalSeconds = 0;
+	config->shareTransport = false;
+	config->trustedCerts = NULL;
+	config->seed = 1;
+}
+
+/* Copies the value of 'key' from a "Key=Value;Key=Value" connection string */
+static int GetConnectionStringValue(const char* connectionString, const char* key, char* value, size_t valueSize)
+{
+	int result = __LINE__;
+	size_t keyLength = strlen(key);
+	const char* position = connectionString;
+
+	while (position != NULL && *position != '\0')
+	{
+		if (strncmp(position, key, keyLength) == 0 && position[keyLength] == '=')
+		{
+			const char* start = position + keyLength + 1;
+			const char* end = strchr(start, ';');
+			size_t length = (end == NULL) ? strlen(start) : (size_t)(end - start);
+			if (length < valueSize)
+			{
+				memcpy(value, start, length);
+				value[length] = '\0';
+				result = 0;
+			}
+			break;
+		}
+		position = strchr(position, ';');
+		if (position != NULL)
+		{
+			position++;
+		}
+	}
+
+	return result;
+}
+
+static int ParseDeviceCredentials(VIRTUAL_DEVICE* device)
+{
+	int result;
+	char hostName[256];
+
+	if (GetConnectionStringValue(device->connectionString, "HostName", hostName, sizeof(hostName)) != 0 ||
+		GetConnectionStringValue(device->connectionString, "DeviceId", device->deviceId, sizeof(device->deviceId)) != 0)
+	{
+		result = __LINE__;
+	}
+	else
+	{
+		char* dot = strchr(hostName, '.');
+		if (dot == NULL || (size_t)(dot - hostName) >= sizeof(device->hubName) || strlen(dot + 1) >= sizeof(device->hubSuffix))
+		{
+			result = __LINE__;
+		}
+		else
+		{
+			*dot = '\0';
+			strcpy(device->hubName, hostName);
+			strcpy(device->hubSuffix, dot + 1);
+			/* devices authenticated by token or x509 simply have no key */
+			if (GetConnectionStringValue(device->connectionString, "SharedAccessKey", device->deviceKey, sizeof(device->deviceKey)) != 0)
+			{
+				device->deviceKey[0] = '\0';
+			}
+			result = 0;
+		}
+	}
+
+	return result;
+}
+
+static VIRTUAL_DEVICE* LoadDevices(const LOAD_GENERATOR_CONFIG* config, size_t* deviceCount)
+{
+	VIRTUAL_DEVICE* result = NULL;
+	FILE* fp;
+
+	*deviceCount = 0;
+
+	if (NULL == (fp = fopen(config->devicesFile, "r")))
+	{
+		printf("Failed to open devices file %s\r\n", config->devicesFile);
+	}
+	else
+	{
+		char line[DEVICE_LINE_MAX];
+		size_t capacity = 0;
+		int failed = 0;
+
+		while (!failed && fgets(line, sizeof(line), fp) != NULL)
+		{
+			char connectionString[DEVICE_LINE_MAX];
+			unsigned int intervalMs = config->intervalMs;
+			unsigned int payloadFields = config->payloadFields;
+			unsigned int twinIntervalSeconds = config->twinIntervalSeconds;
+
+			if (line[0] == '#' || sscanf(line, "%1023s %u %u %u", connectionString, &intervalMs, &payloadFields, &twinIntervalSeconds) < 1)
+			{
+				continue;
+			}
+
+			if (*deviceCount == capacity)
+			{
+				size_t newCapacity = (capacity == 0) ? 64 : capacity * 2;
+				VIRTUAL_DEVICE* grown = realloc(result, newCapacity * sizeof(VIRTUAL_DEVICE));
+				if (grown == NULL)
+				{
+					printf("Out of memory loading device %zu\r\n", *deviceCount);
+					failed = 1;
+					continue;
+				}
+				result = grown;
+				capacity = newCapacity;
+			}
+
+			VIRTUAL_DEVICE* device = &result[*deviceCount];
+			memset(device, 0, sizeof(*device));
+			device->connectionString = strdup(connectionString);
+			device->intervalMs = (intervalMs == 0) ? 1 : intervalMs;
+			device->payloadFields = payloadFields;
+			device->twinIntervalSeconds = twinIntervalSeconds;
+			/* spread the seeds so neighbouring devices do not start from neighbouring states */
+			device->randomState = config->seed + (unsigned int)*deviceCount * 2654435761u;
+			/* DeviceID + Temperature + Humidity + sequence, then 32 bytes per extra field */
+			device->payloadSize = 256 + (size_t)payloadFields * 32;
+			device->payload = malloc(device->payloadSize);
+
+			if (device->connectionString == NULL || device->payload == NULL || ParseDeviceCredentials(device) != 0)
+			{
+				printf("Invalid device entry on line %zu of %s\r\n", *deviceCount + 1, config->devicesFile);
+				free(device->connectionString);
+				free(device->payload);
+				failed = 1;
+			}
+			else
+			{
+				(*deviceCount)++;
+			}
+		}
+
+		fclose(fp);
+
+		if (failed)
+		{
+			for (size_t i = 0; i < *deviceCount; i++)
+			{
+				free(result[i].connectionString);
+				free(result[i].payload);
+			}
+			free(result);
+			result = NULL;
+			*deviceCount = 0;
+		}
+	}
+
+	return result;
+}
+
+static void SendConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+	SEND_CONTEXT* context = userContextCallback;
+	WORKER* worker = context->worker;
+
+	if (result == IOTHUB_CLIENT_CONFIRMATION_OK)
+	{
+		uint64_t now = metrics_now_us();
+
+		worker->stats.confirmed++;
+		worker->stats.lastConfirmedUs = now;
+		latency_histogram_record(&worker->stats.sendLatency, now - context->sentAtUs);
+	}
+	else
+	{
+		worker->stats.failed++;
+	}
+	worker->inFlight--;
+
+	free(context);
+}
+
+static void ReportedStateCallback(int status_code, void* userContextCallback)
+{
+	SEND_CONTEXT* context = userContextCallback;
+	WORKER* worker = context->worker;
+
+	if (status_code >= 200 && status_code < 300)
+	{
+		worker->stats.twinAcked++;
+		latency_histogram_record(&worker->stats.twinLatency, metrics_now_us() - context->sentAtUs);
+	}
+	worker->inFlight--;
+
+	free(context);
+}
+
+static int DeviceMethodCallback(const char* method_name, const unsigned char* payload, size_t size, unsigned char** response, size_t* resp_size, void* userContextCallback)
+{
+	static const char methodResponse[] = "\"load generator method ack\"";
+	VIRTUAL_DEVICE* device = userContextCallback;
+	int result;
+
+	(void)method_name;
+	(void)payload;
+	(void)size;
+
+	device->worker->stats.methods++;
+
+	*response = malloc(sizeof(methodResponse) - 1);
+	if (*response == NULL)
+	{
+		*resp_size = 0;
+		result = 500;
+	}
+	else
+	{
+		memcpy(*response, methodResponse, sizeof(methodResponse) - 1);
+		*resp_size = sizeof(methodResponse) - 1;
+		result = 200;
+	}
+
+	return result;
+}
+
+static size_t FormatPayload(VIRTUAL_DEVICE* device)
+{
+	float tempC = (float)rand_r(&device->randomState) / (float)(RAND_MAX / 5) + 25;
+	float humidityPct = (float)rand_r(&device->randomState) / (float)(RAND_MAX / 5) + 15;
+	int length = snprintf(device->payload, device->payloadSize,
+		"{\"DeviceID\": \"%s\",\"Temperature\" : %f,\"Humidity\" : %f,\"Sequence\" : %u",
+		device->deviceId, tempC, humidityPct, device->sequence);
+
+	for (unsigned int i = 0; i < device->payloadFields && length > 0 && (size_t)length < device->payloadSize; i++)
+	{
+		length += snprintf(device->payload + length, device->payloadSize - length, ",\"Field%u\" : %f", i, (float)rand_r(&device->randomState) / (float)RAND_MAX);
+	}
+	if (length > 0 && (size_t)length < device->payloadSize)
+	{
+		length += snprintf(device->payload + length, device->payloadSize - length, "}");
+	}
+
+	return (length > 0 && (size_t)length < device->payloadSize) ? (size_t)length : 0;
+}
+
+static void SendTelemetry(WORKER* worker, VIRTUAL_DEVICE* device, uint64_t now)
+{
+	size_t length = FormatPayload(device);
+	SEND_CONTEXT* context = malloc(sizeof(SEND_CONTEXT));
+	IOTHUB_MESSAGE_HANDLE messageHandle = (length == 0) ? NULL : IoTHubMessage_CreateFromByteArray((const unsigned char*)device->payload, length);
+
+	device->sequence++;
+
+	if (context == NULL || messageHandle == NULL)
+	{
+		worker->stats.failed++;
+		free(context);
+	}
+	else
+	{
+		context->worker = worker;
+		context->sentAtUs = now;
+		if (IoTHubClient_LL_SendEventAsync(device->clientHandle, messageHandle, SendConfirmationCallback, context) != IOTHUB_CLIENT_OK)
+		{
+			worker->stats.failed++;
+			free(context);
+		}
+		else
+		{
+			if (worker->stats.sent++ == 0)
+			{
+				worker->stats.firstSentUs = now;
+			}
+			worker->stats.bytes += length;
+			worker->inFlight++;
+		}
+	}
+
+	if (messageHandle != NULL)
+	{
+		IoTHubMessage_Destroy(messageHandle);
+	}
+}
+
+static void SendTwinUpdate(WORKER* worker, VIRTUAL_DEVICE* device, uint64_t now)
+{
+	char report[96];
+	int length = snprintf(report, sizeof(report), "{\"LoadGenerator\":{\"Sequence\":%u}}", device->sequence);
+	SEND_CONTEXT* context = malloc(sizeof(SEND_CONTEXT));
+
+	if (context != NULL)
+	{
+		context->worker = worker;
+		context->sentAtUs = now;
+		if (IoTHubClient_LL_SendReportedState(device->clientHandle, (const unsigned char*)report, (size_t)length, ReportedStateCallback, context) != IOTHUB_CLIENT_OK)
+		{
+			free(context);
+		}
+		else
+		{
+			worker->stats.twinSent++;
+			worker->inFlight++;
+		}
+	}
+}
+
+static int ConnectDevice(WORKER* worker, VIRTUAL_DEVICE* device)
+{
+	int result;
+
+	if (worker->config->shareTransport)
+	{
+		if (worker->sharedTransport == NULL)
+		{
+			worker->sharedTransport = IoTHubTransport_Create(AMQP_Protocol, device->hubName, device->hubSuffix);
+		}
+
+		if (worker->sharedTransport == NULL)
+		{
+			printf("Failed to create shared transport for %s.%s\r\n", device->hubName, device->hubSuffix);
+			device->clientHandle = NULL;
+		}
+		else
+		{
+			IOTHUB_CLIENT_DEVICE_CONFIG deviceConfig;
+			memset(&deviceConfig, 0, sizeof(deviceConfig));
+			deviceConfig.protocol = AMQP_Protocol;
+			deviceConfig.transportHandle = IoTHubTransport_GetLLTransport(worker->sharedTransport);
+			deviceConfig.deviceId = device->deviceId;
+			deviceConfig.deviceKey = device->deviceKey;
+			device->clientHandle = IoTHubClient_LL_CreateWithTransport(&deviceConfig);
+		}
+	}
+	else
+	{
+		device->clientHandle = IoTHubClient_LL_CreateFromConnectionString(device->connectionString, MQTT_Protocol);
+	}
+
+	if (device->clientHandle == NULL)
+	{
+		printf("Failed to create client for device %s\r\n", device->deviceId);
+		result = __LINE__;
+	}
+	else
+	{
+		if (worker->config->trustedCerts != NULL && IoTHubClient_LL_SetOption(device->clientHandle, "TrustedCerts", worker->config->trustedCerts) != IOTHUB_CLIENT_OK)
+		{
+			printf("Failed to set option \"TrustedCerts\" for device %s\r\n", device->deviceId);
+		}
+		if (IoTHubClient_LL_SetDeviceMethodCallback(device->clientHandle, DeviceMethodCallback, device) != IOTHUB_CLIENT_OK)
+		{
+			printf("Failed to register method callback for device %s\r\n", device->deviceId);
+		}
+		result = 0;
+	}
+
+	return result;
+}
+
+/* With a shared transport one DoWork drives every device registered on it */
+static void DoWork(WORKER* worker)
+{
+	if (worker->sharedTransport != NULL)
+	{
+		for (size_t i = 0; i < worker->deviceCount; i++)
+		{
+			if (worker->devices[i].clientHandle != NULL)
+			{
+				IoTHubClient_LL_DoWork(worker->devices[i].clientHandle);
+				break;
+			}
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < worker->deviceCount; i++)
+		{
+			if (worker->devices[i].clientHandle != NULL)
+			{
+				IoTHubClient_LL_DoWork(worker->devices[i].clientHandle);
+			}
+		}
+	}
+}
+
+static void* WorkerThread(void* arg)
+{
+	WORKER* worker = arg;
+	uint64_t start = metrics_now_us();
+
+	for (size_t i = 0; i < worker->deviceCount; i++)
+	{
+		VIRTUAL_DEVICE* device = &worker->devices[i];
+		device->worker = worker;
+		if (ConnectDevice(worker, device) == 0)
+		{
+			worker->connectedCount++;
+			/* stagger first sends across one interval so devices do not fire in lockstep */
+			device->nextSendUs = start + ((uint64_t)rand_r(&device->randomState) % ((uint64_t)device->intervalMs * 1000ULL));
+			device->nextTwinUs = start + (uint64_t)device->twinIntervalSeconds * 1000000ULL;
+		}
+	}
+	worker->connectUs = metrics_now_us() - start;
+
+	while (!g_stopRequested)
+	{
+		uint64_t now = metrics_now_us();
+
+		for (size_t i = 0; i < worker->deviceCount; i++)
+		{
+			VIRTUAL_DEVICE* device = &worker->devices[i];
+			if (device->clientHandle == NULL)
+			{
+				continue;
+			}
+
+			if (now >= device->nextSendUs)
+			{
+				uint64_t intervalUs = (uint64_t)device->intervalMs * 1000ULL;
+				SendTelemetry(worker, device, now);
+				device->nextSendUs += intervalUs;
+				/* falling more than one interval behind means the worker is saturated */
+				if (device->nextSendUs + intervalUs < now)
+				{
+					worker->stats.late++;
+					device->nextSendUs = now + intervalUs;
+				}
+			}
+
+			if (device->twinIntervalSeconds > 0 && now >= device->nextTwinUs)
+			{
+				SendTwinUpdate(worker, device, now);
+				device->nextTwinUs = now + (uint64_t)device->twinIntervalSeconds * 1000000ULL;
+			}
+		}
+
+		DoWork(worker);
+		ThreadAPI_Sleep(1);
+	}
+
+	/* let in-flight messages finish before tearing down the connections */
+	uint64_t drainStart = metrics_now_us();
+	while (worker->inFlight > 0 && metrics_now_us() < drainStart + DRAIN_TIMEOUT_US)
+	{
+		DoWork(worker);
+		ThreadAPI_Sleep(1);
+	}
+	worker->drainUs = metrics_now_us() - drainStart;
+
+	for (size_t i = 0; i < worker->deviceCount; i++)
+	{
+		if (worker->devices[i].clientHandle != NULL)
+		{
+			IoTHubClient_LL_Destroy(worker->devices[i].clientHandle);
+			worker->devices[i].clientHandle = NULL;
+		}
+	}
+	if (worker->sharedTransport != NULL)
+	{
+		IoTHubTransport_Destroy(worker->sharedTransport);
+		worker->sharedTransport = NULL;
+	}
+
+	return NULL;
+}
+
+/*
+ * Throughput is measured over the send window, from the first send to the
+ * last confirmation of any worker. The devices connect one after the other
+ * and the drain waits up to DRAIN_TIMEOUT_US, both grow with the device count
+ * and are reported on their own.
+ */
+static void PrintReport(const WORKER* workers, size_t workerCount, size_t deviceCount, double elapsedSeconds)
+{
+	WORKER_STATS total;
+	size_t connected = 0;
+	uint64_t connectUs = 0;
+	uint64_t drainUs = 0;
+	double windowSeconds;
+
+	memset(&total, 0, sizeof(total));
+	for (size_t i = 0; i < workerCount; i++)
+	{
+		const WORKER_STATS* stats = &workers[i].stats;
+		connected += workers[i].connectedCount;
+		connectUs = (workers[i].connectUs > connectUs) ? workers[i].connectUs : connectUs;
+		drainUs = (workers[i].drainUs > drainUs) ? workers[i].drainUs : drainUs;
+		if (stats->sent > 0 && (total.firstSentUs == 0 || stats->firstSentUs < total.firstSentUs))
+		{
+			total.firstSentUs = stats->firstSentUs;
+		}
+		if (stats->lastConfirmedUs > total.lastConfirmedUs)
+		{
+			total.lastConfirmedUs = stats->lastConfirmedUs;
+		}
+		total.sent += stats->sent;
+		total.confirmed += stats->confirmed;
+		total.failed += stats->failed;
+		total.late += stats->late;
+		total.twinSent += stats->twinSent;
+		total.twinAcked += stats->twinAcked;
+		total.methods += stats->methods;
+		total.bytes += stats->bytes;
+		latency_histogram_merge(&total.sendLatency, &stats->sendLatency);
+		latency_histogram_merge(&total.twinLatency, &stats->twinLatency);
+	}
+	windowSeconds = (total.lastConfirmedUs > total.firstSentUs) ? (total.lastConfirmedUs - total.firstSentUs) / 1000000.0 : 0.0;
+
+	printf("\r\n==== load generator report ====\r\n");
+	printf("devices:          %zu configured, %zu connected, %zu worker threads\r\n", deviceCount, connected, workerCount);
+	printf("elapsed:          %.1f s, connect %.1f s, send window %.1f s, drain %.1f s\r\n",
+		elapsedSeconds, connectUs / 1000000.0, windowSeconds, drainUs / 1000000.0);
+	printf("telemetry:        %llu sent, %llu confirmed, %llu failed, %llu late ticks\r\n",
+		(unsigned long long)total.sent, (unsigned long long)total.confirmed, (unsigned long long)total.failed, (unsigned long long)total.late);
+	printf("throughput:       %.1f msg/s confirmed, %.1f KiB/s payload\r\n",
+		(windowSeconds > 0) ? total.confirmed / windowSeconds : 0.0, (windowSeconds > 0) ? total.bytes / 1024.0 / windowSeconds : 0.0);
+	printf("send->confirm:    p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\r\n",
+		latency_histogram_percentile(&total.sendLatency, 50) / 1000.0,
+		latency_histogram_percentile(&total.sendLatency, 90) / 1000.0,
+		latency_histogram_percentile(&total.sendLatency, 99) / 1000.0,
+		total.sendLatency.max_us / 1000.0);
+	printf("twin reported:    %llu sent, %llu acked, p50 %.1f ms, p99 %.1f ms\r\n",
+		(unsigned long long)total.twinSent, (unsigned long long)total.twinAcked,
+		latency_histogram_percentile(&total.twinLatency, 50) / 1000.0,
+		latency_histogram_percentile(&total.twinLatency, 99) / 1000.0);
+	printf("methods invoked:  %llu\r\n", (unsigned long long)total.methods);
+}
+
+int load_generator_run(const LOAD_GENERATOR_CONFIG* config)
+{
+	int result;
+	size_t deviceCount = 0;
+	VIRTUAL_DEVICE* devices = NULL;
+
+	if (config->devicesFile == NULL || config->threadCount == 0)
+	{
+		printf("Load generator needs a devices file and at least one thread\r\n");
+		result = __LINE__;
+	}
+	else if ((devices = LoadDevices(config, &deviceCount)) == NULL || deviceCount == 0)
+	{
+		printf("No devices loaded from %s\r\n", config->devicesFile);
+		result = __LINE__;
+	}
+	else if (platform_init() != 0)
+	{
+		printf("Failed to initialize the platform.\n");
+		result = __LINE__;
+	}
+	else
+	{
+		size_t workerCount = (config->threadCount > deviceCount) ? deviceCount : config->threadCount;
+		WORKER* workers = calloc(workerCount, sizeof(WORKER));
+
+		if (workers == NULL)
+		{
+			printf("Out of memory allocating %zu workers\r\n", workerCount);
+			result = __LINE__;
+		}
+		else
+		{
+			size_t started = 0;
+			size_t offset = 0;
+			uint64_t begin = metrics_now_us();
+
+			printf("Starting %zu virtual devices on %zu threads for %u s (%s)\r\n", deviceCount, workerCount,
+				config->durationSeconds, config->shareTransport ? "shared AMQP transport" : "MQTT per device");
+
+			g_stopRequested = 0;
+			for (size_t i = 0; i < workerCount; i++)
+			{
+				/* contiguous slices, the remainder spread over the first workers */
+				size_t slice = deviceCount / workerCount + ((i < deviceCount % workerCount) ? 1 : 0);
+				workers[i].config = config;
+				workers[i].devices = &devices[offset];
+				workers[i].deviceCount = slice;
+				offset += slice;
+
+				if (pthread_create(&workers[i].thread, NULL, WorkerThread, &workers[i]) != 0)
+				{
+					printf("Failed to start worker thread %zu\r\n", i);
+					break;
+				}
+				started++;
+			}
+
+			if (started == workerCount)
+			{
+				ThreadAPI_Sleep(config->durationSeconds * 1000);
+			}
+			g_stopRequested = 1;
+
+			for (size_t i = 0; i < started; i++)
+			{
+				pthread_join(workers[i].thread, NULL);
+			}
+
+			PrintReport(workers, started, deviceCount, (metrics_now_us() - begin) / 1000000.0);
+			result = (started == workerCount) ? 0 : __LINE__;
+			free(workers);
+		}
+
+		platform_deinit();
+	}
+
+	for (size_t i = 0; i < deviceCount; i++)
+	{
+		free(devices[i].connectionString);
+		free(devices[i].payload);
+	}
+	free(devices);
+
+	return result;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runs many virtual devices from one process. Each line of the devices file is
+ *   <device connection string> [interval-ms] [payload-fields] [twin-interval-s]
+ * where the optional columns override the defaults below for that device.
+ */
+typedef struct LOAD_GENERATOR_CONFIG_TAG
+{
+	const char* devicesFile;
+	size_t threadCount;
+	unsigned int durationSeconds;
+	unsigned int intervalMs;
+	unsigned int payloadFields;
+	unsigned int twinIntervalSeconds;
+	/* share one AMQP connection per worker thread instead of one MQTT connection per device */
+	bool shareTransport;
+	/* PEM certificates to trust, NULL for the platform default */
+	const char* trustedCerts;
+	/* seeds the generator of each device's readings and send offsets, a run with the same seed repeats them */
+	unsigned int seed;
+} LOAD_GENERATOR_CONFIG;
+
+void load_generator_config_init(LOAD_GENERATOR_CONFIG* config);
+int load_generator_run(const LOAD_GENERATOR_CONFIG* config);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOAD_GENERATOR_H */
@@ -1,7 +1,6 @@
 ﻿// Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
-#include "iothubtransportmqtt.h"
 #include "schemalib.h"
 #include "iothub_client.h"
 #include "serializer_devicetwin.h"
@@ -11,6 +10,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "load_generator.h"
+#include "message_format.h"
+#include "sample_clock.h"
+#include "send_report.h"
+#include "text_file.h"
+#include "transport_select.h"
 
 static const char* deviceId = "[Device Id]";
 static const char* connectionString = "HostName=[IoTHub Name].azure-devices.net;DeviceId=[Device Id];SharedAccessKey=[Device Key]";
@@ -24,12 +31,19 @@ static const char* deviceInfo = "{ \"ObjectType\": \"DeviceInfo\","
 "{\"Name\": \"Temperature\", \"DisplayName\" : \"Temperature\", \"Type\" : \"double\"},"
 "{ \"Name\": \"Humidity\", \"DisplayName\" : \"Humidity\", \"Type\" : \"double\" }] }";
 
-static const char* telemetryData = "{"
-"\"DeviceID\": \"%s\","
-"\"Temperature\" : %f,"
-"\"Humidity\" : %f } ";
-
 static IOTHUB_CLIENT_HANDLE g_iotHubClientHandle = NULL;
+static SAMPLE_CLOCK g_sampleClock;
+
+/* Benchmark overrides, see PrintUsage */
+static char* trustedCerts = NULL;
+/* --transport, the default when NULL after the arguments are parsed */
+static const TRANSPORT* transport = NULL;
+static unsigned int messageCount = 0;
+static unsigned int intervalOverrideMs = 0;
+
+#define CONFIRMATION_DRAIN_TIMEOUT_MS 10000
+
+static SEND_REPORT g_sendReport;
 
 /*json of supported methods*/
 static char* supportedMethod = "{ \"LightBlink\": \"light blink\", \"ChangeLightStatus--LightStatusValue-int\""
@@ -100,6 +114,12 @@ METHODRETURN_HANDLE LightBlink(Thermostat* thermostat)
 	return MethodReturn_Create(201, "\"simulated light blink success\"");
 }
 
+/* Measures the time from handing a message to the SDK until the hub acknowledged it */
+static void SendConfirmationCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void* userContextCallback)
+{
+	(void)send_report_confirmed(&g_sendReport, userContextCallback, result == IOTHUB_CLIENT_CONFIRMATION_OK);
+}
+
 /* Send data to IoT Hub */
 static void sendMessage(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const unsigned char* buffer, size_t size)
 {
@@ -110,13 +130,22 @@ static void sendMessage(IOTHUB_CLIENT_HANDLE iotHubClientHandle, const unsigned
 	}
 	else
 	{
-		if (IoTHubClient_SendEventAsync(iotHubClientHandle, messageHandle, NULL, NULL) != IOTHUB_CLIENT_OK)
+		void* sentAtUs = send_report_sent(&g_sendReport);
+		if (sentAtUs == NULL)
 		{
-			printf("failed to hand over the message to IoTHubClient");
+			printf("unable to allocate the send context\r\n");
 		}
 		else
 		{
-			printf("IoTHubClient accepted the message for delivery\r\n");
+			if (IoTHubClient_SendEventAsync(iotHubClientHandle, messageHandle, SendConfirmationCallback, sentAtUs) != IOTHUB_CLIENT_OK)
+			{
+				printf("failed to hand over the message to IoTHubClient");
+				send_report_unsent(&g_sendReport, sentAtUs);
+			}
+			else
+			{
+				printf("IoTHubClient accepted the message for delivery\r\n");
+			}
 		}
 
 		IoTHubMessage_Destroy(messageHandle);
@@ -136,20 +165,36 @@ void SendTelemetryData(IOTHUB_CLIENT_HANDLE iotHubClientHandle)
 {
 	float tempC = (float)rand() / (float)(RAND_MAX / 5) + 25;
 	float humidityPct = (float)rand() / (float)(RAND_MAX / 5) + 15;
+	SAMPLE_STAMP stamp;
 
+	/* the same fields as the devices' telemetry, the simulated sample is stamped when it is made */
+	sample_clock_stamp(&g_sampleClock, &stamp);
 	printf("send simulated data Humidity = %.1f%% Temperature = %.1f*C \n", humidityPct, tempC);
 
-	char* buffer = malloc(sizeof(char) * 256);
-	sprintf(buffer, telemetryData, deviceId, tempC, humidityPct);
-
-	printf("Sending sensor value: %s %d\r\n", buffer, strlen(buffer));
+	char* buffer = malloc(MESSAGE_FORMAT_TELEMETRY_SIZE);
+	size_t length = (buffer == NULL) ? 0 : message_format_telemetry(buffer, MESSAGE_FORMAT_TELEMETRY_SIZE, deviceId, &stamp, tempC, humidityPct);
 
-	sendMessage(iotHubClientHandle, buffer, strlen(buffer));
+	if (length == 0)
+	{
+		printf("Failed to format the simulated values\r\n");
+		free(buffer);
+	}
+	else
+	{
+		printf("Sending sensor value: %s %zu\r\n", buffer, length);
+		sendMessage(iotHubClientHandle, buffer, length);
+	}
 }
 
 void remote_monitoring_run(void)
 {
-	if (platform_init() != 0)
+	int reporting = (send_report_init(&g_sendReport) == 0);
+
+	if (!reporting)
+	{
+		printf("Failed to initialize the send report.\n");
+	}
+	else if (platform_init() != 0)
 	{
 		printf("Failed to initialize the platform.\n");
 	}
@@ -161,7 +206,7 @@ void remote_monitoring_run(void)
 		}
 		else
 		{
-			IOTHUB_CLIENT_HANDLE iotHubClientHandle = IoTHubClient_CreateFromConnectionString(connectionString, MQTT_Protocol);
+			IOTHUB_CLIENT_HANDLE iotHubClientHandle = IoTHubClient_CreateFromConnectionString(connectionString, transport->protocol);
 			g_iotHubClientHandle = iotHubClientHandle;
 			if (iotHubClientHandle == NULL)
 			{
@@ -176,10 +221,20 @@ void remote_monitoring_run(void)
 					printf("Failed to set option \"TrustedCerts\"\n");
 				}
 #endif // MBED_BUILD_TIMESTAMP
-				Thermostat* thermostat = IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle);
+				if (trustedCerts != NULL && IoTHubClient_SetOption(iotHubClientHandle, "TrustedCerts", trustedCerts) != IOTHUB_CLIENT_OK)
+				{
+					printf("Failed to set option \"TrustedCerts\"\n");
+				}
+				if (transport_configure(iotHubClientHandle, transport) != 0)
+				{
+					printf("Failed to set the %s transport options\n", transport->name);
+				}
+				/* HTTP has neither the twin nor direct methods, the simulator only sends telemetry over it */
+				Thermostat* thermostat = transport->hasTwin ? IoTHubDeviceTwin_CreateThermostat(iotHubClientHandle) :
+					CREATE_MODEL_INSTANCE(Contoso, Thermostat);
 				if (thermostat == NULL)
 				{
-					printf("Failure in IoTHubDeviceTwin_CreateThermostat\n");
+					printf("Failure creating the thermostat over %s\n", transport->name);
 				}
 				else
 				{
@@ -190,7 +245,7 @@ void remote_monitoring_run(void)
 					thermostat->SupportedMethods = supportedMethod;
 
 					/* Send reported properties to IoT Hub */
-					if (IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
+					if (transport->hasTwin && IoTHubDeviceTwin_SendReportedStateThermostat(thermostat, deviceTwinCallback, NULL) != IOTHUB_CLIENT_OK)
 					{
 						printf("Failed sending serialized reported state\n");
 					}
@@ -203,27 +258,169 @@ void remote_monitoring_run(void)
 						/* set default telemetry interval */
 						thermostat->TelemetryInterval = 3;
 
-						while (1)
+						for (unsigned int messagesSent = 0; messageCount == 0 || messagesSent < messageCount; messagesSent++)
 						{
 							SendTelemetryData(iotHubClientHandle);
 
-							ThreadAPI_Sleep(thermostat->TelemetryInterval * 1000);
+							ThreadAPI_Sleep(intervalOverrideMs != 0 ? intervalOverrideMs : thermostat->TelemetryInterval * 1000);
 						}
 
+						(void)send_report_wait(&g_sendReport, CONFIRMATION_DRAIN_TIMEOUT_MS);
+						send_report_print_costs(send_report_print(&g_sendReport, transport->name));
+					}
+					if (transport->hasTwin)
+					{
 						IoTHubDeviceTwin_DestroyThermostat(thermostat);
 					}
+					else
+					{
+						DESTROY_MODEL_INSTANCE(thermostat);
+					}
 				}
 				IoTHubClient_Destroy(iotHubClientHandle);
 			}
 			serializer_deinit();
 		}
+		platform_deinit();
 	}
-	platform_deinit();
+
+	if (reporting)
+	{
+		send_report_deinit(&g_sendReport);
+	}
+}
+
+static void PrintUsage(const char* program)
+{
+	printf("usage: %s [options]\n"
+		"  without arguments a single simulated device is run\n"
+		"  --connection-string <cs>    connect with this device connection string instead of the built-in one\n"
+		"  --trusted-certs <file>      PEM certificates to trust, e.g. for the local benchmark stand-in\n"
+		"  --transport <name>          mqtt (default), mqtt-ws, amqp, amqp-ws, http or http-batch; http sends telemetry only\n"
+		"  --count <n>                 stop after n telemetry messages and print a send report\n"
+		"  --interval-ms <ms>          telemetry interval overriding the device twin setting\n"
+		"  --load-devices <file>       run one virtual device per connection string line\n"
+		"  --load-threads <n>          worker threads shared by all devices (default 4)\n"
+		"  --load-duration <s>         length of the run in seconds (default 60)\n"
+		"  --load-interval-ms <ms>     default telemetry interval per device (default 1000)\n"
+		"  --load-payload-fields <n>   default number of extra numeric fields per message (default 0)\n"
+		"  --load-twin-interval <s>    default reported property update interval, 0 disables (default 0)\n"
+		"  --load-share-transport      multiplex each worker's devices over one AMQP connection\n"
+		"  --load-seed <n>             seed of the simulated readings, a run with the same seed repeats them (default 1)\n", program);
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
-	remote_monitoring_run();
+	int result = 0;
+	LOAD_GENERATOR_CONFIG config;
+
+	load_generator_config_init(&config);
+
+	for (int i = 1; i < argc && result == 0; i++)
+	{
+		const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+		if (strcmp(argv[i], "--load-share-transport") == 0)
+		{
+			config.shareTransport = true;
+		}
+		else if (value == NULL)
+		{
+			result = __LINE__;
+		}
+		else if (strcmp(argv[i], "--connection-string") == 0)
+		{
+			connectionString = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--trusted-certs") == 0)
+		{
+			if ((trustedCerts = text_file_read(value)) == NULL)
+			{
+				result = __LINE__;
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--transport") == 0)
+		{
+			if ((transport = transport_find(value)) == NULL)
+			{
+				result = __LINE__;
+			}
+			i++;
+		}
+		else if (strcmp(argv[i], "--count") == 0)
+		{
+			messageCount = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--interval-ms") == 0)
+		{
+			intervalOverrideMs = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-devices") == 0)
+		{
+			config.devicesFile = value;
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-threads") == 0)
+		{
+			config.threadCount = (size_t)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-duration") == 0)
+		{
+			config.durationSeconds = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-interval-ms") == 0)
+		{
+			config.intervalMs = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-payload-fields") == 0)
+		{
+			config.payloadFields = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-twin-interval") == 0)
+		{
+			config.twinIntervalSeconds = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else if (strcmp(argv[i], "--load-seed") == 0)
+		{
+			config.seed = (unsigned int)strtoul(value, NULL, 10);
+			i++;
+		}
+		else
+		{
+			result = __LINE__;
+		}
+	}
 
-	return 0;
-}
\ No newline at end of file
+	if (transport == NULL)
+	{
+		transport = transport_default();
+	}
+
+	if (result != 0)
+	{
+		PrintUsage(argv[0]);
+		result = EXIT_FAILURE;
+	}
+	else if (config.devicesFile != NULL)
+	{
+		config.trustedCerts = trustedCerts;
+		result = (load_generator_run(&config) == 0) ? 0 : EXIT_FAILURE;
+	}
+	else
+	{
+		remote_monitoring_run();
+	}
+
+	free(trustedCerts);
+
+	return result;
+}